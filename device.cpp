@@ -3,454 +3,6807 @@
  * @brief Chemical process simulation with Stream, Mixer and Reactor classes
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
 #include <iostream>
+#include <list>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
 #include <cmath>
+#include <cstdint>
+#include <utility>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define DEVICE_HAS_MMAP 1
+#define DEVICE_HAS_FORK 1
+#define DEVICE_HAS_POSIX_MEMALIGN 1
+#else
+#define DEVICE_HAS_MMAP 0
+#define DEVICE_HAS_FORK 0
+#define DEVICE_HAS_POSIX_MEMALIGN 0
+#endif
 
 using namespace std;
 
-int streamcounter; ///< Global variable to keep track of stream creation.
+atomic<int> streamcounter(0); ///< Numbers streams created outside of any flowsheet; bumping it never yields a duplicate.
 
 const int MIXER_OUTPUTS = 1;
 const float POSSIBLE_ERROR = 0.01;
 
+#ifndef DEVICE_TRACE_LEVEL
+#define DEVICE_TRACE_LEVEL 0 ///< Most verbose TraceLevel compiled in; 0 removes all tracing.
+#endif
+
 /**
- * @class Stream
- * @brief Represents a chemical stream with a name and mass flow.
+ * @brief Severity of a trace message; lower values are more important.
  */
-class Stream
-{
-private:
-    double mass_flow; ///< The mass flow rate of the stream.
-    string name;      ///< The name of the stream.
-
-public:
-    /**
-     * @brief Constructor to create a Stream with a unique name.
-     * @param s An integer used to generate a unique name for the stream.
-     */
-    Stream(int s){setName("s"+std::to_string(s));}
-
-    /**
-     * @brief Set the name of the stream.
-     * @param s The new name for the stream.
-     */
-    void setName(string s){name=s;}
-
-    /**
-     * @brief Get the name of the stream.
-     * @return The name of the stream.
-     */
-    string getName(){return name;}
+enum class TraceLevel { Error = 1, Info = 2, Debug = 3 };
 
-    /**
-     * @brief Set the mass flow rate of the stream.
-     * @param m The new mass flow rate value.
-     */
-    void setMassFlow(double m){mass_flow=m;}
+const size_t TRACE_MESSAGE_SIZE = 112; ///< Longest trace message kept, including the terminator.
 
-    /**
-     * @brief Get the mass flow rate of the stream.
-     * @return The mass flow rate of the stream.
-     */
-    double getMassFlow() const {return mass_flow;}
+/**
+ * @class TraceSink
+ * @brief Destination for trace messages emitted by devices.
+ */
+class TraceSink
+{
+public:
+    virtual ~TraceSink() {}
 
     /**
-     * @brief Print information about the stream.
+     * @brief Accept one formatted message; must not block the caller.
+     * @param level Severity of the message.
+     * @param text Null-terminated message text.
      */
-    void print() { cout << "Stream " << getName() << " flow = " << getMassFlow() << endl; }
+    virtual void write(TraceLevel level, const char* text) = 0;
 };
 
 /**
- * @class Device
- * @brief Represents a device that manipulates chemical streams.
+ * @class RingBufferTraceSink
+ * @brief Bounded lock-free multi-producer queue of trace messages.
+ *
+ * Solver threads only copy the message into a preallocated slot; the text
+ * reaches an ostream when drain() is called, typically from a TraceDrainer
+ * thread. Messages are dropped (and counted) while the buffer is full.
  */
-class Device
+class RingBufferTraceSink : public TraceSink
 {
-protected:
-    vector<shared_ptr<Stream>> inputs;  ///< Input streams connected to the device.
-    vector<shared_ptr<Stream>> outputs; ///< Output streams produced by the device.
-    int inputAmount;
-    int outputAmount;
+private:
+    struct Slot {
+        atomic<size_t> sequence;
+        TraceLevel level;
+        char text[TRACE_MESSAGE_SIZE];
+    };
+
+    unique_ptr<Slot[]> slots; ///< Ring storage, capacity is a power of two.
+    size_t mask;              ///< capacity - 1.
+    atomic<size_t> head;      ///< Next slot to write.
+    atomic<size_t> tail;      ///< Next slot to read.
+    atomic<size_t> dropped;   ///< Messages lost because the ring was full.
+
 public:
     /**
-     * @brief Add an input stream to the device.
-     * @param s A shared pointer to the input stream.
+     * @brief Create a ring buffer.
+     * @param capacity Number of message slots, rounded up to a power of two.
      */
-    void addInput(shared_ptr<Stream> s){
-        if(inputs.size() < inputAmount) inputs.push_back(s);
-        else throw"INPUT STREAM LIMIT!";
+    explicit RingBufferTraceSink(size_t capacity = 1024) : head(0), tail(0), dropped(0)
+    {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.reset(new Slot[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) slots[i].sequence.store(i, memory_order_relaxed);
     }
+
+    void write(TraceLevel level, const char* text) override
+    {
+        size_t pos = head.load(memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped.fetch_add(1, memory_order_relaxed);
+                return;
+            } else {
+                pos = head.load(memory_order_relaxed);
+            }
+        }
+        slot->level = level;
+        strncpy(slot->text, text, TRACE_MESSAGE_SIZE - 1);
+        slot->text[TRACE_MESSAGE_SIZE - 1] = '\0';
+        slot->sequence.store(pos + 1, memory_order_release);
+    }
+
     /**
-     * @brief Add an output stream to the device.
-     * @param s A shared pointer to the output stream.
+     * @brief Move every queued message to an output stream, one per line.
+     * @param out Destination; written with '\n' and flushed once at the end.
+     * @return Number of messages written.
      */
-    void addOutput(shared_ptr<Stream> s){
-        if(outputs.size() < outputAmount) outputs.push_back(s);
-        else throw "OUTPUT STREAM LIMIT!";
+    size_t drain(ostream& out)
+    {
+        size_t count = 0;
+        size_t pos = tail.load(memory_order_relaxed);
+        for (;;) {
+            Slot* slot = &slots[pos & mask];
+            size_t seq = slot->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    out << slot->text << '\n';
+                    slot->sequence.store(pos + mask + 1, memory_order_release);
+                    ++pos;
+                    ++count;
+                }
+            } else if (diff < 0) {
+                break;
+            } else {
+                pos = tail.load(memory_order_relaxed);
+            }
+        }
+        if (count) out.flush();
+        return count;
     }
 
     /**
-     * @brief Update the output streams of the device (to be implemented by derived classes).
+     * @brief Get the number of messages lost to a full buffer.
+     * @return The drop counter.
      */
-    virtual void updateOutputs() = 0;
+    size_t droppedCount() const { return dropped.load(memory_order_relaxed); }
 };
 
-class Mixer: public Device
+/**
+ * @class TraceDrainer
+ * @brief Background thread that periodically drains a ring buffer sink.
+ */
+class TraceDrainer
 {
 private:
-    int _inputs_count = 0;
+    RingBufferTraceSink& sink;
+    ostream& out;
+    atomic<bool> running;
+    thread worker;
+
 public:
-    Mixer(int inputs_count): Device() {
-        _inputs_count = inputs_count;
-    }
-    void addInput(shared_ptr<Stream> s) {
-        if (inputs.size() == _inputs_count) {
-            throw "Too much inputs"s;
-        }
-        inputs.push_back(s);
-    }
-    void addOutput(shared_ptr<Stream> s) {
-        if (outputs.size() == MIXER_OUTPUTS) {
-            throw "Too much outputs"s;
-        }
-        outputs.push_back(s);
+    /**
+     * @brief Start draining.
+     * @param sink The buffer to drain.
+     * @param out The stream receiving the messages.
+     * @param period Pause between two drains.
+     */
+    TraceDrainer(RingBufferTraceSink& sink, ostream& out,
+                 chrono::milliseconds period = chrono::milliseconds(10))
+        : sink(sink), out(out), running(true)
+    {
+        worker = thread([this, period]() {
+            while (running.load(memory_order_acquire)) {
+                this->sink.drain(this->out);
+                this_thread::sleep_for(period);
+            }
+            this->sink.drain(this->out);
+        });
     }
-    void updateOutputs() override {
-        double sum_mass_flow = 0;
-        for (const auto& input_stream : inputs) {
-            sum_mass_flow += input_stream -> getMassFlow();
-        }
 
-        if (outputs.empty()) {
-            throw "Should set outputs before update"s;
-        }
-
-        double output_mass = sum_mass_flow / outputs.size();
-
-        for (auto& output_stream : outputs) {
-            output_stream -> setMassFlow(output_mass);
-        }
+    ~TraceDrainer()
+    {
+        running.store(false, memory_order_release);
+        worker.join();
     }
 };
 
-void shouldSetOutputsCorrectlyWithOneOutput() {
-    streamcounter=0;
-    Mixer d1 = Mixer(2);
-
-    shared_ptr<Stream> s1(new Stream(++streamcounter));
-    shared_ptr<Stream> s2(new Stream(++streamcounter));
-    shared_ptr<Stream> s3(new Stream(++streamcounter));
-    s1->setMassFlow(10.0);
-    s2->setMassFlow(5.0);
+/**
+ * @brief Global trace configuration: the active sink and its runtime level.
+ */
+struct TraceConfig {
+    atomic<TraceSink*> sink;
+    atomic<int> level;
 
-    d1.addInput(s1);
-    d1.addInput(s2);
-    d1.addOutput(s3);
+    static TraceConfig& instance()
+    {
+        static TraceConfig config;
+        return config;
+    }
 
-    d1.updateOutputs();
+private:
+    TraceConfig() : sink(nullptr), level((int)TraceLevel::Info) {}
+};
 
-    if (abs(s3->getMassFlow()) - 15 < POSSIBLE_ERROR) {
-        cout << "Test 1 passed"s << endl;
-    } else {
-        cout << "Test 1 failed"s << endl;
-    }
+/**
+ * @brief Install a trace sink.
+ * @param sink The sink, or nullptr to discard all messages.
+ * @param level Most verbose level forwarded to the sink.
+ */
+inline void setTraceSink(TraceSink* sink, TraceLevel level = TraceLevel::Info)
+{
+    TraceConfig::instance().level.store((int)level, memory_order_relaxed);
+    TraceConfig::instance().sink.store(sink, memory_order_release);
 }
 
-void shouldCorrectOutputs() {
-    streamcounter=0;
-    Mixer d1 = Mixer(2);
-
-    shared_ptr<Stream> s1(new Stream(++streamcounter));
-    shared_ptr<Stream> s2(new Stream(++streamcounter));
-    shared_ptr<Stream> s3(new Stream(++streamcounter));
-    shared_ptr<Stream> s4(new Stream(++streamcounter));
-    s1->setMassFlow(10.0);
-    s2->setMassFlow(5.0);
+/**
+ * @brief Format a message and hand it to the installed sink if its level passes.
+ * @param level Severity of the message.
+ * @param format printf-style format string.
+ */
+inline void traceMessage(TraceLevel level, const char* format, ...)
+{
+    TraceConfig& config = TraceConfig::instance();
+    TraceSink* sink = config.sink.load(memory_order_acquire);
+    if (!sink || (int)level > config.level.load(memory_order_relaxed)) return;
 
-    d1.addInput(s1);
-    d1.addInput(s2);
-    d1.addOutput(s3);
+    char text[TRACE_MESSAGE_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    sink->write(level, text);
+}
 
-    try {
-        d1.addOutput(s4);
-    } catch (const string ex) {
-        if (ex == "Too much outputs"s) {
-            cout << "Test 2 passed"s << endl;
-            return;
-        }
-    }
+/**
+ * @brief Emit a trace message; expands to nothing above DEVICE_TRACE_LEVEL.
+ */
+#if DEVICE_TRACE_LEVEL > 0
+#define DEVICE_TRACE(level, ...) \
+    do { \
+        if ((int)(level) <= DEVICE_TRACE_LEVEL) traceMessage((level), __VA_ARGS__); \
+    } while (0)
+#else
+#define DEVICE_TRACE(level, ...) do {} while (0)
+#endif
 
-    cout << "Test 2 failed"s << endl;
-}
+#ifndef DEVICE_PROFILING
+#define DEVICE_PROFILING 0 ///< 1 records call counts and timings of every device evaluation.
+#endif
 
-void shouldCorrectInputs() {
-    streamcounter=0;
-    Mixer d1 = Mixer(2);
+class Device;
 
-    shared_ptr<Stream> s1(new Stream(++streamcounter));
-    shared_ptr<Stream> s2(new Stream(++streamcounter));
-    shared_ptr<Stream> s3(new Stream(++streamcounter));
-    shared_ptr<Stream> s4(new Stream(++streamcounter));
-    s1->setMassFlow(10.0);
-    s2->setMassFlow(5.0);
+/**
+ * @brief Kind of evaluation a device profile entry counts.
+ */
+enum class ProfilePhase { Update = 0, Batch, Components, Tangents };
 
-    d1.addInput(s1);
-    d1.addInput(s2);
-    d1.addOutput(s3);
+const size_t PROFILE_PHASES = 4; ///< Number of ProfilePhase values.
 
-    try {
-        d1.addInput(s4);
-    } catch (const string ex) {
-        if (ex == "Too much inputs"s) {
-            cout << "Test 3 passed"s << endl;
-            return;
-        }
+/**
+ * @brief Get the name of a profile phase.
+ * @param phase The phase.
+ * @return Static text.
+ */
+inline const char* profilePhaseName(ProfilePhase phase)
+{
+    switch (phase) {
+    case ProfilePhase::Update: return "update";
+    case ProfilePhase::Batch: return "batch";
+    case ProfilePhase::Components: return "components";
+    case ProfilePhase::Tangents: return "tangents";
     }
-
-    cout << "Test 3 failed"s << endl;
+    return "unknown";
 }
 
 /**
- * @class Reactor
- * @brief Chemical reactor with 1 input and 1 or 2 outputs
+ * @struct DeviceProfile
+ * @brief Counters of one device and phase, summed over all threads.
+ */
+struct DeviceProfile {
+    const Device* device;
+    ProfilePhase phase;
+    uint64_t calls;      ///< Evaluations started.
+    uint64_t totalNs;    ///< Wall time spent in all evaluations.
+    uint64_t maxNs;      ///< Longest single evaluation.
+    uint64_t exceptions; ///< Evaluations that ended with an exception.
+    const char* typeName; ///< Device type, captured while the device was alive.
+};
+
+/**
+ * @class ProfileRegistry
+ * @brief Per-thread device counters, merged on query.
  *
- * Reactor can operate in two modes:
- * - Single output mode: 1 input → 1 output
- * - Double output mode: 1 input → 2 outputs (mass split equally)
+ * Each thread writes only its own table, under a lock that is uncontended
+ * except while a query, reset or device destruction walks the tables, so
+ * recording needs no atomic read-modify-write. Tables outlive their threads
+ * so nothing is lost on exit; a device's entries go when the device does.
  */
-class Reactor : public Device
+class ProfileRegistry
 {
 private:
-    bool isDoubleOutput; ///< Flag for double output mode
+    struct Counters {
+        uint64_t calls = 0;
+        uint64_t totalNs = 0;
+        uint64_t maxNs = 0;
+        uint64_t exceptions = 0;
+    };
+
+    struct Entry {
+        const char* typeName;
+        array<Counters, PROFILE_PHASES> phases;
+    };
+
+    struct ThreadTable {
+        mutex lock; ///< Taken by the owning thread on every record and by every query.
+        unordered_map<const Device*, Entry> entries;
+    };
+
+    mutex lock;                          ///< Guards tables.
+    vector<shared_ptr<ThreadTable>> tables;
+
+    ProfileRegistry() {}
+
+    ThreadTable& local()
+    {
+        static thread_local shared_ptr<ThreadTable> table;
+        if (!table) {
+            table = make_shared<ThreadTable>();
+            lock_guard<mutex> guard(lock);
+            tables.push_back(table);
+        }
+        return *table;
+    }
 
 public:
+    static ProfileRegistry& instance()
+    {
+        // Never destroyed, so devices with static storage can still unregister at exit
+        static ProfileRegistry* registry = new ProfileRegistry();
+        return *registry;
+    }
+
     /**
-     * @brief Constructor for Reactor device
-     * @param isDoubleReactor true - 2 outputs, false - 1 output
+     * @brief Count one evaluation on the calling thread.
+     * @param device The evaluated device.
+     * @param phase Kind of evaluation.
+     * @param ns Duration of the evaluation.
+     * @param threw Whether it ended with an exception.
      */
-    Reactor(bool isDoubleReactor) : Device()
+    void record(const Device* device, const char* typeName, ProfilePhase phase, uint64_t ns, bool threw)
     {
-        isDoubleOutput = isDoubleReactor;
-        inputAmount = 1;  // Always 1 input
-        outputAmount = isDoubleReactor ? 2 : 1;  // 1 or 2 outputs
+        ThreadTable& table = local();
+        lock_guard<mutex> guard(table.lock);
+        auto it = table.entries.find(device);
+        if (it == table.entries.end()) it = table.entries.emplace(device, Entry{typeName, {}}).first;
+        Counters& counters = it->second.phases[(size_t)phase];
+        ++counters.calls;
+        counters.totalNs += ns;
+        counters.maxNs = max(counters.maxNs, ns);
+        if (threw) ++counters.exceptions;
     }
 
     /**
-     * @brief Updates output streams based on input stream and reactor configuration
-     *
-     * In single output mode: output mass flow = input mass flow
-     * In double output mode: each output gets half of input mass flow
-     *
-     * @throws std::string if outputs are not set before update
+     * @brief Sum the counters of every thread.
+     * @return One entry per device and phase that was evaluated at least once.
      */
-    void updateOutputs() override
+    vector<DeviceProfile> snapshot()
     {
-        // Check if input is connected
-        if (inputs.empty()) {
-            throw "Input stream not connected to reactor"s;
+        unordered_map<const Device*, array<DeviceProfile, PROFILE_PHASES>> merged;
+        lock_guard<mutex> guard(lock);
+        for (const shared_ptr<ThreadTable>& table : tables) {
+            lock_guard<mutex> tableGuard(table->lock);
+            for (const auto& entry : table->entries) {
+                auto inserted = merged.emplace(entry.first, array<DeviceProfile, PROFILE_PHASES>());
+                for (size_t p = 0; p < PROFILE_PHASES; ++p) {
+                    DeviceProfile& profile = inserted.first->second[p];
+                    if (inserted.second) profile = DeviceProfile{entry.first, (ProfilePhase)p, 0, 0, 0, 0, entry.second.typeName};
+                    const Counters& counters = entry.second.phases[p];
+                    profile.calls += counters.calls;
+                    profile.totalNs += counters.totalNs;
+                    profile.maxNs = max(profile.maxNs, counters.maxNs);
+                    profile.exceptions += counters.exceptions;
+                }
+            }
         }
-
-        // Check if outputs are set
-        if (outputs.size() != outputAmount) {
-            throw "Output streams not properly set for reactor"s;
+        vector<DeviceProfile> result;
+        for (const auto& entry : merged) {
+            for (const DeviceProfile& profile : entry.second) {
+                if (profile.calls) result.push_back(profile);
+            }
         }
+        return result;
+    }
 
-        double inputMass = inputs[0]->getMassFlow();
-
-        if (isDoubleOutput) {
-            // Split mass equally between two outputs
-            double outputMass = inputMass / 2.0;
-            outputs[0]->setMassFlow(outputMass);
-            outputs[1]->setMassFlow(outputMass);
-            cout << "Reactor: split mass " << inputMass << " into two outputs of " << outputMass << endl;
-        } else {
-            // Single output - same mass flow as input
-            outputs[0]->setMassFlow(inputMass);
-            cout << "Reactor: transferred mass " << inputMass << " to single output" << endl;
+    /**
+     * @brief Forget every counter; an evaluation finishing concurrently is counted afresh.
+     */
+    void reset()
+    {
+        lock_guard<mutex> guard(lock);
+        for (const shared_ptr<ThreadTable>& table : tables) {
+            lock_guard<mutex> tableGuard(table->lock);
+            table->entries.clear();
         }
     }
 
     /**
-     * @brief Gets the reactor operation mode
-     * @return true if reactor is in double output mode, false if single output
+     * @brief Drop the entries of a device that is being destroyed.
+     * @param device The device; a later device at the same address starts from zero.
      */
-    bool getIsDoubleOutput() const { return isDoubleOutput; }
+    void forget(const Device* device)
+    {
+        lock_guard<mutex> guard(lock);
+        for (const shared_ptr<ThreadTable>& table : tables) {
+            lock_guard<mutex> tableGuard(table->lock);
+            table->entries.erase(device);
+        }
+    }
 };
 
 /**
- * @test Test reactor in single output mode
+ * @brief Run one device evaluation, timing it when DEVICE_PROFILING is on.
+ * @param device The device being evaluated.
+ * @param phase Kind of evaluation.
+ * @param body The evaluation itself.
+ * @tparam Owner Device, deferred so the type is complete where this is instantiated.
  */
-void testReactorSingleOutput() {
-    cout << "=== Test 1: Reactor with single output ===" << endl;
-    streamcounter = 0;
-    Reactor reactor(false); // Single output mode
+template <class Owner, class Body>
+inline void profiledCall(const Owner* device, ProfilePhase phase, const Body& body)
+{
+#if DEVICE_PROFILING
+    auto start = chrono::steady_clock::now();
+    try {
+        body();
+    } catch (...) {
+        uint64_t ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        ProfileRegistry::instance().record(device, device->typeName(), phase, ns, true);
+        throw;
+    }
+    uint64_t ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    ProfileRegistry::instance().record(device, device->typeName(), phase, ns, false);
+#else
+    (void)device;
+    (void)phase;
+    body();
+#endif
+}
 
-    shared_ptr<Stream> input(new Stream(++streamcounter));
-    shared_ptr<Stream> output(new Stream(++streamcounter));
+/**
+ * @brief Get the profile of every evaluated device; empty unless DEVICE_PROFILING is on.
+ * @return One entry per device and phase.
+ */
+inline vector<DeviceProfile> deviceProfiles() { return ProfileRegistry::instance().snapshot(); }
 
-    input->setMassFlow(20.0);
+/**
+ * @brief Get the profile of one device.
+ * @param device The device.
+ * @param phase Kind of evaluation.
+ * @return The counters; all zero if the device was never evaluated in that phase.
+ */
+inline DeviceProfile deviceProfile(const Device* device, ProfilePhase phase = ProfilePhase::Update)
+{
+    for (const DeviceProfile& profile : deviceProfiles()) {
+        if (profile.device == device && profile.phase == phase) return profile;
+    }
+    return DeviceProfile{device, phase, 0, 0, 0, 0, nullptr};
+}
 
-    reactor.addInput(input);
-    reactor.addOutput(output);
-    reactor.updateOutputs();
+/**
+ * @brief Forget all recorded profiles.
+ */
+inline void resetDeviceProfiles() { ProfileRegistry::instance().reset(); }
 
-    if (abs(output->getMassFlow() - 20.0) < POSSIBLE_ERROR) {
-        cout << "PASS: Single output mode works correctly" << endl;
-    } else {
-        cout << "FAIL: Incorrect output mass" << endl;
+/**
+ * @brief dst[i] += src[i] for a lane of scenario values.
+ */
+inline void lanesAdd(double* dst, const double* src, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(dst + i), _mm256_loadu_pd(src + i)));
     }
-    cout << endl;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 2 <= n; i += 2) {
+        vst1q_f64(dst + i, vaddq_f64(vld1q_f64(dst + i), vld1q_f64(src + i)));
+    }
+#endif
+    for (; i < n; ++i) dst[i] += src[i];
 }
 
 /**
- * @test Test reactor in double output mode
+ * @brief dst[i] = factor * src[i] for a lane of scenario values; dst may equal src.
  */
-void testReactorDoubleOutput() {
-    cout << "=== Test 2: Reactor with double output ===" << endl;
-    streamcounter = 0;
-    Reactor reactor(true); // Double output mode
+inline void lanesScale(double* dst, const double* src, double factor, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256d f = _mm256_set1_pd(factor);
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(src + i), f));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float64x2_t f = vdupq_n_f64(factor);
+    for (; i + 2 <= n; i += 2) {
+        vst1q_f64(dst + i, vmulq_f64(vld1q_f64(src + i), f));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = factor * src[i];
+}
+
+/**
+ * @brief dst[i] = scale[i] * values[index[i]], gathering through an index list.
+ */
+inline void gatherScaled(double* dst, const double* values, const uint32_t* index, const double* scale, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    // Widen the ids to 64 bits: a signed 32-bit gather would misread ids of
+    // 2^31 and above. The masked form starts from a defined register.
+    const __m256d lanes = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    for (; i + 4 <= n; i += 4) {
+        __m256i slots = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(index + i)));
+        __m256d gathered = _mm256_mask_i64gather_pd(_mm256_setzero_pd(), values, slots, lanes, 8);
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(gathered, _mm256_loadu_pd(scale + i)));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = scale[i] * values[index[i]];
+}
+
+typedef uint32_t StreamId; ///< Index of a stream inside its StreamStore.
+
+const size_t SIMD_ALIGNMENT = 32; ///< Bytes; one AVX register.
+
+/**
+ * @brief Allocate an aligned block from the malloc heap, without going through operator new.
+ * @param size Bytes wanted.
+ * @param alignment A power of two, at least sizeof(void*).
+ * @return The block, or nullptr if malloc failed; give it back with alignedFree().
+ */
+inline void* alignedMalloc(size_t size, size_t alignment) noexcept
+{
+#if DEVICE_HAS_POSIX_MEMALIGN
+    void* p = nullptr;
+    return posix_memalign(&p, alignment, size) == 0 ? p : nullptr;
+#else
+    // Over-allocate and keep malloc's pointer in the word below the aligned block
+    void* raw = malloc(size + alignment + sizeof(void*));
+    if (!raw) return nullptr;
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    reinterpret_cast<void**>(aligned)[-1] = raw;
+    return reinterpret_cast<void*>(aligned);
+#endif
+}
+
+/**
+ * @brief Release a block from alignedMalloc(); nullptr is ignored.
+ */
+inline void alignedFree(void* p) noexcept
+{
+#if DEVICE_HAS_POSIX_MEMALIGN
+    free(p);
+#else
+    if (p) free(static_cast<void**>(p)[-1]);
+#endif
+}
+
+/**
+ * @brief Minimal allocator returning SIMD_ALIGNMENT-aligned memory for component vectors.
+ *
+ * Uses posix_memalign where it exists, else the C++17 aligned operator new,
+ * else alignedMalloc()'s hand-aligned blocks.
+ */
+template <class T>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    AlignedAllocator() {}
+    template <class U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n)
+    {
+        size_t bytes = max(n * sizeof(T), SIMD_ALIGNMENT);
+#if !DEVICE_HAS_POSIX_MEMALIGN && defined(__cpp_aligned_new)
+        return static_cast<T*>(::operator new(bytes, align_val_t(SIMD_ALIGNMENT)));
+#else
+        void* p = alignedMalloc(bytes, SIMD_ALIGNMENT);
+        if (!p) throw bad_alloc();
+        return static_cast<T*>(p);
+#endif
+    }
+
+    void deallocate(T* p, size_t)
+    {
+#if !DEVICE_HAS_POSIX_MEMALIGN && defined(__cpp_aligned_new)
+        ::operator delete(p, align_val_t(SIMD_ALIGNMENT));
+#else
+        alignedFree(p);
+#endif
+    }
+};
+
+template <class T, class U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return true; }
+template <class T, class U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return false; }
+
+/**
+ * @struct StreamRows
+ * @brief A block of fixed-width per-stream rows (scenario lanes or component flows).
+ */
+struct StreamRows {
+    double* base; ///< Row of stream 0.
+    size_t width; ///< Values per row, including padding.
+
+    double* row(StreamId id) const { return base + id * width; }
+};
+
+
+/**
+ * @brief Heap bytes reserved by a vector.
+ */
+template <class T, class Allocator>
+inline size_t heapBytes(const vector<T, Allocator>& items) { return items.capacity() * sizeof(T); }
+
+/**
+ * @brief Heap bytes of a string; 0 while it fits the inline buffer.
+ */
+inline size_t heapBytes(const string& text)
+{
+    const char* data = text.data();
+    bool local = data >= reinterpret_cast<const char*>(&text) && data < reinterpret_cast<const char*>(&text + 1);
+    return local ? 0 : text.capacity() + 1;
+}
+
+/**
+ * @brief Estimated heap bytes of a hash map: one node per element plus the bucket array.
+ *
+ * A map with a single bucket keeps it inline.
+ */
+template <class K, class V>
+inline size_t heapBytes(const unordered_map<K, V>& items)
+{
+    size_t buckets = items.bucket_count() > 1 ? items.bucket_count() : 0;
+    return items.size() * (sizeof(typename unordered_map<K, V>::value_type) + sizeof(void*)) + buckets * sizeof(void*);
+}
+
+/**
+ * @class SmallVector
+ * @brief Vector of trivially copyable values that stores the first N inline.
+ *
+ * Used for device ports: almost every device has 1-4 of them, so wiring a
+ * device costs no heap allocation and its ports share a cache line with it.
+ * Longer lists move to the heap, doubling as a vector would.
+ * @tparam T Element type.
+ * @tparam N Elements kept inline.
+ */
+template <class T, size_t N>
+class SmallVector
+{
+    static_assert(is_trivially_copyable<T>::value, "SmallVector copies elements with memcpy");
+
+private:
+    T* items;          ///< Points to local or to the heap block.
+    uint32_t count;
+    uint32_t capacity;
+    T local[N];        ///< Inline storage.
+
+    void grow(size_t wanted)
+    {
+        size_t grown = max(wanted, 2 * (size_t)capacity);
+        T* block = static_cast<T*>(::operator new(grown * sizeof(T)));
+        memcpy(block, items, count * sizeof(T));
+        release();
+        items = block;
+        capacity = (uint32_t)grown;
+    }
+
+    void release()
+    {
+        if (items != local) ::operator delete(items);
+        items = local;
+        capacity = N;
+    }
+
+public:
+    SmallVector() : items(local), count(0), capacity(N) {}
+    SmallVector(const SmallVector& other) : SmallVector() { *this = other; }
+    SmallVector(SmallVector&& other) : SmallVector() { *this = move(other); }
+    ~SmallVector() { release(); }
+
+    SmallVector& operator=(const SmallVector& other)
+    {
+        if (this == &other) return *this;
+        count = 0;
+        if (other.count > capacity) grow(other.count);
+        memcpy(items, other.items, other.count * sizeof(T));
+        count = other.count;
+        return *this;
+    }
+
+    SmallVector& operator=(SmallVector&& other)
+    {
+        if (this == &other) return *this;
+        if (other.items == other.local) return *this = other;
+        release();
+        items = other.items;
+        count = other.count;
+        capacity = other.capacity;
+        other.items = other.local;
+        other.count = 0;
+        other.capacity = N;
+        return *this;
+    }
+
+    void push_back(const T& value)
+    {
+        if (count == capacity) {
+            T copy = value;  // value may live in the block being replaced
+            grow(count + 1);
+            items[count++] = copy;
+            return;
+        }
+        items[count++] = value;
+    }
+
+    void reserve(size_t wanted)
+    {
+        if (wanted > capacity) grow(wanted);
+    }
+
+    void clear() { count = 0; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool isInline() const { return items == local; }
+    size_t heapBytes() const { return isInline() ? 0 : capacity * sizeof(T); }
+    T* data() { return items; }
+    const T* data() const { return items; }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+    T* begin() { return items; }
+    T* end() { return items + count; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+};
+
+typedef SmallVector<StreamId, 4> PortList; ///< Port storage of a device, inline up to four streams.
+
+/**
+ * @class StreamStore
+ * @brief Structure-of-arrays storage for stream data.
+ *
+ * All mass flows live in one contiguous array indexed by StreamId, names are
+ * kept in a separate side table so that solving never touches them.
+ */
+class StreamStore
+{
+private:
+    vector<double> mass_flows; ///< Mass flow of every stream, indexed by StreamId.
+    vector<uint32_t> numbers;  ///< Numeric identity of every stream, indexed by StreamId.
+    unordered_map<StreamId, string> custom_names; ///< Names given with setName(), if any.
+    vector<uint8_t> dirty;     ///< Set when a mass flow changed since the last clearDirty().
+    size_t lane_count = 0;     ///< Scenario values per stream in batch mode.
+    vector<double> lane_values; ///< lane_count values per stream, stream-major.
+    size_t component_count = 0; ///< Species per stream in multi-component mode.
+    size_t component_stride = 0; ///< component_count rounded up to a whole SIMD register.
+    vector<double, AlignedAllocator<double>> component_flows; ///< component_stride flows per stream.
+    size_t tangent_count = 0;  ///< Derivative directions per stream in tangent mode.
+    size_t tangent_stride = 0; ///< tangent_count rounded up to a whole SIMD register.
+    vector<double, AlignedAllocator<double>> tangent_values; ///< tangent_stride derivatives per stream.
+    vector<StreamId> free_slots; ///< Slots given back with release(), reused by acquire().
+
+public:
+    /**
+     * @brief Append a stream to the store.
+     * @param number The numeric identity of the new stream; its default name is "s<number>".
+     * @return The index of the new stream.
+     */
+    StreamId add(uint32_t number)
+    {
+        mass_flows.push_back(0.0);
+        numbers.push_back(number);
+        dirty.push_back(1);
+        lane_values.resize(lane_values.size() + lane_count, 0.0);
+        component_flows.resize(component_flows.size() + component_stride, 0.0);
+        tangent_values.resize(tangent_values.size() + tangent_stride, 0.0);
+        return (StreamId)(mass_flows.size() - 1);
+    }
+
+    /**
+     * @brief Take a slot for a stream, reusing one given back with release() if there is one.
+     * @param number The numeric identity of the stream; its default name is "s<number>".
+     * @return The index of the stream, with every value zeroed and no custom name.
+     */
+    StreamId acquire(uint32_t number)
+    {
+        if (free_slots.empty()) return add(number);
+        StreamId id = free_slots.back();
+        free_slots.pop_back();
+        mass_flows[id] = 0.0;
+        numbers[id] = number;
+        dirty[id] = 1;
+        custom_names.erase(id);
+        fill_n(laneValues(id), lane_count, 0.0);
+        fill_n(componentFlows(id), component_stride, 0.0);
+        fill_n(tangentValues(id), tangent_stride, 0.0);
+        return id;
+    }
+
+    /**
+     * @brief Give a slot taken with acquire() back for reuse.
+     * @param id The stream index; must not be used afterwards.
+     */
+    void release(StreamId id) { free_slots.push_back(id); }
+
+    double getMassFlow(StreamId id) const { return mass_flows[id]; }
+
+    /**
+     * @brief Set a mass flow, flagging the stream dirty only if the value changed.
+     * @param id The stream index.
+     * @param m The new mass flow.
+     */
+    void setMassFlow(StreamId id, double m)
+    {
+        if (mass_flows[id] != m) {
+            mass_flows[id] = m;
+            dirty[id] = 1;
+        }
+    }
+
+    bool isDirty(StreamId id) const { return dirty[id] != 0; }
+    const uint8_t* dirtyFlags() const { return dirty.data(); }
+    void clearDirty() { fill(dirty.begin(), dirty.end(), 0); }
+    uint32_t getNumber(StreamId id) const { return numbers[id]; }
+    const uint32_t* streamNumbers() const { return numbers.data(); }
+    const unordered_map<StreamId, string>& customNames() const { return custom_names; }
+
+    /**
+     * @brief Heap bytes of the per-stream arrays, lanes, components and tangents included.
+     */
+    size_t footprint() const
+    {
+        return heapBytes(mass_flows) + heapBytes(numbers) + heapBytes(dirty) + heapBytes(lane_values) +
+               heapBytes(component_flows) + heapBytes(tangent_values) + heapBytes(free_slots);
+    }
+
+    /**
+     * @brief Heap bytes of the custom name table.
+     */
+    size_t nameFootprint() const
+    {
+        size_t bytes = heapBytes(custom_names);
+        for (const auto& entry : custom_names) bytes += heapBytes(entry.second);
+        return bytes;
+    }
+
+    /**
+     * @brief Get the display name of a stream, formatting it only now.
+     * @param id The stream index.
+     * @return The name given with setName(), or "s<number>".
+     */
+    string getName(StreamId id) const
+    {
+        auto it = custom_names.find(id);
+        if (it != custom_names.end()) return it->second;
+        return "s" + std::to_string(numbers[id]);
+    }
+
+    void setName(StreamId id, const string& name) { custom_names[id] = name; }
+    size_t size() const { return mass_flows.size(); }
+
+    /**
+     * @brief Raw access to the contiguous mass flow array.
+     * @return Pointer to the first mass flow; invalidated by add().
+     */
+    double* massFlows() { return mass_flows.data(); }
+    const double* massFlows() const { return mass_flows.data(); }
+
+    /**
+     * @brief Switch batch mode on (n > 0) or off (n == 0), zeroing all lanes.
+     * @param n Number of scenario values held by every stream.
+     */
+    void setLanes(size_t n)
+    {
+        lane_count = n;
+        lane_values.assign(mass_flows.size() * n, 0.0);
+    }
+
+    size_t lanes() const { return lane_count; }
+
+    /**
+     * @brief Access the scenario lane of a stream.
+     * @param id The stream index.
+     * @return Pointer to lanes() contiguous values; invalidated by add() and setLanes().
+     */
+    double* laneValues(StreamId id) { return lane_values.data() + id * lane_count; }
+    const double* laneValues(StreamId id) const { return lane_values.data() + id * lane_count; }
+    StreamRows laneRows() { return StreamRows{lane_values.data(), lane_count}; }
+
+    /**
+     * @brief Switch multi-component mode on (n > 0) or off (n == 0), zeroing all flows.
+     *
+     * Rows are padded with zeros to a multiple of four doubles and start on a
+     * SIMD_ALIGNMENT boundary, so kernels can process whole registers.
+     * @param n Number of species per stream.
+     */
+    void setComponents(size_t n)
+    {
+        component_count = n;
+        component_stride = (n + 3) / 4 * 4;
+        component_flows.assign(mass_flows.size() * component_stride, 0.0);
+    }
+
+    size_t components() const { return component_count; }
+    double* componentFlows(StreamId id) { return component_flows.data() + id * component_stride; }
+    const double* componentFlows(StreamId id) const { return component_flows.data() + id * component_stride; }
+    StreamRows componentRows() { return StreamRows{component_flows.data(), component_stride}; }
+
+    /**
+     * @brief Switch tangent mode on (n > 0) or off (n == 0), zeroing all derivatives.
+     *
+     * Every stream then carries the derivatives of its mass flow along n
+     * directions, padded like component rows so kernels process whole registers.
+     * @param n Number of derivative directions.
+     */
+    void setTangents(size_t n)
+    {
+        tangent_count = n;
+        tangent_stride = (n + 3) / 4 * 4;
+        tangent_values.assign(mass_flows.size() * tangent_stride, 0.0);
+    }
+
+    size_t tangents() const { return tangent_count; }
+    double* tangentValues(StreamId id) { return tangent_values.data() + id * tangent_stride; }
+    const double* tangentValues(StreamId id) const { return tangent_values.data() + id * tangent_stride; }
+    StreamRows tangentRows() { return StreamRows{tangent_values.data(), tangent_stride}; }
+
+    /**
+     * @brief Total mass flow of a stream in multi-component mode.
+     * @param id The stream index.
+     * @return Sum of the component flows, padding excluded.
+     */
+    double totalMass(StreamId id) const
+    {
+        const double* flows = componentFlows(id);
+        double total = 0.0;
+        for (size_t c = 0; c < component_count; ++c) total += flows[c];
+        return total;
+    }
+
+    /**
+     * @brief Append copies of every stream of another store.
+     * @param other Store with the same batch and multi-component layout.
+     * @return Index of the first appended stream; other's stream i becomes offset + i.
+     * @throws std::string if the layouts differ
+     */
+    StreamId append(const StreamStore& other)
+    {
+        if (other.lane_count != lane_count || other.component_count != component_count ||
+            other.tangent_count != tangent_count) {
+            throw string("Stream stores have different batch or component layouts");
+        }
+        StreamId offset = (StreamId)size();
+        mass_flows.insert(mass_flows.end(), other.mass_flows.begin(), other.mass_flows.end());
+        numbers.insert(numbers.end(), other.numbers.begin(), other.numbers.end());
+        dirty.insert(dirty.end(), other.dirty.begin(), other.dirty.end());
+        lane_values.insert(lane_values.end(), other.lane_values.begin(), other.lane_values.end());
+        component_flows.insert(component_flows.end(), other.component_flows.begin(), other.component_flows.end());
+        tangent_values.insert(tangent_values.end(), other.tangent_values.begin(), other.tangent_values.end());
+        for (const auto& entry : other.custom_names) custom_names[offset + entry.first] = entry.second;
+        return offset;
+    }
+
+    /**
+     * @brief Replace every stream with a block of saved values.
+     *
+     * Lanes and component flows are reset to zero in the current layout and
+     * every stream starts dirty; custom names are dropped.
+     * @param flows Mass flow of each stream.
+     * @param streamNumbers Numeric identity of each stream.
+     * @param count Number of streams.
+     */
+    void assign(const double* flows, const uint32_t* streamNumbers, size_t count)
+    {
+        mass_flows.assign(flows, flows + count);
+        numbers.assign(streamNumbers, streamNumbers + count);
+        custom_names.clear();
+        dirty.assign(count, 1);
+        lane_values.assign(count * lane_count, 0.0);
+        component_flows.assign(count * component_stride, 0.0);
+        tangent_values.assign(count * tangent_stride, 0.0);
+    }
+
+    /**
+     * @brief Remove every stream, keeping the batch and multi-component layout.
+     */
+    void clear()
+    {
+        mass_flows.clear();
+        numbers.clear();
+        custom_names.clear();
+        dirty.clear();
+        lane_values.clear();
+        component_flows.clear();
+        tangent_values.clear();
+        free_slots.clear();
+    }
+};
+
+/**
+ * @class StandaloneStore
+ * @brief StreamStore of the streams one thread creates outside of any flowsheet.
+ *
+ * Each thread gets its own store, so threads building standalone streams at
+ * once never grow shared arrays. A standalone stream may be destroyed on any
+ * thread; the store outlives its thread until the last of its streams is gone.
+ */
+class StandaloneStore : public StreamStore
+{
+private:
+    mutex lock;            ///< Guards the free list and the counters against releases from other threads.
+    size_t live = 0;       ///< Streams holding a slot.
+    bool orphaned = false; ///< Set once the owning thread has exited.
+
+    /**
+     * @brief Deletes the calling thread's store at thread exit, or leaves that to its last stream.
+     */
+    struct Owner {
+        StandaloneStore* store = new StandaloneStore();
+
+        ~Owner()
+        {
+            bool empty;
+            {
+                lock_guard<mutex> guard(store->lock);
+                store->orphaned = true;
+                empty = store->live == 0;
+            }
+            if (empty) delete store;
+        }
+    };
+
+public:
+    /**
+     * @brief Get the store of the calling thread.
+     * @return Store for the thread's standalone streams; use them on that thread only.
+     */
+    static StandaloneStore& current()
+    {
+        static thread_local Owner owner;
+        return *owner.store;
+    }
+
+    /**
+     * @brief Take a slot for a new standalone stream; call on the owning thread.
+     * @param number The numeric identity of the stream.
+     * @return The stream index.
+     */
+    StreamId acquire(uint32_t number)
+    {
+        lock_guard<mutex> guard(lock);
+        ++live;
+        return StreamStore::acquire(number);
+    }
+
+    /**
+     * @brief Give a slot back from any thread, deleting the store with its last stream once orphaned.
+     * @param id The stream index.
+     */
+    void release(StreamId id)
+    {
+        bool last;
+        {
+            lock_guard<mutex> guard(lock);
+            StreamStore::release(id);
+            last = --live == 0 && orphaned;
+        }
+        if (last) delete this;
+    }
+};
+
+/**
+ * @class Stream
+ * @brief Represents a chemical stream with a name and mass flow.
+ *
+ * A Stream is a handle to one slot of a StreamStore; the data itself lives in
+ * the store. A stream built from a number alone owns its slot of the
+ * calling thread's StandaloneStore and gives it back when destroyed. Handles
+ * are not copyable, so two Stream objects never silently share one slot.
+ */
+class Stream
+{
+    friend class StreamArena;
+
+private:
+    StreamStore* store; ///< Store holding the stream data.
+    StreamId id;        ///< Slot of the stream in the store.
+    bool standalone = false; ///< Whether the stream owns its slot and releases it on destruction.
+
+public:
+    /**
+     * @brief Constructor to create a Stream with a unique name.
+     *
+     * The stream takes a slot of the calling thread's StandaloneStore, so
+     * build and use it on one thread, or synchronize as for a Flowsheet.
+     * @param s An integer used to generate a unique name for the stream.
+     */
+    Stream(int s) : store(&StandaloneStore::current()), id(StandaloneStore::current().acquire((uint32_t)s)),
+                    standalone(true) {}
+
+    /**
+     * @brief Constructor to wrap an existing slot of a store.
+     * @param store The store holding the stream.
+     * @param id The slot of the stream in the store.
+     */
+    Stream(StreamStore& store, StreamId id) : store(&store), id(id) {}
+
+    Stream(const Stream&) = delete;
+    Stream& operator=(const Stream&) = delete;
+
+    /**
+     * @brief Give a standalone stream's slot back to its StandaloneStore.
+     */
+    ~Stream()
+    {
+        if (standalone) static_cast<StandaloneStore*>(store)->release(id);
+    }
+
+    /**
+     * @brief Set the name of the stream.
+     * @param s The new name for the stream.
+     */
+    void setName(const string& s){store->setName(id, s);}
+
+    /**
+     * @brief Get the name of the stream.
+     * @return The name of the stream.
+     */
+    string getName(){return store->getName(id);}
+
+    /**
+     * @brief Set the mass flow rate of the stream.
+     * @param m The new mass flow rate value.
+     * @throws std::string in multi-component mode, where the total is derived
+     */
+    void setMassFlow(double m){
+        if (store->components()) throw "Mass flow is derived from component flows"s;
+        store->setMassFlow(id, m);
+    }
+
+    /**
+     * @brief Get the mass flow rate of the stream.
+     * @return The mass flow rate, summed over the components in multi-component mode.
+     */
+    double getMassFlow() const {return store->components() ? store->totalMass(id) : store->getMassFlow(id);}
+
+    /**
+     * @brief Set the flow of one species in multi-component mode.
+     * @param c The component index.
+     * @param m The new component flow.
+     * @throws std::string if c is not below the store's component count
+     */
+    void setComponentFlow(size_t c, double m){
+        if (c >= store->components()) throw "Component index out of range"s;
+        store->componentFlows(id)[c] = m;
+    }
+
+    /**
+     * @brief Get the flow of one species in multi-component mode.
+     * @param c The component index.
+     * @return The component flow.
+     * @throws std::string if c is not below the store's component count
+     */
+    double getComponentFlow(size_t c) const {
+        if (c >= store->components()) throw "Component index out of range"s;
+        return store->componentFlows(id)[c];
+    }
+
+    /**
+     * @brief Set the mass flow of one scenario in batch mode.
+     * @param lane The scenario index.
+     * @param m The new mass flow rate value.
+     */
+    void setLane(size_t lane, double m){store->laneValues(id)[lane]=m;}
+
+    /**
+     * @brief Get the mass flow of one scenario in batch mode.
+     * @param lane The scenario index.
+     * @return The mass flow rate of the scenario.
+     */
+    double getLane(size_t lane) const {return store->laneValues(id)[lane];}
+
+    /**
+     * @brief Get the numeric identity of the stream.
+     * @return The number the default name is derived from.
+     */
+    uint32_t getNumber() const {return store->getNumber(id);}
+
+    /**
+     * @brief Get the slot of the stream in its store.
+     * @return The stream index.
+     */
+    StreamId getId() const {return id;}
+
+    /**
+     * @brief Get the store holding the stream data.
+     * @return The owning store.
+     */
+    StreamStore& getStore() const {return *store;}
+
+    /**
+     * @brief Print information about the stream.
+     */
+    void print() { cout << "Stream " << getName() << " flow = " << getMassFlow() << '\n'; }
+};
+
+/**
+ * @class StreamArena
+ * @brief Owns a flowsheet's StreamStore together with the Stream handles given out for it.
+ *
+ * Handles are placement-constructed into fixed-size chunks and never freed
+ * individually; they own no slot, so their destructors are never run. The
+ * shared_ptrs handed out alias the arena's control block, so creating a
+ * stream costs no heap allocation of its own and everything is released in
+ * bulk once the flowsheet and the last handle are gone.
+ */
+class StreamArena
+{
+private:
+    typedef aligned_storage<sizeof(Stream), alignof(Stream)>::type Slot;
+    static const size_t CHUNK_SIZE = 1024; ///< Handles per chunk.
+
+    vector<unique_ptr<Slot[]>> chunks; ///< Handle storage, never shrunk.
+    size_t used = CHUNK_SIZE;          ///< Handles taken from the last chunk.
+    vector<pair<unique_ptr<Slot[]>, size_t>> adopted; ///< Chunks taken over from merged arenas, with their handle counts.
+    vector<shared_ptr<StreamArena>> successors;       ///< Arenas this one was merged into, kept alive for its old handles.
+
+    /**
+     * @brief Point the handles of a chunk at this arena's store.
+     */
+    void rebind(Slot* slots, size_t count, StreamId offset)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            Stream* handle = reinterpret_cast<Stream*>(&slots[i]);
+            handle->store = &store;
+            handle->id += offset;
+        }
+    }
+
+public:
+    StreamStore store; ///< Data of every stream of the flowsheet.
+
+    /**
+     * @brief Construct a handle for a stream of the arena's store.
+     * @param id The stream index.
+     * @return A handle that lives as long as the arena.
+     */
+    Stream* create(StreamId id)
+    {
+        if (used == CHUNK_SIZE) {
+            chunks.emplace_back(new Slot[CHUNK_SIZE]);
+            used = 0;
+        }
+        return new (&chunks.back()[used++]) Stream(store, id);
+    }
+
+    /**
+     * @brief Take over the handles of an arena whose streams were appended to this store.
+     *
+     * The handles are rebound in place, so shared_ptrs given out by the other
+     * arena keep working; the other arena keeps this one alive for them.
+     * @param other The merged arena; left without handles.
+     * @param offset Index of other's first stream in this store.
+     * @param self Owning pointer to this arena.
+     */
+    void adopt(StreamArena& other, StreamId offset, const shared_ptr<StreamArena>& self)
+    {
+        for (size_t c = 0; c < other.chunks.size(); ++c) {
+            size_t count = c + 1 == other.chunks.size() ? other.used : CHUNK_SIZE;
+            rebind(other.chunks[c].get(), count, offset);
+            adopted.emplace_back(move(other.chunks[c]), count);
+        }
+        for (auto& chunk : other.adopted) {
+            rebind(chunk.first.get(), chunk.second, offset);
+            adopted.push_back(move(chunk));
+        }
+        other.chunks.clear();
+        other.adopted.clear();
+        other.used = CHUNK_SIZE;
+        other.successors.push_back(self);
+    }
+
+    /**
+     * @brief Whether target is this arena or one it was merged into, directly or not.
+     *
+     * Adopting such an arena would make the two keep each other alive.
+     */
+    bool reaches(const StreamArena& target) const
+    {
+        vector<const StreamArena*> pending{this}, seen;
+        while (!pending.empty()) {
+            const StreamArena* arena = pending.back();
+            pending.pop_back();
+            if (arena == &target) return true;
+            if (find(seen.begin(), seen.end(), arena) != seen.end()) continue;
+            seen.push_back(arena);
+            for (const auto& successor : arena->successors) pending.push_back(successor.get());
+        }
+        return false;
+    }
+
+    /**
+     * @brief Heap bytes of the handle chunks and their bookkeeping, the store aside.
+     */
+    size_t footprint() const
+    {
+        return (chunks.size() + adopted.size()) * CHUNK_SIZE * sizeof(Slot) + heapBytes(chunks) + heapBytes(adopted) +
+               heapBytes(successors);
+    }
+};
+
+/**
+ * @class StreamSnapshot
+ * @brief Mass flows of the last completed pass, readable from any thread while the next pass runs.
+ *
+ * The solver publishes into the back of two buffers and then flips the epoch,
+ * so readers always copy a buffer that is not being written. Each buffer is
+ * also guarded by a sequence counter: a reader retries only if the solver
+ * completed a whole extra pass during its copy. Published values are never
+ * torn and never mix two passes.
+ */
+class StreamSnapshot
+{
+private:
+    struct Buffer {
+        atomic<uint64_t> sequence{0};         ///< Odd while the solver writes this buffer.
+        atomic<size_t> count{0};              ///< Streams in the published pass.
+        unique_ptr<atomic<double>[]> values;  ///< Published mass flows.
+    };
+
+    struct Generation {
+        size_t capacity;           ///< Streams both buffers can hold.
+        Buffer buffers[2];         ///< Front is buffers[epoch & 1].
+        atomic<uint64_t> epoch{0}; ///< Number of passes published so far.
+    };
+
+    atomic<Generation*> current{nullptr};     ///< Generation readers use.
+    vector<unique_ptr<Generation>> generations; ///< Outgrown generations stay alive for late readers.
+
+public:
+    StreamSnapshot() {}
+    StreamSnapshot(const StreamSnapshot&) = delete;
+    StreamSnapshot& operator=(const StreamSnapshot&) = delete;
+
+    /**
+     * @brief Heap bytes of every generation's buffers; call from the solver thread.
+     */
+    size_t footprint() const
+    {
+        size_t bytes = heapBytes(generations);
+        for (const auto& generation : generations) {
+            bytes += sizeof(Generation) + 2 * generation->capacity * sizeof(atomic<double>);
+        }
+        return bytes;
+    }
+
+    /**
+     * @brief Publish the current mass flows of a store; called by the single solver thread.
+     * @param store The store; in multi-component mode its total masses are published.
+     */
+    void publish(const StreamStore& store)
+    {
+        size_t n = store.size();
+        Generation* generation = current.load(memory_order_relaxed);
+        if (!generation || generation->capacity < n) {
+            unique_ptr<Generation> grown(new Generation);
+            grown->capacity = max(n, generation ? 2 * generation->capacity : n);
+            for (Buffer& buffer : grown->buffers) buffer.values.reset(new atomic<double>[grown->capacity]);
+            grown->epoch.store(generation ? generation->epoch.load(memory_order_relaxed) : 0, memory_order_relaxed);
+            generation = grown.get();
+            generations.push_back(move(grown));
+        }
+
+        uint64_t epoch = generation->epoch.load(memory_order_relaxed) + 1;
+        Buffer& back = generation->buffers[epoch & 1];
+        uint64_t sequence = back.sequence.load(memory_order_relaxed);
+        back.sequence.store(sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        const double* flows = store.massFlows();
+        bool components = store.components() > 0;
+        for (size_t id = 0; id < n; ++id) {
+            back.values[id].store(components ? store.totalMass((StreamId)id) : flows[id], memory_order_relaxed);
+        }
+        back.count.store(n, memory_order_relaxed);
+        back.sequence.store(sequence + 2, memory_order_release);
+
+        generation->epoch.store(epoch, memory_order_release);
+        current.store(generation, memory_order_release);
+    }
+
+    /**
+     * @brief Copy the last published pass.
+     * @param out Receives one mass flow per stream; emptied if nothing was published yet.
+     * @return The epoch of the copied pass, 0 if nothing was published yet.
+     */
+    uint64_t read(vector<double>& out) const
+    {
+        for (;;) {
+            const Generation* generation = current.load(memory_order_acquire);
+            if (!generation) {
+                out.clear();
+                return 0;
+            }
+            uint64_t epoch = generation->epoch.load(memory_order_acquire);
+            const Buffer& front = generation->buffers[epoch & 1];
+            uint64_t sequence = front.sequence.load(memory_order_acquire);
+            if (sequence & 1) continue;
+            out.resize(front.count.load(memory_order_relaxed));
+            for (size_t id = 0; id < out.size(); ++id) out[id] = front.values[id].load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            if (front.sequence.load(memory_order_relaxed) == sequence) return epoch;
+        }
+    }
+
+    /**
+     * @brief Read one stream of the last published pass.
+     * @param id The stream index.
+     * @return Its mass flow, or 0 if the stream was not part of the pass.
+     */
+    double get(StreamId id) const
+    {
+        for (;;) {
+            const Generation* generation = current.load(memory_order_acquire);
+            if (!generation) return 0.0;
+            const Buffer& front = generation->buffers[generation->epoch.load(memory_order_acquire) & 1];
+            uint64_t sequence = front.sequence.load(memory_order_acquire);
+            if (sequence & 1) continue;
+            double value = id < front.count.load(memory_order_relaxed) ? front.values[id].load(memory_order_relaxed) : 0.0;
+            atomic_thread_fence(memory_order_acquire);
+            if (front.sequence.load(memory_order_relaxed) == sequence) return value;
+        }
+    }
+
+    /**
+     * @brief Get the number of passes published so far.
+     */
+    uint64_t epoch() const
+    {
+        const Generation* generation = current.load(memory_order_acquire);
+        return generation ? generation->epoch.load(memory_order_acquire) : 0;
+    }
+};
+
+/**
+ * @class StreamIdAllocator
+ * @brief Lock-free source of stream numbers for flowsheets built on several threads.
+ *
+ * Numbers are reserved in blocks, so a builder touches the shared counter
+ * once per block; blocks never overlap, so flowsheets drawing from one
+ * allocator can be merged without two streams sharing a name.
+ */
+class StreamIdAllocator
+{
+private:
+    atomic<uint32_t> next; ///< First number not handed out yet.
+
+public:
+    static const uint32_t BLOCK_SIZE = 256; ///< Numbers reserved by a StreamIdBlock at a time.
+
+    explicit StreamIdAllocator(uint32_t first = 1) : next(first) {}
+
+    /**
+     * @brief Reserve consecutive numbers.
+     * @param count How many numbers to reserve.
+     * @return The first reserved number.
+     */
+    uint32_t reserve(uint32_t count) { return next.fetch_add(count, memory_order_relaxed); }
+
+    /**
+     * @brief Make sure no number up to and including `number` is handed out again.
+     * @param number Highest number already in use, e.g. by a loaded snapshot.
+     */
+    void advancePast(uint32_t number)
+    {
+        uint32_t current = next.load(memory_order_relaxed);
+        while (current <= number && !next.compare_exchange_weak(current, number + 1, memory_order_relaxed)) {
+        }
+    }
+};
+
+/**
+ * @struct StreamIdBlock
+ * @brief Numbers reserved by one builder; not shared between threads.
+ */
+struct StreamIdBlock {
+    uint32_t next = 0; ///< Next number to hand out.
+    uint32_t end = 0;  ///< One past the last reserved number.
+
+    uint32_t take(StreamIdAllocator& allocator)
+    {
+        if (next == end) {
+            next = allocator.reserve(StreamIdAllocator::BLOCK_SIZE);
+            end = next + StreamIdAllocator::BLOCK_SIZE;
+        }
+        return next++;
+    }
+};
+
+/**
+ * @brief Wiring and evaluation failures shared by every device type.
+ */
+enum class DeviceError {
+    None = 0,          ///< No error.
+    InputLimit,        ///< All input ports are already connected.
+    OutputLimit,       ///< All output ports are already connected.
+    StoreMismatch,     ///< Stream lives in a different StreamStore than the device's other streams.
+    InputNotConnected, ///< A required input stream is missing.
+    OutputsNotSet      ///< Output streams are missing or incomplete.
+};
+
+/**
+ * @brief Get a static description of a device error.
+ * @param error The error code.
+ * @return Human readable text; never allocated.
+ */
+inline const char* deviceErrorMessage(DeviceError error)
+{
+    switch (error) {
+    case DeviceError::None: return "No error";
+    case DeviceError::InputLimit: return "Input stream limit reached";
+    case DeviceError::OutputLimit: return "Output stream limit reached";
+    case DeviceError::StoreMismatch: return "Stream belongs to a different stream store";
+    case DeviceError::InputNotConnected: return "Input stream not connected";
+    case DeviceError::OutputsNotSet: return "Output streams not properly set";
+    }
+    return "Unknown device error";
+}
+
+/**
+ * @struct DeviceStatus
+ * @brief Allocation-free result of a non-throwing device operation.
+ */
+struct DeviceStatus {
+    DeviceError error; ///< DeviceError::None on success.
+
+    DeviceStatus(DeviceError error = DeviceError::None) : error(error) {}
+    bool ok() const { return error == DeviceError::None; }
+    explicit operator bool() const { return ok(); }
+    const char* message() const { return deviceErrorMessage(error); }
+};
+
+class FlowsheetTape;
+
+/**
+ * @brief Device types a flowsheet snapshot can rebuild; stored in the file, so never renumber.
+ */
+enum class DeviceKind : uint32_t {
+    Custom = 0, ///< Not saveable.
+    Mixer = 1,
+    Reactor = 2,
+    Splitter = 3
+};
+
+/**
+ * @class Device
+ * @brief Represents a device that manipulates chemical streams.
+ */
+class Device
+{
+    friend class Flowsheet;
+
+protected:
+    PortList inputs;  ///< Input streams connected to the device.
+    PortList outputs; ///< Output streams produced by the device.
+    StreamStore* store = nullptr; ///< Store all connected streams live in.
+    int inputAmount;
+    int outputAmount;
+    unsigned* topologyVersion = nullptr; ///< Owning flowsheet's wiring counter, if any.
+
+    /**
+     * @brief Connect a stream to one of the port lists without throwing.
+     * @param ports The input or output port list.
+     * @param limit Number of ports available.
+     * @param s The stream being connected.
+     * @param full Error reported when no port is left.
+     * @return The outcome of the connection.
+     */
+    DeviceStatus connect(PortList& ports, int limit, const Stream& s, DeviceError full)
+    {
+        if ((int)ports.size() >= limit) return full;
+        if (store && store != &s.getStore()) return DeviceError::StoreMismatch;
+        store = &s.getStore();
+        ports.push_back(s.getId());
+        portConnected(&ports == &inputs, ports.size() - 1);
+        topologyChanged();
+        return DeviceError::None;
+    }
+
+    /**
+     * @brief Throw the legacy exception for an error code.
+     *
+     * Derived classes override this to keep their historical exception
+     * types and messages.
+     * @param error The error to report; never DeviceError::None.
+     */
+    [[noreturn]] virtual void raise(DeviceError error) const
+    {
+        if (error == DeviceError::InputLimit) throw "INPUT STREAM LIMIT!";
+        if (error == DeviceError::OutputLimit) throw "OUTPUT STREAM LIMIT!";
+        throw string(deviceErrorMessage(error));
+    }
+
+    /**
+     * @brief Called after a stream was connected, for devices that keep their own copy of the ports.
+     * @param isInput true for an input port, false for an output port.
+     * @param slot Position of the new port in its list.
+     */
+    virtual void portConnected(bool isInput, size_t slot) { (void)isInput; (void)slot; }
+
+    /**
+     * @brief Describe the device for a flowsheet snapshot.
+     * @param parameters Receives the constructor parameters of the kind.
+     * @return The kind the loader rebuilds; DeviceKind::Custom if the device cannot be saved.
+     */
+    virtual DeviceKind describe(vector<double>& parameters) const { (void)parameters; return DeviceKind::Custom; }
+
+    /**
+     * @brief Move the ports to another store after the device's streams were appended to it.
+     * @param target The store now holding the streams.
+     * @param offset Index of the old store's first stream in target.
+     */
+    void rebind(StreamStore& target, StreamId offset)
+    {
+        if (!store) return;
+        store = &target;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            inputs[i] += offset;
+            portConnected(true, i);
+        }
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            outputs[i] += offset;
+            portConnected(false, i);
+        }
+    }
+
+    /**
+     * @brief Tell the owning flowsheet (if any) that its cached schedule is stale.
+     */
+    void topologyChanged() { if (topologyVersion) ++*topologyVersion; }
+public:
+    virtual ~Device()
+    {
+#if DEVICE_PROFILING
+        ProfileRegistry::instance().forget(this);
+#endif
+    }
+
+    /**
+     * @brief Add an input stream to the device.
+     *
+     * Devices only record the stream's id, so a plain reference is enough and
+     * no reference count is touched.
+     * @param s The input stream; it must outlive its use by the device's owner.
+     */
+    void addInput(const Stream& s){
+        DeviceStatus status = tryAddInput(s);
+        if (!status) raise(status.error);
+    }
+    /**
+     * @brief Add an input stream to the device.
+     * @param s A shared pointer to the input stream, passed without copying.
+     */
+    void addInput(const shared_ptr<Stream>& s){ addInput(*s); }
+    /**
+     * @brief Add an input stream handed over by a legacy caller.
+     * @param s A shared pointer to the input stream; it is not retained.
+     */
+    void addInput(shared_ptr<Stream>&& s){ addInput(*s); }
+    /**
+     * @brief Add an output stream to the device.
+     * @param s The output stream; it must outlive its use by the device's owner.
+     */
+    void addOutput(const Stream& s){
+        DeviceStatus status = tryAddOutput(s);
+        if (!status) raise(status.error);
+    }
+    /**
+     * @brief Add an output stream to the device.
+     * @param s A shared pointer to the output stream, passed without copying.
+     */
+    void addOutput(const shared_ptr<Stream>& s){ addOutput(*s); }
+    /**
+     * @brief Add an output stream handed over by a legacy caller.
+     * @param s A shared pointer to the output stream; it is not retained.
+     */
+    void addOutput(shared_ptr<Stream>&& s){ addOutput(*s); }
+
+    /**
+     * @brief Add an input stream without throwing.
+     * @param s The input stream.
+     * @return DeviceError::InputLimit or DeviceError::StoreMismatch on failure.
+     */
+    DeviceStatus tryAddInput(const Stream& s) { return connect(inputs, inputAmount, s, DeviceError::InputLimit); }
+
+    /**
+     * @brief Add an output stream without throwing.
+     * @param s The output stream.
+     * @return DeviceError::OutputLimit or DeviceError::StoreMismatch on failure.
+     */
+    DeviceStatus tryAddOutput(const Stream& s) { return connect(outputs, outputAmount, s, DeviceError::OutputLimit); }
+
+    /**
+     * @brief Check that the device is wired well enough to be updated.
+     * @return The first wiring problem found, if any.
+     */
+    virtual DeviceStatus validate() const { return DeviceError::None; }
+
+    /**
+     * @brief Update the outputs, reporting wiring problems instead of throwing.
+     * @return The validation result; outputs are untouched on failure.
+     */
+    DeviceStatus tryUpdateOutputs()
+    {
+        DeviceStatus status = validate();
+        if (status) evaluate();
+        return status;
+    }
+
+    /**
+     * @brief Run updateOutputs(), counted in the device profile when DEVICE_PROFILING is on.
+     */
+    void evaluate() { profiledCall(this, ProfilePhase::Update, [this]() { updateOutputs(); }); }
+
+    /**
+     * @brief Get the name of the device type, used in profile dumps.
+     * @return Static text.
+     */
+    virtual const char* typeName() const { return "Device"; }
+
+    /**
+     * @brief Get the input streams connected to the device.
+     * @return The input streams in connection order.
+     */
+    const PortList& getInputs() const { return inputs; }
+
+    /**
+     * @brief Get the output streams produced by the device.
+     * @return The output streams in connection order.
+     */
+    const PortList& getOutputs() const { return outputs; }
+
+    /**
+     * @brief Get the store the connected streams live in.
+     * @return The store, or nullptr while nothing is connected.
+     */
+    StreamStore* getStore() const { return store; }
+
+    /**
+     * @brief Update the output streams of the device (to be implemented by derived classes).
+     */
+    virtual void updateOutputs() = 0;
+
+    /**
+     * @brief Append the device's update to a flowsheet tape.
+     *
+     * The default records a Call of updateOutputs(); devices that are linear
+     * maps of their inputs emit Sum, Split or Copy instead.
+     * @param tape The tape being compiled; wiring has already been validated.
+     */
+    virtual void compile(FlowsheetTape& tape);
+
+    /**
+     * @brief Apply the device's linear map to one block of per-stream rows.
+     *
+     * Used for scenario lanes, component vectors and tangent directions alike;
+     * wiring has already been validated by the caller.
+     * @param rows The block to update.
+     * @throws std::string unless the derived class provides a row kernel
+     */
+    virtual void updateRows(const StreamRows& rows) {
+        (void)rows;
+        throw string("Device does not support batch evaluation");
+    }
+
+    /**
+     * @brief Update every scenario lane of the output streams at once.
+     * @throws std::string on incomplete wiring or if the device has no row kernel
+     */
+    void updateOutputsBatch() {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+        StreamRows rows = store->laneRows();
+        profiledCall(this, ProfilePhase::Batch, [&]() { updateRows(rows); });
+    }
+
+    /**
+     * @brief Update every component flow of the output streams at once.
+     * @throws std::string on incomplete wiring or if the device has no row kernel
+     */
+    void updateComponents() {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+        StreamRows rows = store->componentRows();
+        profiledCall(this, ProfilePhase::Components, [&]() { updateRows(rows); });
+    }
+
+    /**
+     * @brief Propagate every tangent direction of the input streams to the outputs.
+     *
+     * Row kernels are linear in their inputs, so the kernel that maps flows also
+     * maps their derivatives.
+     * @throws std::string on incomplete wiring or if the device has no row kernel
+     */
+    void updateTangents() {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+        StreamRows rows = store->tangentRows();
+        profiledCall(this, ProfilePhase::Tangents, [&]() { updateRows(rows); });
+    }
+};
+
+/**
+ * @brief Write one profile entry as a line of the profile dump.
+ * @param out Destination stream.
+ * @param label Identifies the device.
+ * @param profile The counters.
+ */
+inline void writeProfileLine(ostream& out, const string& label, const DeviceProfile& profile)
+{
+    out << label << ' ' << profilePhaseName(profile.phase)
+        << " calls=" << profile.calls
+        << " total_ns=" << profile.totalNs
+        << " max_ns=" << profile.maxNs
+        << " exceptions=" << profile.exceptions << '\n';
+}
+
+/**
+ * @brief Dump every recorded profile, most expensive first.
+ * @param out Destination stream.
+ */
+inline void dumpDeviceProfiles(ostream& out)
+{
+    vector<DeviceProfile> profiles = deviceProfiles();
+    sort(profiles.begin(), profiles.end(),
+         [](const DeviceProfile& a, const DeviceProfile& b) { return a.totalNs > b.totalNs; });
+    for (const DeviceProfile& profile : profiles) {
+        ostringstream label;
+        label << profile.typeName << '@' << (const void*)profile.device;
+        writeProfileLine(out, label.str(), profile);
+    }
+}
+
+/**
+ * @brief Opcodes of a compiled flowsheet tape.
+ */
+enum class TapeOp : uint8_t {
+    Sum,   ///< values[stream] = bias + sum of coefficient * values[operand].
+    Split, ///< values[operand] = coefficient * values[stream] for every operand.
+    Copy,  ///< values[stream] = values[first operand].
+    Call   ///< device->updateOutputs(), for devices without a linear form.
+};
+
+/**
+ * @struct TapeOperand
+ * @brief Stream slot read or written by an instruction, with its weight.
+ */
+struct TapeOperand {
+    StreamId stream;    ///< Slot in the store's mass flow array.
+    double coefficient; ///< Weight of the slot; unused by Copy.
+};
+
+/**
+ * @struct TapeInstruction
+ * @brief One step of a compiled tape; operands live in the tape's shared pool.
+ */
+struct TapeInstruction {
+    TapeOp op;
+    StreamId stream;          ///< Destination of Sum and Copy, source of Split.
+    uint32_t first;           ///< Offset of the first operand.
+    uint32_t count;           ///< Number of operands.
+    double bias;              ///< Constant term of Sum.
+    Device* device;           ///< Callee of Call, nullptr otherwise.
+};
+
+/**
+ * @class FlowsheetTape
+ * @brief A flowsheet flattened into straight-line instructions over stream slots.
+ *
+ * Built once per topology by Flowsheet::getTape(); run() then evaluates the
+ * whole flowsheet with no virtual calls except for Call fallbacks.
+ */
+class FlowsheetTape
+{
+private:
+    vector<TapeInstruction> code;  ///< Instructions in schedule order.
+    vector<TapeOperand> operands;  ///< Operand pool indexed by TapeInstruction::first.
+
+    TapeInstruction& emit(TapeOp op, StreamId stream)
+    {
+        code.push_back(TapeInstruction{op, stream, (uint32_t)operands.size(), 0, 0.0, nullptr});
+        return code.back();
+    }
+
+    /**
+     * @brief Execute the tape over mass flows stored as Value; arithmetic is done in double.
+     */
+    template <class Value>
+    void execute(Value* values) const
+    {
+        const TapeOperand* pool = operands.data();
+        for (const TapeInstruction& in : code) {
+            const TapeOperand* o = pool + in.first;
+            switch (in.op) {
+            case TapeOp::Sum: {
+                double sum = in.bias;
+                for (uint32_t i = 0; i < in.count; ++i) sum += o[i].coefficient * values[o[i].stream];
+                values[in.stream] = (Value)sum;
+                break;
+            }
+            case TapeOp::Split: {
+                double source = values[in.stream];
+                for (uint32_t i = 0; i < in.count; ++i) values[o[i].stream] = (Value)(o[i].coefficient * source);
+                break;
+            }
+            case TapeOp::Copy:
+                values[in.stream] = values[o[0].stream];
+                break;
+            case TapeOp::Call:
+                if (!is_same<Value, double>::value) throw "Compact tapes cannot call device: "s + in.device->typeName();
+                in.device->evaluate();
+                break;
+            }
+        }
+    }
+
+    void operand(StreamId stream, double coefficient)
+    {
+        operands.push_back(TapeOperand{stream, coefficient});
+        ++code.back().count;
+    }
+
+public:
+    /**
+     * @brief Append destination = coefficient * (sum of sources).
+     * @param destination The stream written.
+     * @param sources The streams summed.
+     * @param count Number of sources.
+     * @param coefficient Weight applied to every source.
+     */
+    void emitSum(StreamId destination, const StreamId* sources, size_t count, double coefficient)
+    {
+        emit(TapeOp::Sum, destination);
+        for (size_t i = 0; i < count; ++i) operand(sources[i], coefficient);
+    }
+
+    /**
+     * @brief Append destination = bias + sum of weighted terms.
+     * @param destination The stream written.
+     * @param terms The streams summed, each with its own weight.
+     * @param count Number of terms.
+     * @param bias Constant added to the sum.
+     */
+    void emitSum(StreamId destination, const TapeOperand* terms, size_t count, double bias)
+    {
+        emit(TapeOp::Sum, destination).bias = bias;
+        for (size_t i = 0; i < count; ++i) operand(terms[i].stream, terms[i].coefficient);
+    }
+
+    /**
+     * @brief Append destinations[i] = factor * source.
+     * @param source The stream read.
+     * @param destinations The streams written.
+     * @param count Number of destinations.
+     * @param factor Share of the source each destination gets.
+     */
+    void emitSplit(StreamId source, const StreamId* destinations, size_t count, double factor)
+    {
+        emit(TapeOp::Split, source);
+        for (size_t i = 0; i < count; ++i) operand(destinations[i], factor);
+    }
+
+    /**
+     * @brief Append destinations[i] = factors[i] * source.
+     * @param source The stream read.
+     * @param destinations The streams written.
+     * @param factors Share of the source each destination gets.
+     * @param count Number of destinations.
+     */
+    void emitSplit(StreamId source, const StreamId* destinations, const double* factors, size_t count)
+    {
+        emit(TapeOp::Split, source);
+        for (size_t i = 0; i < count; ++i) operand(destinations[i], factors[i]);
+    }
+
+    /**
+     * @brief Append destination = source.
+     */
+    void emitCopy(StreamId destination, StreamId source)
+    {
+        emit(TapeOp::Copy, destination);
+        operand(source, 1.0);
+    }
+
+    /**
+     * @brief Append a call of the device's own updateOutputs().
+     * @param device The device; must outlive the tape.
+     */
+    void emitCall(Device* device) { emit(TapeOp::Call, 0).device = device; }
+
+    /**
+     * @brief Remove every instruction.
+     */
+    void clear()
+    {
+        code.clear();
+        operands.clear();
+    }
+
+    /**
+     * @brief Execute the tape.
+     * @param values Mass flow array of the store the tape was compiled for.
+     */
+    void run(double* values) const { execute(values); }
+
+    /**
+     * @brief Execute the tape over single-precision mass flows.
+     *
+     * Sums accumulate in double and every result is rounded to float once,
+     * which keeps flows below about 1e5 within POSSIBLE_ERROR.
+     * @param values One float per stream of the store the tape was compiled for.
+     * @throws std::string on a Call instruction, since devices work on the double store
+     */
+    void run(float* values) const { execute(values); }
+
+    const vector<TapeInstruction>& instructions() const { return code; }
+    const vector<TapeOperand>& operandPool() const { return operands; }
+
+    /**
+     * @brief Change the weight of one operand, e.g. a split fraction.
+     * @param operand Index in operandPool().
+     * @param coefficient The new weight.
+     */
+    void setCoefficient(uint32_t operand, double coefficient) { operands[operand].coefficient = coefficient; }
+    size_t size() const { return code.size(); }
+    size_t footprint() const { return heapBytes(code) + heapBytes(operands); }
+};
+
+inline void Device::compile(FlowsheetTape& tape) { tape.emitCall(this); }
+
+class Mixer: public Device
+{
+protected:
+    [[noreturn]] void raise(DeviceError error) const override {
+        if (error == DeviceError::InputLimit) throw "Too much inputs"s;
+        if (error == DeviceError::OutputLimit) throw "Too much outputs"s;
+        if (error == DeviceError::OutputsNotSet) throw "Should set outputs before update"s;
+        Device::raise(error);
+    }
+public:
+    const char* typeName() const override { return "Mixer"; }
+    Mixer(int inputs_count, int outputs_count = MIXER_OUTPUTS): Device() {
+        inputAmount = inputs_count;
+        outputAmount = outputs_count;
+    }
+    DeviceStatus validate() const override {
+        if (outputs.empty()) return DeviceError::OutputsNotSet;
+        return DeviceError::None;
+    }
+    void updateOutputs() override {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+
+        const double* flows = store->massFlows();
+        double sum_mass_flow = 0;
+        for (StreamId input_stream : inputs) {
+            sum_mass_flow += flows[input_stream];
+        }
+
+        double output_mass = sum_mass_flow / outputs.size();
+
+        for (StreamId output_stream : outputs) {
+            store->setMassFlow(output_stream, output_mass);
+        }
+    }
+    void compile(FlowsheetTape& tape) override {
+        for (StreamId output_stream : outputs) {
+            tape.emitSum(output_stream, inputs.data(), inputs.size(), 1.0 / outputs.size());
+        }
+    }
+    DeviceKind describe(vector<double>& parameters) const override {
+        (void)parameters;
+        return DeviceKind::Mixer;
+    }
+    void updateRows(const StreamRows& rows) override {
+        size_t n = rows.width;
+        double* sum = rows.row(outputs[0]);
+        fill(sum, sum + n, 0.0);
+        for (StreamId input_stream : inputs) {
+            lanesAdd(sum, rows.row(input_stream), n);
+        }
+
+        lanesScale(sum, sum, 1.0 / outputs.size(), n);
+        for (size_t i = 1; i < outputs.size(); ++i) {
+            lanesScale(rows.row(outputs[i]), sum, 1.0, n);
+        }
+    }
+};
+
+void shouldSetOutputsCorrectlyWithOneOutput() {
+    streamcounter=0;
+    Mixer d1 = Mixer(2);
+
+    shared_ptr<Stream> s1(new Stream(++streamcounter));
+    shared_ptr<Stream> s2(new Stream(++streamcounter));
+    shared_ptr<Stream> s3(new Stream(++streamcounter));
+    s1->setMassFlow(10.0);
+    s2->setMassFlow(5.0);
+
+    d1.addInput(s1);
+    d1.addInput(s2);
+    d1.addOutput(s3);
+
+    d1.updateOutputs();
+
+    if (abs(s3->getMassFlow()) - 15 < POSSIBLE_ERROR) {
+        cout << "Test 1 passed"s << endl;
+    } else {
+        cout << "Test 1 failed"s << endl;
+    }
+}
+
+void shouldCorrectOutputs() {
+    streamcounter=0;
+    Mixer d1 = Mixer(2);
+
+    shared_ptr<Stream> s1(new Stream(++streamcounter));
+    shared_ptr<Stream> s2(new Stream(++streamcounter));
+    shared_ptr<Stream> s3(new Stream(++streamcounter));
+    shared_ptr<Stream> s4(new Stream(++streamcounter));
+    s1->setMassFlow(10.0);
+    s2->setMassFlow(5.0);
+
+    d1.addInput(s1);
+    d1.addInput(s2);
+    d1.addOutput(s3);
+
+    try {
+        d1.addOutput(s4);
+    } catch (const string ex) {
+        if (ex == "Too much outputs"s) {
+            cout << "Test 2 passed"s << endl;
+            return;
+        }
+    }
+
+    cout << "Test 2 failed"s << endl;
+}
+
+void shouldCorrectInputs() {
+    streamcounter=0;
+    Mixer d1 = Mixer(2);
+
+    shared_ptr<Stream> s1(new Stream(++streamcounter));
+    shared_ptr<Stream> s2(new Stream(++streamcounter));
+    shared_ptr<Stream> s3(new Stream(++streamcounter));
+    shared_ptr<Stream> s4(new Stream(++streamcounter));
+    s1->setMassFlow(10.0);
+    s2->setMassFlow(5.0);
+
+    d1.addInput(s1);
+    d1.addInput(s2);
+    d1.addOutput(s3);
+
+    try {
+        d1.addInput(s4);
+    } catch (const string ex) {
+        if (ex == "Too much inputs"s) {
+            cout << "Test 3 passed"s << endl;
+            return;
+        }
+    }
+
+    cout << "Test 3 failed"s << endl;
+}
+
+/**
+ * @class Reactor
+ * @brief Chemical reactor with 1 input and 1 or 2 outputs
+ *
+ * Reactor can operate in two modes:
+ * - Single output mode: 1 input → 1 output
+ * - Double output mode: 1 input → 2 outputs (mass split equally)
+ */
+class Reactor : public Device
+{
+private:
+    bool isDoubleOutput; ///< Flag for double output mode
+
+protected:
+    [[noreturn]] void raise(DeviceError error) const override
+    {
+        if (error == DeviceError::InputNotConnected) throw "Input stream not connected to reactor"s;
+        if (error == DeviceError::OutputsNotSet) throw "Output streams not properly set for reactor"s;
+        Device::raise(error);
+    }
+
+public:
+    /**
+     * @brief Constructor for Reactor device
+     * @param isDoubleReactor true - 2 outputs, false - 1 output
+     */
+    Reactor(bool isDoubleReactor) : Device()
+    {
+        isDoubleOutput = isDoubleReactor;
+        inputAmount = 1;  // Always 1 input
+        outputAmount = isDoubleReactor ? 2 : 1;  // 1 or 2 outputs
+    }
+
+    /**
+     * @brief Checks that the input and every output stream are connected
+     * @return DeviceError::InputNotConnected or DeviceError::OutputsNotSet on failure
+     */
+    DeviceStatus validate() const override
+    {
+        // Check if input is connected
+        if (inputs.empty()) return DeviceError::InputNotConnected;
+        // Check if outputs are set
+        if ((int)outputs.size() != outputAmount) return DeviceError::OutputsNotSet;
+        return DeviceError::None;
+    }
+
+    /**
+     * @brief Updates output streams based on input stream and reactor configuration
+     *
+     * In single output mode: output mass flow = input mass flow
+     * In double output mode: each output gets half of input mass flow
+     *
+     * @throws std::string if outputs are not set before update
+     */
+    void updateOutputs() override
+    {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+
+        double inputMass = store->getMassFlow(inputs[0]);
+
+        if (isDoubleOutput) {
+            // Split mass equally between two outputs
+            double outputMass = inputMass / 2.0;
+            store->setMassFlow(outputs[0], outputMass);
+            store->setMassFlow(outputs[1], outputMass);
+            DEVICE_TRACE(TraceLevel::Debug, "Reactor: split mass %g into two outputs of %g", inputMass, outputMass);
+        } else {
+            // Single output - same mass flow as input
+            store->setMassFlow(outputs[0], inputMass);
+            DEVICE_TRACE(TraceLevel::Debug, "Reactor: transferred mass %g to single output", inputMass);
+        }
+    }
+
+    /**
+     * @brief Splits every lane or component of the input row in one vectorized pass
+     */
+    void updateRows(const StreamRows& rows) override
+    {
+        const double* inputRow = rows.row(inputs[0]);
+        double factor = isDoubleOutput ? 0.5 : 1.0;
+        for (StreamId output : outputs) {
+            lanesScale(rows.row(output), inputRow, factor, rows.width);
+        }
+    }
+
+    /**
+     * @brief Records the split so the mode is resolved once at compile time
+     */
+    void compile(FlowsheetTape& tape) override
+    {
+        if (isDoubleOutput) tape.emitSplit(inputs[0], outputs.data(), outputs.size(), 0.5);
+        else tape.emitCopy(outputs[0], inputs[0]);
+    }
+
+    const char* typeName() const override { return "Reactor"; }
+
+    DeviceKind describe(vector<double>& parameters) const override
+    {
+        parameters.push_back(isDoubleOutput ? 1.0 : 0.0);
+        return DeviceKind::Reactor;
+    }
+
+    /**
+     * @brief Gets the reactor operation mode
+     * @return true if reactor is in double output mode, false if single output
+     */
+    bool getIsDoubleOutput() const { return isDoubleOutput; }
+};
+
+/**
+ * @test Test reactor in single output mode
+ */
+void testReactorSingleOutput() {
+    cout << "=== Test 1: Reactor with single output ===" << endl;
+    streamcounter = 0;
+    Reactor reactor(false); // Single output mode
+
+    shared_ptr<Stream> input(new Stream(++streamcounter));
+    shared_ptr<Stream> output(new Stream(++streamcounter));
+
+    input->setMassFlow(20.0);
+
+    reactor.addInput(input);
+    reactor.addOutput(output);
+    reactor.updateOutputs();
+
+    if (abs(output->getMassFlow() - 20.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Single output mode works correctly" << endl;
+    } else {
+        cout << "FAIL: Incorrect output mass" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test reactor in double output mode
+ */
+void testReactorDoubleOutput() {
+    cout << "=== Test 2: Reactor with double output ===" << endl;
+    streamcounter = 0;
+    Reactor reactor(true); // Double output mode
+
+    shared_ptr<Stream> input(new Stream(++streamcounter));
+    shared_ptr<Stream> output1(new Stream(++streamcounter));
+    shared_ptr<Stream> output2(new Stream(++streamcounter));
+
+    input->setMassFlow(30.0);
+
+    reactor.addInput(input);
+    reactor.addOutput(output1);
+    reactor.addOutput(output2);
+    reactor.updateOutputs();
+
+    double totalOutput = output1->getMassFlow() + output2->getMassFlow();
+    if (abs(totalOutput - 30.0) < POSSIBLE_ERROR &&
+        abs(output1->getMassFlow() - 15.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Double output mode works correctly" << endl;
+    } else {
+        cout << "FAIL: Incorrect mass distribution" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test reactor input limit
+ */
+void testReactorInputLimit() {
+    cout << "=== Test 3: Reactor input limit ===" << endl;
+    streamcounter = 0;
+    Reactor reactor(false);
+
+    shared_ptr<Stream> input1(new Stream(++streamcounter));
+    shared_ptr<Stream> input2(new Stream(++streamcounter));
+    shared_ptr<Stream> output(new Stream(++streamcounter));
+
+    reactor.addInput(input1);
+    try {
+        reactor.addInput(input2);
+        cout << "FAIL: Should not allow more than 1 input" << endl;
+    } catch (const char* ex) {
+        if (string(ex) == "INPUT STREAM LIMIT!") {
+            cout << "PASS: Input limit enforced correctly" << endl;
+        } else {
+            cout << "FAIL: Wrong exception message" << endl;
+        }
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test reactor output limit in single mode
+ */
+void testReactorOutputLimitSingle() {
+    cout << "=== Test 4: Reactor output limit (single mode) ===" << endl;
+    streamcounter = 0;
+    Reactor reactor(false);
 
     shared_ptr<Stream> input(new Stream(++streamcounter));
     shared_ptr<Stream> output1(new Stream(++streamcounter));
     shared_ptr<Stream> output2(new Stream(++streamcounter));
 
-    input->setMassFlow(30.0);
+    reactor.addInput(input);
+    reactor.addOutput(output1);
+    try {
+        reactor.addOutput(output2);
+        cout << "FAIL: Should not allow more than 1 output in single mode" << endl;
+    } catch (const char* ex) {
+        if (string(ex) == "OUTPUT STREAM LIMIT!") {
+            cout << "PASS: Output limit enforced correctly" << endl;
+        } else {
+            cout << "FAIL: Wrong exception message" << endl;
+        }
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test getIsDoubleOutput method (unit test for class function)
+ */
+void testReactorGetIsDoubleOutput() {
+    cout << "=== Test 5: getIsDoubleOutput method ===" << endl;
+
+    Reactor singleReactor(false);
+    Reactor doubleReactor(true);
+
+    if (!singleReactor.getIsDoubleOutput() && doubleReactor.getIsDoubleOutput()) {
+        cout << "PASS: getIsDoubleOutput method works correctly" << endl;
+    } else {
+        cout << "FAIL: getIsDoubleOutput method returns wrong values" << endl;
+    }
+}
+
+/**
+ * @test Test exception when no input stream
+ */
+void testReactorNoInputException() {
+    cout << "=== Test 6: Exception when no input ===" << endl;
+    streamcounter = 0;
+    Reactor reactor(false);
+
+    shared_ptr<Stream> output(new Stream(++streamcounter));
+    reactor.addOutput(output);
+
+    try {
+        reactor.updateOutputs();
+        cout << "FAIL: Should throw exception when no input" << endl;
+    } catch (const string& ex) {
+        if (ex == "Input stream not connected to reactor") {
+            cout << "PASS: Exception when no input works correctly" << endl;
+        } else {
+            cout << "FAIL: Wrong exception message" << endl;
+        }
+    }
+}
+
+/**
+ * @test Test exception when wrong output count
+ */
+void testReactorWrongOutputCount() {
+    cout << "=== Test 7: Exception when wrong output count ===" << endl;
+    streamcounter = 0;
+    Reactor reactor(true); // Double output mode
+
+    shared_ptr<Stream> input(new Stream(++streamcounter));
+    shared_ptr<Stream> output1(new Stream(++streamcounter));
+    // Don't add second output!
+
+    reactor.addInput(input);
+    reactor.addOutput(output1);
+
+    try {
+        reactor.updateOutputs();
+        cout << "FAIL: Should throw exception when wrong output count" << endl;
+    } catch (const string& ex) {
+        if (ex == "Output streams not properly set for reactor") {
+            cout << "PASS: Exception when wrong outputs works correctly" << endl;
+        } else {
+            cout << "FAIL: Wrong exception message" << endl;
+        }
+    }
+}
+
+/**
+ * @class Splitter
+ * @brief Divides one input between any number of outputs by fixed fractions.
+ *
+ * Generalizes Reactor: Splitter({1.0}) passes the input through and
+ * Splitter({0.5, 0.5}) behaves like a double-output reactor.
+ */
+class Splitter : public Device
+{
+private:
+    SmallVector<double, 4> fractions; ///< Share of the input each output gets, in connection order.
+
+    void setFractions(const double* begin, const double* end)
+    {
+        double total = 0.0;
+        for (const double* fraction = begin; fraction != end; ++fraction) {
+            if (*fraction < 0.0) throw "Split fractions must not be negative"s;
+            total += *fraction;
+            fractions.push_back(*fraction);
+        }
+        if (fractions.empty() || fabs(total - 1.0) > 1e-9) throw "Split fractions must sum to 1"s;
+        inputAmount = 1;
+        outputAmount = (int)fractions.size();
+        outputs.reserve(fractions.size());
+    }
+
+public:
+    /**
+     * @brief Constructor for Splitter device
+     * @param splitFractions One share per output; non-negative and summing to 1
+     * @throws std::string if the fractions are empty, negative or do not sum to 1
+     */
+    explicit Splitter(const vector<double>& splitFractions) : Device()
+    {
+        setFractions(splitFractions.data(), splitFractions.data() + splitFractions.size());
+    }
+
+    /**
+     * @brief Constructor for Splitter device that allocates nothing for up to four outputs
+     * @param splitFractions One share per output; non-negative and summing to 1
+     * @throws std::string if the fractions are empty, negative or do not sum to 1
+     */
+    explicit Splitter(initializer_list<double> splitFractions) : Device()
+    {
+        setFractions(splitFractions.begin(), splitFractions.end());
+    }
+
+    const char* typeName() const override { return "Splitter"; }
+
+    /**
+     * @brief Checks that the input and every output stream are connected
+     * @return DeviceError::InputNotConnected or DeviceError::OutputsNotSet on failure
+     */
+    DeviceStatus validate() const override
+    {
+        if (inputs.empty()) return DeviceError::InputNotConnected;
+        if ((int)outputs.size() != outputAmount) return DeviceError::OutputsNotSet;
+        return DeviceError::None;
+    }
+
+    void updateOutputs() override
+    {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+
+        double inputMass = store->getMassFlow(inputs[0]);
+        for (size_t i = 0; i < outputs.size(); ++i) store->setMassFlow(outputs[i], fractions[i] * inputMass);
+    }
+
+    void updateRows(const StreamRows& rows) override
+    {
+        const double* inputRow = rows.row(inputs[0]);
+        for (size_t i = 0; i < outputs.size(); ++i) lanesScale(rows.row(outputs[i]), inputRow, fractions[i], rows.width);
+    }
+
+    void compile(FlowsheetTape& tape) override
+    {
+        tape.emitSplit(inputs[0], outputs.data(), fractions.data(), outputs.size());
+    }
+
+    DeviceKind describe(vector<double>& parameters) const override
+    {
+        parameters.insert(parameters.end(), fractions.begin(), fractions.end());
+        return DeviceKind::Splitter;
+    }
+
+    /**
+     * @brief Gets the share of the input sent to one output
+     * @param output Output index in connection order
+     * @return The split fraction
+     */
+    double getFraction(size_t output) const { return fractions[output]; }
+};
+
+/**
+ * @brief Compile-time unrolled loop: calls body(0) ... body(N - 1) in order.
+ */
+template <size_t N>
+struct Unrolled {
+    template <class Body>
+    static void each(const Body& body) { Unrolled<N - 1>::each(body); body(N - 1); }
+};
+
+template <>
+struct Unrolled<0> {
+    template <class Body>
+    static void each(const Body&) {}
+};
+
+/**
+ * @class StaticMixer
+ * @brief Mixer with a fixed number of inputs, for plant models whose topology never changes.
+ *
+ * The port ids are mirrored into inline arrays so the kernels touch only the
+ * device and the store, and the sums are unrolled for exactly Inputs terms.
+ * All Inputs ports must be connected before an update.
+ * @tparam Inputs Number of input streams.
+ */
+template <size_t Inputs>
+class StaticMixer : public Device
+{
+    static_assert(Inputs >= 1, "StaticMixer needs at least one input");
+
+private:
+    array<StreamId, Inputs> inputPorts; ///< Inline copy of the input ids.
+    StreamId outputPort = 0;            ///< Inline copy of the output id.
+
+protected:
+    void portConnected(bool isInput, size_t slot) override
+    {
+        if (isInput) inputPorts[slot] = inputs[slot];
+        else outputPort = outputs[slot];
+    }
+
+public:
+    const char* typeName() const override { return "StaticMixer"; }
+
+    StaticMixer() : Device()
+    {
+        inputAmount = (int)Inputs;
+        outputAmount = MIXER_OUTPUTS;
+        inputs.reserve(Inputs);
+        outputs.reserve(MIXER_OUTPUTS);
+    }
+
+    /**
+     * @brief Checks that every input and the output are connected
+     * @return DeviceError::InputNotConnected or DeviceError::OutputsNotSet on failure
+     */
+    DeviceStatus validate() const override
+    {
+        if (inputs.size() != Inputs) return DeviceError::InputNotConnected;
+        if (outputs.empty()) return DeviceError::OutputsNotSet;
+        return DeviceError::None;
+    }
+
+    void updateOutputs() override
+    {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+
+        const double* flows = store->massFlows();
+        const array<StreamId, Inputs>& ports = inputPorts;
+        double sum = 0;
+        Unrolled<Inputs>::each([&](size_t i) { sum += flows[ports[i]]; });
+        store->setMassFlow(outputPort, sum);
+    }
+
+    void updateRows(const StreamRows& rows) override
+    {
+        size_t n = rows.width;
+        double* sum = rows.row(outputPort);
+        const array<StreamId, Inputs>& ports = inputPorts;
+        lanesScale(sum, rows.row(ports[0]), 1.0, n);
+        Unrolled<Inputs - 1>::each([&](size_t i) { lanesAdd(sum, rows.row(ports[i + 1]), n); });
+    }
+
+    void compile(FlowsheetTape& tape) override
+    {
+        tape.emitSum(outputPort, inputPorts.data(), Inputs, 1.0);
+    }
+};
+
+/**
+ * @class StaticReactor
+ * @brief Reactor with a fixed number of outputs that split the input mass equally.
+ *
+ * The split factor is a compile-time constant, so updates carry no mode
+ * branch; StaticReactor<1> and StaticReactor<2> match Reactor(false) and
+ * Reactor(true).
+ * @tparam Outputs Number of output streams.
+ */
+template <size_t Outputs>
+class StaticReactor : public Device
+{
+    static_assert(Outputs >= 1, "StaticReactor needs at least one output");
+
+private:
+    StreamId inputPort = 0;               ///< Inline copy of the input id.
+    array<StreamId, Outputs> outputPorts; ///< Inline copy of the output ids.
+
+protected:
+    void portConnected(bool isInput, size_t slot) override
+    {
+        if (isInput) inputPort = inputs[slot];
+        else outputPorts[slot] = outputs[slot];
+    }
+
+public:
+    const char* typeName() const override { return "StaticReactor"; }
+
+    StaticReactor() : Device()
+    {
+        inputAmount = 1;
+        outputAmount = (int)Outputs;
+        inputs.reserve(1);
+        outputs.reserve(Outputs);
+    }
+
+    /**
+     * @brief Checks that the input and every output stream are connected
+     * @return DeviceError::InputNotConnected or DeviceError::OutputsNotSet on failure
+     */
+    DeviceStatus validate() const override
+    {
+        if (inputs.empty()) return DeviceError::InputNotConnected;
+        if (outputs.size() != Outputs) return DeviceError::OutputsNotSet;
+        return DeviceError::None;
+    }
+
+    void updateOutputs() override
+    {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+
+        double outputMass = store->getMassFlow(inputPort) * (1.0 / Outputs);
+        StreamStore& target = *store;
+        const array<StreamId, Outputs>& ports = outputPorts;
+        Unrolled<Outputs>::each([&](size_t i) { target.setMassFlow(ports[i], outputMass); });
+    }
+
+    void updateRows(const StreamRows& rows) override
+    {
+        const double* inputRow = rows.row(inputPort);
+        const array<StreamId, Outputs>& ports = outputPorts;
+        Unrolled<Outputs>::each([&](size_t i) {
+            lanesScale(rows.row(ports[i]), inputRow, 1.0 / Outputs, rows.width);
+        });
+    }
+
+    void compile(FlowsheetTape& tape) override
+    {
+        if (Outputs == 1) tape.emitCopy(outputPorts[0], inputPort);
+        else tape.emitSplit(inputPort, outputPorts.data(), Outputs, 1.0 / Outputs);
+    }
+};
+
+/**
+ * @brief How Flowsheet::converge() picks the next tear stream guess.
+ */
+enum class RecycleMethod {
+    Substitution, ///< Plain successive substitution: next guess = computed value.
+    Wegstein      ///< Secant extrapolation per tear stream, bounded by qMin/qMax.
+};
+
+/**
+ * @struct RecycleOptions
+ * @brief Convergence settings for recycle loops.
+ */
+struct RecycleOptions {
+    double tolerance = POSSIBLE_ERROR; ///< Largest accepted |computed - guessed| on any tear stream.
+    size_t maxIterations = 100;        ///< Passes before giving up.
+    RecycleMethod method = RecycleMethod::Wegstein;
+    double qMin = -5.0;                ///< Lower bound of the Wegstein factor (acceleration).
+    double qMax = 0.0;                 ///< Upper bound of the Wegstein factor (no damping).
+};
+
+/**
+ * @struct RecycleResult
+ * @brief Outcome of Flowsheet::converge().
+ */
+struct RecycleResult {
+    bool converged;    ///< The tolerance was reached.
+    size_t iterations; ///< Passes run.
+    double residual;   ///< Largest tear stream mismatch of the last pass.
+};
+
+/**
+ * @brief Next guess of one tear stream.
+ * @param options Acceleration method and Wegstein bounds.
+ * @param iteration Passes run so far, the one that computed g included.
+ * @param x Guess of the last pass.
+ * @param g Value the last pass computed.
+ * @param lastX Guess of the pass before.
+ * @param lastG Value the pass before computed.
+ * @return g, or the Wegstein extrapolation along the secant of the last two passes.
+ */
+inline double nextTearGuess(const RecycleOptions& options, size_t iteration, double x, double g, double lastX, double lastG)
+{
+    double dx = x - lastX;
+    if (options.method != RecycleMethod::Wegstein || iteration <= 1 || dx == 0.0) return g;
+    double slope = (g - lastG) / dx;
+    double q = slope == 1.0 ? options.qMin : slope / (slope - 1.0);
+    q = min(max(q, options.qMin), options.qMax);
+    return q * x + (1.0 - q) * g;
+}
+
+/**
+ * @struct PartitionPlan
+ * @brief Devices of a flowsheet grouped into sub-flowsheets, see Flowsheet::partition().
+ */
+struct PartitionPlan {
+    vector<vector<size_t>> partitions; ///< Insertion indices of each partition's devices, in schedule order.
+    vector<StreamId> cutStreams;       ///< Streams read in a partition other than their producer's, ascending.
+};
+
+/**
+ * @struct WiringIssue
+ * @brief A device of a flowsheet that failed validation.
+ */
+struct WiringIssue {
+    size_t device;     ///< Index of the device in insertion order.
+    DeviceError error; ///< What is wrong with its wiring.
+};
+
+/**
+ * @class SparseLU
+ * @brief LU factorization without pivoting of a sparse matrix with a dominant diagonal.
+ *
+ * Rows are eliminated in order through a sparse accumulator, so for a
+ * flowsheet matrix in schedule order the only fill-in comes from the
+ * entries above the diagonal, one per recycle stream.
+ */
+class SparseLU
+{
+public:
+    /**
+     * @struct Entry
+     * @brief One nonzero of a row; duplicates within a row are summed.
+     */
+    struct Entry {
+        uint32_t column;
+        double value;
+    };
+
+private:
+    vector<size_t> lowerStarts;  ///< CSR offsets of the unit lower factor (diagonal implied).
+    vector<Entry> lower;
+    vector<size_t> upperStarts;  ///< CSR offsets of the upper factor without its diagonal.
+    vector<Entry> upper;
+    vector<double> diagonal;     ///< Diagonal of the upper factor.
+
+public:
+    /**
+     * @brief Factor a square matrix given as CSR rows.
+     * @param n Number of rows and columns.
+     * @param starts Offset of each row in entries, plus the end.
+     * @param entries Nonzeros, any order within a row.
+     * @return false if a pivot vanished; the factors are then unusable.
+     */
+    bool factor(size_t n, const vector<size_t>& starts, const vector<Entry>& entries)
+    {
+        lower.clear();
+        upper.clear();
+        lowerStarts.assign(1, 0);
+        upperStarts.assign(1, 0);
+        diagonal.assign(n, 0.0);
+
+        vector<double> work(n, 0.0);
+        vector<bool> marked(n, false);
+        vector<uint32_t> pattern;
+        vector<uint32_t> pending; ///< Min-heap of columns left of the diagonal still to eliminate.
+        for (size_t r = 0; r < n; ++r) {
+            pattern.clear();
+            pending.clear();
+            auto touch = [&](uint32_t column) {
+                if (marked[column]) return;
+                marked[column] = true;
+                pattern.push_back(column);
+                if (column < r) {
+                    pending.push_back(column);
+                    push_heap(pending.begin(), pending.end(), greater<uint32_t>());
+                }
+            };
+            touch((uint32_t)r);
+            for (size_t e = starts[r]; e < starts[r + 1]; ++e) {
+                touch(entries[e].column);
+                work[entries[e].column] += entries[e].value;
+            }
+
+            while (!pending.empty()) {
+                pop_heap(pending.begin(), pending.end(), greater<uint32_t>());
+                uint32_t k = pending.back();
+                pending.pop_back();
+                double factor = work[k] / diagonal[k];
+                lower.push_back(Entry{k, factor});
+                for (size_t e = upperStarts[k]; e < upperStarts[k + 1]; ++e) {
+                    touch(upper[e].column);
+                    work[upper[e].column] -= factor * upper[e].value;
+                }
+            }
+
+            diagonal[r] = work[r];
+            sort(pattern.begin(), pattern.end());
+            for (uint32_t column : pattern) {
+                if (column > r && work[column] != 0.0) upper.push_back(Entry{column, work[column]});
+                work[column] = 0.0;
+                marked[column] = false;
+            }
+            lowerStarts.push_back(lower.size());
+            upperStarts.push_back(upper.size());
+            if (fabs(diagonal[r]) < 1e-12) return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Solve A x = b with forward and back substitution.
+     * @param x On entry b, on exit the solution.
+     */
+    void solve(double* x) const
+    {
+        size_t n = diagonal.size();
+        for (size_t r = 0; r < n; ++r) {
+            double sum = x[r];
+            for (size_t e = lowerStarts[r]; e < lowerStarts[r + 1]; ++e) sum -= lower[e].value * x[lower[e].column];
+            x[r] = sum;
+        }
+        for (size_t r = n; r-- > 0;) {
+            double sum = x[r];
+            for (size_t e = upperStarts[r]; e < upperStarts[r + 1]; ++e) sum -= upper[e].value * x[upper[e].column];
+            x[r] = sum / diagonal[r];
+        }
+    }
+
+    size_t size() const { return diagonal.size(); }
+    size_t footprint() const
+    {
+        return heapBytes(lowerStarts) + heapBytes(lower) + heapBytes(upperStarts) + heapBytes(upper) + heapBytes(diagonal);
+    }
+    size_t nonZeros() const { return lower.size() + upper.size() + diagonal.size(); }
+};
+
+/**
+ * @struct BalanceOptions
+ * @brief Settings of Flowsheet::checkMassBalance().
+ */
+struct BalanceOptions {
+    double tolerance = POSSIBLE_ERROR; ///< Largest |in - out| accepted per device.
+    size_t worstCount = 5;             ///< Offenders listed in the report.
+};
+
+/**
+ * @struct BalanceIssue
+ * @brief Mass balance closure of one device.
+ */
+struct BalanceIssue {
+    size_t device;   ///< Index of the device in insertion order.
+    double residual; ///< Mass flow in minus mass flow out.
+};
+
+/**
+ * @struct BalanceReport
+ * @brief Result of a whole-flowsheet mass balance check.
+ */
+struct BalanceReport {
+    size_t checked;            ///< Fully wired devices checked.
+    size_t violations;         ///< Devices whose |residual| exceeds the tolerance.
+    double maxResidual;        ///< Largest |residual| found.
+    vector<BalanceIssue> worst; ///< Devices with the largest |residual|, worst first.
+
+    bool ok() const { return violations == 0; }
+};
+
+const uint32_t SNAPSHOT_VERSION = 1;          ///< Format written by Flowsheet::saveSnapshot().
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304; ///< Reads back differently on a foreign-endian machine.
+
+/**
+ * @struct SnapshotHeader
+ * @brief Start of a flowsheet snapshot file.
+ *
+ * The header is followed by 8-byte aligned sections, in this order: the mass
+ * flows, the stream numbers, one SnapshotDevice per device, every device's
+ * input then output ports, and the device parameters.
+ */
+struct SnapshotHeader {
+    char magic[8];       ///< "FLOWSNAP".
+    uint32_t version;    ///< SNAPSHOT_VERSION.
+    uint32_t byteOrder;  ///< SNAPSHOT_BYTE_ORDER as written.
+    uint64_t streams;    ///< Number of streams.
+    uint64_t devices;    ///< Number of devices, in schedule order.
+    uint64_t ports;      ///< Total connected ports.
+    uint64_t parameters; ///< Total device parameters.
+};
+
+/**
+ * @struct SnapshotDevice
+ * @brief One device of a flowsheet snapshot.
+ */
+struct SnapshotDevice {
+    uint32_t kind;        ///< A DeviceKind.
+    uint32_t inputLimit;  ///< Input ports available.
+    uint32_t outputLimit; ///< Output ports available.
+    uint32_t inputs;      ///< Connected inputs.
+    uint32_t outputs;     ///< Connected outputs.
+    uint32_t parameters;  ///< Constructor parameters.
+};
+
+/**
+ * @brief Round a section size up to the next multiple of 8 bytes.
+ */
+inline size_t snapshotAlign(size_t bytes) { return (bytes + 7) / 8 * 8; }
+
+/**
+ * @class MappedFile
+ * @brief Read-only view of a whole file, memory-mapped where the platform allows.
+ */
+class MappedFile
+{
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+#if DEVICE_HAS_MMAP
+    void* mapping = nullptr;
+#else
+    vector<uint8_t> buffer; ///< File contents where mmap is unavailable.
+#endif
+
+public:
+    /**
+     * @brief Map a file.
+     * @param path The file.
+     * @throws std::string if the file cannot be opened or mapped
+     */
+    explicit MappedFile(const string& path)
+    {
+#if DEVICE_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw "Cannot open "s + path;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw "Cannot open "s + path;
+        }
+        length = (size_t)info.st_size;
+        if (length > 0) {
+            mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                mapping = nullptr;
+                ::close(fd);
+                throw "Cannot map "s + path;
+            }
+            bytes = static_cast<const uint8_t*>(mapping);
+        }
+        ::close(fd);
+#else
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) throw "Cannot open "s + path;
+        uint8_t chunk[65536];
+        size_t got;
+        while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) buffer.insert(buffer.end(), chunk, chunk + got);
+        fclose(file);
+        bytes = buffer.data();
+        length = buffer.size();
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+#if DEVICE_HAS_MMAP
+        if (mapping) munmap(mapping, length);
+#endif
+    }
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+/**
+ * @struct MemoStats
+ * @brief Counters of a flowsheet's solve cache.
+ */
+struct MemoStats {
+    uint64_t hits;      ///< Solves answered from the cache.
+    uint64_t misses;    ///< Solves that ran the devices.
+    uint64_t evictions; ///< Entries dropped to stay within the capacity.
+    size_t entries;     ///< Entries currently held.
+};
+
+/**
+ * @class SolveCache
+ * @brief Bounded least-recently-used map from quantized inlet flows to solved stream values.
+ */
+class SolveCache
+{
+private:
+    struct Entry {
+        uint64_t hash;
+        vector<int64_t> key;    ///< Quantized inlet mass flows.
+        vector<double> outputs; ///< Solved values of every produced stream.
+    };
+
+    list<Entry> entries; ///< Most recently used first.
+    unordered_map<uint64_t, list<Entry>::iterator> index;
+    size_t capacity = 0;
+    MemoStats stats = {0, 0, 0, 0};
+
+    void evict()
+    {
+        index.erase(entries.back().hash);
+        entries.pop_back();
+        ++stats.evictions;
+    }
+
+public:
+    /**
+     * @brief Hash a quantized inlet vector.
+     */
+    static uint64_t hashKey(const vector<int64_t>& key)
+    {
+        // Four independent lanes, so the multiplies do not wait on each other
+        const uint64_t prime = 0x100000001b3ull;
+        uint64_t lanes[4] = {0xcbf29ce484222325ull ^ key.size(), 0x84222325cbf29ce4ull, 0x9e3779b97f4a7c15ull, 0x7f4a7c159e3779b9ull};
+        size_t i = 0;
+        for (; i + 4 <= key.size(); i += 4) {
+            for (size_t lane = 0; lane < 4; ++lane) lanes[lane] = (lanes[lane] ^ (uint64_t)key[i + lane]) * prime;
+        }
+        for (; i < key.size(); ++i) lanes[0] = (lanes[0] ^ (uint64_t)key[i]) * prime;
+        uint64_t hash = lanes[0] ^ (lanes[1] * 3) ^ (lanes[2] * 5) ^ (lanes[3] * 7);
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+        return hash ^ (hash >> 31);
+    }
+
+    /**
+     * @brief Change the number of entries kept; 0 turns the cache off.
+     */
+    void setCapacity(size_t entriesKept)
+    {
+        capacity = entriesKept;
+        while (entries.size() > capacity) evict();
+    }
+
+    size_t getCapacity() const { return capacity; }
+
+    /**
+     * @brief Drop every entry; the counters are kept.
+     */
+    void clear()
+    {
+        entries.clear();
+        index.clear();
+    }
+
+    /**
+     * @brief Look up solved values and count the hit or miss.
+     * @return The stored outputs, or nullptr if the key is not cached.
+     */
+    const vector<double>* find(uint64_t hash, const vector<int64_t>& key)
+    {
+        auto it = index.find(hash);
+        if (it == index.end() || it->second->key != key) {
+            ++stats.misses;
+            return nullptr;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        ++stats.hits;
+        return &entries.front().outputs;
+    }
+
+    /**
+     * @brief Store solved values, reusing the least recently used entry when full.
+     * @param hash hashKey(key).
+     * @param key Quantized inlet mass flows.
+     * @param values Produced stream values.
+     * @param count Number of values.
+     */
+    void insert(uint64_t hash, const vector<int64_t>& key, const double* values, size_t count)
+    {
+        if (capacity == 0) return;
+        auto existing = index.find(hash);
+        if (existing != index.end()) {
+            entries.erase(existing->second);
+            index.erase(existing);
+        }
+        if (entries.size() == capacity) {
+            index.erase(entries.back().hash);
+            entries.splice(entries.begin(), entries, prev(entries.end()));
+            ++stats.evictions;
+        } else {
+            entries.emplace_front();
+        }
+        Entry& entry = entries.front();
+        entry.hash = hash;
+        entry.key = key;
+        entry.outputs.assign(values, values + count);
+        index[hash] = entries.begin();
+    }
+
+    MemoStats getStats() const
+    {
+        MemoStats current = stats;
+        current.entries = entries.size();
+        return current;
+    }
+
+    /**
+     * @brief Estimated heap bytes of the entries, their list nodes and the index.
+     */
+    size_t footprint() const
+    {
+        size_t bytes = heapBytes(index) + entries.size() * (sizeof(Entry) + 2 * sizeof(void*));
+        for (const Entry& entry : entries) bytes += heapBytes(entry.key) + heapBytes(entry.outputs);
+        return bytes;
+    }
+};
+
+/**
+ * @struct FootprintReport
+ * @brief Memory held by a flowsheet, in bytes, by category.
+ */
+struct FootprintReport {
+    size_t streams;   ///< Stream store arrays, stream handles and the published snapshot.
+    size_t names;     ///< Custom stream names.
+    size_t ports;     ///< Device objects and their port lists.
+    size_t schedules; ///< Evaluation order, dependency levels and tear streams.
+    size_t caches;    ///< Compiled tapes, linear factors, balance plan and solve cache.
+
+    size_t total() const { return streams + names + ports + schedules + caches; }
+};
+
+/**
+ * @brief Write a footprint report as one line.
+ * @param out Destination stream.
+ * @param report The byte counts.
+ */
+inline void writeFootprint(ostream& out, const FootprintReport& report)
+{
+    out << "footprint streams=" << report.streams
+        << " names=" << report.names
+        << " ports=" << report.ports
+        << " schedules=" << report.schedules
+        << " caches=" << report.caches
+        << " total=" << report.total() << '\n';
+}
+
+/**
+ * @class Flowsheet
+ * @brief Owns devices and the streams between them and solves them in dependency order.
+ *
+ * The dependency graph is derived from the addInput/addOutput wiring: a device
+ * depends on every device that produces one of its input streams. The
+ * topological schedule is computed lazily and cached until the wiring changes.
+ */
+class Flowsheet
+{
+    friend class PartitionedSolver;
+
+private:
+    vector<unique_ptr<Device>> devices;  ///< Owned devices in insertion order.
+    size_t deviceBytes = 0;              ///< Object sizes of the owned devices.
+    shared_ptr<StreamArena> arena;       ///< Stream data and handles, freed in bulk.
+    StreamStore& store;                  ///< The arena's store, holding every stream's data.
+    shared_ptr<StreamIdAllocator> ids;   ///< Source of stream numbers, possibly shared.
+    StreamIdBlock idBlock;               ///< Numbers reserved for this flowsheet.
+    StreamSnapshot snapshot;             ///< Last completed pass, for concurrent readers.
+    bool publishing = false;             ///< Publish a snapshot at the end of every pass.
+    vector<Device*> schedule;            ///< Cached topological evaluation order.
+    vector<Device*> levelOrder;          ///< Schedule regrouped by dependency level.
+    vector<size_t> levelStarts;          ///< Offset of each level in levelOrder, plus the end.
+    vector<StreamId> tearStreams;        ///< Recycle streams cut to make the schedule acyclic.
+    unsigned topologyVersion = 0;        ///< Bumped on every device or wiring change.
+    unsigned scheduleVersion = 0;        ///< Topology version the schedule was built for.
+    bool scheduleValid = false;
+    FlowsheetTape tape;                  ///< Cached compiled form of the schedule.
+    unsigned tapeVersion = 0;            ///< Topology version the tape was compiled for.
+    bool tapeValid = false;
+    bool optimizing = false;             ///< getTape() returns the rewritten tape.
+    vector<StreamId> pinnedStreams;      ///< Streams the rewritten tape keeps current.
+    vector<StreamId> constantStreams;    ///< Feeds whose value the rewritten tape folds in.
+    SparseLU linear;                      ///< Factored I - M of a linear flowsheet.
+    vector<StreamId> linearUnknowns;      ///< Stream of each row, in schedule order.
+    vector<size_t> linearFeedStarts;      ///< Offset of each row's feed terms, plus the end.
+    vector<TapeOperand> linearFeeds;      ///< Feed streams entering each row, with their weight.
+    vector<double> linearBias;            ///< Constant term of each row.
+    vector<double> linearRhs;             ///< Scratch right-hand side and solution.
+    unsigned linearVersion = 0;           ///< Topology version the factors were built for.
+    bool linearValid = false;
+    bool linearUsable = false;            ///< Every device is linear and the matrix is regular.
+    vector<uint32_t> balancePorts;       ///< Streams of every checked device, inputs then outputs.
+    vector<double> balanceSigns;         ///< +1 for an input, -1 for an output.
+    vector<size_t> balanceStarts;        ///< Offset of each checked device in balancePorts, plus the end.
+    vector<size_t> balanceDevices;       ///< Insertion index of each checked device.
+    vector<double> balanceTerms;         ///< Scratch for the signed mass flows.
+    vector<double> balanceTotals;        ///< Scratch for total masses in multi-component mode.
+    vector<BalanceIssue> balanceIssues;  ///< Scratch for the per-device residuals.
+    unsigned balanceVersion = 0;         ///< Topology version the balance plan was built for.
+    bool balanceValid = false;
+    SolveCache memo;                     ///< Results of earlier solveCached() calls.
+    vector<StreamId> memoInlets;         ///< Streams no device produces, in store order.
+    vector<StreamId> memoOutputs;        ///< Streams some device produces, in store order.
+    vector<int64_t> memoKey;             ///< Scratch for the quantized inlet flows.
+    vector<double> memoValues;           ///< Scratch for the produced values.
+    unsigned memoVersion = 0;            ///< Topology version the inlet list was built for.
+    bool memoValid = false;
+    bool solvedOnce = false;             ///< A full pass has run since construction.
+    unsigned solvedVersion = 0;          ///< Topology version of the last full pass.
+
+    /**
+     * @brief Compile the current schedule, tear streams included, into a tape.
+     * @throws std::string if a device is not fully wired
+     */
+    void compileInto(FlowsheetTape& target) { compileInto(getSchedule(), target); }
+
+    /**
+     * @brief Compile some devices, in the given order, into a tape.
+     * @throws std::string if a device is not fully wired
+     */
+    void compileInto(const vector<Device*>& order, FlowsheetTape& target)
+    {
+        target.clear();
+        for (Device* device : order) {
+            DeviceStatus status = device->validate();
+            if (!status) device->raise(status.error);
+            device->compile(target);
+        }
+    }
+
+    /**
+     * @brief Rewrite a compiled tape so that only visible streams are stored.
+     *
+     * Copies and sums whose result feeds a single consumer are substituted
+     * into that consumer, which removes pass-through devices and fuses mixer
+     * trees into one weighted sum; constant feeds are folded into the bias.
+     * A stream is still written if it is a product, pinned, read by a Call, or
+     * read several times through an expression of more than one term, so no
+     * work is duplicated.
+     * @param source Tape compiled from the schedule, without recycle loops.
+     * @param target Receives the rewritten tape.
+     */
+    void optimizeInto(const FlowsheetTape& source, FlowsheetTape& target)
+    {
+        const size_t n = store.size();
+        const uint32_t none = UINT32_MAX;
+        const double* values = store.massFlows();
+        const vector<TapeOperand>& pool = source.operandPool();
+        vector<uint32_t> reads(n, 0);
+        vector<bool> written(n, false);
+        vector<bool> keep(n, false);
+        vector<bool> constant(n, false);
+        for (StreamId id : pinnedStreams) keep[id] = true;
+        for (const TapeInstruction& in : source.instructions()) {
+            const TapeOperand* o = pool.data() + in.first;
+            switch (in.op) {
+            case TapeOp::Sum:
+            case TapeOp::Copy:
+                for (uint32_t i = 0; i < in.count; ++i) ++reads[o[i].stream];
+                written[in.stream] = true;
+                break;
+            case TapeOp::Split:
+                reads[in.stream] += in.count;
+                for (uint32_t i = 0; i < in.count; ++i) written[o[i].stream] = true;
+                break;
+            case TapeOp::Call:
+                for (StreamId id : in.device->getInputs()) keep[id] = true;
+                for (StreamId id : in.device->getOutputs()) written[id] = true;
+                break;
+            }
+        }
+        for (StreamId id : constantStreams) constant[id] = !written[id];
+
+        // Expressions of streams that are substituted instead of stored
+        vector<bool> deferred(n, false);
+        vector<uint32_t> exprFirst(n, 0), exprCount(n, 0);
+        vector<double> exprBias(n, 0.0);
+        vector<TapeOperand> exprPool;
+        vector<TapeOperand> expr;
+        vector<uint32_t> slot(n, none);
+        double bias = 0.0;
+
+        auto term = [&](StreamId stream, double coefficient) {
+            if (slot[stream] == none) {
+                slot[stream] = (uint32_t)expr.size();
+                expr.push_back(TapeOperand{stream, coefficient});
+            } else {
+                expr[slot[stream]].coefficient += coefficient;
+            }
+        };
+        auto read = [&](StreamId stream, double coefficient) {
+            if (constant[stream]) {
+                bias += coefficient * values[stream];
+            } else if (deferred[stream]) {
+                bias += coefficient * exprBias[stream];
+                const TapeOperand* e = exprPool.data() + exprFirst[stream];
+                for (uint32_t i = 0; i < exprCount[stream]; ++i) term(e[i].stream, coefficient * e[i].coefficient);
+            } else {
+                term(stream, coefficient);
+            }
+        };
+        auto define = [&](StreamId stream) {
+            for (const TapeOperand& t : expr) slot[t.stream] = none;
+            if (keep[stream] || reads[stream] == 0 || (reads[stream] > 1 && expr.size() > 1)) {
+                if (expr.size() == 1 && expr[0].coefficient == 1.0 && bias == 0.0) {
+                    target.emitCopy(stream, expr[0].stream);
+                } else {
+                    target.emitSum(stream, expr.data(), expr.size(), bias);
+                }
+            } else {
+                deferred[stream] = true;
+                exprFirst[stream] = (uint32_t)exprPool.size();
+                exprCount[stream] = (uint32_t)expr.size();
+                exprBias[stream] = bias;
+                exprPool.insert(exprPool.end(), expr.begin(), expr.end());
+            }
+            expr.clear();
+            bias = 0.0;
+        };
+
+        target.clear();
+        for (const TapeInstruction& in : source.instructions()) {
+            const TapeOperand* o = pool.data() + in.first;
+            switch (in.op) {
+            case TapeOp::Sum:
+                bias = in.bias;
+                for (uint32_t i = 0; i < in.count; ++i) read(o[i].stream, o[i].coefficient);
+                define(in.stream);
+                break;
+            case TapeOp::Copy:
+                read(o[0].stream, 1.0);
+                define(in.stream);
+                break;
+            case TapeOp::Split:
+                for (uint32_t i = 0; i < in.count; ++i) {
+                    read(in.stream, o[i].coefficient);
+                    define(o[i].stream);
+                }
+                break;
+            case TapeOp::Call:
+                target.emitCall(in.device);
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief Assemble I - M from the compiled devices and factor it.
+     *
+     * Each produced stream is one unknown whose row holds 1 on the diagonal
+     * and minus the weight of every produced stream it is computed from;
+     * feeds and constants go to the right-hand side.
+     */
+    void buildLinearSystem()
+    {
+        FlowsheetTape system;
+        compileInto(system);
+        linearUsable = true;
+        linearUnknowns.clear();
+        linearFeeds.clear();
+        linearFeedStarts.assign(1, 0);
+        linearBias.clear();
+
+        const uint32_t none = UINT32_MAX;
+        vector<uint32_t> unknown(store.size(), none);
+        vector<vector<TapeOperand>> sources;
+        const vector<TapeOperand>& pool = system.operandPool();
+        auto equation = [&](StreamId target, double bias) -> vector<TapeOperand>& {
+            unknown[target] = (uint32_t)linearUnknowns.size();
+            linearUnknowns.push_back(target);
+            linearBias.push_back(bias);
+            sources.emplace_back();
+            return sources.back();
+        };
+        for (const TapeInstruction& in : system.instructions()) {
+            const TapeOperand* o = pool.data() + in.first;
+            switch (in.op) {
+            case TapeOp::Sum:
+                equation(in.stream, in.bias).assign(o, o + in.count);
+                break;
+            case TapeOp::Split:
+                for (uint32_t i = 0; i < in.count; ++i) equation(o[i].stream, 0.0).push_back(TapeOperand{in.stream, o[i].coefficient});
+                break;
+            case TapeOp::Copy:
+                equation(in.stream, 0.0).push_back(TapeOperand{o[0].stream, 1.0});
+                break;
+            case TapeOp::Call:
+                linearUsable = false;
+                break;
+            }
+        }
+
+        vector<size_t> starts(1, 0);
+        vector<SparseLU::Entry> entries;
+        for (size_t row = 0; row < sources.size(); ++row) {
+            for (const TapeOperand& source : sources[row]) {
+                if (unknown[source.stream] != none) {
+                    entries.push_back(SparseLU::Entry{unknown[source.stream], -source.coefficient});
+                } else {
+                    linearFeeds.push_back(source);
+                }
+            }
+            entries.push_back(SparseLU::Entry{(uint32_t)row, 1.0});
+            starts.push_back(entries.size());
+            linearFeedStarts.push_back(linearFeeds.size());
+        }
+        if (linearUsable) linearUsable = linear.factor(sources.size(), starts, entries);
+        linearRhs.resize(sources.size());
+        linearVersion = topologyVersion;
+        linearValid = true;
+    }
+
+    /**
+     * @brief Find a strongly connected component no other one feeds (Tarjan's algorithm).
+     * Only unscheduled devices and the edges between them are considered.
+     * Components come out sinks first, so the last one found is a source.
+     * @param consumers Downstream devices of each device.
+     * @param scheduled Devices already placed in the schedule.
+     * @return Indices of the devices in the component.
+     */
+    static vector<size_t> sourceComponent(const vector<vector<size_t>>& consumers, const vector<bool>& scheduled)
+    {
+        const size_t unvisited = consumers.size();
+        vector<size_t> index(consumers.size(), unvisited), low(consumers.size(), 0);
+        vector<bool> onStack(consumers.size(), false);
+        vector<size_t> stack, component;
+        vector<pair<size_t, size_t>> calls;
+        size_t visited = 0;
+        for (size_t root = 0; root < consumers.size(); ++root) {
+            if (scheduled[root] || index[root] != unvisited) continue;
+            calls.emplace_back(root, 0);
+            index[root] = low[root] = visited++;
+            stack.push_back(root);
+            onStack[root] = true;
+            while (!calls.empty()) {
+                size_t node = calls.back().first;
+                size_t& edge = calls.back().second;
+                if (edge < consumers[node].size()) {
+                    size_t next = consumers[node][edge++];
+                    if (scheduled[next]) continue;
+                    if (index[next] == unvisited) {
+                        index[next] = low[next] = visited++;
+                        stack.push_back(next);
+                        onStack[next] = true;
+                        calls.emplace_back(next, 0);
+                    } else if (onStack[next]) {
+                        low[node] = min(low[node], index[next]);
+                    }
+                    continue;
+                }
+                calls.pop_back();
+                if (!calls.empty()) low[calls.back().first] = min(low[calls.back().first], low[node]);
+                if (low[node] != index[node]) continue;
+                component.clear();
+                size_t member;
+                do {
+                    member = stack.back();
+                    stack.pop_back();
+                    onStack[member] = false;
+                    component.push_back(member);
+                } while (member != node);
+            }
+        }
+        return component;
+    }
+
+    /**
+     * @brief Rebuild the topological schedule (Kahn's algorithm).
+     * Recycle loops are cut at tear streams: whenever every remaining device
+     * waits on a cycle, the one with the fewest unresolved producers in a
+     * loop no other remaining device feeds is scheduled next and its
+     * unresolved inputs become tear streams.
+     * @throws std::string if a device uses foreign streams or a stream has two producers
+     */
+    void buildSchedule()
+    {
+        const size_t none = devices.size();
+        vector<size_t> producer(store.size(), none);
+        for (size_t i = 0; i < devices.size(); ++i) {
+            if (devices[i]->getStore() && devices[i]->getStore() != &store) {
+                throw string("Device is wired to streams outside the flowsheet");
+            }
+            for (StreamId out : devices[i]->getOutputs()) {
+                if (producer[out] != none) {
+                    throw string("Stream " + store.getName(out) + " has more than one producer");
+                }
+                producer[out] = i;
+            }
+        }
+
+        vector<vector<size_t>> consumers(devices.size());
+        vector<size_t> pending(devices.size(), 0);
+        for (size_t i = 0; i < devices.size(); ++i) {
+            for (StreamId in : devices[i]->getInputs()) {
+                if (producer[in] != none) {
+                    consumers[producer[in]].push_back(i);
+                    ++pending[i];
+                }
+            }
+        }
+
+        vector<size_t> order;
+        vector<bool> scheduled(devices.size(), false);
+        order.reserve(devices.size());
+        for (size_t i = 0; i < devices.size(); ++i) {
+            if (pending[i] == 0) {
+                order.push_back(i);
+                scheduled[i] = true;
+            }
+        }
+
+        vector<size_t> depth(devices.size(), 0);
+        tearStreams.clear();
+        size_t head = 0;
+        for (;;) {
+            for (; head < order.size(); ++head) {
+                for (size_t next : consumers[order[head]]) {
+                    if (scheduled[next]) continue;
+                    depth[next] = max(depth[next], depth[order[head]] + 1);
+                    if (--pending[next] == 0) {
+                        order.push_back(next);
+                        scheduled[next] = true;
+                    }
+                }
+            }
+            if (order.size() == devices.size()) break;
+
+            // Every remaining device waits on a cycle. Devices merely downstream
+            // of one wait too, so pick from a recycle loop no other remaining
+            // device feeds: its unresolved inputs are all edges of that loop.
+            size_t pick = none;
+            for (size_t i : sourceComponent(consumers, scheduled)) {
+                if (pick == none || pending[i] < pending[pick]) pick = i;
+            }
+            for (StreamId in : devices[pick]->getInputs()) {
+                if (producer[in] != none && !scheduled[producer[in]] &&
+                    find(tearStreams.begin(), tearStreams.end(), in) == tearStreams.end()) {
+                    tearStreams.push_back(in);
+                }
+            }
+            order.push_back(pick);
+            scheduled[pick] = true;
+        }
+
+        schedule.clear();
+        for (size_t i : order) schedule.push_back(devices[i].get());
+
+        size_t levels = 0;
+        for (size_t i : order) levels = max(levels, depth[i] + 1);
+        levelStarts.assign(levels + 1, 0);
+        for (size_t i : order) ++levelStarts[depth[i] + 1];
+        for (size_t level = 0; level < levels; ++level) levelStarts[level + 1] += levelStarts[level];
+        levelOrder.assign(order.size(), nullptr);
+        vector<size_t> cursor(levelStarts.begin(), levelStarts.end() - 1);
+        for (size_t i : order) levelOrder[cursor[depth[i]]++] = devices[i].get();
+        scheduleVersion = topologyVersion;
+        scheduleValid = true;
+    }
+
+public:
+    /**
+     * @brief Create an empty flowsheet.
+     * @param ids Source of stream numbers; share one between flowsheets that will be merged.
+     */
+    explicit Flowsheet(shared_ptr<StreamIdAllocator> ids = make_shared<StreamIdAllocator>())
+        : arena(make_shared<StreamArena>()), store(arena->store), ids(move(ids)) {}
+    Flowsheet(const Flowsheet&) = delete;
+    Flowsheet& operator=(const Flowsheet&) = delete;
+
+    /**
+     * @brief Create a new stream owned by the flowsheet.
+     * @return The stream, named s1, s2, ... in creation order unless the allocator is shared.
+     */
+    shared_ptr<Stream> addStream()
+    {
+        return shared_ptr<Stream>(arena, &createStream());
+    }
+
+    /**
+     * @brief Create a new stream owned by the flowsheet without a shared handle.
+     *
+     * Every shared_ptr from addStream() shares the arena's control block, so
+     * copying them from several threads contends on one counter; a reference
+     * costs nothing to pass around.
+     * @return The stream, valid as long as this flowsheet or one it is merged into.
+     */
+    Stream& createStream()
+    {
+        StreamId id = store.add(idBlock.take(*ids));
+        return *arena->create(id);
+    }
+
+    /**
+     * @brief Construct a device in place and take ownership of it.
+     * @param args Constructor arguments of the device type.
+     * @return Reference to the new device, valid for the flowsheet's lifetime.
+     */
+    template <class T, class... Args>
+    T& addDevice(Args&&... args)
+    {
+        T* device = new T(std::forward<Args>(args)...);
+        devices.emplace_back(device);
+        deviceBytes += sizeof(T);
+        device->topologyVersion = &topologyVersion;
+        ++topologyVersion;
+        return *device;
+    }
+
+    /**
+     * @brief Move every stream and device of another flowsheet into this one.
+     *
+     * Handles and device references obtained from other stay valid and now
+     * belong to this flowsheet; other is left empty. Flowsheets built from one
+     * StreamIdAllocator keep unique stream names after the merge.
+     * @param other The flowsheet to absorb.
+     * @return Index of other's first stream in this flowsheet's store.
+     * @throws std::string on a self-merge, if this flowsheet was merged into other, on foreign wiring
+     * or different batch/component layouts
+     */
+    StreamId merge(Flowsheet& other)
+    {
+        if (&other == this) {
+            throw string("Cannot merge a flowsheet into itself");
+        }
+        if (arena->reaches(*other.arena)) {
+            throw string("Cannot merge a flowsheet into one that was merged into it");
+        }
+        for (const auto& device : other.devices) {
+            if (device->getStore() && device->getStore() != &other.store) {
+                throw string("Device is wired to streams outside the flowsheet");
+            }
+        }
+        StreamId offset = store.append(other.store);
+        arena->adopt(*other.arena, offset, arena);
+        other.store.clear();
+        for (auto& device : other.devices) {
+            device->rebind(store, offset);
+            device->topologyVersion = &topologyVersion;
+            devices.push_back(move(device));
+        }
+        other.devices.clear();
+        deviceBytes += other.deviceBytes;
+        other.deviceBytes = 0;
+        for (StreamId id : other.pinnedStreams) pinnedStreams.push_back(id + offset);
+        for (StreamId id : other.constantStreams) constantStreams.push_back(id + offset);
+        other.pinnedStreams.clear();
+        other.constantStreams.clear();
+        ++topologyVersion;
+        ++other.topologyVersion;
+        return offset;
+    }
+
+    /**
+     * @brief Create another handle for a stream of this flowsheet, e.g. one restored by loadSnapshot().
+     * @param id The stream index in getStore().
+     * @return The handle, valid as long as this flowsheet or one it is merged into.
+     * @throws std::string if there is no such stream
+     */
+    Stream& createHandle(StreamId id)
+    {
+        if (id >= store.size()) throw string("Stream index out of range");
+        return *arena->create(id);
+    }
+
+    /**
+     * @brief Write the devices, their wiring and the current mass flows to a binary snapshot.
+     *
+     * Devices are written in schedule order, so a loaded flowsheet is already
+     * sorted. Custom stream names, batch lanes and component flows are not saved.
+     * @param path The file to create or overwrite.
+     * @throws std::string if a device cannot be saved or the file cannot be written
+     */
+    void saveSnapshot(const string& path)
+    {
+        const vector<Device*>& order = getSchedule();
+        vector<SnapshotDevice> records;
+        vector<uint32_t> ports;
+        vector<double> parameters;
+        records.reserve(order.size());
+        for (const Device* device : order) {
+            if (device->store && device->store != &store) {
+                throw string("Device is wired to streams outside the flowsheet");
+            }
+            size_t first = parameters.size();
+            DeviceKind kind = device->describe(parameters);
+            if (kind == DeviceKind::Custom) throw "Device cannot be saved in a snapshot: "s + device->typeName();
+            records.push_back(SnapshotDevice{(uint32_t)kind, (uint32_t)device->inputAmount,
+                                             (uint32_t)device->outputAmount, (uint32_t)device->inputs.size(),
+                                             (uint32_t)device->outputs.size(), (uint32_t)(parameters.size() - first)});
+            ports.insert(ports.end(), device->inputs.begin(), device->inputs.end());
+            ports.insert(ports.end(), device->outputs.begin(), device->outputs.end());
+        }
+        SnapshotHeader header;
+        memcpy(header.magic, "FLOWSNAP", sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.byteOrder = SNAPSHOT_BYTE_ORDER;
+        header.streams = store.size();
+        header.devices = records.size();
+        header.ports = ports.size();
+        header.parameters = parameters.size();
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) throw "Cannot create "s + path;
+        static const uint8_t padding[8] = {};
+        bool written = true;
+        auto section = [&](const void* data, size_t bytes) {
+            size_t pad = snapshotAlign(bytes) - bytes;
+            if (bytes && fwrite(data, 1, bytes, file) != bytes) written = false;
+            if (pad && fwrite(padding, 1, pad, file) != pad) written = false;
+        };
+        section(&header, sizeof(header));
+        section(store.massFlows(), store.size() * sizeof(double));
+        section(store.streamNumbers(), store.size() * sizeof(uint32_t));
+        section(records.data(), records.size() * sizeof(SnapshotDevice));
+        section(ports.data(), ports.size() * sizeof(uint32_t));
+        section(parameters.data(), parameters.size() * sizeof(double));
+        if (fclose(file) != 0) written = false;
+        if (!written) throw "Cannot write "s + path;
+    }
+
+    /**
+     * @brief Rebuild a flowsheet saved by saveSnapshot().
+     *
+     * The file is memory-mapped and the mass flows are copied into the store
+     * in one block; ports are wired straight from the mapping. Streams keep
+     * their saved numbers and get no handles until createHandle() is called.
+     * @param path The snapshot file.
+     * @throws std::string if the flowsheet is not empty or the file is missing, truncated or from another version
+     */
+    void loadSnapshot(const string& path)
+    {
+        if (!devices.empty() || store.size() != 0) {
+            throw string("Snapshot can only be loaded into an empty flowsheet");
+        }
+        MappedFile file(path);
+        const string invalid = "Invalid flowsheet snapshot: "s + path;
+        SnapshotHeader header;
+        if (file.size() < sizeof(header)) throw invalid;
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, "FLOWSNAP", sizeof(header.magic)) != 0 || header.byteOrder != SNAPSHOT_BYTE_ORDER) {
+            throw invalid;
+        }
+        if (header.version != SNAPSHOT_VERSION) throw "Unsupported flowsheet snapshot version: "s + path;
+        if (header.streams > UINT32_MAX || header.devices > UINT32_MAX || header.ports > UINT32_MAX ||
+            header.parameters > UINT32_MAX) {
+            throw invalid;
+        }
+        size_t streams = (size_t)header.streams;
+        size_t flowsAt = sizeof(header);
+        size_t numbersAt = flowsAt + snapshotAlign(streams * sizeof(double));
+        size_t devicesAt = numbersAt + snapshotAlign(streams * sizeof(uint32_t));
+        size_t portsAt = devicesAt + snapshotAlign((size_t)header.devices * sizeof(SnapshotDevice));
+        size_t parametersAt = portsAt + snapshotAlign((size_t)header.ports * sizeof(uint32_t));
+        if (parametersAt + (size_t)header.parameters * sizeof(double) != file.size()) throw invalid;
+
+        const uint8_t* base = file.data();
+        const double* flows = reinterpret_cast<const double*>(base + flowsAt);
+        const uint32_t* numbers = reinterpret_cast<const uint32_t*>(base + numbersAt);
+        const SnapshotDevice* records = reinterpret_cast<const SnapshotDevice*>(base + devicesAt);
+        const uint32_t* ports = reinterpret_cast<const uint32_t*>(base + portsAt);
+        const double* parameters = reinterpret_cast<const double*>(base + parametersAt);
+        uint64_t portTotal = 0, parameterTotal = 0;
+        for (size_t i = 0; i < header.devices; ++i) {
+            portTotal += (uint64_t)records[i].inputs + records[i].outputs;
+            parameterTotal += records[i].parameters;
+        }
+        if (portTotal != header.ports || parameterTotal != header.parameters) throw invalid;
+        for (size_t i = 0; i < header.ports; ++i) {
+            if (ports[i] >= streams) throw invalid;
+        }
+
+        store.assign(flows, numbers, streams);
+        uint32_t highest = 0;
+        for (size_t i = 0; i < streams; ++i) highest = max(highest, numbers[i]);
+        if (streams) ids->advancePast(highest);
+        idBlock = StreamIdBlock();
+        devices.reserve((size_t)header.devices);
+        try {
+            for (size_t i = 0; i < header.devices; ++i) {
+                const SnapshotDevice& record = records[i];
+                Device* device = nullptr;
+                switch ((DeviceKind)record.kind) {
+                case DeviceKind::Mixer:
+                    device = &addDevice<Mixer>((int)record.inputLimit, (int)record.outputLimit);
+                    break;
+                case DeviceKind::Reactor:
+                    if (record.parameters != 1) throw invalid;
+                    device = &addDevice<Reactor>(parameters[0] != 0.0);
+                    break;
+                case DeviceKind::Splitter:
+                    device = &addDevice<Splitter>(vector<double>(parameters, parameters + record.parameters));
+                    break;
+                default:
+                    throw invalid;
+                }
+                for (uint32_t k = 0; k < record.inputs; ++k) {
+                    if (!device->tryAddInput(Stream(store, *ports++))) throw invalid;
+                }
+                for (uint32_t k = 0; k < record.outputs; ++k) {
+                    if (!device->tryAddOutput(Stream(store, *ports++))) throw invalid;
+                }
+                parameters += record.parameters;
+            }
+        } catch (...) {
+            devices.clear();
+            deviceBytes = 0;
+            store.clear();
+            ++topologyVersion;
+            throw;
+        }
+    }
+
+    /**
+     * @brief Get the evaluation order, rebuilding it only if the wiring changed.
+     * @return Devices in topological order.
+     * @throws std::string if the wiring is invalid
+     */
+    const vector<Device*>& getSchedule()
+    {
+        if (!scheduleValid || scheduleVersion != topologyVersion) buildSchedule();
+        return schedule;
+    }
+
+    /**
+     * @brief Get the schedule grouped by dependency level.
+     * @return Devices sorted by level; see getLevelStarts() for the boundaries.
+     */
+    const vector<Device*>& getLevelOrder()
+    {
+        getSchedule();
+        return levelOrder;
+    }
+
+    /**
+     * @brief Get where each dependency level starts in getLevelOrder().
+     * @return One offset per level followed by the total device count.
+     */
+    const vector<size_t>& getLevelStarts()
+    {
+        getSchedule();
+        return levelStarts;
+    }
+
+    /**
+     * @brief Record that a full pass finished; used by solve() and external executors.
+     * @param complete Whether every stream is current; a partial pass is not published.
+     */
+    void markSolved(bool complete = true)
+    {
+        store.clearDirty();
+        solvedOnce = complete;
+        solvedVersion = topologyVersion;
+        if (publishing && complete) snapshot.publish(store);
+    }
+
+    /**
+     * @brief Publish a StreamSnapshot at the end of every complete pass (off by default).
+     *
+     * An optimized solveTape() pass leaves intermediate streams stale, so it
+     * keeps the previous snapshot.
+     * @param enabled Whether passes publish; enabling publishes the current values at once.
+     */
+    void setPublishing(bool enabled)
+    {
+        publishing = enabled;
+        if (enabled) snapshot.publish(store);
+    }
+
+    /**
+     * @brief Get the published results, safe to read while the flowsheet is being solved.
+     * @return The snapshot; empty until publishing is enabled.
+     */
+    const StreamSnapshot& getSnapshot() const { return snapshot; }
+
+    /**
+     * @brief Get the streams cut to break recycle loops.
+     * @return Tear streams; empty for an acyclic flowsheet.
+     */
+    const vector<StreamId>& getTearStreams()
+    {
+        getSchedule();
+        return tearStreams;
+    }
+
+    /**
+     * @brief Run one full pass of updateOutputs() over the flowsheet.
+     * @throws std::string if the flowsheet has recycle loops (use converge())
+     */
+    void solve()
+    {
+        if (!getTearStreams().empty()) {
+            throw string("Flowsheet contains a recycle loop");
+        }
+        for (Device* device : schedule) device->evaluate();
+        markSolved();
+    }
+
+    /**
+     * @brief Keep the results of up to `entries` distinct inlet configurations for solveCached().
+     * @param entries Capacity of the least-recently-used cache; 0 (the default) turns it off.
+     */
+    void setMemoCapacity(size_t entries) { memo.setCapacity(entries); }
+
+    /**
+     * @brief Get the solve cache counters, for tuning its capacity.
+     */
+    MemoStats getMemoStats() const { return memo.getStats(); }
+
+    /**
+     * @brief Measure the memory the flowsheet holds.
+     *
+     * Counts reserved capacity rather than used size; hash maps and the nodes
+     * of the solve cache are estimated from their element counts. Heap data
+     * owned by device subclasses, such as split fractions, is not included.
+     * @return Bytes per category.
+     */
+    FootprintReport footprint() const
+    {
+        FootprintReport report;
+        report.streams = sizeof(StreamArena) + store.footprint() + arena->footprint() + snapshot.footprint();
+        report.names = store.nameFootprint();
+        report.ports = deviceBytes + heapBytes(devices);
+        for (const auto& device : devices) report.ports += device->inputs.heapBytes() + device->outputs.heapBytes();
+        report.schedules = heapBytes(schedule) + heapBytes(levelOrder) + heapBytes(levelStarts) + heapBytes(tearStreams);
+        report.caches = tape.footprint() + linear.footprint() + heapBytes(pinnedStreams) + heapBytes(constantStreams) +
+                        heapBytes(linearUnknowns) + heapBytes(linearFeedStarts) + heapBytes(linearFeeds) +
+                        heapBytes(linearBias) + heapBytes(linearRhs) + heapBytes(balancePorts) + heapBytes(balanceSigns) +
+                        heapBytes(balanceStarts) + heapBytes(balanceDevices) + heapBytes(balanceTerms) +
+                        heapBytes(balanceTotals) + heapBytes(balanceIssues) + memo.footprint() + heapBytes(memoInlets) +
+                        heapBytes(memoOutputs) + heapBytes(memoKey) + heapBytes(memoValues);
+        return report;
+    }
+
+    /**
+     * @brief Drop every cached result, e.g. after changing a device parameter; the counters are kept.
+     */
+    void clearMemo() { memo.clear(); }
+
+    /**
+     * @brief Solve, reusing the result of an earlier call with the same inlet flows.
+     *
+     * Inlets are the streams no device produces; their mass flows are
+     * quantized to POSSIBLE_ERROR, so configurations closer than that share
+     * one entry. A hit writes back every produced stream and runs no device.
+     * The cache is emptied when the wiring changes; changes to device
+     * parameters need clearMemo().
+     * @return true if the result came from the cache.
+     * @throws std::string if the flowsheet has recycle loops
+     */
+    bool solveCached()
+    {
+        if (memo.getCapacity() == 0) {
+            solve();
+            return false;
+        }
+        if (!memoValid || memoVersion != topologyVersion) {
+            vector<bool> produced(store.size(), false);
+            for (Device* device : getSchedule()) {
+                for (StreamId id : device->getOutputs()) produced[id] = true;
+            }
+            memoInlets.clear();
+            memoOutputs.clear();
+            for (StreamId id = 0; id < store.size(); ++id) (produced[id] ? memoOutputs : memoInlets).push_back(id);
+            memo.clear();
+            memoVersion = topologyVersion;
+            memoValid = true;
+        }
+
+        const double* flows = store.massFlows();
+        const double scale = 1.0 / POSSIBLE_ERROR;
+        memoKey.resize(memoInlets.size());
+        bool representable = true;
+        for (size_t i = 0; i < memoInlets.size(); ++i) {
+            double steps = floor(flows[memoInlets[i]] * scale + 0.5);
+            representable &= fabs(steps) < 9e18;
+            memoKey[i] = representable ? (int64_t)steps : 0;
+        }
+        if (!representable) {
+            solve();
+            return false;
+        }
+        uint64_t hash = SolveCache::hashKey(memoKey);
+        if (const vector<double>* outputs = memo.find(hash, memoKey)) {
+            // markSolved() clears the dirty flags, so write the values directly
+            double* values = store.massFlows();
+            for (size_t i = 0; i < memoOutputs.size(); ++i) values[memoOutputs[i]] = (*outputs)[i];
+            markSolved();
+            return true;
+        }
+        solve();
+        memoValues.resize(memoOutputs.size());
+        for (size_t i = 0; i < memoOutputs.size(); ++i) memoValues[i] = store.getMassFlow(memoOutputs[i]);
+        memo.insert(hash, memoKey, memoValues.data(), memoValues.size());
+        return false;
+    }
+
+    /**
+     * @brief Get the flowsheet compiled into a tape, recompiling only if the wiring changed.
+     * @return The tape, rewritten if optimizing is on; valid until the next wiring change.
+     * @throws std::string if the flowsheet has recycle loops or a device is not fully wired
+     */
+    const FlowsheetTape& getTape()
+    {
+        if (tapeValid && tapeVersion == topologyVersion) return tape;
+        if (!getTearStreams().empty()) {
+            throw string("Flowsheet contains a recycle loop");
+        }
+        if (optimizing) {
+            FlowsheetTape compiled;
+            compileInto(compiled);
+            optimizeInto(compiled, tape);
+        } else {
+            compileInto(tape);
+        }
+        tapeVersion = topologyVersion;
+        tapeValid = true;
+        return tape;
+    }
+
+    /**
+     * @brief Run one full pass through the compiled tape; same result as solve().
+     *
+     * With optimizing on, only products and pinned streams are guaranteed
+     * current afterwards, so the next solveIncremental() runs a full pass
+     * and the pass is not published.
+     * @throws std::string if the flowsheet has recycle loops or a device is not fully wired
+     */
+    void solveTape()
+    {
+        getTape().run(store.massFlows());
+        markSolved(!optimizing);
+    }
+
+    /**
+     * @brief Let getTape() and solveTape() use a tape rewritten by graph optimization (off by default).
+     *
+     * Pass-through devices are skipped, mixer trees become single sums and
+     * constant feeds are folded. Intermediate streams are then left stale;
+     * pin the ones that must stay readable.
+     * @param enabled Whether to optimize.
+     */
+    void setOptimizing(bool enabled)
+    {
+        optimizing = enabled;
+        tapeValid = false;
+    }
+
+    /**
+     * @brief Keep a stream current under the optimized tape.
+     * @param s A stream of this flowsheet.
+     */
+    void pinStream(const Stream& s)
+    {
+        pinnedStreams.push_back(s.getId());
+        tapeValid = false;
+    }
+
+    /**
+     * @brief Declare a feed constant so the optimized tape folds in its current value.
+     *
+     * Later changes to the feed are ignored by the optimized tape until it is
+     * rebuilt, which happens when the wiring, the pins or the constants
+     * change. Streams written by a device are never folded.
+     * @param s A feed stream of this flowsheet.
+     */
+    void markConstant(const Stream& s)
+    {
+        constantStreams.push_back(s.getId());
+        tapeValid = false;
+    }
+
+    /**
+     * @brief Iterate the flowsheet until every tear stream settles.
+     *
+     * Each iteration writes the current guesses into the tear streams, runs one
+     * pass and reads back what the producers computed. With Wegstein
+     * acceleration the next guess extrapolates along the secant of the last
+     * two iterations, which converges linear loops in a few passes.
+     * @param options Tolerance, iteration limit and acceleration method.
+     * @return Whether and how fast the tear streams converged.
+     */
+    RecycleResult converge(const RecycleOptions& options = RecycleOptions())
+    {
+        const vector<Device*>& order = getSchedule();
+        RecycleResult result = {false, 0, 0.0};
+        size_t n = tearStreams.size();
+        vector<double> x(n), g(n), lastX(n), lastG(n);
+        for (size_t i = 0; i < n; ++i) x[i] = store.getMassFlow(tearStreams[i]);
+
+        while (result.iterations < options.maxIterations) {
+            for (size_t i = 0; i < n; ++i) store.setMassFlow(tearStreams[i], x[i]);
+            for (Device* device : order) device->evaluate();
+            ++result.iterations;
+
+            result.residual = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                g[i] = store.getMassFlow(tearStreams[i]);
+                result.residual = max(result.residual, fabs(g[i] - x[i]));
+            }
+            if (result.residual <= options.tolerance) {
+                result.converged = true;
+                break;
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                double next = nextTearGuess(options, result.iterations, x[i], g[i], lastX[i], lastG[i]);
+                lastX[i] = x[i];
+                lastG[i] = g[i];
+                x[i] = next;
+            }
+        }
+        markSolved();
+        return result;
+    }
+
+    /**
+     * @brief Split the devices into sub-flowsheets that share few streams.
+     *
+     * The devices are laid out in a depth-first topological order, so chains
+     * and independent trains stay together, and cut into contiguous pieces of
+     * equal size. Each cut is then moved by up to half a piece to the
+     * position that the fewest streams cross. Streams other than tear streams
+     * only run from a piece to a later one, so the partitions form a DAG.
+     * @param parts Number of partitions; at most one per device.
+     * @return The partitions and the streams cut between them.
+     * @throws std::string if parts is zero or the schedule cannot be built
+     */
+    PartitionPlan partition(size_t parts)
+    {
+        if (parts == 0) throw string("Partition count must be positive");
+        const vector<Device*>& order = getSchedule();
+        const size_t n = devices.size();
+        const size_t none = n;
+        parts = min(parts, n);
+        if (n == 0) return PartitionPlan();
+
+        unordered_map<const Device*, size_t> indexOf;
+        for (size_t i = 0; i < n; ++i) indexOf[devices[i].get()] = i;
+        vector<size_t> position(n);
+        for (size_t p = 0; p < n; ++p) position[indexOf[order[p]]] = p;
+        vector<size_t> producer(store.size(), none);
+        for (size_t i = 0; i < n; ++i) {
+            for (StreamId out : devices[i]->getOutputs()) producer[out] = i;
+        }
+
+        // Forward edges of the schedule; the backward ones are the tear stream reads
+        vector<vector<size_t>> consumers(n);
+        vector<size_t> pending(n, 0);
+        for (size_t i = 0; i < n; ++i) {
+            for (StreamId in : devices[i]->getInputs()) {
+                size_t from = producer[in];
+                if (from != none && position[from] < position[i]) {
+                    consumers[from].push_back(i);
+                    ++pending[i];
+                }
+            }
+        }
+
+        // Reverse postorder of a depth-first search from the roots, in schedule order
+        vector<size_t> postorder;
+        vector<bool> visited(n, false);
+        vector<pair<size_t, size_t>> stack;
+        for (Device* root : order) {
+            size_t start = indexOf[root];
+            if (pending[start] != 0 || visited[start]) continue;
+            visited[start] = true;
+            stack.emplace_back(start, 0);
+            while (!stack.empty()) {
+                pair<size_t, size_t>& top = stack.back();
+                if (top.second < consumers[top.first].size()) {
+                    size_t next = consumers[top.first][top.second++];
+                    if (!visited[next]) {
+                        visited[next] = true;
+                        stack.emplace_back(next, 0);
+                    }
+                } else {
+                    postorder.push_back(top.first);
+                    stack.pop_back();
+                }
+            }
+        }
+        vector<size_t> rank(n);
+        for (size_t r = 0; r < n; ++r) rank[postorder[n - 1 - r]] = r;
+
+        // crossing[k]: streams whose producer and readers span the cut before rank k
+        vector<size_t> low(store.size(), none), high(store.size(), 0);
+        for (size_t i = 0; i < n; ++i) {
+            for (StreamId in : devices[i]->getInputs()) {
+                if (producer[in] == none) continue;
+                low[in] = min({low[in], rank[i], rank[producer[in]]});
+                high[in] = max({high[in], rank[i], rank[producer[in]]});
+            }
+        }
+        vector<long> crossing(n + 1, 0);
+        for (StreamId id = 0; id < store.size(); ++id) {
+            if (low[id] == none || low[id] == high[id]) continue;
+            ++crossing[low[id] + 1];
+            --crossing[high[id] + 1];
+        }
+        for (size_t k = 1; k <= n; ++k) crossing[k] += crossing[k - 1];
+
+        vector<size_t> cuts(1, 0);
+        size_t slack = n / parts / 2;
+        for (size_t j = 1; j < parts; ++j) {
+            size_t ideal = j * n / parts;
+            size_t first = max(cuts.back() + 1, ideal > slack ? ideal - slack : 0);
+            size_t last = min(ideal + slack, n - (parts - j));
+            size_t best = max(first, min(ideal, last));
+            for (size_t k = first; k <= last; ++k) {
+                size_t distance = k > ideal ? k - ideal : ideal - k;
+                size_t bestDistance = best > ideal ? best - ideal : ideal - best;
+                if (crossing[k] < crossing[best] || (crossing[k] == crossing[best] && distance < bestDistance)) best = k;
+            }
+            cuts.push_back(best);
+        }
+        cuts.push_back(n);
+
+        PartitionPlan plan;
+        plan.partitions.resize(parts);
+        vector<size_t> part(n);
+        for (size_t j = 0; j < parts; ++j) {
+            for (size_t r = cuts[j]; r < cuts[j + 1]; ++r) part[postorder[n - 1 - r]] = j;
+        }
+        for (Device* device : order) plan.partitions[part[indexOf[device]]].push_back(indexOf[device]);
+        vector<bool> cut(store.size(), false);
+        for (size_t i = 0; i < n; ++i) {
+            for (StreamId in : devices[i]->getInputs()) {
+                if (producer[in] != none && part[producer[in]] != part[i]) cut[in] = true;
+            }
+        }
+        for (StreamId id = 0; id < store.size(); ++id) {
+            if (cut[id]) plan.cutStreams.push_back(id);
+        }
+        return plan;
+    }
+
+    /**
+     * @brief Whether solveLinear() can use the direct path.
+     * @return true if every device is linear and I - M is regular.
+     * @throws std::string if a device is not fully wired
+     */
+    bool canSolveDirectly()
+    {
+        if (!linearValid || linearVersion != topologyVersion) buildLinearSystem();
+        return linearUsable;
+    }
+
+    /**
+     * @brief Solve a linear flowsheet, recycle loops included, without iterating.
+     *
+     * The sparse matrix I - M is assembled from the compiled devices and
+     * factored once per topology; each call only substitutes the current feed
+     * values forward and back. Falls back to converge() if a device has no
+     * linear form or the matrix is singular (a loop that recycles everything).
+     * @param options Settings of the converge() fallback.
+     * @return {true, 0, 0} on the direct path, otherwise the converge() result.
+     * @throws std::string if a device is not fully wired
+     */
+    RecycleResult solveLinear(const RecycleOptions& options = RecycleOptions())
+    {
+        if (!canSolveDirectly()) return converge(options);
+
+        const double* flows = store.massFlows();
+        for (size_t row = 0; row < linearUnknowns.size(); ++row) {
+            double rhs = linearBias[row];
+            for (size_t k = linearFeedStarts[row]; k < linearFeedStarts[row + 1]; ++k) {
+                rhs += linearFeeds[k].coefficient * flows[linearFeeds[k].stream];
+            }
+            linearRhs[row] = rhs;
+        }
+        linear.solve(linearRhs.data());
+        for (size_t row = 0; row < linearUnknowns.size(); ++row) store.setMassFlow(linearUnknowns[row], linearRhs[row]);
+        markSolved();
+        return RecycleResult{true, 0, 0.0};
+    }
+
+    /**
+     * @brief Re-run only the devices downstream of streams changed since the last solve.
+     *
+     * A device is evaluated when one of its inputs is dirty; its outputs only
+     * become dirty if their value actually changed, which stops propagation.
+     * Falls back to a full pass after a topology change.
+     * @return Number of devices evaluated.
+     */
+    size_t solveIncremental()
+    {
+        const vector<Device*>& order = getSchedule();
+        if (!tearStreams.empty()) {
+            throw string("Flowsheet contains a recycle loop");
+        }
+        if (!solvedOnce || solvedVersion != topologyVersion) {
+            solve();
+            return order.size();
+        }
+
+        const uint8_t* dirty = store.dirtyFlags();
+        size_t evaluated = 0;
+        for (Device* device : order) {
+            for (StreamId in : device->getInputs()) {
+                if (dirty[in]) {
+                    device->evaluate();
+                    ++evaluated;
+                    break;
+                }
+            }
+        }
+        store.clearDirty();
+        if (publishing) snapshot.publish(store);
+        return evaluated;
+    }
+
+    /**
+     * @brief Switch the flowsheet into batch mode with n scenarios per stream.
+     * @param n Number of scenarios; 0 leaves batch mode.
+     */
+    void setScenarioCount(size_t n) { store.setLanes(n); }
+
+    /**
+     * @brief Check the wiring of every device without throwing.
+     * @return One entry per device that is not ready to be updated.
+     */
+    vector<WiringIssue> validate() const
+    {
+        vector<WiringIssue> issues;
+        for (size_t i = 0; i < devices.size(); ++i) {
+            DeviceStatus status = devices[i]->validate();
+            if (!status) issues.push_back(WiringIssue{i, status.error});
+        }
+        return issues;
+    }
+
+    /**
+     * @brief Check that every fully wired device conserves mass, in one sweep over the store.
+     *
+     * The signed port list of all devices is built once per topology; each
+     * check gathers every port's mass flow in a single vectorized pass and
+     * sums the residuals per device. It reads the store as it is, so after an
+     * optimized solveTape() pass devices around stale intermediate streams
+     * may be reported; run solve() or pin those streams first.
+     * @param options Tolerance and how many offenders to report.
+     * @return Overall closure and the worst devices.
+     */
+    BalanceReport checkMassBalance(const BalanceOptions& options = BalanceOptions())
+    {
+        if (!balanceValid || balanceVersion != topologyVersion) {
+            balancePorts.clear();
+            balanceSigns.clear();
+            balanceDevices.clear();
+            balanceStarts.assign(1, 0);
+            for (size_t i = 0; i < devices.size(); ++i) {
+                if (!devices[i]->validate()) continue;
+                for (StreamId in : devices[i]->getInputs()) {
+                    balancePorts.push_back(in);
+                    balanceSigns.push_back(1.0);
+                }
+                for (StreamId out : devices[i]->getOutputs()) {
+                    balancePorts.push_back(out);
+                    balanceSigns.push_back(-1.0);
+                }
+                balanceDevices.push_back(i);
+                balanceStarts.push_back(balancePorts.size());
+            }
+            balanceTerms.resize(balancePorts.size());
+            balanceVersion = topologyVersion;
+            balanceValid = true;
+        }
+
+        const double* flows = store.massFlows();
+        if (store.components() > 0) {
+            balanceTotals.resize(store.size());
+            for (StreamId id = 0; id < store.size(); ++id) balanceTotals[id] = store.totalMass(id);
+            flows = balanceTotals.data();
+        }
+        gatherScaled(balanceTerms.data(), flows, balancePorts.data(), balanceSigns.data(), balancePorts.size());
+
+        BalanceReport report = {balanceDevices.size(), 0, 0.0, {}};
+        vector<BalanceIssue>& issues = balanceIssues;
+        issues.resize(balanceDevices.size());
+        for (size_t d = 0; d < balanceDevices.size(); ++d) {
+            double residual = 0.0;
+            for (size_t k = balanceStarts[d]; k < balanceStarts[d + 1]; ++k) residual += balanceTerms[k];
+            issues[d] = BalanceIssue{balanceDevices[d], residual};
+            report.maxResidual = max(report.maxResidual, fabs(residual));
+            if (fabs(residual) > options.tolerance) ++report.violations;
+        }
+
+        size_t listed = min(options.worstCount, issues.size());
+        partial_sort(issues.begin(), issues.begin() + listed, issues.end(),
+                     [](const BalanceIssue& a, const BalanceIssue& b) { return fabs(a.residual) > fabs(b.residual); });
+        report.worst.assign(issues.begin(), issues.begin() + listed);
+        return report;
+    }
+
+    /**
+     * @brief Validate all devices up front, then run one pass if the wiring is complete.
+     * @return The first wiring problem in device insertion order, if any.
+     * @throws std::string if the wiring is not a DAG
+     */
+    DeviceStatus trySolve()
+    {
+        for (const auto& device : devices) {
+            DeviceStatus status = device->validate();
+            if (!status) return status;
+        }
+        solve();
+        return DeviceError::None;
+    }
+
+    /**
+     * @brief Evaluate every scenario lane in one pass over the schedule.
+     * @throws std::string if batch mode is off
+     */
+    void solveBatch()
+    {
+        if (store.lanes() == 0) {
+            throw string("Batch mode is not enabled");
+        }
+        for (Device* device : getSchedule()) device->updateOutputsBatch();
+    }
+
+    /**
+     * @brief Switch the flowsheet's streams to per-component flows.
+     * @param n Number of species; 0 returns to scalar mass flows.
+     */
+    void setComponentCount(size_t n) { store.setComponents(n); }
+
+    /**
+     * @brief Run one pass over the component vectors of every stream.
+     * @throws std::string if multi-component mode is off
+     */
+    void solveComponents()
+    {
+        if (store.components() == 0) {
+            throw string("Multi-component mode is not enabled");
+        }
+        for (Device* device : getSchedule()) device->updateComponents();
+        if (publishing) snapshot.publish(store);
+    }
+
+    /**
+     * @brief Switch the flowsheet's streams to carry derivative directions.
+     * @param n Number of directions; 0 turns tangent mode off.
+     */
+    void setTangentDirections(size_t n) { store.setTangents(n); }
+
+    /**
+     * @brief Solve the flowsheet and its tangents in one pass over the schedule.
+     *
+     * Each device updates its output values and then pushes every seeded
+     * direction through the same ports, so all directions cost one traversal.
+     * @throws std::string if tangent mode is off, the flowsheet has recycle loops or a device has no row kernel
+     */
+    void solveTangents()
+    {
+        if (store.tangents() == 0) {
+            throw string("Tangent mode is not enabled");
+        }
+        if (!getTearStreams().empty()) {
+            throw string("Flowsheet contains a recycle loop");
+        }
+        for (Device* device : schedule) {
+            device->evaluate();
+            device->updateTangents();
+        }
+        markSolved();
+    }
+
+    /**
+     * @brief Derivatives of outlet mass flows with respect to feed mass flows.
+     *
+     * Seeds one tangent direction per feed, solves once and reads the outlets'
+     * tangents back; the previous tangent layout is restored afterwards.
+     * @param outlets Streams whose sensitivities are wanted.
+     * @param feeds Inlet streams to differentiate against.
+     * @return outlets.size() x feeds.size() matrix, row-major.
+     * @throws std::string under the same conditions as solveTangents()
+     */
+    vector<double> jacobian(const vector<StreamId>& outlets, const vector<StreamId>& feeds)
+    {
+        size_t previous = store.tangents();
+        store.setTangents(feeds.size());
+        for (size_t j = 0; j < feeds.size(); ++j) store.tangentValues(feeds[j])[j] = 1.0;
+        try {
+            solveTangents();
+        } catch (...) {
+            store.setTangents(previous);
+            throw;
+        }
+        vector<double> result(outlets.size() * feeds.size());
+        for (size_t i = 0; i < outlets.size(); ++i) {
+            const double* row = store.tangentValues(outlets[i]);
+            copy(row, row + feeds.size(), result.begin() + i * feeds.size());
+        }
+        store.setTangents(previous);
+        return result;
+    }
+
+    /**
+     * @brief Dump the profiles of the flowsheet's devices, labelled by insertion index.
+     * @param out Destination stream; prints nothing unless DEVICE_PROFILING is on.
+     */
+    void dumpProfile(ostream& out) const
+    {
+        vector<DeviceProfile> profiles = deviceProfiles();
+        for (size_t i = 0; i < devices.size(); ++i) {
+            for (const DeviceProfile& profile : profiles) {
+                if (profile.device != devices[i].get()) continue;
+                writeProfileLine(out, "#" + to_string(i) + " " + devices[i]->typeName(), profile);
+            }
+        }
+    }
+
+    /**
+     * @brief Get the store holding the data of the flowsheet's streams.
+     * @return The flowsheet's stream store.
+     */
+    StreamStore& getStore() { return store; }
+    const StreamStore& getStore() const { return store; }
+
+    size_t deviceCount() const { return devices.size(); }
+    size_t streamCount() const { return store.size(); }
+};
+
+/**
+ * @class ParallelExecutor
+ * @brief Runs the levels of a flowsheet schedule on a work-stealing thread pool.
+ *
+ * Devices of one dependency level never feed each other, so each level is cut
+ * into chunks of at most `grain` devices and the chunks are spread over
+ * per-thread deques. Idle threads steal from the other deques. Levels no
+ * larger than one chunk run inline on the calling thread. Every stream has a
+ * single producer, so results are identical to a serial solve.
+ */
+class ParallelExecutor
+{
+private:
+    struct Task {
+        Device* const* begin;
+        Device* const* end;
+    };
+
+    struct WorkQueue {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    size_t grain;                       ///< Maximum devices per task.
+    vector<unique_ptr<WorkQueue>> queues; ///< One deque per thread; 0 belongs to the caller.
+    vector<thread> workers;             ///< Background threads 1..n-1.
+    mutex stateLock;
+    condition_variable wake;            ///< Signals a new level or shutdown.
+    condition_variable done;            ///< Signals that a level has finished.
+    unsigned generation = 0;            ///< Bumped once per dispatched level.
+    bool stopping = false;
+    atomic<size_t> remaining;           ///< Tasks of the current level not yet finished.
+    exception_ptr failure;              ///< First exception thrown by a task.
+
+    bool popTask(size_t self, Task& task)
+    {
+        {
+            lock_guard<mutex> guard(queues[self]->lock);
+            if (!queues[self]->tasks.empty()) {
+                task = queues[self]->tasks.back();
+                queues[self]->tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i) {
+            WorkQueue& victim = *queues[(self + i) % queues.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void runTasks(size_t self)
+    {
+        Task task;
+        while (popTask(self, task)) {
+            try {
+                for (Device* const* device = task.begin; device != task.end; ++device) {
+                    (*device)->evaluate();
+                }
+            } catch (...) {
+                lock_guard<mutex> guard(stateLock);
+                if (!failure) failure = current_exception();
+            }
+            if (remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+                lock_guard<mutex> guard(stateLock);
+                done.notify_all();
+            }
+        }
+    }
+
+    void workerLoop(size_t self)
+    {
+        unsigned seen = 0;
+        for (;;) {
+            {
+                unique_lock<mutex> guard(stateLock);
+                wake.wait(guard, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            runTasks(self);
+        }
+    }
+
+    void runLevel(Device* const* begin, Device* const* end)
+    {
+        size_t count = end - begin;
+        if (workers.empty() || count <= grain) {
+            for (Device* const* device = begin; device != end; ++device) (*device)->evaluate();
+            return;
+        }
+
+        // Workers still draining the previous level may pop these tasks at once,
+        // so the counter must be set before the first one is queued
+        size_t tasks = (count + grain - 1) / grain;
+        {
+            lock_guard<mutex> guard(stateLock);
+            remaining.store(tasks, memory_order_release);
+            ++generation;
+        }
+        size_t index = 0;
+        for (Device* const* chunk = begin; chunk < end; chunk += grain, ++index) {
+            Task task = {chunk, chunk + min(grain, (size_t)(end - chunk))};
+            WorkQueue& queue = *queues[index % queues.size()];
+            lock_guard<mutex> guard(queue.lock);
+            queue.tasks.push_back(task);
+        }
+        wake.notify_all();
+
+        runTasks(0);
+        unique_lock<mutex> guard(stateLock);
+        done.wait(guard, [&]() { return remaining.load(memory_order_acquire) == 0; });
+        if (failure) {
+            exception_ptr error = failure;
+            failure = nullptr;
+            rethrow_exception(error);
+        }
+    }
+
+public:
+    /**
+     * @brief Start the thread pool.
+     * @param threads Total threads including the caller; 0 uses the hardware concurrency.
+     * @param grain Devices grouped into one task; small levels run inline.
+     */
+    explicit ParallelExecutor(size_t threads = 0, size_t grain = 64)
+        : grain(max(grain, (size_t)1)), remaining(0)
+    {
+        if (threads == 0) threads = max(thread::hardware_concurrency(), 1u);
+        for (size_t i = 0; i < threads; ++i) queues.emplace_back(new WorkQueue());
+        for (size_t i = 1; i < threads; ++i) workers.emplace_back(&ParallelExecutor::workerLoop, this, i);
+    }
+
+    ParallelExecutor(const ParallelExecutor&) = delete;
+    ParallelExecutor& operator=(const ParallelExecutor&) = delete;
+
+    ~ParallelExecutor()
+    {
+        {
+            lock_guard<mutex> guard(stateLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : workers) worker.join();
+    }
+
+    size_t threadCount() const { return queues.size(); }
+
+    /**
+     * @brief Run one full pass of the flowsheet, level by level.
+     * @param flowsheet The flowsheet to solve.
+     * @throws the first exception thrown by any device, after its level finished
+     */
+    void solve(Flowsheet& flowsheet)
+    {
+        if (!flowsheet.getTearStreams().empty()) {
+            throw string("Flowsheet contains a recycle loop");
+        }
+        const vector<Device*>& order = flowsheet.getLevelOrder();
+        const vector<size_t>& starts = flowsheet.getLevelStarts();
+        for (size_t level = 0; level + 1 < starts.size(); ++level) {
+            runLevel(order.data() + starts[level], order.data() + starts[level + 1]);
+        }
+        flowsheet.markSolved();
+    }
+};
+
+/**
+ * @struct IngestOptions
+ * @brief Batching settings of a SensorIngestor.
+ */
+struct IngestOptions {
+    chrono::microseconds maxDelay = chrono::microseconds(1000); ///< Longest a reading waits for more to join its batch.
+    size_t maxBatch = 4096;                                      ///< Readings that close a batch without waiting.
+};
+
+/**
+ * @struct IngestStats
+ * @brief Counters of a SensorIngestor.
+ */
+struct IngestStats {
+    uint64_t readings; ///< Readings posted.
+    uint64_t batches;  ///< Batches applied, one incremental solve each.
+    uint64_t devices;  ///< Devices re-evaluated by those solves.
+};
+
+/**
+ * @class SensorIngestor
+ * @brief Event loop that feeds live readings into a flowsheet's inlet streams.
+ *
+ * Any thread may post() readings; a background thread waits for the first
+ * reading of a burst, lets the burst build up for at most maxDelay, then
+ * applies the whole batch (the latest value per stream wins) and runs one
+ * solveIncremental(). While the ingestor runs it is the only writer of the
+ * flowsheet; monitor the results through Flowsheet::setPublishing().
+ */
+class SensorIngestor
+{
+private:
+    typedef chrono::steady_clock Clock;
+
+    Flowsheet& flowsheet;
+    IngestOptions options;
+    mutex stateLock;
+    condition_variable wake;               ///< Signals new readings, a flush or shutdown.
+    condition_variable done;               ///< Signals that a batch was solved.
+    vector<pair<StreamId, double>> pending; ///< Readings not yet applied, in arrival order.
+    Clock::time_point firstPending;        ///< Arrival of the oldest pending reading.
+    uint64_t posted = 0;                   ///< Readings accepted so far.
+    uint64_t solved = 0;                   ///< Readings whose batch has been solved.
+    unsigned flushes = 0;                  ///< Callers waiting in flush().
+    bool stopping = false;
+    IngestStats stats = {0, 0, 0};
+    exception_ptr failure;                 ///< First exception thrown by a solve.
+    thread loop;
+
+    void run()
+    {
+        vector<pair<StreamId, double>> batch;
+        unique_lock<mutex> guard(stateLock);
+        for (;;) {
+            wake.wait(guard, [&]() { return stopping || !pending.empty(); });
+            if (pending.empty()) return;
+            wake.wait_until(guard, firstPending + options.maxDelay, [&]() {
+                return stopping || flushes > 0 || pending.size() >= options.maxBatch;
+            });
+            batch.swap(pending);
+            uint64_t upto = posted;
+            guard.unlock();
+
+            size_t evaluated = 0;
+            exception_ptr error;
+            try {
+                StreamStore& store = flowsheet.getStore();
+                for (const pair<StreamId, double>& reading : batch) store.setMassFlow(reading.first, reading.second);
+                evaluated = flowsheet.solveIncremental();
+            } catch (...) {
+                error = current_exception();
+            }
+            batch.clear();
+
+            guard.lock();
+            if (error && !failure) failure = error;
+            solved = upto;
+            ++stats.batches;
+            stats.devices += evaluated;
+            done.notify_all();
+        }
+    }
+
+public:
+    /**
+     * @brief Start the event loop.
+     * @param flowsheet Flowsheet whose inlet streams receive the readings; must outlive the ingestor.
+     * @param options Batching settings.
+     */
+    explicit SensorIngestor(Flowsheet& flowsheet, const IngestOptions& options = IngestOptions())
+        : flowsheet(flowsheet), options(options), loop(&SensorIngestor::run, this) {}
+
+    SensorIngestor(const SensorIngestor&) = delete;
+    SensorIngestor& operator=(const SensorIngestor&) = delete;
+
+    /**
+     * @brief Apply and solve every reading still pending, then stop the loop.
+     */
+    ~SensorIngestor()
+    {
+        {
+            lock_guard<mutex> guard(stateLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        loop.join();
+    }
+
+    /**
+     * @brief Queue a reading; returns at once.
+     * @param id Inlet stream of the flowsheet.
+     * @param massFlow The measured mass flow.
+     */
+    void post(StreamId id, double massFlow)
+    {
+        bool notify;
+        {
+            lock_guard<mutex> guard(stateLock);
+            if (pending.empty()) firstPending = Clock::now();
+            pending.emplace_back(id, massFlow);
+            notify = pending.size() == 1 || pending.size() == options.maxBatch;
+            ++posted;
+            ++stats.readings;
+        }
+        if (notify) wake.notify_one();
+    }
+
+    void post(const Stream& stream, double massFlow) { post(stream.getId(), massFlow); }
+
+    /**
+     * @brief Wait until every reading posted so far has been applied and solved.
+     * @throws the first exception thrown by a solve, which is then cleared
+     */
+    void flush()
+    {
+        unique_lock<mutex> guard(stateLock);
+        uint64_t target = posted;
+        ++flushes;
+        wake.notify_one();
+        done.wait(guard, [&]() { return solved >= target; });
+        --flushes;
+        if (failure) {
+            exception_ptr error = failure;
+            failure = nullptr;
+            rethrow_exception(error);
+        }
+    }
+
+    IngestStats getStats()
+    {
+        lock_guard<mutex> guard(stateLock);
+        return stats;
+    }
+};
+
+/**
+ * @brief File layouts written by ResultExporter.
+ */
+enum class ExportFormat {
+    Csv,     ///< "name,mass_flow" text, one row per stream.
+    Columnar ///< Binary ColumnarHeader, then the mass flow and name columns.
+};
+
+const uint32_t COLUMNAR_VERSION = 1;       ///< Layout written for ExportFormat::Columnar.
+const size_t EXPORT_BUFFER_SIZE = 1 << 20; ///< Bytes collected before each write to the file.
+
+/**
+ * @struct ColumnarHeader
+ * @brief Start of a columnar export.
+ *
+ * Followed by 8-byte aligned sections: one double mass flow per row, rows + 1
+ * uint64 offsets into the name bytes, and the concatenated names.
+ */
+struct ColumnarHeader {
+    char magic[8];      ///< "FLOWCOLS".
+    uint32_t version;   ///< COLUMNAR_VERSION.
+    uint32_t byteOrder; ///< SNAPSHOT_BYTE_ORDER as written.
+    uint64_t rows;      ///< Number of streams.
+    uint64_t nameBytes; ///< Length of the name column.
+};
+
+/**
+ * @class ResultExporter
+ * @brief Writes the name and mass flow of every stream in one buffered pass.
+ *
+ * write() exports synchronously straight from the store. writeAsync() copies
+ * the mass flows and names first and writes on a background thread, so the
+ * flowsheet can be solved again at once.
+ */
+class ResultExporter
+{
+private:
+    /**
+     * @class Output
+     * @brief Buffer in front of a file; writes it in EXPORT_BUFFER_SIZE pieces.
+     */
+    class Output
+    {
+    private:
+        FILE* file;
+        vector<char> buffer;
+        size_t used = 0;
+        bool failed = false;
+
+    public:
+        explicit Output(const string& path) : file(fopen(path.c_str(), "wb")), buffer(EXPORT_BUFFER_SIZE)
+        {
+            if (!file) throw "Cannot create "s + path;
+        }
+        Output(const Output&) = delete;
+        Output& operator=(const Output&) = delete;
+        ~Output() { if (file) fclose(file); }
+
+        /**
+         * @brief Get room for at most `bytes` bytes; fill it, then commit().
+         */
+        char* reserve(size_t bytes)
+        {
+            if (buffer.size() - used < bytes) drain();
+            if (buffer.size() < bytes) buffer.resize(bytes);
+            return buffer.data() + used;
+        }
+        void commit(size_t bytes) { used += bytes; }
+
+        void write(const void* data, size_t bytes)
+        {
+            if (bytes >= buffer.size()) {
+                drain();
+                if (fwrite(data, 1, bytes, file) != bytes) failed = true;
+                return;
+            }
+            memcpy(reserve(bytes), data, bytes);
+            commit(bytes);
+        }
+
+        /**
+         * @brief Pad the output with zeros to a multiple of 8 bytes.
+         * @param written Bytes of the section just written.
+         */
+        void align(size_t written)
+        {
+            static const char padding[8] = {};
+            write(padding, snapshotAlign(written) - written);
+        }
+
+        void drain()
+        {
+            if (used && fwrite(buffer.data(), 1, used, file) != used) failed = true;
+            used = 0;
+        }
+
+        /**
+         * @brief Write what is buffered and close the file.
+         * @throws std::string if any write failed
+         */
+        void close(const string& path)
+        {
+            drain();
+            int closed = fclose(file);
+            file = nullptr;
+            if (failed || closed != 0) throw "Cannot write "s + path;
+        }
+    };
+
+    /**
+     * @brief Format the default name "s<number>".
+     * @return Characters written to out, which holds at least 11.
+     */
+    static size_t formatNumberName(char* out, uint32_t number)
+    {
+        char digits[10];
+        size_t count = 0;
+        do {
+            digits[count++] = (char)('0' + number % 10);
+            number /= 10;
+        } while (number);
+        out[0] = 's';
+        for (size_t i = 0; i < count; ++i) out[1 + i] = digits[count - 1 - i];
+        return count + 1;
+    }
+
+    static void writeCsvName(Output& output, const string& name)
+    {
+        if (name.find_first_of(",\"\r\n") == string::npos) {
+            output.write(name.data(), name.size());
+            return;
+        }
+        output.write("\"", 1);
+        for (char c : name) {
+            if (c == '"') output.write("\"", 1);
+            output.write(&c, 1);
+        }
+        output.write("\"", 1);
+    }
+
+    /**
+     * @brief Export stream results.
+     * @param flows Mass flow of each stream.
+     * @param numbers Numeric identity of each stream.
+     * @param count Number of streams.
+     * @param names Custom names; the other streams are named "s<number>".
+     * @param format The file layout.
+     * @param path The file to create or overwrite.
+     * @throws std::string if the file cannot be written
+     */
+    static void writeRows(const double* flows, const uint32_t* numbers, size_t count,
+                          const unordered_map<StreamId, string>& names, ExportFormat format, const string& path)
+    {
+        Output output(path);
+        if (format == ExportFormat::Csv) {
+            const char heading[] = "name,mass_flow\n";
+            output.write(heading, sizeof(heading) - 1);
+            for (size_t i = 0; i < count; ++i) {
+                auto custom = names.empty() ? names.end() : names.find((StreamId)i);
+                if (custom != names.end()) {
+                    writeCsvName(output, custom->second);
+                    output.write(",", 1);
+                } else {
+                    char* row = output.reserve(12);
+                    size_t length = formatNumberName(row, numbers[i]);
+                    row[length] = ',';
+                    output.commit(length + 1);
+                }
+                char* value = output.reserve(32);
+                int length = snprintf(value, 32, "%.17g\n", flows[i]);
+                output.commit((size_t)length);
+            }
+        } else {
+            vector<uint64_t> offsets(count + 1, 0);
+            for (size_t i = 0; i < count; ++i) {
+                auto custom = names.empty() ? names.end() : names.find((StreamId)i);
+                char name[12];
+                size_t length = custom != names.end() ? custom->second.size() : formatNumberName(name, numbers[i]);
+                offsets[i + 1] = offsets[i] + length;
+            }
+            ColumnarHeader header;
+            memcpy(header.magic, "FLOWCOLS", sizeof(header.magic));
+            header.version = COLUMNAR_VERSION;
+            header.byteOrder = SNAPSHOT_BYTE_ORDER;
+            header.rows = count;
+            header.nameBytes = offsets[count];
+            output.write(&header, sizeof(header));
+            output.write(flows, count * sizeof(double));
+            output.write(offsets.data(), offsets.size() * sizeof(uint64_t));
+            for (size_t i = 0; i < count; ++i) {
+                auto custom = names.empty() ? names.end() : names.find((StreamId)i);
+                if (custom != names.end()) {
+                    output.write(custom->second.data(), custom->second.size());
+                } else {
+                    char* name = output.reserve(12);
+                    output.commit(formatNumberName(name, numbers[i]));
+                }
+            }
+            output.align((size_t)offsets[count]);
+        }
+        output.close(path);
+    }
+
+    vector<double> flows;                  ///< Copy being written by the worker.
+    vector<uint32_t> numbers;              ///< Stream numbers of the copy.
+    unordered_map<StreamId, string> names; ///< Custom names of the copy.
+    thread worker;
+    exception_ptr failure;                 ///< Error of the last background write.
+
+public:
+    ResultExporter() {}
+    ResultExporter(const ResultExporter&) = delete;
+    ResultExporter& operator=(const ResultExporter&) = delete;
+
+    /**
+     * @brief Finish a background write; its errors are dropped.
+     */
+    ~ResultExporter()
+    {
+        if (worker.joinable()) worker.join();
+    }
+
+    /**
+     * @brief Export a store's results now.
+     * @param store The streams to export.
+     * @param path The file to create or overwrite.
+     * @param format The file layout.
+     * @throws std::string if the file cannot be written
+     */
+    static void write(const StreamStore& store, const string& path, ExportFormat format = ExportFormat::Csv)
+    {
+        writeRows(store.massFlows(), store.streamNumbers(), store.size(), store.customNames(), format, path);
+    }
+
+    /**
+     * @brief Copy a store's results and export them on a background thread.
+     *
+     * Waits for the previous background write first.
+     * @param store The streams to export; free to change once this returns.
+     * @param path The file to create or overwrite.
+     * @param format The file layout.
+     * @throws std::string if the previous background write failed; this one is then not started
+     */
+    void writeAsync(const StreamStore& store, const string& path, ExportFormat format = ExportFormat::Csv)
+    {
+        wait();
+        flows.assign(store.massFlows(), store.massFlows() + store.size());
+        numbers.assign(store.streamNumbers(), store.streamNumbers() + store.size());
+        names = store.customNames();
+        worker = thread([this, path, format]() {
+            try {
+                writeRows(flows.data(), numbers.data(), flows.size(), names, format, path);
+            } catch (...) {
+                failure = current_exception();
+            }
+        });
+    }
+
+    /**
+     * @brief Block until the background write is done.
+     * @throws std::string if it failed
+     */
+    void wait()
+    {
+        if (worker.joinable()) worker.join();
+        if (failure) {
+            exception_ptr error = failure;
+            failure = nullptr;
+            rethrow_exception(error);
+        }
+    }
+};
+
+/**
+ * @class QuantileEstimator
+ * @brief Streaming estimate of one quantile in constant memory (the P-square algorithm).
+ *
+ * Five markers track the minimum, the maximum, the quantile and two points
+ * halfway to it; each new value moves the markers by at most one position
+ * and adjusts their heights by piecewise-parabolic interpolation.
+ */
+class QuantileEstimator
+{
+private:
+    double probability;
+    uint64_t count = 0;
+    double heights[5];
+    double positions[5];
+    double desired[5];
+    double increments[5];
+
+    double parabolic(int i, double d) const
+    {
+        return heights[i] + d / (positions[i + 1] - positions[i - 1]) *
+            ((positions[i] - positions[i - 1] + d) * (heights[i + 1] - heights[i]) / (positions[i + 1] - positions[i]) +
+             (positions[i + 1] - positions[i] - d) * (heights[i] - heights[i - 1]) / (positions[i] - positions[i - 1]));
+    }
+
+    double linear(int i, int d) const
+    {
+        return heights[i] + d * (heights[i + d] - heights[i]) / (positions[i + d] - positions[i]);
+    }
+
+public:
+    /**
+     * @param probability The quantile, between 0 and 1.
+     */
+    explicit QuantileEstimator(double probability) : probability(probability)
+    {
+        const double steps[5] = {0.0, probability / 2, probability, (1 + probability) / 2, 1.0};
+        copy(steps, steps + 5, increments);
+    }
+
+    void add(double x)
+    {
+        if (count < 5) {
+            heights[count++] = x;
+            if (count == 5) {
+                sort(heights, heights + 5);
+                const double start[5] = {0.0, 2 * probability, 4 * probability, 2 + 2 * probability, 4.0};
+                for (int i = 0; i < 5; ++i) positions[i] = i;
+                copy(start, start + 5, desired);
+            }
+            return;
+        }
+        int cell;
+        if (x < heights[0]) {
+            heights[0] = x;
+            cell = 0;
+        } else if (x >= heights[4]) {
+            heights[4] = x;
+            cell = 3;
+        } else {
+            cell = 0;
+            while (x >= heights[cell + 1]) ++cell;
+        }
+        for (int i = cell + 1; i < 5; ++i) positions[i] += 1.0;
+        for (int i = 0; i < 5; ++i) desired[i] += increments[i];
+        ++count;
+
+        for (int i = 1; i <= 3; ++i) {
+            double d = desired[i] - positions[i];
+            if ((d >= 1.0 && positions[i + 1] - positions[i] > 1.0) || (d <= -1.0 && positions[i - 1] - positions[i] < -1.0)) {
+                int step = d >= 0.0 ? 1 : -1;
+                double height = parabolic(i, step);
+                heights[i] = heights[i - 1] < height && height < heights[i + 1] ? height : linear(i, step);
+                positions[i] += step;
+            }
+        }
+    }
+
+    /**
+     * @brief Current estimate; exact while fewer than six values were added.
+     * @return The quantile, or 0 before the first value.
+     */
+    double value() const
+    {
+        if (count == 0) return 0.0;
+        if (count <= 5) {
+            double sorted[5];
+            copy(heights, heights + count, sorted);
+            sort(sorted, sorted + count);
+            return sorted[(size_t)(probability * (count - 1) + 0.5)];
+        }
+        return heights[2];
+    }
+};
+
+/**
+ * @struct SweepOptions
+ * @brief Settings of a SweepRunner.
+ */
+struct SweepOptions {
+    size_t threads = 0;   ///< Threads including the caller; 0 uses the hardware concurrency.
+    size_t batch = 256;   ///< Scenarios a thread evaluates before merging them into the statistics.
+    vector<double> quantiles = vector<double>{0.05, 0.5, 0.95}; ///< Percentiles estimated per outlet.
+    bool compact = false; ///< Keep every thread's mass flows as float, see FlowsheetTape::run(float*).
+};
+
+/**
+ * @struct OutletStats
+ * @brief Distribution of one outlet's mass flow over a sweep.
+ */
+struct OutletStats {
+    StreamId stream;          ///< The outlet.
+    uint64_t count;           ///< Scenarios seen.
+    double mean;
+    double variance;          ///< Sample variance; 0 for fewer than two scenarios.
+    double min;
+    double max;
+    vector<double> quantiles; ///< Estimates for SweepOptions::quantiles, in the same order.
+};
+
+/**
+ * @struct SweepResult
+ * @brief Statistics of a whole sweep.
+ */
+struct SweepResult {
+    size_t scenarios;            ///< Scenarios evaluated.
+    vector<OutletStats> outlets; ///< One entry per outlet, in the runner's order.
+};
+
+/**
+ * @class SweepScenario
+ * @brief One worker's copy of the flowsheet, handed to the scenario generator.
+ *
+ * Changes apply to the current scenario only; the runner restores every
+ * touched feed and split before the next one.
+ */
+class SweepScenario
+{
+    friend class SweepRunner;
+
+private:
+    vector<double> values;            ///< The worker's mass flows; empty in compact mode.
+    vector<float> compactValues;      ///< The worker's mass flows in compact mode.
+    bool compact = false;
+    FlowsheetTape tape;               ///< The worker's clone of the compiled flowsheet.
+    const vector<double>* baseValues; ///< Mass flows every scenario starts from.
+    const FlowsheetTape* baseTape;    ///< Coefficients every scenario starts from.
+    const unordered_map<StreamId, uint32_t>* splits; ///< First output of each split -> its instruction.
+    vector<StreamId> touchedStreams;
+    vector<uint32_t> touchedSplits;
+
+    void reset()
+    {
+        for (StreamId id : touchedStreams) {
+            if (compact) compactValues[id] = (float)(*baseValues)[id];
+            else values[id] = (*baseValues)[id];
+        }
+        const vector<TapeOperand>& pool = baseTape->operandPool();
+        for (uint32_t index : touchedSplits) {
+            const TapeInstruction& in = baseTape->instructions()[index];
+            for (uint32_t i = 0; i < in.count; ++i) tape.setCoefficient(in.first + i, pool[in.first + i].coefficient);
+        }
+        touchedStreams.clear();
+        touchedSplits.clear();
+    }
+
+    void evaluate()
+    {
+        if (compact) tape.run(compactValues.data());
+        else tape.run(values.data());
+    }
+
+public:
+    /**
+     * @brief Set a feed for this scenario.
+     * @param id The stream index.
+     * @param m The mass flow.
+     */
+    void setMassFlow(StreamId id, double m)
+    {
+        touchedStreams.push_back(id);
+        if (compact) compactValues[id] = (float)m;
+        else values[id] = m;
+    }
+    void setMassFlow(const Stream& s, double m) { setMassFlow(s.getId(), m); }
+    double getMassFlow(StreamId id) const { return compact ? compactValues[id] : values[id]; }
+
+    /**
+     * @brief Override the shares of a splitting device (Splitter, double Reactor or StaticReactor).
+     * @param device The device; its outputs get fractions[i] of the input.
+     * @param fractions One share per output.
+     * @param count Number of shares.
+     * @throws std::string if the device compiles to no split or the count differs
+     */
+    void setFractions(const Device& device, const double* fractions, size_t count)
+    {
+        auto split = device.getOutputs().empty() ? splits->end() : splits->find(device.getOutputs()[0]);
+        if (split == splits->end()) throw "Device has no split in the compiled flowsheet: "s + device.typeName();
+        const TapeInstruction& in = tape.instructions()[split->second];
+        if (in.count != count) throw string("Wrong number of split fractions");
+        touchedSplits.push_back(split->second);
+        for (uint32_t i = 0; i < in.count; ++i) tape.setCoefficient(in.first + i, fractions[i]);
+    }
+    void setFractions(const Device& device, initializer_list<double> fractions)
+    {
+        setFractions(device, fractions.begin(), fractions.size());
+    }
+};
+
+/**
+ * @class SweepRunner
+ * @brief Evaluates many perturbed scenarios of one flowsheet in parallel.
+ *
+ * The flowsheet is compiled once; every thread then works on its own clone
+ * of the tape and of the mass flows, so scenarios never touch the flowsheet
+ * itself. Threads evaluate batches of scenarios into a local buffer of outlet
+ * values and merge each batch into running statistics, so memory does not
+ * grow with the number of scenarios. Every outlet has its own lock and each
+ * thread starts merging at a different outlet, so merges run side by side.
+ */
+class SweepRunner
+{
+private:
+    FlowsheetTape tape;
+    vector<double> baseValues;
+    unordered_map<StreamId, uint32_t> splits;
+    vector<StreamId> outlets;
+    SweepOptions options;
+
+public:
+    /**
+     * @brief Compile a flowsheet for sweeping.
+     * @param flowsheet The flowsheet; its current mass flows are the base scenario. It is not used after construction.
+     * @param outlets Streams to collect statistics for; empty selects every product stream.
+     * @param options Threads, batching and quantiles.
+     * @throws std::string if the flowsheet has recycle loops or devices without an instruction form
+     */
+    explicit SweepRunner(Flowsheet& flowsheet, const vector<StreamId>& outlets = vector<StreamId>(),
+                         const SweepOptions& options = SweepOptions())
+        : tape(flowsheet.getTape()), outlets(outlets), options(options)
+    {
+        const StreamStore& store = flowsheet.getStore();
+        baseValues.assign(store.massFlows(), store.massFlows() + store.size());
+        vector<bool> read(store.size(), false), written(store.size(), false);
+        const vector<TapeOperand>& pool = tape.operandPool();
+        for (size_t index = 0; index < tape.size(); ++index) {
+            const TapeInstruction& in = tape.instructions()[index];
+            const TapeOperand* o = pool.data() + in.first;
+            switch (in.op) {
+            case TapeOp::Sum:
+            case TapeOp::Copy:
+                for (uint32_t i = 0; i < in.count; ++i) read[o[i].stream] = true;
+                written[in.stream] = true;
+                break;
+            case TapeOp::Split:
+                read[in.stream] = true;
+                for (uint32_t i = 0; i < in.count; ++i) written[o[i].stream] = true;
+                if (in.count > 0) splits[o[0].stream] = (uint32_t)index;
+                break;
+            case TapeOp::Call:
+                throw "Device cannot be swept in parallel: "s + in.device->typeName();
+            }
+        }
+        if (this->outlets.empty()) {
+            for (StreamId id = 0; id < store.size(); ++id) {
+                if (written[id] && !read[id]) this->outlets.push_back(id);
+            }
+        }
+        if (this->options.threads == 0) this->options.threads = max(thread::hardware_concurrency(), 1u);
+        this->options.batch = max(this->options.batch, (size_t)1);
+    }
+
+    const vector<StreamId>& getOutlets() const { return outlets; }
+
+    /**
+     * @brief Evaluate scenarios 0 .. count-1.
+     * @param count Number of scenarios.
+     * @param generator Called once per scenario, from several threads at once, to perturb the
+     *        worker's copy; seed any random numbers from the scenario index.
+     * @return Statistics of every outlet.
+     * @throws whatever the generator throws; the remaining scenarios are skipped
+     */
+    SweepResult run(size_t count, const function<void(size_t, SweepScenario&)>& generator)
+    {
+        struct Accumulator {
+            uint64_t count = 0;
+            double mean = 0.0, m2 = 0.0;
+            double min = 0.0, max = 0.0;
+            vector<QuantileEstimator> quantiles;
+        };
+        vector<Accumulator> totals(outlets.size());
+        for (Accumulator& total : totals) {
+            for (double q : options.quantiles) total.quantiles.emplace_back(q);
+        }
+        unique_ptr<mutex[]> totalLocks(new mutex[max(outlets.size(), (size_t)1)]);
+        mutex failureLock;
+        atomic<size_t> next(0);
+        atomic<bool> failed(false);
+        exception_ptr failure;
+        const size_t width = outlets.size();
+
+        auto work = [&](size_t self) {
+            SweepScenario scenario;
+            scenario.compact = options.compact;
+            if (options.compact) scenario.compactValues.assign(baseValues.begin(), baseValues.end());
+            else scenario.values = baseValues;
+            scenario.tape = tape;
+            scenario.baseValues = &baseValues;
+            scenario.baseTape = &tape;
+            scenario.splits = &splits;
+            vector<double> collected(options.batch * width);
+            try {
+                for (;;) {
+                    size_t first = next.fetch_add(options.batch, memory_order_relaxed);
+                    if (first >= count || failed.load(memory_order_relaxed)) return;
+                    size_t last = min(first + options.batch, count);
+                    for (size_t k = first; k < last; ++k) {
+                        generator(k, scenario);
+                        scenario.evaluate();
+                        double* row = collected.data() + (k - first) * width;
+                        for (size_t o = 0; o < width; ++o) row[o] = scenario.getMassFlow(outlets[o]);
+                        scenario.reset();
+                    }
+
+                    for (size_t step = 0; step < width; ++step) {
+                        size_t o = (self + step) % width;
+                        Accumulator& total = totals[o];
+                        lock_guard<mutex> guard(totalLocks[o]);
+                        for (size_t k = 0; k < last - first; ++k) {
+                            double x = collected[k * width + o];
+                            if (total.count == 0) total.min = total.max = x;
+                            total.min = std::min(total.min, x);
+                            total.max = std::max(total.max, x);
+                            ++total.count;
+                            double delta = x - total.mean;
+                            total.mean += delta / total.count;
+                            total.m2 += delta * (x - total.mean);
+                            for (QuantileEstimator& quantile : total.quantiles) quantile.add(x);
+                        }
+                    }
+                }
+            } catch (...) {
+                lock_guard<mutex> guard(failureLock);
+                if (!failure) failure = current_exception();
+                failed = true;
+            }
+        };
+
+        size_t helpers = min(options.threads, (count + options.batch - 1) / options.batch);
+        vector<thread> threads;
+        for (size_t i = 1; i < helpers; ++i) threads.emplace_back(work, i * width / helpers);
+        work(0);
+        for (thread& worker : threads) worker.join();
+        if (failure) rethrow_exception(failure);
+
+        SweepResult result;
+        result.scenarios = count;
+        for (size_t o = 0; o < width; ++o) {
+            const Accumulator& total = totals[o];
+            OutletStats stats{outlets[o], total.count, total.mean,
+                              total.count > 1 ? total.m2 / (total.count - 1) : 0.0, total.min, total.max, vector<double>()};
+            for (const QuantileEstimator& quantile : total.quantiles) stats.quantiles.push_back(quantile.value());
+            result.outlets.push_back(stats);
+        }
+        return result;
+    }
+};
+
+#if DEVICE_HAS_FORK
+/**
+ * @brief Kind of a message between a PartitionedSolver and its workers.
+ */
+enum class PartitionCommand : uint32_t {
+    Iterate = 1, ///< Boundary values in; the worker runs its devices and answers with its exports.
+    Collect,     ///< The worker answers with every stream it produces.
+    Stop,        ///< The worker exits.
+    Values,      ///< Answer carrying doubles.
+    Failed       ///< Answer carrying the text of the exception a device threw.
+};
+
+/**
+ * @struct PartitionMessage
+ * @brief Header of every message; count doubles, or count bytes of text padded to whole doubles, follow.
+ */
+struct PartitionMessage {
+    PartitionCommand command;
+    uint32_t count;
+};
+
+static_assert(sizeof(PartitionMessage) == sizeof(double), "A message header must fill one value slot");
+
+/**
+ * @class PartitionedSolver
+ * @brief Solves a flowsheet split by Flowsheet::partition(), one worker process per partition.
+ *
+ * Every worker is forked with a copy of the flowsheet and runs the compiled
+ * tape of its own devices. Per pass it receives one message with every value
+ * it reads from outside (feeds, streams cut from earlier partitions, tear
+ * stream guesses) and answers with one message of the values other
+ * partitions read. A partition is dispatched as soon as all partitions it
+ * reads from have answered, so independent partitions run side by side.
+ * Tear streams are iterated as in Flowsheet::converge(); one that crosses a
+ * cut is read as the current guess by every partition but its producer's.
+ */
+class PartitionedSolver
+{
+private:
+    struct Worker {
+        FlowsheetTape tape;          ///< The partition's devices in schedule order.
+        vector<size_t> seeds;        ///< Tear streams read here, as indices into tears.
+        vector<StreamId> inputs;     ///< Other streams read here but not produced here.
+        vector<StreamId> exports;    ///< Streams produced here that are torn or read elsewhere.
+        vector<StreamId> produced;   ///< Every stream produced here.
+        vector<size_t> dependents;   ///< Partitions reading one of the exports, tear streams aside.
+        size_t waits = 0;            ///< Partitions producing one of the inputs.
+        int fd = -1;                 ///< Parent's end of the worker's socket.
+        pid_t pid = -1;
+    };
+
+    Flowsheet& flowsheet;
+    PartitionPlan plan;
+    vector<StreamId> tears;
+    vector<Worker> workers;
+    vector<double> buffer; ///< Message being sent or received; slot 0 holds the header.
+    unsigned version;      ///< Topology version of the flowsheet when it was partitioned.
+    bool broken = false;   ///< A worker died; the solver cannot continue.
+
+    static bool writeAll(int fd, const void* data, size_t size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+#ifdef MSG_NOSIGNAL
+            ssize_t sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+#else
+            ssize_t sent = ::write(fd, bytes, size);
+#endif
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            bytes += sent;
+            size -= (size_t)sent;
+        }
+        return true;
+    }
+
+    static bool readAll(int fd, void* data, size_t size)
+    {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t got = ::read(fd, bytes, size);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            bytes += got;
+            size -= (size_t)got;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Send buffer[1 .. count] behind a header.
+     */
+    bool transmit(int fd, PartitionCommand command, size_t count)
+    {
+        PartitionMessage header = {command, (uint32_t)count};
+        memcpy(buffer.data(), &header, sizeof(header));
+        return writeAll(fd, buffer.data(), (count + 1) * sizeof(double));
+    }
+
+    /**
+     * @brief Read the next message into buffer[1 ..].
+     * @return Its header; Stop if the other side is gone.
+     */
+    PartitionMessage receive(int fd)
+    {
+        PartitionMessage header = {PartitionCommand::Stop, 0};
+        if (!readAll(fd, &header, sizeof(header))) return PartitionMessage{PartitionCommand::Stop, 0};
+        size_t slots = header.command == PartitionCommand::Failed ? (header.count + 7) / 8 : header.count;
+        buffer.resize(max(buffer.size(), slots + 1));
+        if (!readAll(fd, buffer.data() + 1, slots * sizeof(double))) return PartitionMessage{PartitionCommand::Stop, 0};
+        return header;
+    }
+
+    /**
+     * @brief Answer requests in the forked child until told to stop; never returns.
+     */
+    [[noreturn]] void serve(Worker& worker)
+    {
+        double* values = flowsheet.getStore().massFlows();
+        for (;;) {
+            PartitionMessage request = receive(worker.fd);
+            if (request.command == PartitionCommand::Stop) break;
+            const vector<StreamId>& answer = request.command == PartitionCommand::Iterate ? worker.exports : worker.produced;
+            string failure;
+            try {
+                if (request.command == PartitionCommand::Iterate) {
+                    const double* in = buffer.data() + 1;
+                    for (size_t seed : worker.seeds) values[tears[seed]] = *in++;
+                    for (StreamId id : worker.inputs) values[id] = *in++;
+                    worker.tape.run(values);
+                }
+            } catch (const string& error) {
+                failure = error;
+            } catch (const char* error) {
+                failure = error;
+            } catch (const exception& error) {
+                failure = error.what();
+            } catch (...) {
+                failure = "Unknown exception";
+            }
+            bool sent;
+            if (failure.empty()) {
+                buffer.resize(max(buffer.size(), answer.size() + 1));
+                for (size_t i = 0; i < answer.size(); ++i) buffer[i + 1] = values[answer[i]];
+                sent = transmit(worker.fd, PartitionCommand::Values, answer.size());
+            } else {
+                buffer.assign(failure.size() / 8 + 2, 0.0);
+                memcpy(buffer.data() + 1, failure.data(), failure.size());
+                PartitionMessage header = {PartitionCommand::Failed, (uint32_t)failure.size()};
+                memcpy(buffer.data(), &header, sizeof(header));
+                sent = writeAll(worker.fd, buffer.data(), ((failure.size() + 7) / 8 + 1) * sizeof(double));
+            }
+            if (!sent) break;
+        }
+        _exit(0);
+    }
+
+    /**
+     * @brief Read a worker's answer and write the values it carries into the flowsheet.
+     * @return Empty, or the text of the exception the worker reported.
+     * @throws std::string if the worker is gone or answers out of turn
+     */
+    string accept(Worker& worker, const vector<StreamId>& streams)
+    {
+        PartitionMessage answer = receive(worker.fd);
+        if (answer.command == PartitionCommand::Failed) {
+            return string(reinterpret_cast<const char*>(buffer.data() + 1), answer.count);
+        }
+        if (answer.command != PartitionCommand::Values || answer.count != streams.size()) {
+            broken = true;
+            throw string("Partition worker exited");
+        }
+        StreamStore& store = flowsheet.getStore();
+        for (size_t i = 0; i < streams.size(); ++i) store.setMassFlow(streams[i], buffer[i + 1]);
+        return string();
+    }
+
+    void dispatch(size_t w, const vector<double>& guesses)
+    {
+        Worker& worker = workers[w];
+        const double* values = flowsheet.getStore().massFlows();
+        size_t count = worker.seeds.size() + worker.inputs.size();
+        buffer.resize(max(buffer.size(), count + 1));
+        double* out = buffer.data() + 1;
+        for (size_t seed : worker.seeds) *out++ = guesses[seed];
+        for (StreamId id : worker.inputs) *out++ = values[id];
+        if (!transmit(worker.fd, PartitionCommand::Iterate, count)) {
+            broken = true;
+            throw string("Partition worker exited");
+        }
+    }
+
+    /**
+     * @brief Run every partition once, each as soon as the partitions it reads from have answered.
+     * @throws std::string with the first exception a device threw; all workers are idle again
+     */
+    void pass(const vector<double>& guesses)
+    {
+        vector<size_t> waiting(workers.size());
+        vector<size_t> ready, flying;
+        for (size_t w = 0; w < workers.size(); ++w) {
+            waiting[w] = workers[w].waits;
+            if (waiting[w] == 0) ready.push_back(w);
+        }
+        string failure;
+        vector<pollfd> polls;
+        for (;;) {
+            if (failure.empty()) {
+                for (size_t w : ready) dispatch(w, guesses);
+                flying.insert(flying.end(), ready.begin(), ready.end());
+            }
+            ready.clear();
+            if (flying.empty()) break;
+
+            polls.clear();
+            for (size_t w : flying) polls.push_back(pollfd{workers[w].fd, POLLIN, 0});
+            if (poll(polls.data(), (nfds_t)polls.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                broken = true;
+                throw string("Cannot wait for partition workers");
+            }
+            vector<size_t> still;
+            for (size_t k = 0; k < flying.size(); ++k) {
+                size_t w = flying[k];
+                if (polls[k].revents == 0) {
+                    still.push_back(w);
+                    continue;
+                }
+                string error = accept(workers[w], workers[w].exports);
+                if (!error.empty()) {
+                    if (failure.empty()) failure = error;
+                    continue;
+                }
+                for (size_t next : workers[w].dependents) {
+                    if (--waiting[next] == 0) ready.push_back(next);
+                }
+            }
+            flying.swap(still);
+        }
+        if (!failure.empty()) throw failure;
+    }
+
+    void stop()
+    {
+        for (Worker& worker : workers) {
+            if (worker.fd < 0) continue;
+            PartitionMessage header = {PartitionCommand::Stop, 0};
+            writeAll(worker.fd, &header, sizeof(header));
+            ::close(worker.fd);
+            worker.fd = -1;
+            if (worker.pid > 0) waitpid(worker.pid, nullptr, 0);
+        }
+    }
+
+public:
+    /**
+     * @brief Partition a flowsheet and fork one worker per partition.
+     *
+     * Call it while no other thread is running devices: the workers are
+     * copies of the process taken at this point.
+     * @param flowsheet The flowsheet; it must outlive the solver and keep its wiring.
+     * @param parts Number of partitions, see Flowsheet::partition().
+     * @throws std::string if the flowsheet cannot be partitioned or compiled, or the workers cannot start
+     */
+    PartitionedSolver(Flowsheet& flowsheet, size_t parts)
+        : flowsheet(flowsheet), plan(flowsheet.partition(parts)), tears(flowsheet.getTearStreams()),
+          version(flowsheet.topologyVersion)
+    {
+        const StreamStore& store = flowsheet.getStore();
+        const size_t none = plan.partitions.size();
+        workers.resize(plan.partitions.size());
+        vector<size_t> owner(store.size(), none), tearIndex(store.size(), none), mark(store.size(), none);
+        vector<bool> exported(store.size(), false);
+        for (size_t i = 0; i < tears.size(); ++i) {
+            tearIndex[tears[i]] = i;
+            exported[tears[i]] = true;
+        }
+        for (size_t w = 0; w < workers.size(); ++w) {
+            for (size_t i : plan.partitions[w]) {
+                for (StreamId out : flowsheet.devices[i]->getOutputs()) {
+                    owner[out] = w;
+                    workers[w].produced.push_back(out);
+                }
+            }
+        }
+        for (size_t w = 0; w < workers.size(); ++w) {
+            Worker& worker = workers[w];
+            vector<Device*> order;
+            for (size_t i : plan.partitions[w]) {
+                order.push_back(flowsheet.devices[i].get());
+                for (StreamId in : order.back()->getInputs()) {
+                    if (mark[in] == w) continue;
+                    mark[in] = w;
+                    if (tearIndex[in] != none) {
+                        worker.seeds.push_back(tearIndex[in]);
+                    } else if (owner[in] != w) {
+                        worker.inputs.push_back(in);
+                        if (owner[in] == none) continue;
+                        exported[in] = true;
+                        Worker& source = workers[owner[in]];
+                        if (source.dependents.empty() || source.dependents.back() != w) {
+                            source.dependents.push_back(w);
+                            ++worker.waits;
+                        }
+                    }
+                }
+            }
+            flowsheet.compileInto(order, worker.tape);
+        }
+        for (Worker& worker : workers) {
+            for (StreamId id : worker.produced) {
+                if (exported[id]) worker.exports.push_back(id);
+            }
+        }
+
+        buffer.resize(1);
+        for (size_t w = 0; w < workers.size(); ++w) {
+            int ends[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0) {
+                stop();
+                throw string("Cannot create a partition channel");
+            }
+            pid_t pid = fork();
+            if (pid < 0) {
+                ::close(ends[0]);
+                ::close(ends[1]);
+                stop();
+                throw string("Cannot start a partition worker");
+            }
+            if (pid == 0) {
+                ::close(ends[0]);
+                for (size_t v = 0; v < w; ++v) ::close(workers[v].fd);
+                workers[w].fd = ends[1];
+                serve(workers[w]);
+            }
+            ::close(ends[1]);
+            workers[w].fd = ends[0];
+            workers[w].pid = pid;
+        }
+    }
+    PartitionedSolver(const PartitionedSolver&) = delete;
+    PartitionedSolver& operator=(const PartitionedSolver&) = delete;
+
+    ~PartitionedSolver() { stop(); }
+
+    const PartitionPlan& getPlan() const { return plan; }
+
+    /**
+     * @brief Solve the flowsheet with the workers, iterating its tear streams until they settle.
+     *
+     * Feeds are read from the flowsheet on every call; afterwards it holds every
+     * stream the workers produced, as after Flowsheet::converge().
+     * @param options Tolerance, iteration limit and acceleration of the tear streams.
+     * @return {true, 1, 0} without recycle loops, otherwise how the tear streams converged.
+     * @throws std::string if the wiring changed, a worker died or a device threw
+     */
+    RecycleResult solve(const RecycleOptions& options = RecycleOptions())
+    {
+        if (flowsheet.topologyVersion != version) throw string("Flowsheet changed since it was partitioned");
+        if (broken) throw string("Partition worker exited");
+        StreamStore& store = flowsheet.getStore();
+        RecycleResult result = {false, 0, 0.0};
+        size_t n = tears.size();
+        vector<double> x(n), g(n), lastX(n), lastG(n);
+        for (size_t i = 0; i < n; ++i) x[i] = store.getMassFlow(tears[i]);
+
+        while (result.iterations < options.maxIterations) {
+            pass(x);
+            ++result.iterations;
+
+            result.residual = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                g[i] = store.getMassFlow(tears[i]);
+                result.residual = max(result.residual, fabs(g[i] - x[i]));
+            }
+            if (result.residual <= options.tolerance) {
+                result.converged = true;
+                break;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                double next = nextTearGuess(options, result.iterations, x[i], g[i], lastX[i], lastG[i]);
+                lastX[i] = x[i];
+                lastG[i] = g[i];
+                x[i] = next;
+            }
+        }
+
+        for (Worker& worker : workers) {
+            if (!transmit(worker.fd, PartitionCommand::Collect, 0)) {
+                broken = true;
+                throw string("Partition worker exited");
+            }
+        }
+        for (Worker& worker : workers) accept(worker, worker.produced);
+        flowsheet.markSolved();
+        return result;
+    }
+};
+#endif
+
+/**
+ * @test Test flowsheet solves devices added out of dependency order
+ */
+void testFlowsheetScheduleOrder() {
+    cout << "=== Test 8: Flowsheet topological schedule ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed1 = flowsheet.addStream();
+    shared_ptr<Stream> feed2 = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+
+    // Downstream reactor is added first on purpose
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+
+    feed1->setMassFlow(10.0);
+    feed2->setMassFlow(30.0);
+    flowsheet.solve();
+
+    if (flowsheet.getSchedule()[0] == &mixer &&
+        abs(product1->getMassFlow() - 20.0) < POSSIBLE_ERROR &&
+        abs(product2->getMassFlow() - 20.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Flowsheet solves in topological order" << endl;
+    } else {
+        cout << "FAIL: Flowsheet schedule is wrong" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test streams of a flowsheet share one contiguous store
+ */
+void testStreamStoreContiguous() {
+    cout << "=== Test 9: StreamStore contiguous mass flows ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> s1 = flowsheet.addStream();
+    shared_ptr<Stream> s2 = flowsheet.addStream();
+    s1->setMassFlow(3.0);
+    s2->setMassFlow(4.0);
+
+    const double* flows = flowsheet.getStore().massFlows();
+    if (s2->getId() == s1->getId() + 1 &&
+        abs(flows[s1->getId()] - 3.0) < POSSIBLE_ERROR &&
+        abs(flows[s2->getId()] - 4.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Mass flows are stored contiguously" << endl;
+    } else {
+        cout << "FAIL: Mass flows are not where expected" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test batch mode evaluates every scenario lane
+ */
+void testBatchScenarios() {
+    cout << "=== Test 10: Batch scenario evaluation ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(feed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+
+    flowsheet.setScenarioCount(5);
+    for (size_t i = 0; i < 5; ++i) feed->setLane(i, 2.0 * i);
+    flowsheet.solveBatch();
+
+    bool ok = true;
+    for (size_t i = 0; i < 5; ++i) {
+        ok = ok && abs(product1->getLane(i) - i) < POSSIBLE_ERROR
+                && abs(product2->getLane(i) - i) < POSSIBLE_ERROR;
+    }
+    cout << (ok ? "PASS: All scenarios split correctly" : "FAIL: Wrong scenario values") << endl;
+    cout << endl;
+}
+
+/**
+ * @test Test trace messages reach the output through the background drainer
+ */
+void testTraceDrainer() {
+    cout << "=== Test 11: Trace sink drained off the solve thread ===" << endl;
+    RingBufferTraceSink sink;
+    ostringstream out;
+    setTraceSink(&sink, TraceLevel::Info);
+    {
+        TraceDrainer drainer(sink, out);
+        traceMessage(TraceLevel::Info, "Reactor: transferred mass %g to single output", 20.0);
+    }
+    setTraceSink(nullptr);
+
+    if (out.str() == "Reactor: transferred mass 20 to single output\n") {
+        cout << "PASS: Trace message drained correctly" << endl;
+    } else {
+        cout << "FAIL: Trace message lost" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test wiring errors are reported as status codes
+ */
+void testDeviceStatusCodes() {
+    cout << "=== Test 12: Exception-free wiring errors ===" << endl;
+    streamcounter = 0;
+    Reactor reactor(false);
+
+    shared_ptr<Stream> input1(new Stream(++streamcounter));
+    shared_ptr<Stream> input2(new Stream(++streamcounter));
+
+    DeviceStatus missing = reactor.tryUpdateOutputs();
+    reactor.tryAddInput(*input1);
+    DeviceStatus limit = reactor.tryAddInput(*input2);
+
+    if (missing.error == DeviceError::InputNotConnected && limit.error == DeviceError::InputLimit) {
+        cout << "PASS: Status codes reported correctly" << endl;
+    } else {
+        cout << "FAIL: Wrong status codes" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test incremental solve only re-evaluates the changed branch
+ */
+void testIncrementalSolve() {
+    cout << "=== Test 13: Incremental dirty-flag solve ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed1 = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> feed2 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+
+    Reactor& reactor1 = flowsheet.addDevice<Reactor>(false);
+    reactor1.addInput(feed1);
+    reactor1.addOutput(product1);
+    Reactor& reactor2 = flowsheet.addDevice<Reactor>(false);
+    reactor2.addInput(feed2);
+    reactor2.addOutput(product2);
+    flowsheet.solve();
+
+    feed2->setMassFlow(8.0);
+    size_t evaluated = flowsheet.solveIncremental();
+    if (evaluated == 1 && abs(product2->getMassFlow() - 8.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Only the changed branch was re-evaluated" << endl;
+    } else {
+        cout << "FAIL: Incremental solve evaluated " << evaluated << " devices" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test parallel executor reproduces the serial solve
+ */
+void testParallelExecutor() {
+    cout << "=== Test 14: Work-stealing parallel executor ===" << endl;
+    Flowsheet flowsheet;
+    vector<shared_ptr<Stream>> feeds, products;
+    for (int i = 0; i < 200; ++i) {
+        feeds.push_back(flowsheet.addStream());
+        products.push_back(flowsheet.addStream());
+        Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+        reactor.addInput(feeds.back());
+        reactor.addOutput(products.back());
+        feeds.back()->setMassFlow(i);
+    }
+
+    ParallelExecutor executor(4, 16);
+    executor.solve(flowsheet);
+
+    bool ok = true;
+    for (int i = 0; i < 200; ++i) ok = ok && products[i]->getMassFlow() == i;
+    if (ok) {
+        cout << "PASS: Parallel solve matches serial results" << endl;
+    } else {
+        cout << "FAIL: Parallel solve produced different results" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test recycle loop converges with Wegstein acceleration
+ */
+void testRecycleConvergence() {
+    cout << "=== Test 15: Recycle loop with tear stream ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    shared_ptr<Stream> recycle = flowsheet.addStream();
+
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed);
+    mixer.addInput(recycle);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product);
+    reactor.addOutput(recycle);
+
+    feed->setMassFlow(20.0);
+    RecycleResult result = flowsheet.converge();
+    if (result.converged && abs(product->getMassFlow() - 20.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Recycle converged in " << result.iterations << " passes" << endl;
+    } else {
+        cout << "FAIL: Recycle did not converge" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test multi-component streams split species-wise
+ */
+void testComponentStreams() {
+    cout << "=== Test 16: Multi-component streams ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(feed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+
+    flowsheet.setComponentCount(3);
+    feed->setComponentFlow(0, 2.0);
+    feed->setComponentFlow(1, 4.0);
+    feed->setComponentFlow(2, 6.0);
+    flowsheet.solveComponents();
+
+    if (abs(product1->getComponentFlow(2) - 3.0) < POSSIBLE_ERROR &&
+        abs(product2->getMassFlow() - 6.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Components split correctly" << endl;
+    } else {
+        cout << "FAIL: Wrong component flows" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test compile-time specialized devices
+ */
+void testStaticDevices() {
+    cout << "=== Test 17: Static devices ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed1 = flowsheet.addStream();
+    shared_ptr<Stream> feed2 = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    feed1->setMassFlow(4.0);
+    feed2->setMassFlow(6.0);
+
+    StaticMixer<2>& mixer = flowsheet.addDevice<StaticMixer<2>>();
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    StaticReactor<1>& reactor = flowsheet.addDevice<StaticReactor<1>>();
+    reactor.addInput(mixed);
+    reactor.addOutput(product);
+    flowsheet.solve();
+
+    if (abs(product->getMassFlow() - 10.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Static devices work correctly" << endl;
+    } else {
+        cout << "FAIL: Wrong static device result" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test solving through the compiled tape
+ */
+void testFlowsheetTape() {
+    cout << "=== Test 18: Compiled flowsheet tape ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed1 = flowsheet.addStream();
+    shared_ptr<Stream> feed2 = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+    feed1->setMassFlow(7.0);
+    feed2->setMassFlow(3.0);
+
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+    flowsheet.solveTape();
+
+    if (flowsheet.getTape().size() == 2 && abs(product2->getMassFlow() - 5.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Tape evaluates the flowsheet" << endl;
+    } else {
+        cout << "FAIL: Wrong tape result" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test the per-device profile query
+ */
+void testDeviceProfile() {
+    cout << "=== Test 19: Device profiling ===" << endl;
+    resetDeviceProfiles();
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+    flowsheet.solve();
+
+    uint64_t expected = DEVICE_PROFILING ? 1 : 0;
+    if (deviceProfile(&reactor).calls == expected) {
+        cout << "PASS: Device profile counts evaluations" << endl;
+    } else {
+        cout << "FAIL: Wrong device profile" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test merging flowsheets that share a stream number allocator
+ */
+void testFlowsheetMerge() {
+    cout << "=== Test 20: Flowsheet merge ===" << endl;
+    shared_ptr<StreamIdAllocator> ids = make_shared<StreamIdAllocator>();
+    Flowsheet plant(ids);
+    Flowsheet part(ids);
+
+    shared_ptr<Stream> first = plant.addStream();
+    shared_ptr<Stream> feed = part.addStream();
+    shared_ptr<Stream> product = part.addStream();
+    Reactor& reactor = part.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+    feed->setMassFlow(8.0);
+
+    plant.merge(part);
+    plant.solve();
+
+    if (plant.streamCount() == 3 && first->getName() != feed->getName() &&
+        abs(product->getMassFlow() - 8.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Merged flowsheet solves with unique names" << endl;
+    } else {
+        cout << "FAIL: Wrong merged flowsheet" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test publishing solve results for concurrent readers
+ */
+void testStreamSnapshot() {
+    cout << "=== Test 21: Published stream snapshot ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+    flowsheet.setPublishing(true);
+
+    feed->setMassFlow(12.0);
+    double before = flowsheet.getSnapshot().get(product->getId());
+    flowsheet.solve();
+
+    if (before == 0.0 && abs(flowsheet.getSnapshot().get(product->getId()) - 12.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Snapshot shows the last completed pass" << endl;
+    } else {
+        cout << "FAIL: Wrong snapshot values" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test the whole-flowsheet mass balance check
+ */
+void testMassBalanceCheck() {
+    cout << "=== Test 22: Mass balance check ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed1 = flowsheet.addStream();
+    shared_ptr<Stream> feed2 = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+    feed1->setMassFlow(2.0);
+    feed2->setMassFlow(9.0);
+
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+    flowsheet.solve();
+    bool closed = flowsheet.checkMassBalance().ok();
+
+    product2->setMassFlow(0.0);
+    BalanceReport broken = flowsheet.checkMassBalance();
+
+    if (closed && broken.violations == 1 && broken.worst[0].device == 1) {
+        cout << "PASS: Mass balance check finds the offending device" << endl;
+    } else {
+        cout << "FAIL: Wrong mass balance report" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test batching live readings into incremental solves
+ */
+void testSensorIngestor() {
+    cout << "=== Test 23: Sensor ingestion ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+
+    IngestOptions options;
+    options.maxDelay = chrono::seconds(10);
+    SensorIngestor ingestor(flowsheet, options);
+    for (int i = 1; i <= 100; ++i) ingestor.post(*feed, i);
+    ingestor.flush();
+
+    if (ingestor.getStats().batches == 1 && abs(product->getMassFlow() - 100.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Readings are coalesced into one solve" << endl;
+    } else {
+        cout << "FAIL: Wrong ingestion result" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test the direct sparse solve of a recycle loop
+ */
+void testLinearSolve() {
+    cout << "=== Test 24: Direct linear solve ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    shared_ptr<Stream> recycle = flowsheet.addStream();
+
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed);
+    mixer.addInput(recycle);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product);
+    reactor.addOutput(recycle);
+    feed->setMassFlow(6.0);
+
+    RecycleResult result = flowsheet.solveLinear();
+    if (result.iterations == 0 && abs(mixed->getMassFlow() - 12.0) < POSSIBLE_ERROR &&
+        abs(product->getMassFlow() - 6.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Recycle loop solved without iterating" << endl;
+    } else {
+        cout << "FAIL: Wrong direct solve result" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test splitting a feed by fractions into N outputs
+ */
+void testSplitter() {
+    cout << "=== Test 25: N-way splitter ===" << endl;
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    Splitter& splitter = flowsheet.addDevice<Splitter>(initializer_list<double>{0.25, 0.25, 0.5});
+    splitter.addInput(feed);
+    vector<shared_ptr<Stream>> products;
+    for (int i = 0; i < 3; ++i) {
+        products.push_back(flowsheet.addStream());
+        splitter.addOutput(products.back());
+    }
+    feed->setMassFlow(8.0);
+    flowsheet.solve();
+
+    if (abs(products[0]->getMassFlow() - 2.0) < POSSIBLE_ERROR &&
+        abs(products[1]->getMassFlow() - 2.0) < POSSIBLE_ERROR &&
+        abs(products[2]->getMassFlow() - 4.0) < POSSIBLE_ERROR && splitter.getOutputs().isInline()) {
+        cout << "PASS: Feed split by fractions with inline ports" << endl;
+    } else {
+        cout << "FAIL: Wrong split result" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test wiring devices with non-owning stream references
+ */
+void testStreamReferences() {
+    cout << "=== Test 26: Non-owning stream handles ===" << endl;
+    Flowsheet flowsheet;
+
+    Stream& feed = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Mixer& mixer = flowsheet.addDevice<Mixer>(1);
+    mixer.addInput(feed);
+    mixer.addOutput(product);
+    feed.setMassFlow(5.0);
+    flowsheet.solve();
+
+    if (abs(product.getMassFlow() - 5.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Devices wired with stream references" << endl;
+    } else {
+        cout << "FAIL: Wrong result with stream references" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test that tape optimization fuses pass-through devices
+ */
+void testTapeOptimizer() {
+    cout << "=== Test 27: Tape optimization ===" << endl;
+    Flowsheet flowsheet;
+
+    Stream& feed1 = flowsheet.createStream();
+    Stream& feed2 = flowsheet.createStream();
+    Stream& mixed = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(mixed);
+    reactor.addOutput(product);
+    feed1.setMassFlow(3.0);
+    feed2.setMassFlow(4.0);
+
+    flowsheet.setOptimizing(true);
+    flowsheet.solveTape();
+    if (flowsheet.getTape().size() == 1 && abs(product.getMassFlow() - 7.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Pass-through reactor fused into the mixer sum" << endl;
+    } else {
+        cout << "FAIL: Wrong optimized tape" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test saving and restoring a flowsheet through a binary snapshot
+ */
+void testSnapshot() {
+    cout << "=== Test 28: Binary flowsheet snapshot ===" << endl;
+    const string path = "device_test_snapshot.bin";
+    Flowsheet original;
 
-    reactor.addInput(input);
-    reactor.addOutput(output1);
-    reactor.addOutput(output2);
-    reactor.updateOutputs();
+    Stream& feed = original.createStream();
+    Stream& product1 = original.createStream();
+    Stream& product2 = original.createStream();
+    Reactor& reactor = original.addDevice<Reactor>(true);
+    reactor.addInput(feed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+    feed.setMassFlow(9.0);
+    original.solve();
+    original.saveSnapshot(path);
 
-    double totalOutput = output1->getMassFlow() + output2->getMassFlow();
-    if (abs(totalOutput - 30.0) < POSSIBLE_ERROR &&
-        abs(output1->getMassFlow() - 15.0) < POSSIBLE_ERROR) {
-        cout << "PASS: Double output mode works correctly" << endl;
+    Flowsheet loaded;
+    loaded.loadSnapshot(path);
+    remove(path.c_str());
+    if (loaded.deviceCount() == 1 && abs(loaded.getStore().getMassFlow(product2.getId()) - 4.5) < POSSIBLE_ERROR) {
+        cout << "PASS: Snapshot restored devices and mass flows" << endl;
     } else {
-        cout << "FAIL: Incorrect mass distribution" << endl;
+        cout << "FAIL: Snapshot did not round-trip" << endl;
     }
     cout << endl;
 }
 
 /**
- * @test Test reactor input limit
+ * @test Test exporting every stream of a store as CSV
  */
-void testReactorInputLimit() {
-    cout << "=== Test 3: Reactor input limit ===" << endl;
-    streamcounter = 0;
-    Reactor reactor(false);
-
-    shared_ptr<Stream> input1(new Stream(++streamcounter));
-    shared_ptr<Stream> input2(new Stream(++streamcounter));
-    shared_ptr<Stream> output(new Stream(++streamcounter));
+void testResultExport() {
+    cout << "=== Test 29: Bulk result export ===" << endl;
+    const string path = "device_test_export.csv";
+    StreamStore store;
+    store.add(1);
+    store.add(2);
+    store.setMassFlow(0, 4.0);
+    store.setMassFlow(1, 0.5);
 
-    reactor.addInput(input1);
-    try {
-        reactor.addInput(input2);
-        cout << "FAIL: Should not allow more than 1 input" << endl;
-    } catch (const char* ex) {
-        if (string(ex) == "INPUT STREAM LIMIT!") {
-            cout << "PASS: Input limit enforced correctly" << endl;
-        } else {
-            cout << "FAIL: Wrong exception message" << endl;
-        }
+    ResultExporter::write(store, path);
+    char contents[64];
+    size_t length = 0;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file) {
+        length = fread(contents, 1, sizeof(contents), file);
+        fclose(file);
+    }
+    remove(path.c_str());
+    if (string(contents, length) == "name,mass_flow\ns1,4\ns2,0.5\n") {
+        cout << "PASS: Streams exported as CSV" << endl;
+    } else {
+        cout << "FAIL: Wrong CSV export" << endl;
     }
     cout << endl;
 }
 
 /**
- * @test Test reactor output limit in single mode
+ * @test Test statistics of a parallel sweep over perturbed feeds
  */
-void testReactorOutputLimitSingle() {
-    cout << "=== Test 4: Reactor output limit (single mode) ===" << endl;
-    streamcounter = 0;
-    Reactor reactor(false);
+void testSweepRunner() {
+    cout << "=== Test 30: Parallel parameter sweep ===" << endl;
+    Flowsheet flowsheet;
 
-    shared_ptr<Stream> input(new Stream(++streamcounter));
-    shared_ptr<Stream> output1(new Stream(++streamcounter));
-    shared_ptr<Stream> output2(new Stream(++streamcounter));
+    Stream& feed1 = flowsheet.createStream();
+    Stream& feed2 = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(product);
+    feed2.setMassFlow(1.0);
 
-    reactor.addInput(input);
-    reactor.addOutput(output1);
-    try {
-        reactor.addOutput(output2);
-        cout << "FAIL: Should not allow more than 1 output in single mode" << endl;
-    } catch (const char* ex) {
-        if (string(ex) == "OUTPUT STREAM LIMIT!") {
-            cout << "PASS: Output limit enforced correctly" << endl;
-        } else {
-            cout << "FAIL: Wrong exception message" << endl;
-        }
+    SweepRunner runner(flowsheet);
+    SweepResult result = runner.run(11, [&](size_t k, SweepScenario& scenario) {
+        scenario.setMassFlow(feed1, (double)k);
+    });
+    const OutletStats& stats = result.outlets[0];
+    if (stats.count == 11 && abs(stats.mean - 6.0) < POSSIBLE_ERROR && abs(stats.max - 11.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Sweep statistics over perturbed feeds" << endl;
+    } else {
+        cout << "FAIL: Wrong sweep statistics" << endl;
     }
     cout << endl;
 }
 
 /**
- * @test Test getIsDoubleOutput method (unit test for class function)
+ * @test Test answering repeated inlet conditions from the solve cache
  */
-void testReactorGetIsDoubleOutput() {
-    cout << "=== Test 5: getIsDoubleOutput method ===" << endl;
+void testSolveCache() {
+    cout << "=== Test 31: Solve result cache ===" << endl;
+    Flowsheet flowsheet;
 
-    Reactor singleReactor(false);
-    Reactor doubleReactor(true);
+    Stream& feed = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+    flowsheet.setMemoCapacity(8);
 
-    if (!singleReactor.getIsDoubleOutput() && doubleReactor.getIsDoubleOutput()) {
-        cout << "PASS: getIsDoubleOutput method works correctly" << endl;
+    feed.setMassFlow(3.0);
+    bool first = flowsheet.solveCached();
+    feed.setMassFlow(5.0);
+    flowsheet.solveCached();
+    feed.setMassFlow(3.0);
+    bool repeat = flowsheet.solveCached();
+    if (!first && repeat && abs(product.getMassFlow() - 3.0) < POSSIBLE_ERROR && flowsheet.getMemoStats().hits == 1) {
+        cout << "PASS: Repeated inlets answered from the cache" << endl;
     } else {
-        cout << "FAIL: getIsDoubleOutput method returns wrong values" << endl;
+        cout << "FAIL: Wrong solve cache behaviour" << endl;
     }
+    cout << endl;
 }
 
 /**
- * @test Test exception when no input stream
+ * @test Test the forward-mode Jacobian against the values of the same pass
  */
-void testReactorNoInputException() {
-    cout << "=== Test 6: Exception when no input ===" << endl;
-    streamcounter = 0;
-    Reactor reactor(false);
+void testJacobian() {
+    cout << "=== Test 32: Forward-mode Jacobian ===" << endl;
+    Flowsheet flowsheet;
 
-    shared_ptr<Stream> output(new Stream(++streamcounter));
-    reactor.addOutput(output);
+    Stream& feed1 = flowsheet.createStream();
+    Stream& feed2 = flowsheet.createStream();
+    Stream& mixed = flowsheet.createStream();
+    Stream& product1 = flowsheet.createStream();
+    Stream& product2 = flowsheet.createStream();
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    Splitter& splitter = flowsheet.addDevice<Splitter>(initializer_list<double>{0.25, 0.75});
+    splitter.addInput(mixed);
+    splitter.addOutput(product1);
+    splitter.addOutput(product2);
 
-    try {
-        reactor.updateOutputs();
-        cout << "FAIL: Should throw exception when no input" << endl;
-    } catch (const string& ex) {
-        if (ex == "Input stream not connected to reactor") {
-            cout << "PASS: Exception when no input works correctly" << endl;
-        } else {
-            cout << "FAIL: Wrong exception message" << endl;
-        }
+    feed1.setMassFlow(2.0);
+    feed2.setMassFlow(6.0);
+    vector<double> jacobian = flowsheet.jacobian({product1.getId(), product2.getId()},
+                                                 {feed1.getId(), feed2.getId()});
+    if (jacobian.size() == 4 && abs(jacobian[0] - 0.25) < POSSIBLE_ERROR && abs(jacobian[1] - 0.25) < POSSIBLE_ERROR &&
+        abs(jacobian[2] - 0.75) < POSSIBLE_ERROR && abs(jacobian[3] - 0.75) < POSSIBLE_ERROR &&
+        abs(product2.getMassFlow() - 6.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Jacobian and values from one tangent pass" << endl;
+    } else {
+        cout << "FAIL: Wrong Jacobian" << endl;
     }
+    cout << endl;
 }
 
+#if DEVICE_HAS_FORK
 /**
- * @test Test exception when wrong output count
+ * @test Test a chain split across worker processes solves like one flowsheet
  */
-void testReactorWrongOutputCount() {
-    cout << "=== Test 7: Exception when wrong output count ===" << endl;
-    streamcounter = 0;
-    Reactor reactor(true); // Double output mode
+void testPartitionedSolve() {
+    cout << "=== Test 33: Partitioned solve ===" << endl;
+    Flowsheet flowsheet;
 
-    shared_ptr<Stream> input(new Stream(++streamcounter));
-    shared_ptr<Stream> output1(new Stream(++streamcounter));
-    // Don't add second output!
+    Stream* last = &flowsheet.createStream();
+    last->setMassFlow(8.0);
+    for (int i = 0; i < 6; ++i) {
+        Stream& next = flowsheet.createStream();
+        Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+        reactor.addInput(*last);
+        reactor.addOutput(next);
+        last = &next;
+    }
+    PartitionedSolver solver(flowsheet, 3);
+    RecycleResult result = solver.solve();
+    if (solver.getPlan().cutStreams.size() == 2 && result.converged && result.iterations == 1 &&
+        abs(last->getMassFlow() - 8.0) < POSSIBLE_ERROR) {
+        cout << "PASS: Three partitions exchange two cut streams" << endl;
+    } else {
+        cout << "FAIL: Wrong partitioned solve" << endl;
+    }
+    cout << endl;
+}
+#endif
 
-    reactor.addInput(input);
-    reactor.addOutput(output1);
+/**
+ * @test Test that the footprint report grows with names and the schedule
+ */
+void testFootprint() {
+    cout << "=== Test 34: Memory footprint ===" << endl;
+    Flowsheet flowsheet;
 
-    try {
-        reactor.updateOutputs();
-        cout << "FAIL: Should throw exception when wrong output count" << endl;
-    } catch (const string& ex) {
-        if (ex == "Output streams not properly set for reactor") {
-            cout << "PASS: Exception when wrong outputs works correctly" << endl;
-        } else {
-            cout << "FAIL: Wrong exception message" << endl;
-        }
+    Stream& feed = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+    FootprintReport before = flowsheet.footprint();
+    product.setName("a product stream with a long descriptive name");
+    flowsheet.getSchedule();
+    FootprintReport after = flowsheet.footprint();
+    if (after.names > before.names && after.schedules > before.schedules && after.ports >= sizeof(Reactor)) {
+        cout << "PASS: Footprint categories follow names, schedule and devices" << endl;
+    } else {
+        cout << "FAIL: Wrong footprint" << endl;
+    }
+    cout << endl;
+}
+
+/**
+ * @test Test a sweep run on float32 copies of the scenario values
+ */
+void testCompactSweep() {
+    cout << "=== Test 35: Compact float32 sweep ===" << endl;
+    Flowsheet flowsheet;
+
+    Stream& feed = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+
+    SweepOptions options;
+    options.threads = 1;
+    options.compact = true;
+    SweepRunner runner(flowsheet, {product.getId()}, options);
+    SweepResult result = runner.run(10, [](size_t k, SweepScenario& scenario) { scenario.setMassFlow(0, 0.1 * k); });
+    if (abs(result.outlets[0].mean - 0.45) < POSSIBLE_ERROR) {
+        cout << "PASS: Float32 sweep mean over perturbed feeds" << endl;
+    } else {
+        cout << "FAIL: Wrong compact sweep" << endl;
     }
+    cout << endl;
 }
 
 void tests(){
@@ -469,9 +6822,583 @@ void tests(){
     testReactorNoInputException();
     testReactorWrongOutputCount();
 
+    testFlowsheetScheduleOrder();
+    testStreamStoreContiguous();
+    testBatchScenarios();
+    testTraceDrainer();
+    testDeviceStatusCodes();
+    testIncrementalSolve();
+    testParallelExecutor();
+    testRecycleConvergence();
+    testComponentStreams();
+    testStaticDevices();
+    testFlowsheetTape();
+    testDeviceProfile();
+    testFlowsheetMerge();
+    testStreamSnapshot();
+    testMassBalanceCheck();
+    testSensorIngestor();
+    testLinearSolve();
+    testSplitter();
+    testStreamReferences();
+    testTapeOptimizer();
+    testSnapshot();
+    testResultExport();
+    testSweepRunner();
+    testSolveCache();
+    testJacobian();
+#if DEVICE_HAS_FORK
+    testPartitionedSolve();
+#endif
+    testFootprint();
+    testCompactSweep();
+
     cout << endl << "=== TESTS COMPLETED ===" << endl;
 }
 
+#ifdef DEVICE_BENCH
+/**
+ * @brief Heap allocations made by the process, counted by the operators new below.
+ *
+ * Every replaceable form is replaced, so each new is paired with a delete
+ * that frees through the same allocator.
+ */
+static atomic<size_t> benchAllocations(0);
+
+/**
+ * @brief Allocate and count one block.
+ * @return The block, or nullptr if malloc failed.
+ */
+static void* benchAllocate(size_t size) noexcept
+{
+    benchAllocations.fetch_add(1, memory_order_relaxed);
+    return malloc(size ? size : 1);
+}
+
+/**
+ * @brief Free a counted block.
+ *
+ * Kept out of line so the compiler never sees operator new's block reach
+ * free() directly and report it as a mismatched deallocation.
+ */
+__attribute__((noinline)) static void benchRelease(void* p) noexcept
+{
+    free(p);
+}
+
+void* operator new(size_t size)
+{
+    if (void* p = benchAllocate(size)) return p;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    if (void* p = benchAllocate(size)) return p;
+    throw bad_alloc();
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept { return benchAllocate(size); }
+void* operator new[](size_t size, const nothrow_t&) noexcept { return benchAllocate(size); }
+
+void operator delete(void* p) noexcept { benchRelease(p); }
+void operator delete[](void* p) noexcept { benchRelease(p); }
+void operator delete(void* p, size_t) noexcept { benchRelease(p); }
+void operator delete[](void* p, size_t) noexcept { benchRelease(p); }
+void operator delete(void* p, const nothrow_t&) noexcept { benchRelease(p); }
+void operator delete[](void* p, const nothrow_t&) noexcept { benchRelease(p); }
+
+#ifdef __cpp_aligned_new
+/**
+ * @brief Allocate and count one over-aligned block.
+ * @return The block, or nullptr if the allocation failed.
+ */
+static void* benchAllocate(size_t size, align_val_t alignment) noexcept
+{
+    benchAllocations.fetch_add(1, memory_order_relaxed);
+    return alignedMalloc(size ? size : 1, max(static_cast<size_t>(alignment), sizeof(void*)));
+}
+
+/**
+ * @brief Free a counted over-aligned block; out of line like benchRelease().
+ */
+__attribute__((noinline)) static void benchReleaseAligned(void* p) noexcept
+{
+    alignedFree(p);
+}
+
+void* operator new(size_t size, align_val_t alignment)
+{
+    if (void* p = benchAllocate(size, alignment)) return p;
+    throw bad_alloc();
+}
+
+void* operator new[](size_t size, align_val_t alignment)
+{
+    if (void* p = benchAllocate(size, alignment)) return p;
+    throw bad_alloc();
+}
+
+void* operator new(size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return benchAllocate(size, alignment);
+}
+
+void* operator new[](size_t size, align_val_t alignment, const nothrow_t&) noexcept
+{
+    return benchAllocate(size, alignment);
+}
+
+void operator delete(void* p, align_val_t) noexcept { benchReleaseAligned(p); }
+void operator delete[](void* p, align_val_t) noexcept { benchReleaseAligned(p); }
+void operator delete(void* p, size_t, align_val_t) noexcept { benchReleaseAligned(p); }
+void operator delete[](void* p, size_t, align_val_t) noexcept { benchReleaseAligned(p); }
+void operator delete(void* p, align_val_t, const nothrow_t&) noexcept { benchReleaseAligned(p); }
+void operator delete[](void* p, align_val_t, const nothrow_t&) noexcept { benchReleaseAligned(p); }
+#endif
+
+volatile double benchSink; ///< Keeps benchmarked results observable to the optimizer.
+
+/**
+ * @brief Time a benchmark body and print one JSON line with its results.
+ *
+ * The body is run with a doubling repeat count until a run takes at least
+ * 200 ms; the last run is reported.
+ * @param name Benchmark name.
+ * @param param Size parameter of the benchmark (inputs, devices, ...).
+ * @param opsPerCall Operations performed by one call of the body.
+ * @param body The work to measure.
+ */
+template <class Body>
+void runBenchmark(const string& name, size_t param, size_t opsPerCall, Body body)
+{
+    using Clock = chrono::steady_clock;
+    body();  // warm-up
+
+    size_t repeats = 1;
+    double seconds = 0;
+    size_t allocations = 0;
+    for (;;) {
+        size_t allocationsBefore = benchAllocations.load(memory_order_relaxed);
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < repeats; ++i) body();
+        seconds = chrono::duration<double>(Clock::now() - start).count();
+        allocations = benchAllocations.load(memory_order_relaxed) - allocationsBefore;
+        if (seconds >= 0.2 || repeats >= (1u << 30)) break;
+        repeats *= 2;
+    }
+
+    double ops = (double)repeats * opsPerCall;
+    printf("{\"benchmark\":\"%s\",\"param\":%zu,\"ops\":%.0f,\"ns_per_op\":%.3f,"
+           "\"allocs_per_op\":%.3f,\"ops_per_sec\":%.1f}\n",
+           name.c_str(), param, ops, seconds * 1e9 / ops, allocations / ops, ops / seconds);
+    fflush(stdout);
+}
+
+/**
+ * @brief Build a flowsheet of about `devices` devices as Mixer -> Reactor pairs.
+ * @param flowsheet The empty flowsheet to fill.
+ * @param devices Number of devices to create (rounded up to an even number).
+ */
+void buildBenchFlowsheet(Flowsheet& flowsheet, size_t devices)
+{
+    for (size_t i = 0; i < (devices + 1) / 2; ++i) {
+        shared_ptr<Stream> feed1 = flowsheet.addStream();
+        shared_ptr<Stream> feed2 = flowsheet.addStream();
+        shared_ptr<Stream> mixed = flowsheet.addStream();
+        shared_ptr<Stream> product = flowsheet.addStream();
+        feed1->setMassFlow(1.0 + i);
+        feed2->setMassFlow(2.0);
+
+        Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+        mixer.addInput(feed1);
+        mixer.addInput(feed2);
+        mixer.addOutput(mixed);
+        Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+        reactor.addInput(mixed);
+        reactor.addOutput(product);
+    }
+}
+
+/**
+ * @brief Build generated-style trees: two Mixers feeding a Mixer, then two pass-through Reactors.
+ * @param flowsheet The empty flowsheet to fill.
+ * @param devices Approximate number of devices; five per tree.
+ * @return The streams of every tree's first feed, which are the only ones that vary.
+ */
+vector<Stream*> buildBenchMixerTrees(Flowsheet& flowsheet, size_t devices)
+{
+    vector<Stream*> varying;
+    for (size_t i = 0; i < (devices + 4) / 5; ++i) {
+        Stream* feeds[4];
+        for (Stream*& feed : feeds) {
+            feed = &flowsheet.createStream();
+            feed->setMassFlow(1.0);
+            if (feed != feeds[0]) flowsheet.markConstant(*feed);
+        }
+        Stream& left = flowsheet.createStream();
+        Stream& right = flowsheet.createStream();
+        Stream& mixed = flowsheet.createStream();
+        Stream& reacted = flowsheet.createStream();
+        Stream& product = flowsheet.createStream();
+
+        Mixer& mixerLeft = flowsheet.addDevice<Mixer>(2);
+        mixerLeft.addInput(*feeds[0]);
+        mixerLeft.addInput(*feeds[1]);
+        mixerLeft.addOutput(left);
+        Mixer& mixerRight = flowsheet.addDevice<Mixer>(2);
+        mixerRight.addInput(*feeds[2]);
+        mixerRight.addInput(*feeds[3]);
+        mixerRight.addOutput(right);
+        Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+        mixer.addInput(left);
+        mixer.addInput(right);
+        mixer.addOutput(mixed);
+        Reactor& first = flowsheet.addDevice<Reactor>(false);
+        first.addInput(mixed);
+        first.addOutput(reacted);
+        Reactor& second = flowsheet.addDevice<Reactor>(false);
+        second.addInput(reacted);
+        second.addOutput(product);
+        varying.push_back(feeds[0]);
+    }
+    return varying;
+}
+
+/**
+ * @brief Build `loops` independent Mixer -> Reactor loops that recycle half of their product.
+ * @param flowsheet The empty flowsheet to fill.
+ * @param loops Number of recycle loops.
+ */
+void buildBenchRecycles(Flowsheet& flowsheet, size_t loops)
+{
+    for (size_t i = 0; i < loops; ++i) {
+        shared_ptr<Stream> feed = flowsheet.addStream();
+        shared_ptr<Stream> mixed = flowsheet.addStream();
+        shared_ptr<Stream> product = flowsheet.addStream();
+        shared_ptr<Stream> recycle = flowsheet.addStream();
+        feed->setMassFlow(1.0 + i);
+
+        Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+        mixer.addInput(feed);
+        mixer.addInput(recycle);
+        mixer.addOutput(mixed);
+        Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+        reactor.addInput(mixed);
+        reactor.addOutput(product);
+        reactor.addOutput(recycle);
+    }
+}
+
+/**
+ * @brief Run every benchmark, printing one JSON object per line.
+ */
+void benchmarks()
+{
+    const size_t mixerInputs[] = {1, 2, 8, 64};
+    for (size_t inputs : mixerInputs) {
+        Flowsheet flowsheet;
+        Mixer& mixer = flowsheet.addDevice<Mixer>((int)inputs);
+        for (size_t i = 0; i < inputs; ++i) {
+            shared_ptr<Stream> feed = flowsheet.addStream();
+            feed->setMassFlow(1.0 + i);
+            mixer.addInput(feed);
+        }
+        shared_ptr<Stream> product = flowsheet.addStream();
+        mixer.addOutput(product);
+        runBenchmark("mixer_update", inputs, 1, [&]() {
+            mixer.updateOutputs();
+            benchSink = product->getMassFlow();
+        });
+    }
+
+    {
+        Flowsheet flowsheet;
+        StaticMixer<8>& mixer = flowsheet.addDevice<StaticMixer<8>>();
+        for (size_t i = 0; i < 8; ++i) {
+            shared_ptr<Stream> feed = flowsheet.addStream();
+            feed->setMassFlow(1.0 + i);
+            mixer.addInput(feed);
+        }
+        shared_ptr<Stream> product = flowsheet.addStream();
+        mixer.addOutput(product);
+        runBenchmark("static_mixer_update", 8, 1, [&]() {
+            mixer.updateOutputs();
+            benchSink = product->getMassFlow();
+        });
+    }
+
+    for (int outputs = 1; outputs <= 2; ++outputs) {
+        Flowsheet flowsheet;
+        Reactor& reactor = flowsheet.addDevice<Reactor>(outputs == 2);
+        shared_ptr<Stream> feed = flowsheet.addStream();
+        feed->setMassFlow(10.0);
+        reactor.addInput(feed);
+        for (int i = 0; i < outputs; ++i) reactor.addOutput(flowsheet.addStream());
+        runBenchmark(outputs == 2 ? "reactor_update_double" : "reactor_update_single", outputs, 1, [&]() {
+            reactor.updateOutputs();
+            benchSink = feed->getMassFlow();
+        });
+    }
+
+    const size_t streamBatch = 10000;
+    runBenchmark("stream_construction", streamBatch, streamBatch, [&]() {
+        Flowsheet flowsheet;
+        for (size_t i = 0; i < streamBatch; ++i) flowsheet.addStream();
+        benchSink = (double)flowsheet.streamCount();
+    });
+
+    const size_t deviceBatch = 10000;
+    runBenchmark("device_construction", deviceBatch, deviceBatch, [&]() {
+        Flowsheet flowsheet;
+        Stream& feed = flowsheet.createStream();
+        for (size_t i = 0; i < deviceBatch; ++i) {
+            Splitter& splitter = flowsheet.addDevice<Splitter>(initializer_list<double>{0.25, 0.75});
+            splitter.addInput(feed);
+            splitter.addOutput(flowsheet.createStream());
+            splitter.addOutput(flowsheet.createStream());
+        }
+        benchSink = (double)flowsheet.deviceCount();
+    });
+
+    const size_t flowsheetSizes[] = {10, 1000, 100000};
+    for (size_t devices : flowsheetSizes) {
+        Flowsheet flowsheet;
+        buildBenchFlowsheet(flowsheet, devices);
+        flowsheet.solve();
+        runBenchmark("flowsheet_solve", devices, 1, [&]() {
+            flowsheet.solve();
+            benchSink = flowsheet.getStore().massFlows()[0];
+        });
+        runBenchmark("flowsheet_solve_tape", devices, 1, [&]() {
+            flowsheet.solveTape();
+            benchSink = flowsheet.getStore().massFlows()[0];
+        });
+        runBenchmark("mass_balance_check", devices, 1, [&]() {
+            benchSink = flowsheet.checkMassBalance().maxResidual;
+        });
+    }
+
+    const size_t snapshotDevices = 100000;
+    const string snapshotPath = "bench_snapshot.bin";
+    runBenchmark("flowsheet_build", snapshotDevices, 1, [&]() {
+        Flowsheet flowsheet;
+        buildBenchFlowsheet(flowsheet, snapshotDevices);
+        benchSink = (double)flowsheet.deviceCount();
+    });
+    {
+        Flowsheet source;
+        buildBenchFlowsheet(source, snapshotDevices);
+        source.solve();
+        runBenchmark("snapshot_save", snapshotDevices, 1, [&]() { source.saveSnapshot(snapshotPath); });
+        runBenchmark("snapshot_load", snapshotDevices, 1, [&]() {
+            Flowsheet loaded;
+            loaded.loadSnapshot(snapshotPath);
+            benchSink = (double)loaded.deviceCount();
+        });
+        remove(snapshotPath.c_str());
+    }
+
+    {
+        const size_t exportDevices = 100000;
+        const string exportPath = "bench_export.out";
+        Flowsheet flowsheet;
+        buildBenchFlowsheet(flowsheet, exportDevices);
+        flowsheet.solve();
+        const StreamStore& store = flowsheet.getStore();
+        runBenchmark("export_csv", store.size(), store.size(), [&]() {
+            ResultExporter::write(store, exportPath, ExportFormat::Csv);
+        });
+        runBenchmark("export_columnar", store.size(), store.size(), [&]() {
+            ResultExporter::write(store, exportPath, ExportFormat::Columnar);
+        });
+        remove(exportPath.c_str());
+    }
+
+    {
+        const size_t sweepDevices = 1000;
+        const size_t sweepScenarios = 4096;
+        Flowsheet flowsheet;
+        buildBenchFlowsheet(flowsheet, sweepDevices);
+        auto perturb = [](size_t scenario, SweepScenario& copy) {
+            copy.setMassFlow((StreamId)(scenario % 1000), 1.0 + (double)(scenario % 97) / 97.0);
+        };
+        runBenchmark("sweep_rebuild_serial", sweepDevices, 1, [&]() {
+            Flowsheet fresh;
+            buildBenchFlowsheet(fresh, sweepDevices);
+            fresh.getStore().setMassFlow(0, 1.5);
+            fresh.solve();
+            benchSink = fresh.getStore().massFlows()[3];
+        });
+        vector<StreamId> outlets = SweepRunner(flowsheet).getOutlets();
+        outlets.resize(8);
+        const size_t sweepThreads[] = {1, 4};
+        for (size_t threads : sweepThreads) {
+            SweepOptions options;
+            options.threads = threads;
+            SweepRunner runner(flowsheet, outlets, options);
+            runBenchmark("sweep", threads, sweepScenarios, [&]() {
+                benchSink = runner.run(sweepScenarios, perturb).outlets[0].mean;
+            });
+        }
+    }
+
+    {
+        const size_t compactDevices = 400000;
+        const size_t compactScenarios = 32;
+        Flowsheet flowsheet;
+        buildBenchFlowsheet(flowsheet, compactDevices);
+        auto perturb = [](size_t scenario, SweepScenario& copy) { copy.setMassFlow(0, 1.0 + (double)scenario); };
+        vector<StreamId> outlets(1, 3);
+        for (bool compact : {false, true}) {
+            SweepOptions options;
+            options.threads = 1;
+            options.compact = compact;
+            SweepRunner runner(flowsheet, outlets, options);
+            runBenchmark(compact ? "sweep_large_compact" : "sweep_large", compactDevices, compactScenarios, [&]() {
+                benchSink = runner.run(compactScenarios, perturb).outlets[0].mean;
+            });
+        }
+        runBenchmark("footprint", compactDevices, 1, [&]() { benchSink = (double)flowsheet.footprint().total(); });
+    }
+
+    {
+        const size_t memoDevices = 1000;
+        const size_t configurations = 8;
+        // Mixer -> Reactor pairs have one inlet per device; a Reactor chain has one inlet in total
+        Flowsheet pairs;
+        buildBenchFlowsheet(pairs, memoDevices);
+        Flowsheet chain;
+        Stream* last = &chain.createStream();
+        for (size_t i = 0; i < memoDevices; ++i) {
+            Stream& next = chain.createStream();
+            Reactor& reactor = chain.addDevice<Reactor>(false);
+            reactor.addInput(*last);
+            reactor.addOutput(next);
+            last = &next;
+        }
+        Flowsheet* sheets[] = {&pairs, &chain};
+        const char* names[][2] = {{"pairs_solve", "pairs_solve_cached"}, {"chain_solve", "chain_solve_cached"}};
+        for (size_t sheet = 0; sheet < 2; ++sheet) {
+            Flowsheet& flowsheet = *sheets[sheet];
+            StreamStore& store = flowsheet.getStore();
+            flowsheet.setMemoCapacity(configurations);
+            size_t call = 0;
+            runBenchmark(names[sheet][0], memoDevices, 1, [&]() {
+                store.setMassFlow(0, 1.0 + (double)(call++ % configurations));
+                flowsheet.solve();
+                benchSink = store.massFlows()[3];
+            });
+            runBenchmark(names[sheet][1], memoDevices, 1, [&]() {
+                store.setMassFlow(0, 1.0 + (double)(call++ % configurations));
+                flowsheet.solveCached();
+                benchSink = store.massFlows()[3];
+            });
+        }
+    }
+
+    {
+        const size_t jacobianDevices = 1000;
+        const size_t directions[] = {4, 16};
+        Flowsheet flowsheet;
+        buildBenchFlowsheet(flowsheet, jacobianDevices);
+        vector<StreamId> outlets;
+        for (StreamId id = 3; id < flowsheet.getStore().size(); id += 4) outlets.push_back(id);
+        for (size_t count : directions) {
+            vector<StreamId> feeds;
+            for (size_t j = 0; j < count; ++j) feeds.push_back((StreamId)(j * 4));
+            runBenchmark("jacobian_forward", count, 1, [&]() {
+                benchSink = flowsheet.jacobian(outlets, feeds)[0];
+            });
+            StreamStore& store = flowsheet.getStore();
+            vector<double> differences(outlets.size() * count);
+            runBenchmark("jacobian_finite_difference", count, 1, [&]() {
+                flowsheet.solve();
+                vector<double> base(outlets.size());
+                for (size_t i = 0; i < outlets.size(); ++i) base[i] = store.massFlows()[outlets[i]];
+                for (size_t j = 0; j < count; ++j) {
+                    double flow = store.massFlows()[feeds[j]];
+                    store.setMassFlow(feeds[j], flow + 1e-6);
+                    flowsheet.solve();
+                    for (size_t i = 0; i < outlets.size(); ++i) {
+                        differences[i * count + j] = (store.massFlows()[outlets[i]] - base[i]) / 1e-6;
+                    }
+                    store.setMassFlow(feeds[j], flow);
+                }
+                benchSink = differences[0];
+            });
+        }
+    }
+
+#if DEVICE_HAS_FORK
+    {
+        const size_t partitionedDevices = 100000;
+        const size_t partCounts[] = {1, 2, 4};
+        Flowsheet flowsheet;
+        buildBenchFlowsheet(flowsheet, partitionedDevices);
+        StreamStore& store = flowsheet.getStore();
+        runBenchmark("partitioned_reference_solve", partitionedDevices, 1, [&]() {
+            store.setMassFlow(0, benchSink);
+            flowsheet.solve();
+            benchSink = store.massFlows()[3];
+        });
+        for (size_t parts : partCounts) {
+            PartitionedSolver solver(flowsheet, parts);
+            runBenchmark("partitioned_solve", parts, 1, [&]() {
+                store.setMassFlow(0, benchSink);
+                solver.solve();
+                benchSink = store.massFlows()[3];
+            });
+        }
+    }
+#endif
+
+    const size_t treeSizes[] = {1000, 100000};
+    for (size_t devices : treeSizes) {
+        Flowsheet flowsheet;
+        vector<Stream*> varying = buildBenchMixerTrees(flowsheet, devices);
+        runBenchmark("mixer_tree_solve_tape", devices, 1, [&]() {
+            varying[0]->setMassFlow(benchSink);
+            flowsheet.solveTape();
+            benchSink = flowsheet.getStore().massFlows()[0];
+        });
+        flowsheet.setOptimizing(true);
+        runBenchmark("mixer_tree_solve_tape_optimized", devices, 1, [&]() {
+            varying[0]->setMassFlow(benchSink);
+            flowsheet.solveTape();
+            benchSink = flowsheet.getStore().massFlows()[0];
+        });
+    }
+
+    const size_t recycleLoops[] = {1, 1000};
+    for (size_t loops : recycleLoops) {
+        Flowsheet flowsheet;
+        buildBenchRecycles(flowsheet, loops);
+        flowsheet.solveLinear();
+        double feed = 1.0;
+        runBenchmark("recycle_converge", loops, 1, [&]() {
+            feed = 3.0 - feed;
+            flowsheet.getStore().setMassFlow(0, feed);
+            benchSink = (double)flowsheet.converge().iterations;
+        });
+        runBenchmark("recycle_solve_linear", loops, 1, [&]() {
+            feed = 3.0 - feed;
+            flowsheet.getStore().setMassFlow(0, feed);
+            benchSink = (double)flowsheet.solveLinear().iterations;
+        });
+    }
+}
+
+/**
+ * @brief The entry point of the benchmark build (make bench).
+ * @return 0 on successful execution.
+ */
+int main()
+{
+    benchmarks();
+    return 0;
+}
+#else
 /**
  * @brief The entry point of the program.
  * @return 0 on successful execution.
@@ -485,4 +7412,5 @@ int main()
     tests();
 
     return 0;
-}
\ No newline at end of file
+}
+#endif
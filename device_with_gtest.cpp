@@ -3,15 +3,62 @@
  * @brief Chemical process simulation with Google Tests
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
 #include <iostream>
+#include <list>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
 #include <cmath>
+#include <cstdint>
+#include <utility>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define DEVICE_HAS_MMAP 1
+#define DEVICE_HAS_FORK 1
+#define DEVICE_HAS_POSIX_MEMALIGN 1
+#else
+#define DEVICE_HAS_MMAP 0
+#define DEVICE_HAS_FORK 0
+#define DEVICE_HAS_POSIX_MEMALIGN 0
+#endif
 
 using namespace std;
 
-int streamcounter;
+atomic<int> streamcounter(0);
 const int MIXER_OUTPUTS = 1;
 const float POSSIBLE_ERROR = 0.01;
 
@@ -21,9 +68,17 @@ const float POSSIBLE_ERROR = 0.01;
 #include <functional>
 
 // Simple Google Test implementation
+// Failure messages go to the running test's log, which the runner prints in one piece
+std::ostream*& TestLogTarget() {
+    static thread_local std::ostream* target = &std::cout;
+    return target;
+}
+
+std::ostream& TestLog() { return *TestLogTarget(); }
+
 #define EXPECT_TRUE(condition) \
     if (!(condition)) { \
-        std::cout << "Failure: " << #condition << " in " << __FILE__ << ":" << __LINE__ << std::endl; \
+        TestLog() << "Failure: " << #condition << " in " << __FILE__ << ":" << __LINE__ << std::endl; \
         throw std::runtime_error("Test failed"); \
     }
 
@@ -31,26 +86,33 @@ const float POSSIBLE_ERROR = 0.01;
 
 #define EXPECT_NEAR(val1, val2, abs_error) \
     if (std::abs((val1) - (val2)) > (abs_error)) { \
-        std::cout << "Failure: " << #val1 << " (" << (val1) << ") != " << #val2 << " (" << (val2) << ") in " << __FILE__ << ":" << __LINE__ << std::endl; \
+        TestLog() << "Failure: " << #val1 << " (" << (val1) << ") != " << #val2 << " (" << (val2) << ") in " << __FILE__ << ":" << __LINE__ << std::endl; \
         throw std::runtime_error("Test failed"); \
     }
 
 #define EXPECT_THROW(statement, exception_type) \
     try { \
         statement; \
-        std::cout << "Failure: Expected exception in " << __FILE__ << ":" << __LINE__ << std::endl; \
+        TestLog() << "Failure: Expected exception in " << __FILE__ << ":" << __LINE__ << std::endl; \
         throw std::runtime_error("Test failed"); \
     } catch (exception_type&) { \
         /* Expected */ \
     } catch (...) { \
-        std::cout << "Failure: Wrong exception type in " << __FILE__ << ":" << __LINE__ << std::endl; \
+        TestLog() << "Failure: Wrong exception type in " << __FILE__ << ":" << __LINE__ << std::endl; \
         throw std::runtime_error("Test failed"); \
     }
 
 // Test registration system
+enum class TestKind {
+    Parallel,  // may run on any worker thread
+    Serial,    // touches global state; runs alone on the main thread
+    Benchmark  // repeated for timing; only runs with --benchmarks
+};
+
 struct TestCase {
     std::string name;
     std::function<void()> function;
+    TestKind kind;
 };
 
 std::vector<TestCase>& GetTests() {
@@ -59,286 +121,6624 @@ std::vector<TestCase>& GetTests() {
 }
 
 struct TestRegistrar {
-    TestRegistrar(const std::string& name, std::function<void()> func) {
-        GetTests().push_back({name, func});
+    TestRegistrar(const std::string& name, std::function<void()> func, TestKind kind = TestKind::Parallel) {
+        GetTests().push_back({name, func, kind});
     }
 };
 
 #define CONCAT_(a, b) a##b
 #define CONCAT(a, b) CONCAT_(a, b)
-#define TEST_REGISTRAR(test_suite, test_name) \
-    static TestRegistrar CONCAT(reg, __LINE__)(#test_suite "." #test_name, [](){ test_suite##_##test_name##_Test::Run(); });
+#define TEST_REGISTRAR(test_suite, test_name, kind) \
+    static TestRegistrar CONCAT(reg, __LINE__)(#test_suite "." #test_name, [](){ test_suite##_##test_name##_Test::Run(); }, kind);
 
-#define TEST(test_suite_name, test_name) \
+#define TEST_WITH_KIND(test_suite_name, test_name, kind) \
     class test_suite_name##_##test_name##_Test { \
     public: \
         static void Run(); \
     }; \
-    TEST_REGISTRAR(test_suite_name, test_name) \
+    TEST_REGISTRAR(test_suite_name, test_name, kind) \
     void test_suite_name##_##test_name##_Test::Run()
 
-// ==================== END SIMPLE GTEST ====================
+#define TEST(test_suite_name, test_name) TEST_WITH_KIND(test_suite_name, test_name, TestKind::Parallel)
 
-// ==================== КЛАССЫ ====================
+// For tests that use standalone streams, streamcounter, the trace sink or the device profiles
+#define TEST_SERIAL(test_suite_name, test_name) TEST_WITH_KIND(test_suite_name, test_name, TestKind::Serial)
 
-class Stream
-{
-private:
-    double mass_flow;
-    string name;
+// The body is repeated until timings are stable; the runner reports ns per run
+#define BENCHMARK(test_suite_name, test_name) TEST_WITH_KIND(test_suite_name, test_name, TestKind::Benchmark)
 
-public:
-    Stream(int s){setName("s"+std::to_string(s));}
-    void setName(string s){name=s;}
-    string getName(){return name;}
-    void setMassFlow(double m){mass_flow=m;}
-    double getMassFlow() const {return mass_flow;}
-    void print() { cout << "Stream " << getName() << " flow = " << getMassFlow() << endl; }
-};
+// gtest-style filter: ':'-separated glob patterns, optionally followed by '-' and negative patterns
+bool GlobMatch(const char* pattern, const char* text) {
+    if (*pattern == '\0') return *text == '\0';
+    if (*pattern == '*') return GlobMatch(pattern + 1, text) || (*text && GlobMatch(pattern, text + 1));
+    if (*text && (*pattern == '?' || *pattern == *text)) return GlobMatch(pattern + 1, text + 1);
+    return false;
+}
 
-class Device
-{
-protected:
-    vector<shared_ptr<Stream>> inputs;
-    vector<shared_ptr<Stream>> outputs;
-    int inputAmount;
-    int outputAmount;
+bool AnyGlobMatches(const std::string& patterns, const std::string& name) {
+    std::stringstream list(patterns);
+    std::string pattern;
+    while (std::getline(list, pattern, ':')) {
+        if (GlobMatch(pattern.c_str(), name.c_str())) return true;
+    }
+    return false;
+}
 
-public:
-    void addInput(shared_ptr<Stream> s){
-        if((int)inputs.size() < inputAmount) inputs.push_back(s);  // FIX: cast to int
-        else throw "INPUT STREAM LIMIT!";
+bool FilterMatches(const std::string& filter, const std::string& name) {
+    size_t dash = filter.find('-');
+    std::string positive = filter.substr(0, dash);
+    if (positive.empty()) positive = "*";
+    if (!AnyGlobMatches(positive, name)) return false;
+    return dash == std::string::npos || !AnyGlobMatches(filter.substr(dash + 1), name);
+}
+
+double ElapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs one test with its failure messages captured; returns whether it passed
+bool RunCaptured(const std::function<void()>& body, std::ostream& log) {
+    std::ostream* previous = TestLogTarget();
+    TestLogTarget() = &log;
+    bool ok = true;
+    try {
+        body();
+    } catch (const std::exception&) {
+        ok = false;
+    } catch (...) {
+        log << "Failure: Unexpected exception" << std::endl;
+        ok = false;
     }
+    TestLogTarget() = previous;
+    return ok;
+}
 
-    void addOutput(shared_ptr<Stream> s){
-        if((int)outputs.size() < outputAmount) outputs.push_back(s);  // FIX: cast to int
-        else throw "OUTPUT STREAM LIMIT!";
+// Repeats a benchmark body in batches of at least 1 ms and reports the median and fastest batch
+bool RunBenchmark(const TestCase& test, std::ostream& log) {
+    const int samples = 15;
+    size_t repeats = 1;
+    std::function<bool(size_t, double&)> batch = [&](size_t count, double& ns) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            if (!RunCaptured(test.function, log)) return false;
+        }
+        ns = ElapsedMs(start) * 1e6 / count;
+        return true;
+    };
+    double ns = 0;
+    if (!batch(1, ns)) return false;  // warm-up, also runs one-time setup in the body
+    for (;;) {
+        if (!batch(repeats, ns)) return false;
+        if (ns * repeats >= 1e6 || repeats >= (1u << 20)) break;
+        repeats *= 2;
     }
 
-    virtual void updateOutputs() = 0;
+    std::vector<double> perRun;
+    for (int s = 0; s < samples; ++s) {
+        if (!batch(repeats, ns)) return false;
+        perRun.push_back(ns);
+    }
+    std::sort(perRun.begin(), perRun.end());
+    log << "[ BENCH    ] " << test.name << " median=" << perRun[samples / 2] << " ns min=" << perRun[0]
+        << " ns runs=" << repeats * samples << std::endl;
+    return true;
+}
+
+struct TestResult {
+    bool passed;
+    double ms;
+    std::string log;
 };
 
-class Mixer: public Device
-{
-private:
-    int _inputs_count = 0;
+TestResult RunTest(const TestCase& test) {
+    std::ostringstream log;
+    auto start = std::chrono::steady_clock::now();
+    bool passed = test.kind == TestKind::Benchmark ? RunBenchmark(test, log) : RunCaptured(test.function, log);
+    return TestResult{passed, ElapsedMs(start), log.str()};
+}
 
-public:
-    Mixer(int inputs_count): Device() {
-        _inputs_count = inputs_count;
-    }
+void PrintResult(const TestCase& test, const TestResult& result) {
+    std::ostringstream out;
+    out << "[ RUN      ] " << test.name << std::endl << result.log
+        << (result.passed ? "[       OK ] " : "[  FAILED  ] ") << test.name
+        << " (" << (long long)result.ms << " ms)" << std::endl;
+    std::cout << out.str() << std::flush;
+}
+
+struct RunnerOptions {
+    unsigned jobs = 1;
+    std::string filter = "*";
+    bool benchmarks = false;
+};
 
-    void addInput(shared_ptr<Stream> s) {
-        if ((int)inputs.size() == _inputs_count) {  // FIX: cast to int
-            throw string("Too much inputs");  // FIX: use string instead of "text"s
+RunnerOptions ParseRunnerOptions(int argc, char** argv) {
+    RunnerOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value = arg.find('=') != std::string::npos ? arg.substr(arg.find('=') + 1) : "";
+        if (value.empty() && i + 1 < argc && (arg == "--jobs" || arg == "--filter")) value = argv[++i];
+        if (arg.compare(0, 6, "--jobs") == 0) {
+            int jobs = std::atoi(value.c_str());
+            options.jobs = jobs > 0 ? (unsigned)jobs : std::max(1u, std::thread::hardware_concurrency());
+        } else if (arg.compare(0, 8, "--filter") == 0) {
+            options.filter = value;
+        } else if (arg == "--benchmarks") {
+            options.benchmarks = true;
         }
-        inputs.push_back(s);
     }
+    return options;
+}
 
-    void addOutput(shared_ptr<Stream> s) {
-        if ((int)outputs.size() == MIXER_OUTPUTS) {  // FIX: cast to int
-            throw string("Too much outputs");  // FIX: use string
-        }
-        outputs.push_back(s);
+// Serial tests and benchmarks run first on the calling thread; the rest are
+// handed out to `jobs` workers one test at a time.
+int RunAllTests(const RunnerOptions& options) {
+    std::vector<const TestCase*> serial, parallel;
+    for (const TestCase& test : GetTests()) {
+        if (!FilterMatches(options.filter, test.name)) continue;
+        if (test.kind == TestKind::Benchmark && !options.benchmarks) continue;
+        (test.kind == TestKind::Parallel ? parallel : serial).push_back(&test);
     }
 
-    void updateOutputs() override {
-        double sum_mass_flow = 0;
-        for (const auto& input_stream : inputs) {
-            sum_mass_flow += input_stream->getMassFlow();
+    std::cout << "[==========] Running " << serial.size() + parallel.size() << " tests on "
+              << options.jobs << (options.jobs == 1 ? " thread" : " threads") << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<int> passed(0), failed(0);
+    std::mutex failuresLock;
+    std::vector<std::string> failures;
+    auto record = [&](const TestCase& test, const TestResult& result) {
+        PrintResult(test, result);
+        if (result.passed) {
+            ++passed;
+        } else {
+            ++failed;
+            std::lock_guard<std::mutex> guard(failuresLock);
+            failures.push_back(test.name);
         }
+    };
 
-        if (outputs.empty()) {
-            throw string("Should set outputs before update");  // FIX: use string
-        }
+    for (const TestCase* test : serial) record(*test, RunTest(*test));
 
-        double output_mass = sum_mass_flow / outputs.size();
-        for (auto& output_stream : outputs) {
-            output_stream->setMassFlow(output_mass);
-        }
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < parallel.size(); i = next++) record(*parallel[i], RunTest(*parallel[i]));
+    };
+    std::vector<std::thread> workers;
+    for (unsigned j = 1; j < options.jobs; ++j) workers.emplace_back(worker);
+    worker();
+    for (std::thread& thread : workers) thread.join();
+
+    std::cout << "[==========] " << (passed + failed) << " tests ran (" << (long long)ElapsedMs(start)
+              << " ms total)" << std::endl;
+    std::cout << "[  PASSED  ] " << passed << " tests" << std::endl;
+    if (failed > 0) {
+        std::cout << "[  FAILED  ] " << failed << " tests, listed below:" << std::endl;
+        std::sort(failures.begin(), failures.end());
+        for (const std::string& name : failures) std::cout << "[  FAILED  ] " << name << std::endl;
+        return 1;
     }
+    return 0;
+}
+
+// ==================== END SIMPLE GTEST ====================
+
+// ==================== КЛАССЫ ====================
+
+#ifndef DEVICE_TRACE_LEVEL
+#define DEVICE_TRACE_LEVEL 0
+#endif
+
+enum class TraceLevel { Error = 1, Info = 2, Debug = 3 };
+
+const size_t TRACE_MESSAGE_SIZE = 112;
+
+class TraceSink
+{
+public:
+    virtual ~TraceSink() {}
+
+    virtual void write(TraceLevel level, const char* text) = 0;
 };
 
-class Reactor : public Device
+class RingBufferTraceSink : public TraceSink
 {
 private:
-    bool isDoubleOutput;
+    struct Slot {
+        atomic<size_t> sequence;
+        TraceLevel level;
+        char text[TRACE_MESSAGE_SIZE];
+    };
+
+    unique_ptr<Slot[]> slots;
+    size_t mask;
+    atomic<size_t> head;
+    atomic<size_t> tail;
+    atomic<size_t> dropped;
 
 public:
-    Reactor(bool isDoubleReactor) : Device()
+    explicit RingBufferTraceSink(size_t capacity = 1024) : head(0), tail(0), dropped(0)
     {
-        isDoubleOutput = isDoubleReactor;
-        inputAmount = 1;
-        outputAmount = isDoubleReactor ? 2 : 1;
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.reset(new Slot[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) slots[i].sequence.store(i, memory_order_relaxed);
     }
 
-    void updateOutputs() override
+    void write(TraceLevel level, const char* text) override
     {
-        if (inputs.empty()) {
-            throw string("Input stream not connected to reactor");  // FIX: use string
+        size_t pos = head.load(memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots[pos & mask];
+            size_t seq = slot->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                dropped.fetch_add(1, memory_order_relaxed);
+                return;
+            } else {
+                pos = head.load(memory_order_relaxed);
+            }
         }
+        slot->level = level;
+        strncpy(slot->text, text, TRACE_MESSAGE_SIZE - 1);
+        slot->text[TRACE_MESSAGE_SIZE - 1] = '\0';
+        slot->sequence.store(pos + 1, memory_order_release);
+    }
 
-        if ((int)outputs.size() != outputAmount) {  // FIX: cast to int
-            throw string("Output streams not properly set for reactor");  // FIX: use string
+    size_t drain(ostream& out)
+    {
+        size_t count = 0;
+        size_t pos = tail.load(memory_order_relaxed);
+        for (;;) {
+            Slot* slot = &slots[pos & mask];
+            size_t seq = slot->sequence.load(memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, memory_order_relaxed)) {
+                    out << slot->text << '\n';
+                    slot->sequence.store(pos + mask + 1, memory_order_release);
+                    ++pos;
+                    ++count;
+                }
+            } else if (diff < 0) {
+                break;
+            } else {
+                pos = tail.load(memory_order_relaxed);
+            }
         }
+        if (count) out.flush();
+        return count;
+    }
 
-        double inputMass = inputs[0]->getMassFlow();
+    size_t droppedCount() const { return dropped.load(memory_order_relaxed); }
+};
 
-        if (isDoubleOutput) {
-            double outputMass = inputMass / 2.0;
-            outputs[0]->setMassFlow(outputMass);
-            outputs[1]->setMassFlow(outputMass);
-        } else {
-            outputs[0]->setMassFlow(inputMass);
-        }
+class TraceDrainer
+{
+private:
+    RingBufferTraceSink& sink;
+    ostream& out;
+    atomic<bool> running;
+    thread worker;
+
+public:
+    TraceDrainer(RingBufferTraceSink& sink, ostream& out,
+                 chrono::milliseconds period = chrono::milliseconds(10))
+        : sink(sink), out(out), running(true)
+    {
+        worker = thread([this, period]() {
+            while (running.load(memory_order_acquire)) {
+                this->sink.drain(this->out);
+                this_thread::sleep_for(period);
+            }
+            this->sink.drain(this->out);
+        });
     }
 
-    bool getIsDoubleOutput() const { return isDoubleOutput; }
+    ~TraceDrainer()
+    {
+        running.store(false, memory_order_release);
+        worker.join();
+    }
 };
 
-// ==================== GOOGLE TESTS ====================
+struct TraceConfig {
+    atomic<TraceSink*> sink;
+    atomic<int> level;
 
-TEST(ReactorTest, SingleOutputMode) {
-    streamcounter = 0;
-    Reactor reactor(false);
+    static TraceConfig& instance()
+    {
+        static TraceConfig config;
+        return config;
+    }
 
-    shared_ptr<Stream> input(new Stream(++streamcounter));
-    shared_ptr<Stream> output(new Stream(++streamcounter));
+private:
+    TraceConfig() : sink(nullptr), level((int)TraceLevel::Info) {}
+};
 
-    input->setMassFlow(20.0);
+inline void setTraceSink(TraceSink* sink, TraceLevel level = TraceLevel::Info)
+{
+    TraceConfig::instance().level.store((int)level, memory_order_relaxed);
+    TraceConfig::instance().sink.store(sink, memory_order_release);
+}
 
-    reactor.addInput(input);
-    reactor.addOutput(output);
-    reactor.updateOutputs();
+inline void traceMessage(TraceLevel level, const char* format, ...)
+{
+    TraceConfig& config = TraceConfig::instance();
+    TraceSink* sink = config.sink.load(memory_order_acquire);
+    if (!sink || (int)level > config.level.load(memory_order_relaxed)) return;
 
-    EXPECT_NEAR(output->getMassFlow(), 20.0, POSSIBLE_ERROR);
+    char text[TRACE_MESSAGE_SIZE];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text, sizeof(text), format, args);
+    va_end(args);
+    sink->write(level, text);
 }
 
-TEST(ReactorTest, DoubleOutputMode) {
-    streamcounter = 0;
-    Reactor reactor(true);
+#if DEVICE_TRACE_LEVEL > 0
+#define DEVICE_TRACE(level, ...) \
+    do { \
+        if ((int)(level) <= DEVICE_TRACE_LEVEL) traceMessage((level), __VA_ARGS__); \
+    } while (0)
+#else
+#define DEVICE_TRACE(level, ...) do {} while (0)
+#endif
 
-    shared_ptr<Stream> input(new Stream(++streamcounter));
-    shared_ptr<Stream> output1(new Stream(++streamcounter));
-    shared_ptr<Stream> output2(new Stream(++streamcounter));
+#ifndef DEVICE_PROFILING
+#define DEVICE_PROFILING 0
+#endif
 
-    input->setMassFlow(30.0);
+class Device;
 
-    reactor.addInput(input);
-    reactor.addOutput(output1);
-    reactor.addOutput(output2);
-    reactor.updateOutputs();
+enum class ProfilePhase { Update = 0, Batch, Components, Tangents };
 
-    EXPECT_NEAR(output1->getMassFlow(), 15.0, POSSIBLE_ERROR);
-    EXPECT_NEAR(output2->getMassFlow(), 15.0, POSSIBLE_ERROR);
+const size_t PROFILE_PHASES = 4;
 
-    // Check mass conservation
-    double totalOutput = output1->getMassFlow() + output2->getMassFlow();
-    EXPECT_NEAR(totalOutput, 30.0, POSSIBLE_ERROR);
+inline const char* profilePhaseName(ProfilePhase phase)
+{
+    switch (phase) {
+    case ProfilePhase::Update: return "update";
+    case ProfilePhase::Batch: return "batch";
+    case ProfilePhase::Components: return "components";
+    case ProfilePhase::Tangents: return "tangents";
+    }
+    return "unknown";
 }
 
-TEST(ReactorTest, InputLimitEnforcement) {
-    streamcounter = 0;
-    Reactor reactor(false);
+struct DeviceProfile {
+    const Device* device;
+    ProfilePhase phase;
+    uint64_t calls;
+    uint64_t totalNs;
+    uint64_t maxNs;
+    uint64_t exceptions;
+    const char* typeName;
+};
 
-    shared_ptr<Stream> input1(new Stream(++streamcounter));
-    shared_ptr<Stream> input2(new Stream(++streamcounter));
+class ProfileRegistry
+{
+private:
+    struct Counters {
+        uint64_t calls = 0;
+        uint64_t totalNs = 0;
+        uint64_t maxNs = 0;
+        uint64_t exceptions = 0;
+    };
 
-    reactor.addInput(input1);
-    EXPECT_THROW(reactor.addInput(input2), const char*);
-}
+    struct Entry {
+        const char* typeName;
+        array<Counters, PROFILE_PHASES> phases;
+    };
 
-TEST(ReactorTest, OutputLimitSingleMode) {
-    streamcounter = 0;
-    Reactor reactor(false);
+    struct ThreadTable {
+        mutex lock;
+        unordered_map<const Device*, Entry> entries;
+    };
 
-    shared_ptr<Stream> input(new Stream(++streamcounter));
-    shared_ptr<Stream> output1(new Stream(++streamcounter));
-    shared_ptr<Stream> output2(new Stream(++streamcounter));
+    mutex lock;
+    vector<shared_ptr<ThreadTable>> tables;
 
-    reactor.addInput(input);
-    reactor.addOutput(output1);
-    EXPECT_THROW(reactor.addOutput(output2), const char*);
+    ProfileRegistry() {}
+
+    ThreadTable& local()
+    {
+        static thread_local shared_ptr<ThreadTable> table;
+        if (!table) {
+            table = make_shared<ThreadTable>();
+            lock_guard<mutex> guard(lock);
+            tables.push_back(table);
+        }
+        return *table;
+    }
+
+public:
+    static ProfileRegistry& instance()
+    {
+        // Never destroyed, so devices with static storage can still unregister at exit
+        static ProfileRegistry* registry = new ProfileRegistry();
+        return *registry;
+    }
+
+    void record(const Device* device, const char* typeName, ProfilePhase phase, uint64_t ns, bool threw)
+    {
+        ThreadTable& table = local();
+        lock_guard<mutex> guard(table.lock);
+        auto it = table.entries.find(device);
+        if (it == table.entries.end()) it = table.entries.emplace(device, Entry{typeName, {}}).first;
+        Counters& counters = it->second.phases[(size_t)phase];
+        ++counters.calls;
+        counters.totalNs += ns;
+        counters.maxNs = max(counters.maxNs, ns);
+        if (threw) ++counters.exceptions;
+    }
+
+    vector<DeviceProfile> snapshot()
+    {
+        unordered_map<const Device*, array<DeviceProfile, PROFILE_PHASES>> merged;
+        lock_guard<mutex> guard(lock);
+        for (const shared_ptr<ThreadTable>& table : tables) {
+            lock_guard<mutex> tableGuard(table->lock);
+            for (const auto& entry : table->entries) {
+                auto inserted = merged.emplace(entry.first, array<DeviceProfile, PROFILE_PHASES>());
+                for (size_t p = 0; p < PROFILE_PHASES; ++p) {
+                    DeviceProfile& profile = inserted.first->second[p];
+                    if (inserted.second) profile = DeviceProfile{entry.first, (ProfilePhase)p, 0, 0, 0, 0, entry.second.typeName};
+                    const Counters& counters = entry.second.phases[p];
+                    profile.calls += counters.calls;
+                    profile.totalNs += counters.totalNs;
+                    profile.maxNs = max(profile.maxNs, counters.maxNs);
+                    profile.exceptions += counters.exceptions;
+                }
+            }
+        }
+        vector<DeviceProfile> result;
+        for (const auto& entry : merged) {
+            for (const DeviceProfile& profile : entry.second) {
+                if (profile.calls) result.push_back(profile);
+            }
+        }
+        return result;
+    }
+
+    void reset()
+    {
+        lock_guard<mutex> guard(lock);
+        for (const shared_ptr<ThreadTable>& table : tables) {
+            lock_guard<mutex> tableGuard(table->lock);
+            table->entries.clear();
+        }
+    }
+
+    void forget(const Device* device)
+    {
+        lock_guard<mutex> guard(lock);
+        for (const shared_ptr<ThreadTable>& table : tables) {
+            lock_guard<mutex> tableGuard(table->lock);
+            table->entries.erase(device);
+        }
+    }
+};
+
+template <class Owner, class Body>
+inline void profiledCall(const Owner* device, ProfilePhase phase, const Body& body)
+{
+#if DEVICE_PROFILING
+    auto start = chrono::steady_clock::now();
+    try {
+        body();
+    } catch (...) {
+        uint64_t ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        ProfileRegistry::instance().record(device, device->typeName(), phase, ns, true);
+        throw;
+    }
+    uint64_t ns = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    ProfileRegistry::instance().record(device, device->typeName(), phase, ns, false);
+#else
+    (void)device;
+    (void)phase;
+    body();
+#endif
 }
 
-TEST(ReactorTest, GetIsDoubleOutputMethod) {
-    Reactor singleReactor(false);
-    Reactor doubleReactor(true);
+inline vector<DeviceProfile> deviceProfiles() { return ProfileRegistry::instance().snapshot(); }
 
-    EXPECT_FALSE(singleReactor.getIsDoubleOutput());
-    EXPECT_TRUE(doubleReactor.getIsDoubleOutput());
+inline DeviceProfile deviceProfile(const Device* device, ProfilePhase phase = ProfilePhase::Update)
+{
+    for (const DeviceProfile& profile : deviceProfiles()) {
+        if (profile.device == device && profile.phase == phase) return profile;
+    }
+    return DeviceProfile{device, phase, 0, 0, 0, 0, nullptr};
 }
 
-TEST(ReactorTest, NoInputException) {
-    streamcounter = 0;
-    Reactor reactor(false);
+inline void resetDeviceProfiles() { ProfileRegistry::instance().reset(); }
 
-    shared_ptr<Stream> output(new Stream(++streamcounter));
-    reactor.addOutput(output);
-    EXPECT_THROW(reactor.updateOutputs(), string);
+inline void lanesAdd(double* dst, const double* src, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_add_pd(_mm256_loadu_pd(dst + i), _mm256_loadu_pd(src + i)));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 2 <= n; i += 2) {
+        vst1q_f64(dst + i, vaddq_f64(vld1q_f64(dst + i), vld1q_f64(src + i)));
+    }
+#endif
+    for (; i < n; ++i) dst[i] += src[i];
 }
 
-TEST(ReactorTest, WrongOutputCountException) {
-    streamcounter = 0;
-    Reactor reactor(true);
+inline void lanesScale(double* dst, const double* src, double factor, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256d f = _mm256_set1_pd(factor);
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(_mm256_loadu_pd(src + i), f));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float64x2_t f = vdupq_n_f64(factor);
+    for (; i + 2 <= n; i += 2) {
+        vst1q_f64(dst + i, vmulq_f64(vld1q_f64(src + i), f));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = factor * src[i];
+}
 
-    shared_ptr<Stream> input(new Stream(++streamcounter));
-    shared_ptr<Stream> output1(new Stream(++streamcounter));
+inline void gatherScaled(double* dst, const double* values, const uint32_t* index, const double* scale, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    // Widen the ids to 64 bits: a signed 32-bit gather would misread ids of
+    // 2^31 and above. The masked form starts from a defined register.
+    const __m256d lanes = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    for (; i + 4 <= n; i += 4) {
+        __m256i slots = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(index + i)));
+        __m256d gathered = _mm256_mask_i64gather_pd(_mm256_setzero_pd(), values, slots, lanes, 8);
+        _mm256_storeu_pd(dst + i, _mm256_mul_pd(gathered, _mm256_loadu_pd(scale + i)));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = scale[i] * values[index[i]];
+}
 
-    reactor.addInput(input);
-    reactor.addOutput(output1);
-    EXPECT_THROW(reactor.updateOutputs(), string);
+typedef uint32_t StreamId;
+
+const size_t SIMD_ALIGNMENT = 32;
+
+inline void* alignedMalloc(size_t size, size_t alignment) noexcept
+{
+#if DEVICE_HAS_POSIX_MEMALIGN
+    void* p = nullptr;
+    return posix_memalign(&p, alignment, size) == 0 ? p : nullptr;
+#else
+    // Over-allocate and keep malloc's pointer in the word below the aligned block
+    void* raw = malloc(size + alignment + sizeof(void*));
+    if (!raw) return nullptr;
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(void*) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    reinterpret_cast<void**>(aligned)[-1] = raw;
+    return reinterpret_cast<void*>(aligned);
+#endif
 }
 
-TEST(MixerTest, BasicFunctionality) {
-    streamcounter = 0;
-    Mixer mixer(2);
+inline void alignedFree(void* p) noexcept
+{
+#if DEVICE_HAS_POSIX_MEMALIGN
+    free(p);
+#else
+    if (p) free(static_cast<void**>(p)[-1]);
+#endif
+}
 
-    shared_ptr<Stream> s1(new Stream(++streamcounter));
-    shared_ptr<Stream> s2(new Stream(++streamcounter));
-    shared_ptr<Stream> s3(new Stream(++streamcounter));
+template <class T>
+struct AlignedAllocator {
+    typedef T value_type;
 
-    s1->setMassFlow(10.0);
-    s2->setMassFlow(5.0);
+    AlignedAllocator() {}
+    template <class U> AlignedAllocator(const AlignedAllocator<U>&) {}
 
-    mixer.addInput(s1);
-    mixer.addInput(s2);
-    mixer.addOutput(s3);
-    mixer.updateOutputs();
+    T* allocate(size_t n)
+    {
+        size_t bytes = max(n * sizeof(T), SIMD_ALIGNMENT);
+#if !DEVICE_HAS_POSIX_MEMALIGN && defined(__cpp_aligned_new)
+        return static_cast<T*>(::operator new(bytes, align_val_t(SIMD_ALIGNMENT)));
+#else
+        void* p = alignedMalloc(bytes, SIMD_ALIGNMENT);
+        if (!p) throw bad_alloc();
+        return static_cast<T*>(p);
+#endif
+    }
 
-    EXPECT_NEAR(s3->getMassFlow(), 15.0, POSSIBLE_ERROR);
+    void deallocate(T* p, size_t)
+    {
+#if !DEVICE_HAS_POSIX_MEMALIGN && defined(__cpp_aligned_new)
+        ::operator delete(p, align_val_t(SIMD_ALIGNMENT));
+#else
+        alignedFree(p);
+#endif
+    }
+};
+
+template <class T, class U>
+bool operator==(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return true; }
+template <class T, class U>
+bool operator!=(const AlignedAllocator<T>&, const AlignedAllocator<U>&) { return false; }
+
+struct StreamRows {
+    double* base;
+    size_t width;
+
+    double* row(StreamId id) const { return base + id * width; }
+};
+
+
+template <class T, class Allocator>
+inline size_t heapBytes(const vector<T, Allocator>& items) { return items.capacity() * sizeof(T); }
+
+inline size_t heapBytes(const string& text)
+{
+    const char* data = text.data();
+    bool local = data >= reinterpret_cast<const char*>(&text) && data < reinterpret_cast<const char*>(&text + 1);
+    return local ? 0 : text.capacity() + 1;
 }
 
-// ==================== MAIN ====================
+template <class K, class V>
+inline size_t heapBytes(const unordered_map<K, V>& items)
+{
+    size_t buckets = items.bucket_count() > 1 ? items.bucket_count() : 0;
+    return items.size() * (sizeof(typename unordered_map<K, V>::value_type) + sizeof(void*)) + buckets * sizeof(void*);
+}
 
-int main(int argc, char **argv) {
-    cout << "Chemical Process Simulation - Google Tests" << endl;
-    cout << "==========================================" << endl;
+template <class T, size_t N>
+class SmallVector
+{
+    static_assert(is_trivially_copyable<T>::value, "SmallVector copies elements with memcpy");
 
-    // Run all tests using our simple test runner
-    std::cout << "[==========] Running " << GetTests().size() << " tests" << std::endl;
-    int passed = 0;
-    int failed = 0;
+private:
+    T* items;
+    uint32_t count;
+    uint32_t capacity;
+    T local[N];
 
-    for (const auto& test : GetTests()) {
-        std::cout << "[ RUN      ] " << test.name << std::endl;
-        try {
-            test.function();
-            std::cout << "[       OK ] " << test.name << std::endl;
-            passed++;
-        } catch (const std::exception& e) {
-            std::cout << "[  FAILED  ] " << test.name << std::endl;
-            failed++;
-        }
+    void grow(size_t wanted)
+    {
+        size_t grown = max(wanted, 2 * (size_t)capacity);
+        T* block = static_cast<T*>(::operator new(grown * sizeof(T)));
+        memcpy(block, items, count * sizeof(T));
+        release();
+        items = block;
+        capacity = (uint32_t)grown;
     }
 
-    std::cout << "[==========] " << (passed + failed) << " tests ran" << std::endl;
-    std::cout << "[  PASSED  ] " << passed << " tests" << std::endl;
-    if (failed > 0) {
-        std::cout << "[  FAILED  ] " << failed << " tests" << std::endl;
-        return 1;
+    void release()
+    {
+        if (items != local) ::operator delete(items);
+        items = local;
+        capacity = N;
     }
 
-    cout << endl << "All tests passed successfully!" << endl;
-    return 0;
-}
\ No newline at end of file
+public:
+    SmallVector() : items(local), count(0), capacity(N) {}
+    SmallVector(const SmallVector& other) : SmallVector() { *this = other; }
+    SmallVector(SmallVector&& other) : SmallVector() { *this = move(other); }
+    ~SmallVector() { release(); }
+
+    SmallVector& operator=(const SmallVector& other)
+    {
+        if (this == &other) return *this;
+        count = 0;
+        if (other.count > capacity) grow(other.count);
+        memcpy(items, other.items, other.count * sizeof(T));
+        count = other.count;
+        return *this;
+    }
+
+    SmallVector& operator=(SmallVector&& other)
+    {
+        if (this == &other) return *this;
+        if (other.items == other.local) return *this = other;
+        release();
+        items = other.items;
+        count = other.count;
+        capacity = other.capacity;
+        other.items = other.local;
+        other.count = 0;
+        other.capacity = N;
+        return *this;
+    }
+
+    void push_back(const T& value)
+    {
+        if (count == capacity) {
+            T copy = value;  // value may live in the block being replaced
+            grow(count + 1);
+            items[count++] = copy;
+            return;
+        }
+        items[count++] = value;
+    }
+
+    void reserve(size_t wanted)
+    {
+        if (wanted > capacity) grow(wanted);
+    }
+
+    void clear() { count = 0; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    bool isInline() const { return items == local; }
+    size_t heapBytes() const { return isInline() ? 0 : capacity * sizeof(T); }
+    T* data() { return items; }
+    const T* data() const { return items; }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+    T* begin() { return items; }
+    T* end() { return items + count; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+};
+
+typedef SmallVector<StreamId, 4> PortList;
+
+class StreamStore
+{
+private:
+    vector<double> mass_flows;
+    vector<uint32_t> numbers;
+    unordered_map<StreamId, string> custom_names;
+    vector<uint8_t> dirty;
+    size_t lane_count = 0;
+    vector<double> lane_values;
+    size_t component_count = 0;
+    size_t component_stride = 0;
+    vector<double, AlignedAllocator<double>> component_flows;
+    size_t tangent_count = 0;
+    size_t tangent_stride = 0;
+    vector<double, AlignedAllocator<double>> tangent_values;
+    vector<StreamId> free_slots;
+
+public:
+    StreamId add(uint32_t number)
+    {
+        mass_flows.push_back(0.0);
+        numbers.push_back(number);
+        dirty.push_back(1);
+        lane_values.resize(lane_values.size() + lane_count, 0.0);
+        component_flows.resize(component_flows.size() + component_stride, 0.0);
+        tangent_values.resize(tangent_values.size() + tangent_stride, 0.0);
+        return (StreamId)(mass_flows.size() - 1);
+    }
+
+    StreamId acquire(uint32_t number)
+    {
+        if (free_slots.empty()) return add(number);
+        StreamId id = free_slots.back();
+        free_slots.pop_back();
+        mass_flows[id] = 0.0;
+        numbers[id] = number;
+        dirty[id] = 1;
+        custom_names.erase(id);
+        fill_n(laneValues(id), lane_count, 0.0);
+        fill_n(componentFlows(id), component_stride, 0.0);
+        fill_n(tangentValues(id), tangent_stride, 0.0);
+        return id;
+    }
+
+    void release(StreamId id) { free_slots.push_back(id); }
+
+    double getMassFlow(StreamId id) const { return mass_flows[id]; }
+
+    void setMassFlow(StreamId id, double m)
+    {
+        if (mass_flows[id] != m) {
+            mass_flows[id] = m;
+            dirty[id] = 1;
+        }
+    }
+
+    bool isDirty(StreamId id) const { return dirty[id] != 0; }
+    const uint8_t* dirtyFlags() const { return dirty.data(); }
+    void clearDirty() { fill(dirty.begin(), dirty.end(), 0); }
+    uint32_t getNumber(StreamId id) const { return numbers[id]; }
+    const uint32_t* streamNumbers() const { return numbers.data(); }
+    const unordered_map<StreamId, string>& customNames() const { return custom_names; }
+
+    size_t footprint() const
+    {
+        return heapBytes(mass_flows) + heapBytes(numbers) + heapBytes(dirty) + heapBytes(lane_values) +
+               heapBytes(component_flows) + heapBytes(tangent_values) + heapBytes(free_slots);
+    }
+
+    size_t nameFootprint() const
+    {
+        size_t bytes = heapBytes(custom_names);
+        for (const auto& entry : custom_names) bytes += heapBytes(entry.second);
+        return bytes;
+    }
+
+    string getName(StreamId id) const
+    {
+        auto it = custom_names.find(id);
+        if (it != custom_names.end()) return it->second;
+        return "s" + std::to_string(numbers[id]);
+    }
+
+    void setName(StreamId id, const string& name) { custom_names[id] = name; }
+    size_t size() const { return mass_flows.size(); }
+
+    double* massFlows() { return mass_flows.data(); }
+    const double* massFlows() const { return mass_flows.data(); }
+
+    void setLanes(size_t n)
+    {
+        lane_count = n;
+        lane_values.assign(mass_flows.size() * n, 0.0);
+    }
+
+    size_t lanes() const { return lane_count; }
+
+    double* laneValues(StreamId id) { return lane_values.data() + id * lane_count; }
+    const double* laneValues(StreamId id) const { return lane_values.data() + id * lane_count; }
+    StreamRows laneRows() { return StreamRows{lane_values.data(), lane_count}; }
+
+    void setComponents(size_t n)
+    {
+        component_count = n;
+        component_stride = (n + 3) / 4 * 4;
+        component_flows.assign(mass_flows.size() * component_stride, 0.0);
+    }
+
+    size_t components() const { return component_count; }
+    double* componentFlows(StreamId id) { return component_flows.data() + id * component_stride; }
+    const double* componentFlows(StreamId id) const { return component_flows.data() + id * component_stride; }
+    StreamRows componentRows() { return StreamRows{component_flows.data(), component_stride}; }
+
+    void setTangents(size_t n)
+    {
+        tangent_count = n;
+        tangent_stride = (n + 3) / 4 * 4;
+        tangent_values.assign(mass_flows.size() * tangent_stride, 0.0);
+    }
+
+    size_t tangents() const { return tangent_count; }
+    double* tangentValues(StreamId id) { return tangent_values.data() + id * tangent_stride; }
+    const double* tangentValues(StreamId id) const { return tangent_values.data() + id * tangent_stride; }
+    StreamRows tangentRows() { return StreamRows{tangent_values.data(), tangent_stride}; }
+
+    double totalMass(StreamId id) const
+    {
+        const double* flows = componentFlows(id);
+        double total = 0.0;
+        for (size_t c = 0; c < component_count; ++c) total += flows[c];
+        return total;
+    }
+
+    StreamId append(const StreamStore& other)
+    {
+        if (other.lane_count != lane_count || other.component_count != component_count ||
+            other.tangent_count != tangent_count) {
+            throw string("Stream stores have different batch or component layouts");
+        }
+        StreamId offset = (StreamId)size();
+        mass_flows.insert(mass_flows.end(), other.mass_flows.begin(), other.mass_flows.end());
+        numbers.insert(numbers.end(), other.numbers.begin(), other.numbers.end());
+        dirty.insert(dirty.end(), other.dirty.begin(), other.dirty.end());
+        lane_values.insert(lane_values.end(), other.lane_values.begin(), other.lane_values.end());
+        component_flows.insert(component_flows.end(), other.component_flows.begin(), other.component_flows.end());
+        tangent_values.insert(tangent_values.end(), other.tangent_values.begin(), other.tangent_values.end());
+        for (const auto& entry : other.custom_names) custom_names[offset + entry.first] = entry.second;
+        return offset;
+    }
+
+    void assign(const double* flows, const uint32_t* streamNumbers, size_t count)
+    {
+        mass_flows.assign(flows, flows + count);
+        numbers.assign(streamNumbers, streamNumbers + count);
+        custom_names.clear();
+        dirty.assign(count, 1);
+        lane_values.assign(count * lane_count, 0.0);
+        component_flows.assign(count * component_stride, 0.0);
+        tangent_values.assign(count * tangent_stride, 0.0);
+    }
+
+    void clear()
+    {
+        mass_flows.clear();
+        numbers.clear();
+        custom_names.clear();
+        dirty.clear();
+        lane_values.clear();
+        component_flows.clear();
+        tangent_values.clear();
+        free_slots.clear();
+    }
+};
+
+class StandaloneStore : public StreamStore
+{
+private:
+    mutex lock;
+    size_t live = 0;
+    bool orphaned = false;
+
+    struct Owner {
+        StandaloneStore* store = new StandaloneStore();
+
+        ~Owner()
+        {
+            bool empty;
+            {
+                lock_guard<mutex> guard(store->lock);
+                store->orphaned = true;
+                empty = store->live == 0;
+            }
+            if (empty) delete store;
+        }
+    };
+
+public:
+    static StandaloneStore& current()
+    {
+        static thread_local Owner owner;
+        return *owner.store;
+    }
+
+    StreamId acquire(uint32_t number)
+    {
+        lock_guard<mutex> guard(lock);
+        ++live;
+        return StreamStore::acquire(number);
+    }
+
+    void release(StreamId id)
+    {
+        bool last;
+        {
+            lock_guard<mutex> guard(lock);
+            StreamStore::release(id);
+            last = --live == 0 && orphaned;
+        }
+        if (last) delete this;
+    }
+};
+
+class Stream
+{
+    friend class StreamArena;
+
+private:
+    StreamStore* store;
+    StreamId id;
+    bool standalone = false;
+
+public:
+    Stream(int s) : store(&StandaloneStore::current()), id(StandaloneStore::current().acquire((uint32_t)s)),
+                    standalone(true) {}
+
+    Stream(StreamStore& store, StreamId id) : store(&store), id(id) {}
+
+    Stream(const Stream&) = delete;
+    Stream& operator=(const Stream&) = delete;
+
+    ~Stream()
+    {
+        if (standalone) static_cast<StandaloneStore*>(store)->release(id);
+    }
+
+    void setName(const string& s){store->setName(id, s);}
+
+    string getName(){return store->getName(id);}
+
+    void setMassFlow(double m){
+        if (store->components()) throw string("Mass flow is derived from component flows");
+        store->setMassFlow(id, m);
+    }
+
+    double getMassFlow() const {return store->components() ? store->totalMass(id) : store->getMassFlow(id);}
+
+    void setComponentFlow(size_t c, double m){
+        if (c >= store->components()) throw string("Component index out of range");
+        store->componentFlows(id)[c] = m;
+    }
+
+    double getComponentFlow(size_t c) const {
+        if (c >= store->components()) throw string("Component index out of range");
+        return store->componentFlows(id)[c];
+    }
+
+    void setLane(size_t lane, double m){store->laneValues(id)[lane]=m;}
+
+    double getLane(size_t lane) const {return store->laneValues(id)[lane];}
+
+    uint32_t getNumber() const {return store->getNumber(id);}
+
+    StreamId getId() const {return id;}
+
+    StreamStore& getStore() const {return *store;}
+
+    void print() { cout << "Stream " << getName() << " flow = " << getMassFlow() << '\n'; }
+};
+
+class StreamArena
+{
+private:
+    typedef aligned_storage<sizeof(Stream), alignof(Stream)>::type Slot;
+    static const size_t CHUNK_SIZE = 1024;
+
+    vector<unique_ptr<Slot[]>> chunks;
+    size_t used = CHUNK_SIZE;
+    vector<pair<unique_ptr<Slot[]>, size_t>> adopted;
+    vector<shared_ptr<StreamArena>> successors;
+
+    void rebind(Slot* slots, size_t count, StreamId offset)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            Stream* handle = reinterpret_cast<Stream*>(&slots[i]);
+            handle->store = &store;
+            handle->id += offset;
+        }
+    }
+
+public:
+    StreamStore store;
+
+    Stream* create(StreamId id)
+    {
+        if (used == CHUNK_SIZE) {
+            chunks.emplace_back(new Slot[CHUNK_SIZE]);
+            used = 0;
+        }
+        return new (&chunks.back()[used++]) Stream(store, id);
+    }
+
+    void adopt(StreamArena& other, StreamId offset, const shared_ptr<StreamArena>& self)
+    {
+        for (size_t c = 0; c < other.chunks.size(); ++c) {
+            size_t count = c + 1 == other.chunks.size() ? other.used : CHUNK_SIZE;
+            rebind(other.chunks[c].get(), count, offset);
+            adopted.emplace_back(move(other.chunks[c]), count);
+        }
+        for (auto& chunk : other.adopted) {
+            rebind(chunk.first.get(), chunk.second, offset);
+            adopted.push_back(move(chunk));
+        }
+        other.chunks.clear();
+        other.adopted.clear();
+        other.used = CHUNK_SIZE;
+        other.successors.push_back(self);
+    }
+
+    bool reaches(const StreamArena& target) const
+    {
+        vector<const StreamArena*> pending{this}, seen;
+        while (!pending.empty()) {
+            const StreamArena* arena = pending.back();
+            pending.pop_back();
+            if (arena == &target) return true;
+            if (find(seen.begin(), seen.end(), arena) != seen.end()) continue;
+            seen.push_back(arena);
+            for (const auto& successor : arena->successors) pending.push_back(successor.get());
+        }
+        return false;
+    }
+
+    size_t footprint() const
+    {
+        return (chunks.size() + adopted.size()) * CHUNK_SIZE * sizeof(Slot) + heapBytes(chunks) + heapBytes(adopted) +
+               heapBytes(successors);
+    }
+};
+
+class StreamSnapshot
+{
+private:
+    struct Buffer {
+        atomic<uint64_t> sequence{0};
+        atomic<size_t> count{0};
+        unique_ptr<atomic<double>[]> values;
+    };
+
+    struct Generation {
+        size_t capacity;
+        Buffer buffers[2];
+        atomic<uint64_t> epoch{0};
+    };
+
+    atomic<Generation*> current{nullptr};
+    vector<unique_ptr<Generation>> generations;
+
+public:
+    StreamSnapshot() {}
+    StreamSnapshot(const StreamSnapshot&) = delete;
+    StreamSnapshot& operator=(const StreamSnapshot&) = delete;
+
+    size_t footprint() const
+    {
+        size_t bytes = heapBytes(generations);
+        for (const auto& generation : generations) {
+            bytes += sizeof(Generation) + 2 * generation->capacity * sizeof(atomic<double>);
+        }
+        return bytes;
+    }
+
+    void publish(const StreamStore& store)
+    {
+        size_t n = store.size();
+        Generation* generation = current.load(memory_order_relaxed);
+        if (!generation || generation->capacity < n) {
+            unique_ptr<Generation> grown(new Generation);
+            grown->capacity = max(n, generation ? 2 * generation->capacity : n);
+            for (Buffer& buffer : grown->buffers) buffer.values.reset(new atomic<double>[grown->capacity]);
+            grown->epoch.store(generation ? generation->epoch.load(memory_order_relaxed) : 0, memory_order_relaxed);
+            generation = grown.get();
+            generations.push_back(move(grown));
+        }
+
+        uint64_t epoch = generation->epoch.load(memory_order_relaxed) + 1;
+        Buffer& back = generation->buffers[epoch & 1];
+        uint64_t sequence = back.sequence.load(memory_order_relaxed);
+        back.sequence.store(sequence + 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        const double* flows = store.massFlows();
+        bool components = store.components() > 0;
+        for (size_t id = 0; id < n; ++id) {
+            back.values[id].store(components ? store.totalMass((StreamId)id) : flows[id], memory_order_relaxed);
+        }
+        back.count.store(n, memory_order_relaxed);
+        back.sequence.store(sequence + 2, memory_order_release);
+
+        generation->epoch.store(epoch, memory_order_release);
+        current.store(generation, memory_order_release);
+    }
+
+    uint64_t read(vector<double>& out) const
+    {
+        for (;;) {
+            const Generation* generation = current.load(memory_order_acquire);
+            if (!generation) {
+                out.clear();
+                return 0;
+            }
+            uint64_t epoch = generation->epoch.load(memory_order_acquire);
+            const Buffer& front = generation->buffers[epoch & 1];
+            uint64_t sequence = front.sequence.load(memory_order_acquire);
+            if (sequence & 1) continue;
+            out.resize(front.count.load(memory_order_relaxed));
+            for (size_t id = 0; id < out.size(); ++id) out[id] = front.values[id].load(memory_order_relaxed);
+            atomic_thread_fence(memory_order_acquire);
+            if (front.sequence.load(memory_order_relaxed) == sequence) return epoch;
+        }
+    }
+
+    double get(StreamId id) const
+    {
+        for (;;) {
+            const Generation* generation = current.load(memory_order_acquire);
+            if (!generation) return 0.0;
+            const Buffer& front = generation->buffers[generation->epoch.load(memory_order_acquire) & 1];
+            uint64_t sequence = front.sequence.load(memory_order_acquire);
+            if (sequence & 1) continue;
+            double value = id < front.count.load(memory_order_relaxed) ? front.values[id].load(memory_order_relaxed) : 0.0;
+            atomic_thread_fence(memory_order_acquire);
+            if (front.sequence.load(memory_order_relaxed) == sequence) return value;
+        }
+    }
+
+    uint64_t epoch() const
+    {
+        const Generation* generation = current.load(memory_order_acquire);
+        return generation ? generation->epoch.load(memory_order_acquire) : 0;
+    }
+};
+
+class StreamIdAllocator
+{
+private:
+    atomic<uint32_t> next;
+
+public:
+    static const uint32_t BLOCK_SIZE = 256;
+
+    explicit StreamIdAllocator(uint32_t first = 1) : next(first) {}
+
+    uint32_t reserve(uint32_t count) { return next.fetch_add(count, memory_order_relaxed); }
+
+    void advancePast(uint32_t number)
+    {
+        uint32_t current = next.load(memory_order_relaxed);
+        while (current <= number && !next.compare_exchange_weak(current, number + 1, memory_order_relaxed)) {
+        }
+    }
+};
+
+struct StreamIdBlock {
+    uint32_t next = 0;
+    uint32_t end = 0;
+
+    uint32_t take(StreamIdAllocator& allocator)
+    {
+        if (next == end) {
+            next = allocator.reserve(StreamIdAllocator::BLOCK_SIZE);
+            end = next + StreamIdAllocator::BLOCK_SIZE;
+        }
+        return next++;
+    }
+};
+
+enum class DeviceError {
+    None = 0,
+    InputLimit,
+    OutputLimit,
+    StoreMismatch,
+    InputNotConnected,
+    OutputsNotSet
+};
+
+inline const char* deviceErrorMessage(DeviceError error)
+{
+    switch (error) {
+    case DeviceError::None: return "No error";
+    case DeviceError::InputLimit: return "Input stream limit reached";
+    case DeviceError::OutputLimit: return "Output stream limit reached";
+    case DeviceError::StoreMismatch: return "Stream belongs to a different stream store";
+    case DeviceError::InputNotConnected: return "Input stream not connected";
+    case DeviceError::OutputsNotSet: return "Output streams not properly set";
+    }
+    return "Unknown device error";
+}
+
+struct DeviceStatus {
+    DeviceError error;
+
+    DeviceStatus(DeviceError error = DeviceError::None) : error(error) {}
+    bool ok() const { return error == DeviceError::None; }
+    explicit operator bool() const { return ok(); }
+    const char* message() const { return deviceErrorMessage(error); }
+};
+
+class FlowsheetTape;
+
+enum class DeviceKind : uint32_t {
+    Custom = 0,
+    Mixer = 1,
+    Reactor = 2,
+    Splitter = 3
+};
+
+class Device
+{
+    friend class Flowsheet;
+
+protected:
+    PortList inputs;
+    PortList outputs;
+    StreamStore* store = nullptr;
+    int inputAmount;
+    int outputAmount;
+    unsigned* topologyVersion = nullptr;
+
+    DeviceStatus connect(PortList& ports, int limit, const Stream& s, DeviceError full)
+    {
+        if ((int)ports.size() >= limit) return full;
+        if (store && store != &s.getStore()) return DeviceError::StoreMismatch;
+        store = &s.getStore();
+        ports.push_back(s.getId());
+        portConnected(&ports == &inputs, ports.size() - 1);
+        topologyChanged();
+        return DeviceError::None;
+    }
+
+    [[noreturn]] virtual void raise(DeviceError error) const
+    {
+        if (error == DeviceError::InputLimit) throw "INPUT STREAM LIMIT!";
+        if (error == DeviceError::OutputLimit) throw "OUTPUT STREAM LIMIT!";
+        throw string(deviceErrorMessage(error));
+    }
+
+    virtual void portConnected(bool isInput, size_t slot) { (void)isInput; (void)slot; }
+
+    virtual DeviceKind describe(vector<double>& parameters) const { (void)parameters; return DeviceKind::Custom; }
+
+    void rebind(StreamStore& target, StreamId offset)
+    {
+        if (!store) return;
+        store = &target;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            inputs[i] += offset;
+            portConnected(true, i);
+        }
+        for (size_t i = 0; i < outputs.size(); ++i) {
+            outputs[i] += offset;
+            portConnected(false, i);
+        }
+    }
+
+    void topologyChanged() { if (topologyVersion) ++*topologyVersion; }
+public:
+    virtual ~Device()
+    {
+#if DEVICE_PROFILING
+        ProfileRegistry::instance().forget(this);
+#endif
+    }
+
+    void addInput(const Stream& s){
+        DeviceStatus status = tryAddInput(s);
+        if (!status) raise(status.error);
+    }
+    void addInput(const shared_ptr<Stream>& s){ addInput(*s); }
+    void addInput(shared_ptr<Stream>&& s){ addInput(*s); }
+    void addOutput(const Stream& s){
+        DeviceStatus status = tryAddOutput(s);
+        if (!status) raise(status.error);
+    }
+    void addOutput(const shared_ptr<Stream>& s){ addOutput(*s); }
+    void addOutput(shared_ptr<Stream>&& s){ addOutput(*s); }
+
+    DeviceStatus tryAddInput(const Stream& s) { return connect(inputs, inputAmount, s, DeviceError::InputLimit); }
+
+    DeviceStatus tryAddOutput(const Stream& s) { return connect(outputs, outputAmount, s, DeviceError::OutputLimit); }
+
+    virtual DeviceStatus validate() const { return DeviceError::None; }
+
+    DeviceStatus tryUpdateOutputs()
+    {
+        DeviceStatus status = validate();
+        if (status) evaluate();
+        return status;
+    }
+
+    void evaluate() { profiledCall(this, ProfilePhase::Update, [this]() { updateOutputs(); }); }
+
+    virtual const char* typeName() const { return "Device"; }
+
+    const PortList& getInputs() const { return inputs; }
+
+    const PortList& getOutputs() const { return outputs; }
+
+    StreamStore* getStore() const { return store; }
+
+    virtual void updateOutputs() = 0;
+
+    virtual void compile(FlowsheetTape& tape);
+
+    virtual void updateRows(const StreamRows& rows) {
+        (void)rows;
+        throw string("Device does not support batch evaluation");
+    }
+
+    void updateOutputsBatch() {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+        StreamRows rows = store->laneRows();
+        profiledCall(this, ProfilePhase::Batch, [&]() { updateRows(rows); });
+    }
+
+    void updateComponents() {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+        StreamRows rows = store->componentRows();
+        profiledCall(this, ProfilePhase::Components, [&]() { updateRows(rows); });
+    }
+
+    void updateTangents() {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+        StreamRows rows = store->tangentRows();
+        profiledCall(this, ProfilePhase::Tangents, [&]() { updateRows(rows); });
+    }
+};
+
+inline void writeProfileLine(ostream& out, const string& label, const DeviceProfile& profile)
+{
+    out << label << ' ' << profilePhaseName(profile.phase)
+        << " calls=" << profile.calls
+        << " total_ns=" << profile.totalNs
+        << " max_ns=" << profile.maxNs
+        << " exceptions=" << profile.exceptions << '\n';
+}
+
+inline void dumpDeviceProfiles(ostream& out)
+{
+    vector<DeviceProfile> profiles = deviceProfiles();
+    sort(profiles.begin(), profiles.end(),
+         [](const DeviceProfile& a, const DeviceProfile& b) { return a.totalNs > b.totalNs; });
+    for (const DeviceProfile& profile : profiles) {
+        ostringstream label;
+        label << profile.typeName << '@' << (const void*)profile.device;
+        writeProfileLine(out, label.str(), profile);
+    }
+}
+
+enum class TapeOp : uint8_t {
+    Sum,
+    Split,
+    Copy,
+    Call
+};
+
+struct TapeOperand {
+    StreamId stream;
+    double coefficient;
+};
+
+struct TapeInstruction {
+    TapeOp op;
+    StreamId stream;
+    uint32_t first;
+    uint32_t count;
+    double bias;
+    Device* device;
+};
+
+class FlowsheetTape
+{
+private:
+    vector<TapeInstruction> code;
+    vector<TapeOperand> operands;
+
+    TapeInstruction& emit(TapeOp op, StreamId stream)
+    {
+        code.push_back(TapeInstruction{op, stream, (uint32_t)operands.size(), 0, 0.0, nullptr});
+        return code.back();
+    }
+
+    template <class Value>
+    void execute(Value* values) const
+    {
+        const TapeOperand* pool = operands.data();
+        for (const TapeInstruction& in : code) {
+            const TapeOperand* o = pool + in.first;
+            switch (in.op) {
+            case TapeOp::Sum: {
+                double sum = in.bias;
+                for (uint32_t i = 0; i < in.count; ++i) sum += o[i].coefficient * values[o[i].stream];
+                values[in.stream] = (Value)sum;
+                break;
+            }
+            case TapeOp::Split: {
+                double source = values[in.stream];
+                for (uint32_t i = 0; i < in.count; ++i) values[o[i].stream] = (Value)(o[i].coefficient * source);
+                break;
+            }
+            case TapeOp::Copy:
+                values[in.stream] = values[o[0].stream];
+                break;
+            case TapeOp::Call:
+                if (!is_same<Value, double>::value) throw string("Compact tapes cannot call device: ") + in.device->typeName();
+                in.device->evaluate();
+                break;
+            }
+        }
+    }
+
+    void operand(StreamId stream, double coefficient)
+    {
+        operands.push_back(TapeOperand{stream, coefficient});
+        ++code.back().count;
+    }
+
+public:
+    void emitSum(StreamId destination, const StreamId* sources, size_t count, double coefficient)
+    {
+        emit(TapeOp::Sum, destination);
+        for (size_t i = 0; i < count; ++i) operand(sources[i], coefficient);
+    }
+
+    void emitSum(StreamId destination, const TapeOperand* terms, size_t count, double bias)
+    {
+        emit(TapeOp::Sum, destination).bias = bias;
+        for (size_t i = 0; i < count; ++i) operand(terms[i].stream, terms[i].coefficient);
+    }
+
+    void emitSplit(StreamId source, const StreamId* destinations, size_t count, double factor)
+    {
+        emit(TapeOp::Split, source);
+        for (size_t i = 0; i < count; ++i) operand(destinations[i], factor);
+    }
+
+    void emitSplit(StreamId source, const StreamId* destinations, const double* factors, size_t count)
+    {
+        emit(TapeOp::Split, source);
+        for (size_t i = 0; i < count; ++i) operand(destinations[i], factors[i]);
+    }
+
+    void emitCopy(StreamId destination, StreamId source)
+    {
+        emit(TapeOp::Copy, destination);
+        operand(source, 1.0);
+    }
+
+    void emitCall(Device* device) { emit(TapeOp::Call, 0).device = device; }
+
+    void clear()
+    {
+        code.clear();
+        operands.clear();
+    }
+
+    void run(double* values) const { execute(values); }
+
+    void run(float* values) const { execute(values); }
+
+    const vector<TapeInstruction>& instructions() const { return code; }
+    const vector<TapeOperand>& operandPool() const { return operands; }
+
+    void setCoefficient(uint32_t operand, double coefficient) { operands[operand].coefficient = coefficient; }
+    size_t size() const { return code.size(); }
+    size_t footprint() const { return heapBytes(code) + heapBytes(operands); }
+};
+
+inline void Device::compile(FlowsheetTape& tape) { tape.emitCall(this); }
+
+class Mixer: public Device
+{
+protected:
+    [[noreturn]] void raise(DeviceError error) const override {
+        if (error == DeviceError::InputLimit) throw string("Too much inputs");
+        if (error == DeviceError::OutputLimit) throw string("Too much outputs");
+        if (error == DeviceError::OutputsNotSet) throw string("Should set outputs before update");
+        Device::raise(error);
+    }
+public:
+    const char* typeName() const override { return "Mixer"; }
+    Mixer(int inputs_count, int outputs_count = MIXER_OUTPUTS): Device() {
+        inputAmount = inputs_count;
+        outputAmount = outputs_count;
+    }
+    DeviceStatus validate() const override {
+        if (outputs.empty()) return DeviceError::OutputsNotSet;
+        return DeviceError::None;
+    }
+    void updateOutputs() override {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+
+        const double* flows = store->massFlows();
+        double sum_mass_flow = 0;
+        for (StreamId input_stream : inputs) {
+            sum_mass_flow += flows[input_stream];
+        }
+
+        double output_mass = sum_mass_flow / outputs.size();
+
+        for (StreamId output_stream : outputs) {
+            store->setMassFlow(output_stream, output_mass);
+        }
+    }
+    void compile(FlowsheetTape& tape) override {
+        for (StreamId output_stream : outputs) {
+            tape.emitSum(output_stream, inputs.data(), inputs.size(), 1.0 / outputs.size());
+        }
+    }
+    DeviceKind describe(vector<double>& parameters) const override {
+        (void)parameters;
+        return DeviceKind::Mixer;
+    }
+    void updateRows(const StreamRows& rows) override {
+        size_t n = rows.width;
+        double* sum = rows.row(outputs[0]);
+        fill(sum, sum + n, 0.0);
+        for (StreamId input_stream : inputs) {
+            lanesAdd(sum, rows.row(input_stream), n);
+        }
+
+        lanesScale(sum, sum, 1.0 / outputs.size(), n);
+        for (size_t i = 1; i < outputs.size(); ++i) {
+            lanesScale(rows.row(outputs[i]), sum, 1.0, n);
+        }
+    }
+};
+
+class Reactor : public Device
+{
+private:
+    bool isDoubleOutput;
+
+protected:
+    [[noreturn]] void raise(DeviceError error) const override
+    {
+        if (error == DeviceError::InputNotConnected) throw string("Input stream not connected to reactor");
+        if (error == DeviceError::OutputsNotSet) throw string("Output streams not properly set for reactor");
+        Device::raise(error);
+    }
+
+public:
+    Reactor(bool isDoubleReactor) : Device()
+    {
+        isDoubleOutput = isDoubleReactor;
+        inputAmount = 1;  // Always 1 input
+        outputAmount = isDoubleReactor ? 2 : 1;  // 1 or 2 outputs
+    }
+
+    DeviceStatus validate() const override
+    {
+        // Check if input is connected
+        if (inputs.empty()) return DeviceError::InputNotConnected;
+        // Check if outputs are set
+        if ((int)outputs.size() != outputAmount) return DeviceError::OutputsNotSet;
+        return DeviceError::None;
+    }
+
+    void updateOutputs() override
+    {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+
+        double inputMass = store->getMassFlow(inputs[0]);
+
+        if (isDoubleOutput) {
+            // Split mass equally between two outputs
+            double outputMass = inputMass / 2.0;
+            store->setMassFlow(outputs[0], outputMass);
+            store->setMassFlow(outputs[1], outputMass);
+            DEVICE_TRACE(TraceLevel::Debug, "Reactor: split mass %g into two outputs of %g", inputMass, outputMass);
+        } else {
+            // Single output - same mass flow as input
+            store->setMassFlow(outputs[0], inputMass);
+            DEVICE_TRACE(TraceLevel::Debug, "Reactor: transferred mass %g to single output", inputMass);
+        }
+    }
+
+    void updateRows(const StreamRows& rows) override
+    {
+        const double* inputRow = rows.row(inputs[0]);
+        double factor = isDoubleOutput ? 0.5 : 1.0;
+        for (StreamId output : outputs) {
+            lanesScale(rows.row(output), inputRow, factor, rows.width);
+        }
+    }
+
+    void compile(FlowsheetTape& tape) override
+    {
+        if (isDoubleOutput) tape.emitSplit(inputs[0], outputs.data(), outputs.size(), 0.5);
+        else tape.emitCopy(outputs[0], inputs[0]);
+    }
+
+    const char* typeName() const override { return "Reactor"; }
+
+    DeviceKind describe(vector<double>& parameters) const override
+    {
+        parameters.push_back(isDoubleOutput ? 1.0 : 0.0);
+        return DeviceKind::Reactor;
+    }
+
+    bool getIsDoubleOutput() const { return isDoubleOutput; }
+};
+
+class Splitter : public Device
+{
+private:
+    SmallVector<double, 4> fractions;
+
+    void setFractions(const double* begin, const double* end)
+    {
+        double total = 0.0;
+        for (const double* fraction = begin; fraction != end; ++fraction) {
+            if (*fraction < 0.0) throw string("Split fractions must not be negative");
+            total += *fraction;
+            fractions.push_back(*fraction);
+        }
+        if (fractions.empty() || fabs(total - 1.0) > 1e-9) throw string("Split fractions must sum to 1");
+        inputAmount = 1;
+        outputAmount = (int)fractions.size();
+        outputs.reserve(fractions.size());
+    }
+
+public:
+    explicit Splitter(const vector<double>& splitFractions) : Device()
+    {
+        setFractions(splitFractions.data(), splitFractions.data() + splitFractions.size());
+    }
+
+    explicit Splitter(initializer_list<double> splitFractions) : Device()
+    {
+        setFractions(splitFractions.begin(), splitFractions.end());
+    }
+
+    const char* typeName() const override { return "Splitter"; }
+
+    DeviceStatus validate() const override
+    {
+        if (inputs.empty()) return DeviceError::InputNotConnected;
+        if ((int)outputs.size() != outputAmount) return DeviceError::OutputsNotSet;
+        return DeviceError::None;
+    }
+
+    void updateOutputs() override
+    {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+
+        double inputMass = store->getMassFlow(inputs[0]);
+        for (size_t i = 0; i < outputs.size(); ++i) store->setMassFlow(outputs[i], fractions[i] * inputMass);
+    }
+
+    void updateRows(const StreamRows& rows) override
+    {
+        const double* inputRow = rows.row(inputs[0]);
+        for (size_t i = 0; i < outputs.size(); ++i) lanesScale(rows.row(outputs[i]), inputRow, fractions[i], rows.width);
+    }
+
+    void compile(FlowsheetTape& tape) override
+    {
+        tape.emitSplit(inputs[0], outputs.data(), fractions.data(), outputs.size());
+    }
+
+    DeviceKind describe(vector<double>& parameters) const override
+    {
+        parameters.insert(parameters.end(), fractions.begin(), fractions.end());
+        return DeviceKind::Splitter;
+    }
+
+    double getFraction(size_t output) const { return fractions[output]; }
+};
+
+template <size_t N>
+struct Unrolled {
+    template <class Body>
+    static void each(const Body& body) { Unrolled<N - 1>::each(body); body(N - 1); }
+};
+
+template <>
+struct Unrolled<0> {
+    template <class Body>
+    static void each(const Body&) {}
+};
+
+template <size_t Inputs>
+class StaticMixer : public Device
+{
+    static_assert(Inputs >= 1, "StaticMixer needs at least one input");
+
+private:
+    array<StreamId, Inputs> inputPorts;
+    StreamId outputPort = 0;
+
+protected:
+    void portConnected(bool isInput, size_t slot) override
+    {
+        if (isInput) inputPorts[slot] = inputs[slot];
+        else outputPort = outputs[slot];
+    }
+
+public:
+    const char* typeName() const override { return "StaticMixer"; }
+
+    StaticMixer() : Device()
+    {
+        inputAmount = (int)Inputs;
+        outputAmount = MIXER_OUTPUTS;
+        inputs.reserve(Inputs);
+        outputs.reserve(MIXER_OUTPUTS);
+    }
+
+    DeviceStatus validate() const override
+    {
+        if (inputs.size() != Inputs) return DeviceError::InputNotConnected;
+        if (outputs.empty()) return DeviceError::OutputsNotSet;
+        return DeviceError::None;
+    }
+
+    void updateOutputs() override
+    {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+
+        const double* flows = store->massFlows();
+        const array<StreamId, Inputs>& ports = inputPorts;
+        double sum = 0;
+        Unrolled<Inputs>::each([&](size_t i) { sum += flows[ports[i]]; });
+        store->setMassFlow(outputPort, sum);
+    }
+
+    void updateRows(const StreamRows& rows) override
+    {
+        size_t n = rows.width;
+        double* sum = rows.row(outputPort);
+        const array<StreamId, Inputs>& ports = inputPorts;
+        lanesScale(sum, rows.row(ports[0]), 1.0, n);
+        Unrolled<Inputs - 1>::each([&](size_t i) { lanesAdd(sum, rows.row(ports[i + 1]), n); });
+    }
+
+    void compile(FlowsheetTape& tape) override
+    {
+        tape.emitSum(outputPort, inputPorts.data(), Inputs, 1.0);
+    }
+};
+
+template <size_t Outputs>
+class StaticReactor : public Device
+{
+    static_assert(Outputs >= 1, "StaticReactor needs at least one output");
+
+private:
+    StreamId inputPort = 0;
+    array<StreamId, Outputs> outputPorts;
+
+protected:
+    void portConnected(bool isInput, size_t slot) override
+    {
+        if (isInput) inputPort = inputs[slot];
+        else outputPorts[slot] = outputs[slot];
+    }
+
+public:
+    const char* typeName() const override { return "StaticReactor"; }
+
+    StaticReactor() : Device()
+    {
+        inputAmount = 1;
+        outputAmount = (int)Outputs;
+        inputs.reserve(1);
+        outputs.reserve(Outputs);
+    }
+
+    DeviceStatus validate() const override
+    {
+        if (inputs.empty()) return DeviceError::InputNotConnected;
+        if (outputs.size() != Outputs) return DeviceError::OutputsNotSet;
+        return DeviceError::None;
+    }
+
+    void updateOutputs() override
+    {
+        DeviceStatus status = validate();
+        if (!status) raise(status.error);
+
+        double outputMass = store->getMassFlow(inputPort) * (1.0 / Outputs);
+        StreamStore& target = *store;
+        const array<StreamId, Outputs>& ports = outputPorts;
+        Unrolled<Outputs>::each([&](size_t i) { target.setMassFlow(ports[i], outputMass); });
+    }
+
+    void updateRows(const StreamRows& rows) override
+    {
+        const double* inputRow = rows.row(inputPort);
+        const array<StreamId, Outputs>& ports = outputPorts;
+        Unrolled<Outputs>::each([&](size_t i) {
+            lanesScale(rows.row(ports[i]), inputRow, 1.0 / Outputs, rows.width);
+        });
+    }
+
+    void compile(FlowsheetTape& tape) override
+    {
+        if (Outputs == 1) tape.emitCopy(outputPorts[0], inputPort);
+        else tape.emitSplit(inputPort, outputPorts.data(), Outputs, 1.0 / Outputs);
+    }
+};
+
+enum class RecycleMethod {
+    Substitution,
+    Wegstein
+};
+
+struct RecycleOptions {
+    double tolerance = POSSIBLE_ERROR;
+    size_t maxIterations = 100;
+    RecycleMethod method = RecycleMethod::Wegstein;
+    double qMin = -5.0;
+    double qMax = 0.0;
+};
+
+struct RecycleResult {
+    bool converged;
+    size_t iterations;
+    double residual;
+};
+
+inline double nextTearGuess(const RecycleOptions& options, size_t iteration, double x, double g, double lastX, double lastG)
+{
+    double dx = x - lastX;
+    if (options.method != RecycleMethod::Wegstein || iteration <= 1 || dx == 0.0) return g;
+    double slope = (g - lastG) / dx;
+    double q = slope == 1.0 ? options.qMin : slope / (slope - 1.0);
+    q = min(max(q, options.qMin), options.qMax);
+    return q * x + (1.0 - q) * g;
+}
+
+struct PartitionPlan {
+    vector<vector<size_t>> partitions;
+    vector<StreamId> cutStreams;
+};
+
+struct WiringIssue {
+    size_t device;
+    DeviceError error;
+};
+
+class SparseLU
+{
+public:
+    struct Entry {
+        uint32_t column;
+        double value;
+    };
+
+private:
+    vector<size_t> lowerStarts;
+    vector<Entry> lower;
+    vector<size_t> upperStarts;
+    vector<Entry> upper;
+    vector<double> diagonal;
+
+public:
+    bool factor(size_t n, const vector<size_t>& starts, const vector<Entry>& entries)
+    {
+        lower.clear();
+        upper.clear();
+        lowerStarts.assign(1, 0);
+        upperStarts.assign(1, 0);
+        diagonal.assign(n, 0.0);
+
+        vector<double> work(n, 0.0);
+        vector<bool> marked(n, false);
+        vector<uint32_t> pattern;
+        vector<uint32_t> pending;
+        for (size_t r = 0; r < n; ++r) {
+            pattern.clear();
+            pending.clear();
+            auto touch = [&](uint32_t column) {
+                if (marked[column]) return;
+                marked[column] = true;
+                pattern.push_back(column);
+                if (column < r) {
+                    pending.push_back(column);
+                    push_heap(pending.begin(), pending.end(), greater<uint32_t>());
+                }
+            };
+            touch((uint32_t)r);
+            for (size_t e = starts[r]; e < starts[r + 1]; ++e) {
+                touch(entries[e].column);
+                work[entries[e].column] += entries[e].value;
+            }
+
+            while (!pending.empty()) {
+                pop_heap(pending.begin(), pending.end(), greater<uint32_t>());
+                uint32_t k = pending.back();
+                pending.pop_back();
+                double factor = work[k] / diagonal[k];
+                lower.push_back(Entry{k, factor});
+                for (size_t e = upperStarts[k]; e < upperStarts[k + 1]; ++e) {
+                    touch(upper[e].column);
+                    work[upper[e].column] -= factor * upper[e].value;
+                }
+            }
+
+            diagonal[r] = work[r];
+            sort(pattern.begin(), pattern.end());
+            for (uint32_t column : pattern) {
+                if (column > r && work[column] != 0.0) upper.push_back(Entry{column, work[column]});
+                work[column] = 0.0;
+                marked[column] = false;
+            }
+            lowerStarts.push_back(lower.size());
+            upperStarts.push_back(upper.size());
+            if (fabs(diagonal[r]) < 1e-12) return false;
+        }
+        return true;
+    }
+
+    void solve(double* x) const
+    {
+        size_t n = diagonal.size();
+        for (size_t r = 0; r < n; ++r) {
+            double sum = x[r];
+            for (size_t e = lowerStarts[r]; e < lowerStarts[r + 1]; ++e) sum -= lower[e].value * x[lower[e].column];
+            x[r] = sum;
+        }
+        for (size_t r = n; r-- > 0;) {
+            double sum = x[r];
+            for (size_t e = upperStarts[r]; e < upperStarts[r + 1]; ++e) sum -= upper[e].value * x[upper[e].column];
+            x[r] = sum / diagonal[r];
+        }
+    }
+
+    size_t size() const { return diagonal.size(); }
+    size_t footprint() const
+    {
+        return heapBytes(lowerStarts) + heapBytes(lower) + heapBytes(upperStarts) + heapBytes(upper) + heapBytes(diagonal);
+    }
+    size_t nonZeros() const { return lower.size() + upper.size() + diagonal.size(); }
+};
+
+struct BalanceOptions {
+    double tolerance = POSSIBLE_ERROR;
+    size_t worstCount = 5;
+};
+
+struct BalanceIssue {
+    size_t device;
+    double residual;
+};
+
+struct BalanceReport {
+    size_t checked;
+    size_t violations;
+    double maxResidual;
+    vector<BalanceIssue> worst;
+
+    bool ok() const { return violations == 0; }
+};
+
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t streams;
+    uint64_t devices;
+    uint64_t ports;
+    uint64_t parameters;
+};
+
+struct SnapshotDevice {
+    uint32_t kind;
+    uint32_t inputLimit;
+    uint32_t outputLimit;
+    uint32_t inputs;
+    uint32_t outputs;
+    uint32_t parameters;
+};
+
+inline size_t snapshotAlign(size_t bytes) { return (bytes + 7) / 8 * 8; }
+
+class MappedFile
+{
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+#if DEVICE_HAS_MMAP
+    void* mapping = nullptr;
+#else
+    vector<uint8_t> buffer;
+#endif
+
+public:
+    explicit MappedFile(const string& path)
+    {
+#if DEVICE_HAS_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw string("Cannot open ") + path;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw string("Cannot open ") + path;
+        }
+        length = (size_t)info.st_size;
+        if (length > 0) {
+            mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                mapping = nullptr;
+                ::close(fd);
+                throw string("Cannot map ") + path;
+            }
+            bytes = static_cast<const uint8_t*>(mapping);
+        }
+        ::close(fd);
+#else
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file) throw string("Cannot open ") + path;
+        uint8_t chunk[65536];
+        size_t got;
+        while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) buffer.insert(buffer.end(), chunk, chunk + got);
+        fclose(file);
+        bytes = buffer.data();
+        length = buffer.size();
+#endif
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+#if DEVICE_HAS_MMAP
+        if (mapping) munmap(mapping, length);
+#endif
+    }
+
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+struct MemoStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    size_t entries;
+};
+
+class SolveCache
+{
+private:
+    struct Entry {
+        uint64_t hash;
+        vector<int64_t> key;
+        vector<double> outputs;
+    };
+
+    list<Entry> entries;
+    unordered_map<uint64_t, list<Entry>::iterator> index;
+    size_t capacity = 0;
+    MemoStats stats = {0, 0, 0, 0};
+
+    void evict()
+    {
+        index.erase(entries.back().hash);
+        entries.pop_back();
+        ++stats.evictions;
+    }
+
+public:
+    static uint64_t hashKey(const vector<int64_t>& key)
+    {
+        // Four independent lanes, so the multiplies do not wait on each other
+        const uint64_t prime = 0x100000001b3ull;
+        uint64_t lanes[4] = {0xcbf29ce484222325ull ^ key.size(), 0x84222325cbf29ce4ull, 0x9e3779b97f4a7c15ull, 0x7f4a7c159e3779b9ull};
+        size_t i = 0;
+        for (; i + 4 <= key.size(); i += 4) {
+            for (size_t lane = 0; lane < 4; ++lane) lanes[lane] = (lanes[lane] ^ (uint64_t)key[i + lane]) * prime;
+        }
+        for (; i < key.size(); ++i) lanes[0] = (lanes[0] ^ (uint64_t)key[i]) * prime;
+        uint64_t hash = lanes[0] ^ (lanes[1] * 3) ^ (lanes[2] * 5) ^ (lanes[3] * 7);
+        hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+        hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+        return hash ^ (hash >> 31);
+    }
+
+    void setCapacity(size_t entriesKept)
+    {
+        capacity = entriesKept;
+        while (entries.size() > capacity) evict();
+    }
+
+    size_t getCapacity() const { return capacity; }
+
+    void clear()
+    {
+        entries.clear();
+        index.clear();
+    }
+
+    const vector<double>* find(uint64_t hash, const vector<int64_t>& key)
+    {
+        auto it = index.find(hash);
+        if (it == index.end() || it->second->key != key) {
+            ++stats.misses;
+            return nullptr;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        ++stats.hits;
+        return &entries.front().outputs;
+    }
+
+    void insert(uint64_t hash, const vector<int64_t>& key, const double* values, size_t count)
+    {
+        if (capacity == 0) return;
+        auto existing = index.find(hash);
+        if (existing != index.end()) {
+            entries.erase(existing->second);
+            index.erase(existing);
+        }
+        if (entries.size() == capacity) {
+            index.erase(entries.back().hash);
+            entries.splice(entries.begin(), entries, prev(entries.end()));
+            ++stats.evictions;
+        } else {
+            entries.emplace_front();
+        }
+        Entry& entry = entries.front();
+        entry.hash = hash;
+        entry.key = key;
+        entry.outputs.assign(values, values + count);
+        index[hash] = entries.begin();
+    }
+
+    MemoStats getStats() const
+    {
+        MemoStats current = stats;
+        current.entries = entries.size();
+        return current;
+    }
+
+    size_t footprint() const
+    {
+        size_t bytes = heapBytes(index) + entries.size() * (sizeof(Entry) + 2 * sizeof(void*));
+        for (const Entry& entry : entries) bytes += heapBytes(entry.key) + heapBytes(entry.outputs);
+        return bytes;
+    }
+};
+
+struct FootprintReport {
+    size_t streams;
+    size_t names;
+    size_t ports;
+    size_t schedules;
+    size_t caches;
+
+    size_t total() const { return streams + names + ports + schedules + caches; }
+};
+
+inline void writeFootprint(ostream& out, const FootprintReport& report)
+{
+    out << "footprint streams=" << report.streams
+        << " names=" << report.names
+        << " ports=" << report.ports
+        << " schedules=" << report.schedules
+        << " caches=" << report.caches
+        << " total=" << report.total() << '\n';
+}
+
+class Flowsheet
+{
+    friend class PartitionedSolver;
+
+private:
+    vector<unique_ptr<Device>> devices;
+    size_t deviceBytes = 0;
+    shared_ptr<StreamArena> arena;
+    StreamStore& store;
+    shared_ptr<StreamIdAllocator> ids;
+    StreamIdBlock idBlock;
+    StreamSnapshot snapshot;
+    bool publishing = false;
+    vector<Device*> schedule;
+    vector<Device*> levelOrder;
+    vector<size_t> levelStarts;
+    vector<StreamId> tearStreams;
+    unsigned topologyVersion = 0;
+    unsigned scheduleVersion = 0;
+    bool scheduleValid = false;
+    FlowsheetTape tape;
+    unsigned tapeVersion = 0;
+    bool tapeValid = false;
+    bool optimizing = false;
+    vector<StreamId> pinnedStreams;
+    vector<StreamId> constantStreams;
+    SparseLU linear;
+    vector<StreamId> linearUnknowns;
+    vector<size_t> linearFeedStarts;
+    vector<TapeOperand> linearFeeds;
+    vector<double> linearBias;
+    vector<double> linearRhs;
+    unsigned linearVersion = 0;
+    bool linearValid = false;
+    bool linearUsable = false;
+    vector<uint32_t> balancePorts;
+    vector<double> balanceSigns;
+    vector<size_t> balanceStarts;
+    vector<size_t> balanceDevices;
+    vector<double> balanceTerms;
+    vector<double> balanceTotals;
+    vector<BalanceIssue> balanceIssues;
+    unsigned balanceVersion = 0;
+    bool balanceValid = false;
+    SolveCache memo;
+    vector<StreamId> memoInlets;
+    vector<StreamId> memoOutputs;
+    vector<int64_t> memoKey;
+    vector<double> memoValues;
+    unsigned memoVersion = 0;
+    bool memoValid = false;
+    bool solvedOnce = false;
+    unsigned solvedVersion = 0;
+
+    void compileInto(FlowsheetTape& target) { compileInto(getSchedule(), target); }
+
+    void compileInto(const vector<Device*>& order, FlowsheetTape& target)
+    {
+        target.clear();
+        for (Device* device : order) {
+            DeviceStatus status = device->validate();
+            if (!status) device->raise(status.error);
+            device->compile(target);
+        }
+    }
+
+    void optimizeInto(const FlowsheetTape& source, FlowsheetTape& target)
+    {
+        const size_t n = store.size();
+        const uint32_t none = UINT32_MAX;
+        const double* values = store.massFlows();
+        const vector<TapeOperand>& pool = source.operandPool();
+        vector<uint32_t> reads(n, 0);
+        vector<bool> written(n, false);
+        vector<bool> keep(n, false);
+        vector<bool> constant(n, false);
+        for (StreamId id : pinnedStreams) keep[id] = true;
+        for (const TapeInstruction& in : source.instructions()) {
+            const TapeOperand* o = pool.data() + in.first;
+            switch (in.op) {
+            case TapeOp::Sum:
+            case TapeOp::Copy:
+                for (uint32_t i = 0; i < in.count; ++i) ++reads[o[i].stream];
+                written[in.stream] = true;
+                break;
+            case TapeOp::Split:
+                reads[in.stream] += in.count;
+                for (uint32_t i = 0; i < in.count; ++i) written[o[i].stream] = true;
+                break;
+            case TapeOp::Call:
+                for (StreamId id : in.device->getInputs()) keep[id] = true;
+                for (StreamId id : in.device->getOutputs()) written[id] = true;
+                break;
+            }
+        }
+        for (StreamId id : constantStreams) constant[id] = !written[id];
+
+        // Expressions of streams that are substituted instead of stored
+        vector<bool> deferred(n, false);
+        vector<uint32_t> exprFirst(n, 0), exprCount(n, 0);
+        vector<double> exprBias(n, 0.0);
+        vector<TapeOperand> exprPool;
+        vector<TapeOperand> expr;
+        vector<uint32_t> slot(n, none);
+        double bias = 0.0;
+
+        auto term = [&](StreamId stream, double coefficient) {
+            if (slot[stream] == none) {
+                slot[stream] = (uint32_t)expr.size();
+                expr.push_back(TapeOperand{stream, coefficient});
+            } else {
+                expr[slot[stream]].coefficient += coefficient;
+            }
+        };
+        auto read = [&](StreamId stream, double coefficient) {
+            if (constant[stream]) {
+                bias += coefficient * values[stream];
+            } else if (deferred[stream]) {
+                bias += coefficient * exprBias[stream];
+                const TapeOperand* e = exprPool.data() + exprFirst[stream];
+                for (uint32_t i = 0; i < exprCount[stream]; ++i) term(e[i].stream, coefficient * e[i].coefficient);
+            } else {
+                term(stream, coefficient);
+            }
+        };
+        auto define = [&](StreamId stream) {
+            for (const TapeOperand& t : expr) slot[t.stream] = none;
+            if (keep[stream] || reads[stream] == 0 || (reads[stream] > 1 && expr.size() > 1)) {
+                if (expr.size() == 1 && expr[0].coefficient == 1.0 && bias == 0.0) {
+                    target.emitCopy(stream, expr[0].stream);
+                } else {
+                    target.emitSum(stream, expr.data(), expr.size(), bias);
+                }
+            } else {
+                deferred[stream] = true;
+                exprFirst[stream] = (uint32_t)exprPool.size();
+                exprCount[stream] = (uint32_t)expr.size();
+                exprBias[stream] = bias;
+                exprPool.insert(exprPool.end(), expr.begin(), expr.end());
+            }
+            expr.clear();
+            bias = 0.0;
+        };
+
+        target.clear();
+        for (const TapeInstruction& in : source.instructions()) {
+            const TapeOperand* o = pool.data() + in.first;
+            switch (in.op) {
+            case TapeOp::Sum:
+                bias = in.bias;
+                for (uint32_t i = 0; i < in.count; ++i) read(o[i].stream, o[i].coefficient);
+                define(in.stream);
+                break;
+            case TapeOp::Copy:
+                read(o[0].stream, 1.0);
+                define(in.stream);
+                break;
+            case TapeOp::Split:
+                for (uint32_t i = 0; i < in.count; ++i) {
+                    read(in.stream, o[i].coefficient);
+                    define(o[i].stream);
+                }
+                break;
+            case TapeOp::Call:
+                target.emitCall(in.device);
+                break;
+            }
+        }
+    }
+
+    void buildLinearSystem()
+    {
+        FlowsheetTape system;
+        compileInto(system);
+        linearUsable = true;
+        linearUnknowns.clear();
+        linearFeeds.clear();
+        linearFeedStarts.assign(1, 0);
+        linearBias.clear();
+
+        const uint32_t none = UINT32_MAX;
+        vector<uint32_t> unknown(store.size(), none);
+        vector<vector<TapeOperand>> sources;
+        const vector<TapeOperand>& pool = system.operandPool();
+        auto equation = [&](StreamId target, double bias) -> vector<TapeOperand>& {
+            unknown[target] = (uint32_t)linearUnknowns.size();
+            linearUnknowns.push_back(target);
+            linearBias.push_back(bias);
+            sources.emplace_back();
+            return sources.back();
+        };
+        for (const TapeInstruction& in : system.instructions()) {
+            const TapeOperand* o = pool.data() + in.first;
+            switch (in.op) {
+            case TapeOp::Sum:
+                equation(in.stream, in.bias).assign(o, o + in.count);
+                break;
+            case TapeOp::Split:
+                for (uint32_t i = 0; i < in.count; ++i) equation(o[i].stream, 0.0).push_back(TapeOperand{in.stream, o[i].coefficient});
+                break;
+            case TapeOp::Copy:
+                equation(in.stream, 0.0).push_back(TapeOperand{o[0].stream, 1.0});
+                break;
+            case TapeOp::Call:
+                linearUsable = false;
+                break;
+            }
+        }
+
+        vector<size_t> starts(1, 0);
+        vector<SparseLU::Entry> entries;
+        for (size_t row = 0; row < sources.size(); ++row) {
+            for (const TapeOperand& source : sources[row]) {
+                if (unknown[source.stream] != none) {
+                    entries.push_back(SparseLU::Entry{unknown[source.stream], -source.coefficient});
+                } else {
+                    linearFeeds.push_back(source);
+                }
+            }
+            entries.push_back(SparseLU::Entry{(uint32_t)row, 1.0});
+            starts.push_back(entries.size());
+            linearFeedStarts.push_back(linearFeeds.size());
+        }
+        if (linearUsable) linearUsable = linear.factor(sources.size(), starts, entries);
+        linearRhs.resize(sources.size());
+        linearVersion = topologyVersion;
+        linearValid = true;
+    }
+
+    static vector<size_t> sourceComponent(const vector<vector<size_t>>& consumers, const vector<bool>& scheduled)
+    {
+        const size_t unvisited = consumers.size();
+        vector<size_t> index(consumers.size(), unvisited), low(consumers.size(), 0);
+        vector<bool> onStack(consumers.size(), false);
+        vector<size_t> stack, component;
+        vector<pair<size_t, size_t>> calls;
+        size_t visited = 0;
+        for (size_t root = 0; root < consumers.size(); ++root) {
+            if (scheduled[root] || index[root] != unvisited) continue;
+            calls.emplace_back(root, 0);
+            index[root] = low[root] = visited++;
+            stack.push_back(root);
+            onStack[root] = true;
+            while (!calls.empty()) {
+                size_t node = calls.back().first;
+                size_t& edge = calls.back().second;
+                if (edge < consumers[node].size()) {
+                    size_t next = consumers[node][edge++];
+                    if (scheduled[next]) continue;
+                    if (index[next] == unvisited) {
+                        index[next] = low[next] = visited++;
+                        stack.push_back(next);
+                        onStack[next] = true;
+                        calls.emplace_back(next, 0);
+                    } else if (onStack[next]) {
+                        low[node] = min(low[node], index[next]);
+                    }
+                    continue;
+                }
+                calls.pop_back();
+                if (!calls.empty()) low[calls.back().first] = min(low[calls.back().first], low[node]);
+                if (low[node] != index[node]) continue;
+                component.clear();
+                size_t member;
+                do {
+                    member = stack.back();
+                    stack.pop_back();
+                    onStack[member] = false;
+                    component.push_back(member);
+                } while (member != node);
+            }
+        }
+        return component;
+    }
+
+    void buildSchedule()
+    {
+        const size_t none = devices.size();
+        vector<size_t> producer(store.size(), none);
+        for (size_t i = 0; i < devices.size(); ++i) {
+            if (devices[i]->getStore() && devices[i]->getStore() != &store) {
+                throw string("Device is wired to streams outside the flowsheet");
+            }
+            for (StreamId out : devices[i]->getOutputs()) {
+                if (producer[out] != none) {
+                    throw string("Stream " + store.getName(out) + " has more than one producer");
+                }
+                producer[out] = i;
+            }
+        }
+
+        vector<vector<size_t>> consumers(devices.size());
+        vector<size_t> pending(devices.size(), 0);
+        for (size_t i = 0; i < devices.size(); ++i) {
+            for (StreamId in : devices[i]->getInputs()) {
+                if (producer[in] != none) {
+                    consumers[producer[in]].push_back(i);
+                    ++pending[i];
+                }
+            }
+        }
+
+        vector<size_t> order;
+        vector<bool> scheduled(devices.size(), false);
+        order.reserve(devices.size());
+        for (size_t i = 0; i < devices.size(); ++i) {
+            if (pending[i] == 0) {
+                order.push_back(i);
+                scheduled[i] = true;
+            }
+        }
+
+        vector<size_t> depth(devices.size(), 0);
+        tearStreams.clear();
+        size_t head = 0;
+        for (;;) {
+            for (; head < order.size(); ++head) {
+                for (size_t next : consumers[order[head]]) {
+                    if (scheduled[next]) continue;
+                    depth[next] = max(depth[next], depth[order[head]] + 1);
+                    if (--pending[next] == 0) {
+                        order.push_back(next);
+                        scheduled[next] = true;
+                    }
+                }
+            }
+            if (order.size() == devices.size()) break;
+
+            // Every remaining device waits on a cycle. Devices merely downstream
+            // of one wait too, so pick from a recycle loop no other remaining
+            // device feeds: its unresolved inputs are all edges of that loop.
+            size_t pick = none;
+            for (size_t i : sourceComponent(consumers, scheduled)) {
+                if (pick == none || pending[i] < pending[pick]) pick = i;
+            }
+            for (StreamId in : devices[pick]->getInputs()) {
+                if (producer[in] != none && !scheduled[producer[in]] &&
+                    find(tearStreams.begin(), tearStreams.end(), in) == tearStreams.end()) {
+                    tearStreams.push_back(in);
+                }
+            }
+            order.push_back(pick);
+            scheduled[pick] = true;
+        }
+
+        schedule.clear();
+        for (size_t i : order) schedule.push_back(devices[i].get());
+
+        size_t levels = 0;
+        for (size_t i : order) levels = max(levels, depth[i] + 1);
+        levelStarts.assign(levels + 1, 0);
+        for (size_t i : order) ++levelStarts[depth[i] + 1];
+        for (size_t level = 0; level < levels; ++level) levelStarts[level + 1] += levelStarts[level];
+        levelOrder.assign(order.size(), nullptr);
+        vector<size_t> cursor(levelStarts.begin(), levelStarts.end() - 1);
+        for (size_t i : order) levelOrder[cursor[depth[i]]++] = devices[i].get();
+        scheduleVersion = topologyVersion;
+        scheduleValid = true;
+    }
+
+public:
+    explicit Flowsheet(shared_ptr<StreamIdAllocator> ids = make_shared<StreamIdAllocator>())
+        : arena(make_shared<StreamArena>()), store(arena->store), ids(move(ids)) {}
+    Flowsheet(const Flowsheet&) = delete;
+    Flowsheet& operator=(const Flowsheet&) = delete;
+
+    shared_ptr<Stream> addStream()
+    {
+        return shared_ptr<Stream>(arena, &createStream());
+    }
+
+    Stream& createStream()
+    {
+        StreamId id = store.add(idBlock.take(*ids));
+        return *arena->create(id);
+    }
+
+    template <class T, class... Args>
+    T& addDevice(Args&&... args)
+    {
+        T* device = new T(std::forward<Args>(args)...);
+        devices.emplace_back(device);
+        deviceBytes += sizeof(T);
+        device->topologyVersion = &topologyVersion;
+        ++topologyVersion;
+        return *device;
+    }
+
+    StreamId merge(Flowsheet& other)
+    {
+        if (&other == this) {
+            throw string("Cannot merge a flowsheet into itself");
+        }
+        if (arena->reaches(*other.arena)) {
+            throw string("Cannot merge a flowsheet into one that was merged into it");
+        }
+        for (const auto& device : other.devices) {
+            if (device->getStore() && device->getStore() != &other.store) {
+                throw string("Device is wired to streams outside the flowsheet");
+            }
+        }
+        StreamId offset = store.append(other.store);
+        arena->adopt(*other.arena, offset, arena);
+        other.store.clear();
+        for (auto& device : other.devices) {
+            device->rebind(store, offset);
+            device->topologyVersion = &topologyVersion;
+            devices.push_back(move(device));
+        }
+        other.devices.clear();
+        deviceBytes += other.deviceBytes;
+        other.deviceBytes = 0;
+        for (StreamId id : other.pinnedStreams) pinnedStreams.push_back(id + offset);
+        for (StreamId id : other.constantStreams) constantStreams.push_back(id + offset);
+        other.pinnedStreams.clear();
+        other.constantStreams.clear();
+        ++topologyVersion;
+        ++other.topologyVersion;
+        return offset;
+    }
+
+    Stream& createHandle(StreamId id)
+    {
+        if (id >= store.size()) throw string("Stream index out of range");
+        return *arena->create(id);
+    }
+
+    void saveSnapshot(const string& path)
+    {
+        const vector<Device*>& order = getSchedule();
+        vector<SnapshotDevice> records;
+        vector<uint32_t> ports;
+        vector<double> parameters;
+        records.reserve(order.size());
+        for (const Device* device : order) {
+            if (device->store && device->store != &store) {
+                throw string("Device is wired to streams outside the flowsheet");
+            }
+            size_t first = parameters.size();
+            DeviceKind kind = device->describe(parameters);
+            if (kind == DeviceKind::Custom) throw string("Device cannot be saved in a snapshot: ") + device->typeName();
+            records.push_back(SnapshotDevice{(uint32_t)kind, (uint32_t)device->inputAmount,
+                                             (uint32_t)device->outputAmount, (uint32_t)device->inputs.size(),
+                                             (uint32_t)device->outputs.size(), (uint32_t)(parameters.size() - first)});
+            ports.insert(ports.end(), device->inputs.begin(), device->inputs.end());
+            ports.insert(ports.end(), device->outputs.begin(), device->outputs.end());
+        }
+        SnapshotHeader header;
+        memcpy(header.magic, "FLOWSNAP", sizeof(header.magic));
+        header.version = SNAPSHOT_VERSION;
+        header.byteOrder = SNAPSHOT_BYTE_ORDER;
+        header.streams = store.size();
+        header.devices = records.size();
+        header.ports = ports.size();
+        header.parameters = parameters.size();
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) throw string("Cannot create ") + path;
+        static const uint8_t padding[8] = {};
+        bool written = true;
+        auto section = [&](const void* data, size_t bytes) {
+            size_t pad = snapshotAlign(bytes) - bytes;
+            if (bytes && fwrite(data, 1, bytes, file) != bytes) written = false;
+            if (pad && fwrite(padding, 1, pad, file) != pad) written = false;
+        };
+        section(&header, sizeof(header));
+        section(store.massFlows(), store.size() * sizeof(double));
+        section(store.streamNumbers(), store.size() * sizeof(uint32_t));
+        section(records.data(), records.size() * sizeof(SnapshotDevice));
+        section(ports.data(), ports.size() * sizeof(uint32_t));
+        section(parameters.data(), parameters.size() * sizeof(double));
+        if (fclose(file) != 0) written = false;
+        if (!written) throw string("Cannot write ") + path;
+    }
+
+    void loadSnapshot(const string& path)
+    {
+        if (!devices.empty() || store.size() != 0) {
+            throw string("Snapshot can only be loaded into an empty flowsheet");
+        }
+        MappedFile file(path);
+        const string invalid = string("Invalid flowsheet snapshot: ") + path;
+        SnapshotHeader header;
+        if (file.size() < sizeof(header)) throw invalid;
+        memcpy(&header, file.data(), sizeof(header));
+        if (memcmp(header.magic, "FLOWSNAP", sizeof(header.magic)) != 0 || header.byteOrder != SNAPSHOT_BYTE_ORDER) {
+            throw invalid;
+        }
+        if (header.version != SNAPSHOT_VERSION) throw string("Unsupported flowsheet snapshot version: ") + path;
+        if (header.streams > UINT32_MAX || header.devices > UINT32_MAX || header.ports > UINT32_MAX ||
+            header.parameters > UINT32_MAX) {
+            throw invalid;
+        }
+        size_t streams = (size_t)header.streams;
+        size_t flowsAt = sizeof(header);
+        size_t numbersAt = flowsAt + snapshotAlign(streams * sizeof(double));
+        size_t devicesAt = numbersAt + snapshotAlign(streams * sizeof(uint32_t));
+        size_t portsAt = devicesAt + snapshotAlign((size_t)header.devices * sizeof(SnapshotDevice));
+        size_t parametersAt = portsAt + snapshotAlign((size_t)header.ports * sizeof(uint32_t));
+        if (parametersAt + (size_t)header.parameters * sizeof(double) != file.size()) throw invalid;
+
+        const uint8_t* base = file.data();
+        const double* flows = reinterpret_cast<const double*>(base + flowsAt);
+        const uint32_t* numbers = reinterpret_cast<const uint32_t*>(base + numbersAt);
+        const SnapshotDevice* records = reinterpret_cast<const SnapshotDevice*>(base + devicesAt);
+        const uint32_t* ports = reinterpret_cast<const uint32_t*>(base + portsAt);
+        const double* parameters = reinterpret_cast<const double*>(base + parametersAt);
+        uint64_t portTotal = 0, parameterTotal = 0;
+        for (size_t i = 0; i < header.devices; ++i) {
+            portTotal += (uint64_t)records[i].inputs + records[i].outputs;
+            parameterTotal += records[i].parameters;
+        }
+        if (portTotal != header.ports || parameterTotal != header.parameters) throw invalid;
+        for (size_t i = 0; i < header.ports; ++i) {
+            if (ports[i] >= streams) throw invalid;
+        }
+
+        store.assign(flows, numbers, streams);
+        uint32_t highest = 0;
+        for (size_t i = 0; i < streams; ++i) highest = max(highest, numbers[i]);
+        if (streams) ids->advancePast(highest);
+        idBlock = StreamIdBlock();
+        devices.reserve((size_t)header.devices);
+        try {
+            for (size_t i = 0; i < header.devices; ++i) {
+                const SnapshotDevice& record = records[i];
+                Device* device = nullptr;
+                switch ((DeviceKind)record.kind) {
+                case DeviceKind::Mixer:
+                    device = &addDevice<Mixer>((int)record.inputLimit, (int)record.outputLimit);
+                    break;
+                case DeviceKind::Reactor:
+                    if (record.parameters != 1) throw invalid;
+                    device = &addDevice<Reactor>(parameters[0] != 0.0);
+                    break;
+                case DeviceKind::Splitter:
+                    device = &addDevice<Splitter>(vector<double>(parameters, parameters + record.parameters));
+                    break;
+                default:
+                    throw invalid;
+                }
+                for (uint32_t k = 0; k < record.inputs; ++k) {
+                    if (!device->tryAddInput(Stream(store, *ports++))) throw invalid;
+                }
+                for (uint32_t k = 0; k < record.outputs; ++k) {
+                    if (!device->tryAddOutput(Stream(store, *ports++))) throw invalid;
+                }
+                parameters += record.parameters;
+            }
+        } catch (...) {
+            devices.clear();
+            deviceBytes = 0;
+            store.clear();
+            ++topologyVersion;
+            throw;
+        }
+    }
+
+    const vector<Device*>& getSchedule()
+    {
+        if (!scheduleValid || scheduleVersion != topologyVersion) buildSchedule();
+        return schedule;
+    }
+
+    const vector<Device*>& getLevelOrder()
+    {
+        getSchedule();
+        return levelOrder;
+    }
+
+    const vector<size_t>& getLevelStarts()
+    {
+        getSchedule();
+        return levelStarts;
+    }
+
+    void markSolved(bool complete = true)
+    {
+        store.clearDirty();
+        solvedOnce = complete;
+        solvedVersion = topologyVersion;
+        if (publishing && complete) snapshot.publish(store);
+    }
+
+    void setPublishing(bool enabled)
+    {
+        publishing = enabled;
+        if (enabled) snapshot.publish(store);
+    }
+
+    const StreamSnapshot& getSnapshot() const { return snapshot; }
+
+    const vector<StreamId>& getTearStreams()
+    {
+        getSchedule();
+        return tearStreams;
+    }
+
+    void solve()
+    {
+        if (!getTearStreams().empty()) {
+            throw string("Flowsheet contains a recycle loop");
+        }
+        for (Device* device : schedule) device->evaluate();
+        markSolved();
+    }
+
+    void setMemoCapacity(size_t entries) { memo.setCapacity(entries); }
+
+    MemoStats getMemoStats() const { return memo.getStats(); }
+
+    FootprintReport footprint() const
+    {
+        FootprintReport report;
+        report.streams = sizeof(StreamArena) + store.footprint() + arena->footprint() + snapshot.footprint();
+        report.names = store.nameFootprint();
+        report.ports = deviceBytes + heapBytes(devices);
+        for (const auto& device : devices) report.ports += device->inputs.heapBytes() + device->outputs.heapBytes();
+        report.schedules = heapBytes(schedule) + heapBytes(levelOrder) + heapBytes(levelStarts) + heapBytes(tearStreams);
+        report.caches = tape.footprint() + linear.footprint() + heapBytes(pinnedStreams) + heapBytes(constantStreams) +
+                        heapBytes(linearUnknowns) + heapBytes(linearFeedStarts) + heapBytes(linearFeeds) +
+                        heapBytes(linearBias) + heapBytes(linearRhs) + heapBytes(balancePorts) + heapBytes(balanceSigns) +
+                        heapBytes(balanceStarts) + heapBytes(balanceDevices) + heapBytes(balanceTerms) +
+                        heapBytes(balanceTotals) + heapBytes(balanceIssues) + memo.footprint() + heapBytes(memoInlets) +
+                        heapBytes(memoOutputs) + heapBytes(memoKey) + heapBytes(memoValues);
+        return report;
+    }
+
+    void clearMemo() { memo.clear(); }
+
+    bool solveCached()
+    {
+        if (memo.getCapacity() == 0) {
+            solve();
+            return false;
+        }
+        if (!memoValid || memoVersion != topologyVersion) {
+            vector<bool> produced(store.size(), false);
+            for (Device* device : getSchedule()) {
+                for (StreamId id : device->getOutputs()) produced[id] = true;
+            }
+            memoInlets.clear();
+            memoOutputs.clear();
+            for (StreamId id = 0; id < store.size(); ++id) (produced[id] ? memoOutputs : memoInlets).push_back(id);
+            memo.clear();
+            memoVersion = topologyVersion;
+            memoValid = true;
+        }
+
+        const double* flows = store.massFlows();
+        const double scale = 1.0 / POSSIBLE_ERROR;
+        memoKey.resize(memoInlets.size());
+        bool representable = true;
+        for (size_t i = 0; i < memoInlets.size(); ++i) {
+            double steps = floor(flows[memoInlets[i]] * scale + 0.5);
+            representable &= fabs(steps) < 9e18;
+            memoKey[i] = representable ? (int64_t)steps : 0;
+        }
+        if (!representable) {
+            solve();
+            return false;
+        }
+        uint64_t hash = SolveCache::hashKey(memoKey);
+        if (const vector<double>* outputs = memo.find(hash, memoKey)) {
+            // markSolved() clears the dirty flags, so write the values directly
+            double* values = store.massFlows();
+            for (size_t i = 0; i < memoOutputs.size(); ++i) values[memoOutputs[i]] = (*outputs)[i];
+            markSolved();
+            return true;
+        }
+        solve();
+        memoValues.resize(memoOutputs.size());
+        for (size_t i = 0; i < memoOutputs.size(); ++i) memoValues[i] = store.getMassFlow(memoOutputs[i]);
+        memo.insert(hash, memoKey, memoValues.data(), memoValues.size());
+        return false;
+    }
+
+    const FlowsheetTape& getTape()
+    {
+        if (tapeValid && tapeVersion == topologyVersion) return tape;
+        if (!getTearStreams().empty()) {
+            throw string("Flowsheet contains a recycle loop");
+        }
+        if (optimizing) {
+            FlowsheetTape compiled;
+            compileInto(compiled);
+            optimizeInto(compiled, tape);
+        } else {
+            compileInto(tape);
+        }
+        tapeVersion = topologyVersion;
+        tapeValid = true;
+        return tape;
+    }
+
+    void solveTape()
+    {
+        getTape().run(store.massFlows());
+        markSolved(!optimizing);
+    }
+
+    void setOptimizing(bool enabled)
+    {
+        optimizing = enabled;
+        tapeValid = false;
+    }
+
+    void pinStream(const Stream& s)
+    {
+        pinnedStreams.push_back(s.getId());
+        tapeValid = false;
+    }
+
+    void markConstant(const Stream& s)
+    {
+        constantStreams.push_back(s.getId());
+        tapeValid = false;
+    }
+
+    RecycleResult converge(const RecycleOptions& options = RecycleOptions())
+    {
+        const vector<Device*>& order = getSchedule();
+        RecycleResult result = {false, 0, 0.0};
+        size_t n = tearStreams.size();
+        vector<double> x(n), g(n), lastX(n), lastG(n);
+        for (size_t i = 0; i < n; ++i) x[i] = store.getMassFlow(tearStreams[i]);
+
+        while (result.iterations < options.maxIterations) {
+            for (size_t i = 0; i < n; ++i) store.setMassFlow(tearStreams[i], x[i]);
+            for (Device* device : order) device->evaluate();
+            ++result.iterations;
+
+            result.residual = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                g[i] = store.getMassFlow(tearStreams[i]);
+                result.residual = max(result.residual, fabs(g[i] - x[i]));
+            }
+            if (result.residual <= options.tolerance) {
+                result.converged = true;
+                break;
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                double next = nextTearGuess(options, result.iterations, x[i], g[i], lastX[i], lastG[i]);
+                lastX[i] = x[i];
+                lastG[i] = g[i];
+                x[i] = next;
+            }
+        }
+        markSolved();
+        return result;
+    }
+
+    PartitionPlan partition(size_t parts)
+    {
+        if (parts == 0) throw string("Partition count must be positive");
+        const vector<Device*>& order = getSchedule();
+        const size_t n = devices.size();
+        const size_t none = n;
+        parts = min(parts, n);
+        if (n == 0) return PartitionPlan();
+
+        unordered_map<const Device*, size_t> indexOf;
+        for (size_t i = 0; i < n; ++i) indexOf[devices[i].get()] = i;
+        vector<size_t> position(n);
+        for (size_t p = 0; p < n; ++p) position[indexOf[order[p]]] = p;
+        vector<size_t> producer(store.size(), none);
+        for (size_t i = 0; i < n; ++i) {
+            for (StreamId out : devices[i]->getOutputs()) producer[out] = i;
+        }
+
+        // Forward edges of the schedule; the backward ones are the tear stream reads
+        vector<vector<size_t>> consumers(n);
+        vector<size_t> pending(n, 0);
+        for (size_t i = 0; i < n; ++i) {
+            for (StreamId in : devices[i]->getInputs()) {
+                size_t from = producer[in];
+                if (from != none && position[from] < position[i]) {
+                    consumers[from].push_back(i);
+                    ++pending[i];
+                }
+            }
+        }
+
+        // Reverse postorder of a depth-first search from the roots, in schedule order
+        vector<size_t> postorder;
+        vector<bool> visited(n, false);
+        vector<pair<size_t, size_t>> stack;
+        for (Device* root : order) {
+            size_t start = indexOf[root];
+            if (pending[start] != 0 || visited[start]) continue;
+            visited[start] = true;
+            stack.emplace_back(start, 0);
+            while (!stack.empty()) {
+                pair<size_t, size_t>& top = stack.back();
+                if (top.second < consumers[top.first].size()) {
+                    size_t next = consumers[top.first][top.second++];
+                    if (!visited[next]) {
+                        visited[next] = true;
+                        stack.emplace_back(next, 0);
+                    }
+                } else {
+                    postorder.push_back(top.first);
+                    stack.pop_back();
+                }
+            }
+        }
+        vector<size_t> rank(n);
+        for (size_t r = 0; r < n; ++r) rank[postorder[n - 1 - r]] = r;
+
+        // crossing[k]: streams whose producer and readers span the cut before rank k
+        vector<size_t> low(store.size(), none), high(store.size(), 0);
+        for (size_t i = 0; i < n; ++i) {
+            for (StreamId in : devices[i]->getInputs()) {
+                if (producer[in] == none) continue;
+                low[in] = min({low[in], rank[i], rank[producer[in]]});
+                high[in] = max({high[in], rank[i], rank[producer[in]]});
+            }
+        }
+        vector<long> crossing(n + 1, 0);
+        for (StreamId id = 0; id < store.size(); ++id) {
+            if (low[id] == none || low[id] == high[id]) continue;
+            ++crossing[low[id] + 1];
+            --crossing[high[id] + 1];
+        }
+        for (size_t k = 1; k <= n; ++k) crossing[k] += crossing[k - 1];
+
+        vector<size_t> cuts(1, 0);
+        size_t slack = n / parts / 2;
+        for (size_t j = 1; j < parts; ++j) {
+            size_t ideal = j * n / parts;
+            size_t first = max(cuts.back() + 1, ideal > slack ? ideal - slack : 0);
+            size_t last = min(ideal + slack, n - (parts - j));
+            size_t best = max(first, min(ideal, last));
+            for (size_t k = first; k <= last; ++k) {
+                size_t distance = k > ideal ? k - ideal : ideal - k;
+                size_t bestDistance = best > ideal ? best - ideal : ideal - best;
+                if (crossing[k] < crossing[best] || (crossing[k] == crossing[best] && distance < bestDistance)) best = k;
+            }
+            cuts.push_back(best);
+        }
+        cuts.push_back(n);
+
+        PartitionPlan plan;
+        plan.partitions.resize(parts);
+        vector<size_t> part(n);
+        for (size_t j = 0; j < parts; ++j) {
+            for (size_t r = cuts[j]; r < cuts[j + 1]; ++r) part[postorder[n - 1 - r]] = j;
+        }
+        for (Device* device : order) plan.partitions[part[indexOf[device]]].push_back(indexOf[device]);
+        vector<bool> cut(store.size(), false);
+        for (size_t i = 0; i < n; ++i) {
+            for (StreamId in : devices[i]->getInputs()) {
+                if (producer[in] != none && part[producer[in]] != part[i]) cut[in] = true;
+            }
+        }
+        for (StreamId id = 0; id < store.size(); ++id) {
+            if (cut[id]) plan.cutStreams.push_back(id);
+        }
+        return plan;
+    }
+
+    bool canSolveDirectly()
+    {
+        if (!linearValid || linearVersion != topologyVersion) buildLinearSystem();
+        return linearUsable;
+    }
+
+    RecycleResult solveLinear(const RecycleOptions& options = RecycleOptions())
+    {
+        if (!canSolveDirectly()) return converge(options);
+
+        const double* flows = store.massFlows();
+        for (size_t row = 0; row < linearUnknowns.size(); ++row) {
+            double rhs = linearBias[row];
+            for (size_t k = linearFeedStarts[row]; k < linearFeedStarts[row + 1]; ++k) {
+                rhs += linearFeeds[k].coefficient * flows[linearFeeds[k].stream];
+            }
+            linearRhs[row] = rhs;
+        }
+        linear.solve(linearRhs.data());
+        for (size_t row = 0; row < linearUnknowns.size(); ++row) store.setMassFlow(linearUnknowns[row], linearRhs[row]);
+        markSolved();
+        return RecycleResult{true, 0, 0.0};
+    }
+
+    size_t solveIncremental()
+    {
+        const vector<Device*>& order = getSchedule();
+        if (!tearStreams.empty()) {
+            throw string("Flowsheet contains a recycle loop");
+        }
+        if (!solvedOnce || solvedVersion != topologyVersion) {
+            solve();
+            return order.size();
+        }
+
+        const uint8_t* dirty = store.dirtyFlags();
+        size_t evaluated = 0;
+        for (Device* device : order) {
+            for (StreamId in : device->getInputs()) {
+                if (dirty[in]) {
+                    device->evaluate();
+                    ++evaluated;
+                    break;
+                }
+            }
+        }
+        store.clearDirty();
+        if (publishing) snapshot.publish(store);
+        return evaluated;
+    }
+
+    void setScenarioCount(size_t n) { store.setLanes(n); }
+
+    vector<WiringIssue> validate() const
+    {
+        vector<WiringIssue> issues;
+        for (size_t i = 0; i < devices.size(); ++i) {
+            DeviceStatus status = devices[i]->validate();
+            if (!status) issues.push_back(WiringIssue{i, status.error});
+        }
+        return issues;
+    }
+
+    BalanceReport checkMassBalance(const BalanceOptions& options = BalanceOptions())
+    {
+        if (!balanceValid || balanceVersion != topologyVersion) {
+            balancePorts.clear();
+            balanceSigns.clear();
+            balanceDevices.clear();
+            balanceStarts.assign(1, 0);
+            for (size_t i = 0; i < devices.size(); ++i) {
+                if (!devices[i]->validate()) continue;
+                for (StreamId in : devices[i]->getInputs()) {
+                    balancePorts.push_back(in);
+                    balanceSigns.push_back(1.0);
+                }
+                for (StreamId out : devices[i]->getOutputs()) {
+                    balancePorts.push_back(out);
+                    balanceSigns.push_back(-1.0);
+                }
+                balanceDevices.push_back(i);
+                balanceStarts.push_back(balancePorts.size());
+            }
+            balanceTerms.resize(balancePorts.size());
+            balanceVersion = topologyVersion;
+            balanceValid = true;
+        }
+
+        const double* flows = store.massFlows();
+        if (store.components() > 0) {
+            balanceTotals.resize(store.size());
+            for (StreamId id = 0; id < store.size(); ++id) balanceTotals[id] = store.totalMass(id);
+            flows = balanceTotals.data();
+        }
+        gatherScaled(balanceTerms.data(), flows, balancePorts.data(), balanceSigns.data(), balancePorts.size());
+
+        BalanceReport report = {balanceDevices.size(), 0, 0.0, {}};
+        vector<BalanceIssue>& issues = balanceIssues;
+        issues.resize(balanceDevices.size());
+        for (size_t d = 0; d < balanceDevices.size(); ++d) {
+            double residual = 0.0;
+            for (size_t k = balanceStarts[d]; k < balanceStarts[d + 1]; ++k) residual += balanceTerms[k];
+            issues[d] = BalanceIssue{balanceDevices[d], residual};
+            report.maxResidual = max(report.maxResidual, fabs(residual));
+            if (fabs(residual) > options.tolerance) ++report.violations;
+        }
+
+        size_t listed = min(options.worstCount, issues.size());
+        partial_sort(issues.begin(), issues.begin() + listed, issues.end(),
+                     [](const BalanceIssue& a, const BalanceIssue& b) { return fabs(a.residual) > fabs(b.residual); });
+        report.worst.assign(issues.begin(), issues.begin() + listed);
+        return report;
+    }
+
+    DeviceStatus trySolve()
+    {
+        for (const auto& device : devices) {
+            DeviceStatus status = device->validate();
+            if (!status) return status;
+        }
+        solve();
+        return DeviceError::None;
+    }
+
+    void solveBatch()
+    {
+        if (store.lanes() == 0) {
+            throw string("Batch mode is not enabled");
+        }
+        for (Device* device : getSchedule()) device->updateOutputsBatch();
+    }
+
+    void setComponentCount(size_t n) { store.setComponents(n); }
+
+    void solveComponents()
+    {
+        if (store.components() == 0) {
+            throw string("Multi-component mode is not enabled");
+        }
+        for (Device* device : getSchedule()) device->updateComponents();
+        if (publishing) snapshot.publish(store);
+    }
+
+    void setTangentDirections(size_t n) { store.setTangents(n); }
+
+    void solveTangents()
+    {
+        if (store.tangents() == 0) {
+            throw string("Tangent mode is not enabled");
+        }
+        if (!getTearStreams().empty()) {
+            throw string("Flowsheet contains a recycle loop");
+        }
+        for (Device* device : schedule) {
+            device->evaluate();
+            device->updateTangents();
+        }
+        markSolved();
+    }
+
+    vector<double> jacobian(const vector<StreamId>& outlets, const vector<StreamId>& feeds)
+    {
+        size_t previous = store.tangents();
+        store.setTangents(feeds.size());
+        for (size_t j = 0; j < feeds.size(); ++j) store.tangentValues(feeds[j])[j] = 1.0;
+        try {
+            solveTangents();
+        } catch (...) {
+            store.setTangents(previous);
+            throw;
+        }
+        vector<double> result(outlets.size() * feeds.size());
+        for (size_t i = 0; i < outlets.size(); ++i) {
+            const double* row = store.tangentValues(outlets[i]);
+            copy(row, row + feeds.size(), result.begin() + i * feeds.size());
+        }
+        store.setTangents(previous);
+        return result;
+    }
+
+    void dumpProfile(ostream& out) const
+    {
+        vector<DeviceProfile> profiles = deviceProfiles();
+        for (size_t i = 0; i < devices.size(); ++i) {
+            for (const DeviceProfile& profile : profiles) {
+                if (profile.device != devices[i].get()) continue;
+                writeProfileLine(out, "#" + to_string(i) + " " + devices[i]->typeName(), profile);
+            }
+        }
+    }
+
+    StreamStore& getStore() { return store; }
+    const StreamStore& getStore() const { return store; }
+
+    size_t deviceCount() const { return devices.size(); }
+    size_t streamCount() const { return store.size(); }
+};
+
+class ParallelExecutor
+{
+private:
+    struct Task {
+        Device* const* begin;
+        Device* const* end;
+    };
+
+    struct WorkQueue {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    size_t grain;
+    vector<unique_ptr<WorkQueue>> queues;
+    vector<thread> workers;
+    mutex stateLock;
+    condition_variable wake;
+    condition_variable done;
+    unsigned generation = 0;
+    bool stopping = false;
+    atomic<size_t> remaining;
+    exception_ptr failure;
+
+    bool popTask(size_t self, Task& task)
+    {
+        {
+            lock_guard<mutex> guard(queues[self]->lock);
+            if (!queues[self]->tasks.empty()) {
+                task = queues[self]->tasks.back();
+                queues[self]->tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i) {
+            WorkQueue& victim = *queues[(self + i) % queues.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void runTasks(size_t self)
+    {
+        Task task;
+        while (popTask(self, task)) {
+            try {
+                for (Device* const* device = task.begin; device != task.end; ++device) {
+                    (*device)->evaluate();
+                }
+            } catch (...) {
+                lock_guard<mutex> guard(stateLock);
+                if (!failure) failure = current_exception();
+            }
+            if (remaining.fetch_sub(1, memory_order_acq_rel) == 1) {
+                lock_guard<mutex> guard(stateLock);
+                done.notify_all();
+            }
+        }
+    }
+
+    void workerLoop(size_t self)
+    {
+        unsigned seen = 0;
+        for (;;) {
+            {
+                unique_lock<mutex> guard(stateLock);
+                wake.wait(guard, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            runTasks(self);
+        }
+    }
+
+    void runLevel(Device* const* begin, Device* const* end)
+    {
+        size_t count = end - begin;
+        if (workers.empty() || count <= grain) {
+            for (Device* const* device = begin; device != end; ++device) (*device)->evaluate();
+            return;
+        }
+
+        // Workers still draining the previous level may pop these tasks at once,
+        // so the counter must be set before the first one is queued
+        size_t tasks = (count + grain - 1) / grain;
+        {
+            lock_guard<mutex> guard(stateLock);
+            remaining.store(tasks, memory_order_release);
+            ++generation;
+        }
+        size_t index = 0;
+        for (Device* const* chunk = begin; chunk < end; chunk += grain, ++index) {
+            Task task = {chunk, chunk + min(grain, (size_t)(end - chunk))};
+            WorkQueue& queue = *queues[index % queues.size()];
+            lock_guard<mutex> guard(queue.lock);
+            queue.tasks.push_back(task);
+        }
+        wake.notify_all();
+
+        runTasks(0);
+        unique_lock<mutex> guard(stateLock);
+        done.wait(guard, [&]() { return remaining.load(memory_order_acquire) == 0; });
+        if (failure) {
+            exception_ptr error = failure;
+            failure = nullptr;
+            rethrow_exception(error);
+        }
+    }
+
+public:
+    explicit ParallelExecutor(size_t threads = 0, size_t grain = 64)
+        : grain(max(grain, (size_t)1)), remaining(0)
+    {
+        if (threads == 0) threads = max(thread::hardware_concurrency(), 1u);
+        for (size_t i = 0; i < threads; ++i) queues.emplace_back(new WorkQueue());
+        for (size_t i = 1; i < threads; ++i) workers.emplace_back(&ParallelExecutor::workerLoop, this, i);
+    }
+
+    ParallelExecutor(const ParallelExecutor&) = delete;
+    ParallelExecutor& operator=(const ParallelExecutor&) = delete;
+
+    ~ParallelExecutor()
+    {
+        {
+            lock_guard<mutex> guard(stateLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (thread& worker : workers) worker.join();
+    }
+
+    size_t threadCount() const { return queues.size(); }
+
+    void solve(Flowsheet& flowsheet)
+    {
+        if (!flowsheet.getTearStreams().empty()) {
+            throw string("Flowsheet contains a recycle loop");
+        }
+        const vector<Device*>& order = flowsheet.getLevelOrder();
+        const vector<size_t>& starts = flowsheet.getLevelStarts();
+        for (size_t level = 0; level + 1 < starts.size(); ++level) {
+            runLevel(order.data() + starts[level], order.data() + starts[level + 1]);
+        }
+        flowsheet.markSolved();
+    }
+};
+
+struct IngestOptions {
+    chrono::microseconds maxDelay = chrono::microseconds(1000);
+    size_t maxBatch = 4096;
+};
+
+struct IngestStats {
+    uint64_t readings;
+    uint64_t batches;
+    uint64_t devices;
+};
+
+class SensorIngestor
+{
+private:
+    typedef chrono::steady_clock Clock;
+
+    Flowsheet& flowsheet;
+    IngestOptions options;
+    mutex stateLock;
+    condition_variable wake;
+    condition_variable done;
+    vector<pair<StreamId, double>> pending;
+    Clock::time_point firstPending;
+    uint64_t posted = 0;
+    uint64_t solved = 0;
+    unsigned flushes = 0;
+    bool stopping = false;
+    IngestStats stats = {0, 0, 0};
+    exception_ptr failure;
+    thread loop;
+
+    void run()
+    {
+        vector<pair<StreamId, double>> batch;
+        unique_lock<mutex> guard(stateLock);
+        for (;;) {
+            wake.wait(guard, [&]() { return stopping || !pending.empty(); });
+            if (pending.empty()) return;
+            wake.wait_until(guard, firstPending + options.maxDelay, [&]() {
+                return stopping || flushes > 0 || pending.size() >= options.maxBatch;
+            });
+            batch.swap(pending);
+            uint64_t upto = posted;
+            guard.unlock();
+
+            size_t evaluated = 0;
+            exception_ptr error;
+            try {
+                StreamStore& store = flowsheet.getStore();
+                for (const pair<StreamId, double>& reading : batch) store.setMassFlow(reading.first, reading.second);
+                evaluated = flowsheet.solveIncremental();
+            } catch (...) {
+                error = current_exception();
+            }
+            batch.clear();
+
+            guard.lock();
+            if (error && !failure) failure = error;
+            solved = upto;
+            ++stats.batches;
+            stats.devices += evaluated;
+            done.notify_all();
+        }
+    }
+
+public:
+    explicit SensorIngestor(Flowsheet& flowsheet, const IngestOptions& options = IngestOptions())
+        : flowsheet(flowsheet), options(options), loop(&SensorIngestor::run, this) {}
+
+    SensorIngestor(const SensorIngestor&) = delete;
+    SensorIngestor& operator=(const SensorIngestor&) = delete;
+
+    ~SensorIngestor()
+    {
+        {
+            lock_guard<mutex> guard(stateLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        loop.join();
+    }
+
+    void post(StreamId id, double massFlow)
+    {
+        bool notify;
+        {
+            lock_guard<mutex> guard(stateLock);
+            if (pending.empty()) firstPending = Clock::now();
+            pending.emplace_back(id, massFlow);
+            notify = pending.size() == 1 || pending.size() == options.maxBatch;
+            ++posted;
+            ++stats.readings;
+        }
+        if (notify) wake.notify_one();
+    }
+
+    void post(const Stream& stream, double massFlow) { post(stream.getId(), massFlow); }
+
+    void flush()
+    {
+        unique_lock<mutex> guard(stateLock);
+        uint64_t target = posted;
+        ++flushes;
+        wake.notify_one();
+        done.wait(guard, [&]() { return solved >= target; });
+        --flushes;
+        if (failure) {
+            exception_ptr error = failure;
+            failure = nullptr;
+            rethrow_exception(error);
+        }
+    }
+
+    IngestStats getStats()
+    {
+        lock_guard<mutex> guard(stateLock);
+        return stats;
+    }
+};
+
+enum class ExportFormat {
+    Csv,
+    Columnar
+};
+
+const uint32_t COLUMNAR_VERSION = 1;
+const size_t EXPORT_BUFFER_SIZE = 1 << 20;
+
+struct ColumnarHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t rows;
+    uint64_t nameBytes;
+};
+
+class ResultExporter
+{
+private:
+    class Output
+    {
+    private:
+        FILE* file;
+        vector<char> buffer;
+        size_t used = 0;
+        bool failed = false;
+
+    public:
+        explicit Output(const string& path) : file(fopen(path.c_str(), "wb")), buffer(EXPORT_BUFFER_SIZE)
+        {
+            if (!file) throw string("Cannot create ") + path;
+        }
+        Output(const Output&) = delete;
+        Output& operator=(const Output&) = delete;
+        ~Output() { if (file) fclose(file); }
+
+        char* reserve(size_t bytes)
+        {
+            if (buffer.size() - used < bytes) drain();
+            if (buffer.size() < bytes) buffer.resize(bytes);
+            return buffer.data() + used;
+        }
+        void commit(size_t bytes) { used += bytes; }
+
+        void write(const void* data, size_t bytes)
+        {
+            if (bytes >= buffer.size()) {
+                drain();
+                if (fwrite(data, 1, bytes, file) != bytes) failed = true;
+                return;
+            }
+            memcpy(reserve(bytes), data, bytes);
+            commit(bytes);
+        }
+
+        void align(size_t written)
+        {
+            static const char padding[8] = {};
+            write(padding, snapshotAlign(written) - written);
+        }
+
+        void drain()
+        {
+            if (used && fwrite(buffer.data(), 1, used, file) != used) failed = true;
+            used = 0;
+        }
+
+        void close(const string& path)
+        {
+            drain();
+            int closed = fclose(file);
+            file = nullptr;
+            if (failed || closed != 0) throw string("Cannot write ") + path;
+        }
+    };
+
+    static size_t formatNumberName(char* out, uint32_t number)
+    {
+        char digits[10];
+        size_t count = 0;
+        do {
+            digits[count++] = (char)('0' + number % 10);
+            number /= 10;
+        } while (number);
+        out[0] = 's';
+        for (size_t i = 0; i < count; ++i) out[1 + i] = digits[count - 1 - i];
+        return count + 1;
+    }
+
+    static void writeCsvName(Output& output, const string& name)
+    {
+        if (name.find_first_of(",\"\r\n") == string::npos) {
+            output.write(name.data(), name.size());
+            return;
+        }
+        output.write("\"", 1);
+        for (char c : name) {
+            if (c == '"') output.write("\"", 1);
+            output.write(&c, 1);
+        }
+        output.write("\"", 1);
+    }
+
+    static void writeRows(const double* flows, const uint32_t* numbers, size_t count,
+                          const unordered_map<StreamId, string>& names, ExportFormat format, const string& path)
+    {
+        Output output(path);
+        if (format == ExportFormat::Csv) {
+            const char heading[] = "name,mass_flow\n";
+            output.write(heading, sizeof(heading) - 1);
+            for (size_t i = 0; i < count; ++i) {
+                auto custom = names.empty() ? names.end() : names.find((StreamId)i);
+                if (custom != names.end()) {
+                    writeCsvName(output, custom->second);
+                    output.write(",", 1);
+                } else {
+                    char* row = output.reserve(12);
+                    size_t length = formatNumberName(row, numbers[i]);
+                    row[length] = ',';
+                    output.commit(length + 1);
+                }
+                char* value = output.reserve(32);
+                int length = snprintf(value, 32, "%.17g\n", flows[i]);
+                output.commit((size_t)length);
+            }
+        } else {
+            vector<uint64_t> offsets(count + 1, 0);
+            for (size_t i = 0; i < count; ++i) {
+                auto custom = names.empty() ? names.end() : names.find((StreamId)i);
+                char name[12];
+                size_t length = custom != names.end() ? custom->second.size() : formatNumberName(name, numbers[i]);
+                offsets[i + 1] = offsets[i] + length;
+            }
+            ColumnarHeader header;
+            memcpy(header.magic, "FLOWCOLS", sizeof(header.magic));
+            header.version = COLUMNAR_VERSION;
+            header.byteOrder = SNAPSHOT_BYTE_ORDER;
+            header.rows = count;
+            header.nameBytes = offsets[count];
+            output.write(&header, sizeof(header));
+            output.write(flows, count * sizeof(double));
+            output.write(offsets.data(), offsets.size() * sizeof(uint64_t));
+            for (size_t i = 0; i < count; ++i) {
+                auto custom = names.empty() ? names.end() : names.find((StreamId)i);
+                if (custom != names.end()) {
+                    output.write(custom->second.data(), custom->second.size());
+                } else {
+                    char* name = output.reserve(12);
+                    output.commit(formatNumberName(name, numbers[i]));
+                }
+            }
+            output.align((size_t)offsets[count]);
+        }
+        output.close(path);
+    }
+
+    vector<double> flows;
+    vector<uint32_t> numbers;
+    unordered_map<StreamId, string> names;
+    thread worker;
+    exception_ptr failure;
+
+public:
+    ResultExporter() {}
+    ResultExporter(const ResultExporter&) = delete;
+    ResultExporter& operator=(const ResultExporter&) = delete;
+
+    ~ResultExporter()
+    {
+        if (worker.joinable()) worker.join();
+    }
+
+    static void write(const StreamStore& store, const string& path, ExportFormat format = ExportFormat::Csv)
+    {
+        writeRows(store.massFlows(), store.streamNumbers(), store.size(), store.customNames(), format, path);
+    }
+
+    void writeAsync(const StreamStore& store, const string& path, ExportFormat format = ExportFormat::Csv)
+    {
+        wait();
+        flows.assign(store.massFlows(), store.massFlows() + store.size());
+        numbers.assign(store.streamNumbers(), store.streamNumbers() + store.size());
+        names = store.customNames();
+        worker = thread([this, path, format]() {
+            try {
+                writeRows(flows.data(), numbers.data(), flows.size(), names, format, path);
+            } catch (...) {
+                failure = current_exception();
+            }
+        });
+    }
+
+    void wait()
+    {
+        if (worker.joinable()) worker.join();
+        if (failure) {
+            exception_ptr error = failure;
+            failure = nullptr;
+            rethrow_exception(error);
+        }
+    }
+};
+
+class QuantileEstimator
+{
+private:
+    double probability;
+    uint64_t count = 0;
+    double heights[5];
+    double positions[5];
+    double desired[5];
+    double increments[5];
+
+    double parabolic(int i, double d) const
+    {
+        return heights[i] + d / (positions[i + 1] - positions[i - 1]) *
+            ((positions[i] - positions[i - 1] + d) * (heights[i + 1] - heights[i]) / (positions[i + 1] - positions[i]) +
+             (positions[i + 1] - positions[i] - d) * (heights[i] - heights[i - 1]) / (positions[i] - positions[i - 1]));
+    }
+
+    double linear(int i, int d) const
+    {
+        return heights[i] + d * (heights[i + d] - heights[i]) / (positions[i + d] - positions[i]);
+    }
+
+public:
+    explicit QuantileEstimator(double probability) : probability(probability)
+    {
+        const double steps[5] = {0.0, probability / 2, probability, (1 + probability) / 2, 1.0};
+        copy(steps, steps + 5, increments);
+    }
+
+    void add(double x)
+    {
+        if (count < 5) {
+            heights[count++] = x;
+            if (count == 5) {
+                sort(heights, heights + 5);
+                const double start[5] = {0.0, 2 * probability, 4 * probability, 2 + 2 * probability, 4.0};
+                for (int i = 0; i < 5; ++i) positions[i] = i;
+                copy(start, start + 5, desired);
+            }
+            return;
+        }
+        int cell;
+        if (x < heights[0]) {
+            heights[0] = x;
+            cell = 0;
+        } else if (x >= heights[4]) {
+            heights[4] = x;
+            cell = 3;
+        } else {
+            cell = 0;
+            while (x >= heights[cell + 1]) ++cell;
+        }
+        for (int i = cell + 1; i < 5; ++i) positions[i] += 1.0;
+        for (int i = 0; i < 5; ++i) desired[i] += increments[i];
+        ++count;
+
+        for (int i = 1; i <= 3; ++i) {
+            double d = desired[i] - positions[i];
+            if ((d >= 1.0 && positions[i + 1] - positions[i] > 1.0) || (d <= -1.0 && positions[i - 1] - positions[i] < -1.0)) {
+                int step = d >= 0.0 ? 1 : -1;
+                double height = parabolic(i, step);
+                heights[i] = heights[i - 1] < height && height < heights[i + 1] ? height : linear(i, step);
+                positions[i] += step;
+            }
+        }
+    }
+
+    double value() const
+    {
+        if (count == 0) return 0.0;
+        if (count <= 5) {
+            double sorted[5];
+            copy(heights, heights + count, sorted);
+            sort(sorted, sorted + count);
+            return sorted[(size_t)(probability * (count - 1) + 0.5)];
+        }
+        return heights[2];
+    }
+};
+
+struct SweepOptions {
+    size_t threads = 0;
+    size_t batch = 256;
+    vector<double> quantiles = vector<double>{0.05, 0.5, 0.95};
+    bool compact = false;
+};
+
+struct OutletStats {
+    StreamId stream;
+    uint64_t count;
+    double mean;
+    double variance;
+    double min;
+    double max;
+    vector<double> quantiles;
+};
+
+struct SweepResult {
+    size_t scenarios;
+    vector<OutletStats> outlets;
+};
+
+class SweepScenario
+{
+    friend class SweepRunner;
+
+private:
+    vector<double> values;
+    vector<float> compactValues;
+    bool compact = false;
+    FlowsheetTape tape;
+    const vector<double>* baseValues;
+    const FlowsheetTape* baseTape;
+    const unordered_map<StreamId, uint32_t>* splits;
+    vector<StreamId> touchedStreams;
+    vector<uint32_t> touchedSplits;
+
+    void reset()
+    {
+        for (StreamId id : touchedStreams) {
+            if (compact) compactValues[id] = (float)(*baseValues)[id];
+            else values[id] = (*baseValues)[id];
+        }
+        const vector<TapeOperand>& pool = baseTape->operandPool();
+        for (uint32_t index : touchedSplits) {
+            const TapeInstruction& in = baseTape->instructions()[index];
+            for (uint32_t i = 0; i < in.count; ++i) tape.setCoefficient(in.first + i, pool[in.first + i].coefficient);
+        }
+        touchedStreams.clear();
+        touchedSplits.clear();
+    }
+
+    void evaluate()
+    {
+        if (compact) tape.run(compactValues.data());
+        else tape.run(values.data());
+    }
+
+public:
+    void setMassFlow(StreamId id, double m)
+    {
+        touchedStreams.push_back(id);
+        if (compact) compactValues[id] = (float)m;
+        else values[id] = m;
+    }
+    void setMassFlow(const Stream& s, double m) { setMassFlow(s.getId(), m); }
+    double getMassFlow(StreamId id) const { return compact ? compactValues[id] : values[id]; }
+
+    void setFractions(const Device& device, const double* fractions, size_t count)
+    {
+        auto split = device.getOutputs().empty() ? splits->end() : splits->find(device.getOutputs()[0]);
+        if (split == splits->end()) throw string("Device has no split in the compiled flowsheet: ") + device.typeName();
+        const TapeInstruction& in = tape.instructions()[split->second];
+        if (in.count != count) throw string("Wrong number of split fractions");
+        touchedSplits.push_back(split->second);
+        for (uint32_t i = 0; i < in.count; ++i) tape.setCoefficient(in.first + i, fractions[i]);
+    }
+    void setFractions(const Device& device, initializer_list<double> fractions)
+    {
+        setFractions(device, fractions.begin(), fractions.size());
+    }
+};
+
+class SweepRunner
+{
+private:
+    FlowsheetTape tape;
+    vector<double> baseValues;
+    unordered_map<StreamId, uint32_t> splits;
+    vector<StreamId> outlets;
+    SweepOptions options;
+
+public:
+    explicit SweepRunner(Flowsheet& flowsheet, const vector<StreamId>& outlets = vector<StreamId>(),
+                         const SweepOptions& options = SweepOptions())
+        : tape(flowsheet.getTape()), outlets(outlets), options(options)
+    {
+        const StreamStore& store = flowsheet.getStore();
+        baseValues.assign(store.massFlows(), store.massFlows() + store.size());
+        vector<bool> read(store.size(), false), written(store.size(), false);
+        const vector<TapeOperand>& pool = tape.operandPool();
+        for (size_t index = 0; index < tape.size(); ++index) {
+            const TapeInstruction& in = tape.instructions()[index];
+            const TapeOperand* o = pool.data() + in.first;
+            switch (in.op) {
+            case TapeOp::Sum:
+            case TapeOp::Copy:
+                for (uint32_t i = 0; i < in.count; ++i) read[o[i].stream] = true;
+                written[in.stream] = true;
+                break;
+            case TapeOp::Split:
+                read[in.stream] = true;
+                for (uint32_t i = 0; i < in.count; ++i) written[o[i].stream] = true;
+                if (in.count > 0) splits[o[0].stream] = (uint32_t)index;
+                break;
+            case TapeOp::Call:
+                throw string("Device cannot be swept in parallel: ") + in.device->typeName();
+            }
+        }
+        if (this->outlets.empty()) {
+            for (StreamId id = 0; id < store.size(); ++id) {
+                if (written[id] && !read[id]) this->outlets.push_back(id);
+            }
+        }
+        if (this->options.threads == 0) this->options.threads = max(thread::hardware_concurrency(), 1u);
+        this->options.batch = max(this->options.batch, (size_t)1);
+    }
+
+    const vector<StreamId>& getOutlets() const { return outlets; }
+
+    SweepResult run(size_t count, const function<void(size_t, SweepScenario&)>& generator)
+    {
+        struct Accumulator {
+            uint64_t count = 0;
+            double mean = 0.0, m2 = 0.0;
+            double min = 0.0, max = 0.0;
+            vector<QuantileEstimator> quantiles;
+        };
+        vector<Accumulator> totals(outlets.size());
+        for (Accumulator& total : totals) {
+            for (double q : options.quantiles) total.quantiles.emplace_back(q);
+        }
+        unique_ptr<mutex[]> totalLocks(new mutex[max(outlets.size(), (size_t)1)]);
+        mutex failureLock;
+        atomic<size_t> next(0);
+        atomic<bool> failed(false);
+        exception_ptr failure;
+        const size_t width = outlets.size();
+
+        auto work = [&](size_t self) {
+            SweepScenario scenario;
+            scenario.compact = options.compact;
+            if (options.compact) scenario.compactValues.assign(baseValues.begin(), baseValues.end());
+            else scenario.values = baseValues;
+            scenario.tape = tape;
+            scenario.baseValues = &baseValues;
+            scenario.baseTape = &tape;
+            scenario.splits = &splits;
+            vector<double> collected(options.batch * width);
+            try {
+                for (;;) {
+                    size_t first = next.fetch_add(options.batch, memory_order_relaxed);
+                    if (first >= count || failed.load(memory_order_relaxed)) return;
+                    size_t last = min(first + options.batch, count);
+                    for (size_t k = first; k < last; ++k) {
+                        generator(k, scenario);
+                        scenario.evaluate();
+                        double* row = collected.data() + (k - first) * width;
+                        for (size_t o = 0; o < width; ++o) row[o] = scenario.getMassFlow(outlets[o]);
+                        scenario.reset();
+                    }
+
+                    for (size_t step = 0; step < width; ++step) {
+                        size_t o = (self + step) % width;
+                        Accumulator& total = totals[o];
+                        lock_guard<mutex> guard(totalLocks[o]);
+                        for (size_t k = 0; k < last - first; ++k) {
+                            double x = collected[k * width + o];
+                            if (total.count == 0) total.min = total.max = x;
+                            total.min = std::min(total.min, x);
+                            total.max = std::max(total.max, x);
+                            ++total.count;
+                            double delta = x - total.mean;
+                            total.mean += delta / total.count;
+                            total.m2 += delta * (x - total.mean);
+                            for (QuantileEstimator& quantile : total.quantiles) quantile.add(x);
+                        }
+                    }
+                }
+            } catch (...) {
+                lock_guard<mutex> guard(failureLock);
+                if (!failure) failure = current_exception();
+                failed = true;
+            }
+        };
+
+        size_t helpers = min(options.threads, (count + options.batch - 1) / options.batch);
+        vector<thread> threads;
+        for (size_t i = 1; i < helpers; ++i) threads.emplace_back(work, i * width / helpers);
+        work(0);
+        for (thread& worker : threads) worker.join();
+        if (failure) rethrow_exception(failure);
+
+        SweepResult result;
+        result.scenarios = count;
+        for (size_t o = 0; o < width; ++o) {
+            const Accumulator& total = totals[o];
+            OutletStats stats{outlets[o], total.count, total.mean,
+                              total.count > 1 ? total.m2 / (total.count - 1) : 0.0, total.min, total.max, vector<double>()};
+            for (const QuantileEstimator& quantile : total.quantiles) stats.quantiles.push_back(quantile.value());
+            result.outlets.push_back(stats);
+        }
+        return result;
+    }
+};
+
+#if DEVICE_HAS_FORK
+enum class PartitionCommand : uint32_t {
+    Iterate = 1,
+    Collect,
+    Stop,
+    Values,
+    Failed
+};
+
+struct PartitionMessage {
+    PartitionCommand command;
+    uint32_t count;
+};
+
+static_assert(sizeof(PartitionMessage) == sizeof(double), "A message header must fill one value slot");
+
+class PartitionedSolver
+{
+private:
+    struct Worker {
+        FlowsheetTape tape;
+        vector<size_t> seeds;
+        vector<StreamId> inputs;
+        vector<StreamId> exports;
+        vector<StreamId> produced;
+        vector<size_t> dependents;
+        size_t waits = 0;
+        int fd = -1;
+        pid_t pid = -1;
+    };
+
+    Flowsheet& flowsheet;
+    PartitionPlan plan;
+    vector<StreamId> tears;
+    vector<Worker> workers;
+    vector<double> buffer;
+    unsigned version;
+    bool broken = false;
+
+    static bool writeAll(int fd, const void* data, size_t size)
+    {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+#ifdef MSG_NOSIGNAL
+            ssize_t sent = ::send(fd, bytes, size, MSG_NOSIGNAL);
+#else
+            ssize_t sent = ::write(fd, bytes, size);
+#endif
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            bytes += sent;
+            size -= (size_t)sent;
+        }
+        return true;
+    }
+
+    static bool readAll(int fd, void* data, size_t size)
+    {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t got = ::read(fd, bytes, size);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) return false;
+            bytes += got;
+            size -= (size_t)got;
+        }
+        return true;
+    }
+
+    bool transmit(int fd, PartitionCommand command, size_t count)
+    {
+        PartitionMessage header = {command, (uint32_t)count};
+        memcpy(buffer.data(), &header, sizeof(header));
+        return writeAll(fd, buffer.data(), (count + 1) * sizeof(double));
+    }
+
+    PartitionMessage receive(int fd)
+    {
+        PartitionMessage header = {PartitionCommand::Stop, 0};
+        if (!readAll(fd, &header, sizeof(header))) return PartitionMessage{PartitionCommand::Stop, 0};
+        size_t slots = header.command == PartitionCommand::Failed ? (header.count + 7) / 8 : header.count;
+        buffer.resize(max(buffer.size(), slots + 1));
+        if (!readAll(fd, buffer.data() + 1, slots * sizeof(double))) return PartitionMessage{PartitionCommand::Stop, 0};
+        return header;
+    }
+
+    [[noreturn]] void serve(Worker& worker)
+    {
+        double* values = flowsheet.getStore().massFlows();
+        for (;;) {
+            PartitionMessage request = receive(worker.fd);
+            if (request.command == PartitionCommand::Stop) break;
+            const vector<StreamId>& answer = request.command == PartitionCommand::Iterate ? worker.exports : worker.produced;
+            string failure;
+            try {
+                if (request.command == PartitionCommand::Iterate) {
+                    const double* in = buffer.data() + 1;
+                    for (size_t seed : worker.seeds) values[tears[seed]] = *in++;
+                    for (StreamId id : worker.inputs) values[id] = *in++;
+                    worker.tape.run(values);
+                }
+            } catch (const string& error) {
+                failure = error;
+            } catch (const char* error) {
+                failure = error;
+            } catch (const exception& error) {
+                failure = error.what();
+            } catch (...) {
+                failure = "Unknown exception";
+            }
+            bool sent;
+            if (failure.empty()) {
+                buffer.resize(max(buffer.size(), answer.size() + 1));
+                for (size_t i = 0; i < answer.size(); ++i) buffer[i + 1] = values[answer[i]];
+                sent = transmit(worker.fd, PartitionCommand::Values, answer.size());
+            } else {
+                buffer.assign(failure.size() / 8 + 2, 0.0);
+                memcpy(buffer.data() + 1, failure.data(), failure.size());
+                PartitionMessage header = {PartitionCommand::Failed, (uint32_t)failure.size()};
+                memcpy(buffer.data(), &header, sizeof(header));
+                sent = writeAll(worker.fd, buffer.data(), ((failure.size() + 7) / 8 + 1) * sizeof(double));
+            }
+            if (!sent) break;
+        }
+        _exit(0);
+    }
+
+    string accept(Worker& worker, const vector<StreamId>& streams)
+    {
+        PartitionMessage answer = receive(worker.fd);
+        if (answer.command == PartitionCommand::Failed) {
+            return string(reinterpret_cast<const char*>(buffer.data() + 1), answer.count);
+        }
+        if (answer.command != PartitionCommand::Values || answer.count != streams.size()) {
+            broken = true;
+            throw string("Partition worker exited");
+        }
+        StreamStore& store = flowsheet.getStore();
+        for (size_t i = 0; i < streams.size(); ++i) store.setMassFlow(streams[i], buffer[i + 1]);
+        return string();
+    }
+
+    void dispatch(size_t w, const vector<double>& guesses)
+    {
+        Worker& worker = workers[w];
+        const double* values = flowsheet.getStore().massFlows();
+        size_t count = worker.seeds.size() + worker.inputs.size();
+        buffer.resize(max(buffer.size(), count + 1));
+        double* out = buffer.data() + 1;
+        for (size_t seed : worker.seeds) *out++ = guesses[seed];
+        for (StreamId id : worker.inputs) *out++ = values[id];
+        if (!transmit(worker.fd, PartitionCommand::Iterate, count)) {
+            broken = true;
+            throw string("Partition worker exited");
+        }
+    }
+
+    void pass(const vector<double>& guesses)
+    {
+        vector<size_t> waiting(workers.size());
+        vector<size_t> ready, flying;
+        for (size_t w = 0; w < workers.size(); ++w) {
+            waiting[w] = workers[w].waits;
+            if (waiting[w] == 0) ready.push_back(w);
+        }
+        string failure;
+        vector<pollfd> polls;
+        for (;;) {
+            if (failure.empty()) {
+                for (size_t w : ready) dispatch(w, guesses);
+                flying.insert(flying.end(), ready.begin(), ready.end());
+            }
+            ready.clear();
+            if (flying.empty()) break;
+
+            polls.clear();
+            for (size_t w : flying) polls.push_back(pollfd{workers[w].fd, POLLIN, 0});
+            if (poll(polls.data(), (nfds_t)polls.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                broken = true;
+                throw string("Cannot wait for partition workers");
+            }
+            vector<size_t> still;
+            for (size_t k = 0; k < flying.size(); ++k) {
+                size_t w = flying[k];
+                if (polls[k].revents == 0) {
+                    still.push_back(w);
+                    continue;
+                }
+                string error = accept(workers[w], workers[w].exports);
+                if (!error.empty()) {
+                    if (failure.empty()) failure = error;
+                    continue;
+                }
+                for (size_t next : workers[w].dependents) {
+                    if (--waiting[next] == 0) ready.push_back(next);
+                }
+            }
+            flying.swap(still);
+        }
+        if (!failure.empty()) throw failure;
+    }
+
+    void stop()
+    {
+        for (Worker& worker : workers) {
+            if (worker.fd < 0) continue;
+            PartitionMessage header = {PartitionCommand::Stop, 0};
+            writeAll(worker.fd, &header, sizeof(header));
+            ::close(worker.fd);
+            worker.fd = -1;
+            if (worker.pid > 0) waitpid(worker.pid, nullptr, 0);
+        }
+    }
+
+public:
+    PartitionedSolver(Flowsheet& flowsheet, size_t parts)
+        : flowsheet(flowsheet), plan(flowsheet.partition(parts)), tears(flowsheet.getTearStreams()),
+          version(flowsheet.topologyVersion)
+    {
+        const StreamStore& store = flowsheet.getStore();
+        const size_t none = plan.partitions.size();
+        workers.resize(plan.partitions.size());
+        vector<size_t> owner(store.size(), none), tearIndex(store.size(), none), mark(store.size(), none);
+        vector<bool> exported(store.size(), false);
+        for (size_t i = 0; i < tears.size(); ++i) {
+            tearIndex[tears[i]] = i;
+            exported[tears[i]] = true;
+        }
+        for (size_t w = 0; w < workers.size(); ++w) {
+            for (size_t i : plan.partitions[w]) {
+                for (StreamId out : flowsheet.devices[i]->getOutputs()) {
+                    owner[out] = w;
+                    workers[w].produced.push_back(out);
+                }
+            }
+        }
+        for (size_t w = 0; w < workers.size(); ++w) {
+            Worker& worker = workers[w];
+            vector<Device*> order;
+            for (size_t i : plan.partitions[w]) {
+                order.push_back(flowsheet.devices[i].get());
+                for (StreamId in : order.back()->getInputs()) {
+                    if (mark[in] == w) continue;
+                    mark[in] = w;
+                    if (tearIndex[in] != none) {
+                        worker.seeds.push_back(tearIndex[in]);
+                    } else if (owner[in] != w) {
+                        worker.inputs.push_back(in);
+                        if (owner[in] == none) continue;
+                        exported[in] = true;
+                        Worker& source = workers[owner[in]];
+                        if (source.dependents.empty() || source.dependents.back() != w) {
+                            source.dependents.push_back(w);
+                            ++worker.waits;
+                        }
+                    }
+                }
+            }
+            flowsheet.compileInto(order, worker.tape);
+        }
+        for (Worker& worker : workers) {
+            for (StreamId id : worker.produced) {
+                if (exported[id]) worker.exports.push_back(id);
+            }
+        }
+
+        buffer.resize(1);
+        for (size_t w = 0; w < workers.size(); ++w) {
+            int ends[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, ends) != 0) {
+                stop();
+                throw string("Cannot create a partition channel");
+            }
+            pid_t pid = fork();
+            if (pid < 0) {
+                ::close(ends[0]);
+                ::close(ends[1]);
+                stop();
+                throw string("Cannot start a partition worker");
+            }
+            if (pid == 0) {
+                ::close(ends[0]);
+                for (size_t v = 0; v < w; ++v) ::close(workers[v].fd);
+                workers[w].fd = ends[1];
+                serve(workers[w]);
+            }
+            ::close(ends[1]);
+            workers[w].fd = ends[0];
+            workers[w].pid = pid;
+        }
+    }
+    PartitionedSolver(const PartitionedSolver&) = delete;
+    PartitionedSolver& operator=(const PartitionedSolver&) = delete;
+
+    ~PartitionedSolver() { stop(); }
+
+    const PartitionPlan& getPlan() const { return plan; }
+
+    RecycleResult solve(const RecycleOptions& options = RecycleOptions())
+    {
+        if (flowsheet.topologyVersion != version) throw string("Flowsheet changed since it was partitioned");
+        if (broken) throw string("Partition worker exited");
+        StreamStore& store = flowsheet.getStore();
+        RecycleResult result = {false, 0, 0.0};
+        size_t n = tears.size();
+        vector<double> x(n), g(n), lastX(n), lastG(n);
+        for (size_t i = 0; i < n; ++i) x[i] = store.getMassFlow(tears[i]);
+
+        while (result.iterations < options.maxIterations) {
+            pass(x);
+            ++result.iterations;
+
+            result.residual = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                g[i] = store.getMassFlow(tears[i]);
+                result.residual = max(result.residual, fabs(g[i] - x[i]));
+            }
+            if (result.residual <= options.tolerance) {
+                result.converged = true;
+                break;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                double next = nextTearGuess(options, result.iterations, x[i], g[i], lastX[i], lastG[i]);
+                lastX[i] = x[i];
+                lastG[i] = g[i];
+                x[i] = next;
+            }
+        }
+
+        for (Worker& worker : workers) {
+            if (!transmit(worker.fd, PartitionCommand::Collect, 0)) {
+                broken = true;
+                throw string("Partition worker exited");
+            }
+        }
+        for (Worker& worker : workers) accept(worker, worker.produced);
+        flowsheet.markSolved();
+        return result;
+    }
+};
+#endif
+// ==================== GOOGLE TESTS ====================
+
+TEST_SERIAL(ReactorTest, SingleOutputMode) {
+    streamcounter = 0;
+    Reactor reactor(false);
+
+    shared_ptr<Stream> input(new Stream(++streamcounter));
+    shared_ptr<Stream> output(new Stream(++streamcounter));
+
+    input->setMassFlow(20.0);
+
+    reactor.addInput(input);
+    reactor.addOutput(output);
+    reactor.updateOutputs();
+
+    EXPECT_NEAR(output->getMassFlow(), 20.0, POSSIBLE_ERROR);
+}
+
+TEST_SERIAL(ReactorTest, DoubleOutputMode) {
+    streamcounter = 0;
+    Reactor reactor(true);
+
+    shared_ptr<Stream> input(new Stream(++streamcounter));
+    shared_ptr<Stream> output1(new Stream(++streamcounter));
+    shared_ptr<Stream> output2(new Stream(++streamcounter));
+
+    input->setMassFlow(30.0);
+
+    reactor.addInput(input);
+    reactor.addOutput(output1);
+    reactor.addOutput(output2);
+    reactor.updateOutputs();
+
+    EXPECT_NEAR(output1->getMassFlow(), 15.0, POSSIBLE_ERROR);
+    EXPECT_NEAR(output2->getMassFlow(), 15.0, POSSIBLE_ERROR);
+
+    // Check mass conservation
+    double totalOutput = output1->getMassFlow() + output2->getMassFlow();
+    EXPECT_NEAR(totalOutput, 30.0, POSSIBLE_ERROR);
+}
+
+TEST_SERIAL(ReactorTest, InputLimitEnforcement) {
+    streamcounter = 0;
+    Reactor reactor(false);
+
+    shared_ptr<Stream> input1(new Stream(++streamcounter));
+    shared_ptr<Stream> input2(new Stream(++streamcounter));
+
+    reactor.addInput(input1);
+    EXPECT_THROW(reactor.addInput(input2), const char*);
+}
+
+TEST_SERIAL(ReactorTest, OutputLimitSingleMode) {
+    streamcounter = 0;
+    Reactor reactor(false);
+
+    shared_ptr<Stream> input(new Stream(++streamcounter));
+    shared_ptr<Stream> output1(new Stream(++streamcounter));
+    shared_ptr<Stream> output2(new Stream(++streamcounter));
+
+    reactor.addInput(input);
+    reactor.addOutput(output1);
+    EXPECT_THROW(reactor.addOutput(output2), const char*);
+}
+
+TEST(ReactorTest, GetIsDoubleOutputMethod) {
+    Reactor singleReactor(false);
+    Reactor doubleReactor(true);
+
+    EXPECT_FALSE(singleReactor.getIsDoubleOutput());
+    EXPECT_TRUE(doubleReactor.getIsDoubleOutput());
+}
+
+TEST_SERIAL(ReactorTest, NoInputException) {
+    streamcounter = 0;
+    Reactor reactor(false);
+
+    shared_ptr<Stream> output(new Stream(++streamcounter));
+    reactor.addOutput(output);
+    EXPECT_THROW(reactor.updateOutputs(), string);
+}
+
+TEST_SERIAL(ReactorTest, WrongOutputCountException) {
+    streamcounter = 0;
+    Reactor reactor(true);
+
+    shared_ptr<Stream> input(new Stream(++streamcounter));
+    shared_ptr<Stream> output1(new Stream(++streamcounter));
+
+    reactor.addInput(input);
+    reactor.addOutput(output1);
+    EXPECT_THROW(reactor.updateOutputs(), string);
+}
+
+TEST_SERIAL(MixerTest, BasicFunctionality) {
+    streamcounter = 0;
+    Mixer mixer(2);
+
+    shared_ptr<Stream> s1(new Stream(++streamcounter));
+    shared_ptr<Stream> s2(new Stream(++streamcounter));
+    shared_ptr<Stream> s3(new Stream(++streamcounter));
+
+    s1->setMassFlow(10.0);
+    s2->setMassFlow(5.0);
+
+    mixer.addInput(s1);
+    mixer.addInput(s2);
+    mixer.addOutput(s3);
+    mixer.updateOutputs();
+
+    EXPECT_NEAR(s3->getMassFlow(), 15.0, POSSIBLE_ERROR);
+}
+
+TEST(FlowsheetTest, SolvesInTopologicalOrder) {
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed1 = flowsheet.addStream();
+    shared_ptr<Stream> feed2 = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+
+    feed1->setMassFlow(10.0);
+    feed2->setMassFlow(30.0);
+    flowsheet.solve();
+
+    EXPECT_TRUE(flowsheet.getSchedule()[0] == &mixer);
+    EXPECT_TRUE(flowsheet.getSchedule()[1] == &reactor);
+    EXPECT_NEAR(product1->getMassFlow(), 20.0, POSSIBLE_ERROR);
+    EXPECT_NEAR(product2->getMassFlow(), 20.0, POSSIBLE_ERROR);
+}
+
+TEST(FlowsheetTest, ScheduleIsCachedUntilWiringChanges) {
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> middle = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+
+    Reactor& second = flowsheet.addDevice<Reactor>(false);
+    Reactor& first = flowsheet.addDevice<Reactor>(false);
+    first.addInput(feed);
+    first.addOutput(middle);
+
+    const Device* before = flowsheet.getSchedule()[0];
+    EXPECT_TRUE(&flowsheet.getSchedule() == &flowsheet.getSchedule());
+
+    second.addInput(middle);
+    second.addOutput(product);
+    EXPECT_TRUE(before == &second);
+    EXPECT_TRUE(flowsheet.getSchedule()[0] == &first);
+
+    feed->setMassFlow(7.0);
+    flowsheet.solve();
+    EXPECT_NEAR(product->getMassFlow(), 7.0, POSSIBLE_ERROR);
+}
+
+TEST(FlowsheetTest, RecycleLoopIsRejected) {
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> a = flowsheet.addStream();
+    shared_ptr<Stream> b = flowsheet.addStream();
+
+    Reactor& forward = flowsheet.addDevice<Reactor>(false);
+    forward.addInput(a);
+    forward.addOutput(b);
+    Reactor& back = flowsheet.addDevice<Reactor>(false);
+    back.addInput(b);
+    back.addOutput(a);
+
+    EXPECT_THROW(flowsheet.solve(), string);
+}
+
+TEST(StreamStoreTest, StreamsShareContiguousStorage) {
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> s1 = flowsheet.addStream();
+    shared_ptr<Stream> s2 = flowsheet.addStream();
+    s1->setMassFlow(3.0);
+    s2->setMassFlow(4.0);
+
+    const double* flows = flowsheet.getStore().massFlows();
+    EXPECT_TRUE(s2->getId() == s1->getId() + 1);
+    EXPECT_NEAR(flows[s1->getId()], 3.0, POSSIBLE_ERROR);
+    EXPECT_NEAR(flows[s2->getId()], 4.0, POSSIBLE_ERROR);
+    EXPECT_TRUE(s2->getName() == "s2");
+}
+
+TEST_SERIAL(StreamStoreTest, DeviceRejectsStreamsFromAnotherStore) {
+    Flowsheet flowsheet;
+    Mixer mixer(2);
+
+    shared_ptr<Stream> local = flowsheet.addStream();
+    shared_ptr<Stream> standalone(new Stream(++streamcounter));
+
+    mixer.addInput(local);
+    EXPECT_THROW(mixer.addInput(standalone), string);
+}
+
+TEST_SERIAL(StreamStoreTest, StandaloneStreamsReleaseTheirSlots) {
+    size_t before = StandaloneStore::current().size();
+    for (int i = 0; i < 10000; ++i) {
+        Stream stream(i);
+        stream.setMassFlow(i);
+    }
+    EXPECT_TRUE(StandaloneStore::current().size() <= before + 1);
+
+    unique_ptr<Stream> named(new Stream(7));
+    named->setName("named");
+    named->setMassFlow(3.0);
+    named.reset();
+    Stream reused(8);
+    EXPECT_TRUE(reused.getName() == "s8");
+    EXPECT_NEAR(reused.getMassFlow(), 0.0, POSSIBLE_ERROR);
+}
+
+TEST_SERIAL(StreamStoreTest, ThreadsBuildStandaloneStreamsApart) {
+    streamcounter = 0;
+    shared_ptr<Stream> kept[2];
+    vector<thread> builders;
+    for (int t = 0; t < 2; ++t) {
+        builders.emplace_back([t, &kept]() {
+            for (int i = 0; i < 1000; ++i) {
+                shared_ptr<Stream> stream(new Stream(++streamcounter));
+                stream->setMassFlow(t + i);
+                if (i == 999) kept[t] = stream;
+            }
+        });
+    }
+    for (thread& builder : builders) builder.join();
+
+    EXPECT_TRUE(&kept[0]->getStore() != &kept[1]->getStore());
+    EXPECT_TRUE(kept[0]->getNumber() != kept[1]->getNumber());
+    EXPECT_NEAR(kept[0]->getMassFlow(), 999.0, POSSIBLE_ERROR);
+    EXPECT_NEAR(kept[1]->getMassFlow(), 1000.0, POSSIBLE_ERROR);
+    kept[0].reset();
+    kept[1].reset();
+}
+
+TEST(BatchTest, EvaluatesAllScenariosInOnePass) {
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed1 = flowsheet.addStream();
+    shared_ptr<Stream> feed2 = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+
+    const size_t scenarios = 7;  // not a multiple of the SIMD width
+    flowsheet.setScenarioCount(scenarios);
+    for (size_t i = 0; i < scenarios; ++i) {
+        feed1->setLane(i, 10.0 * i);
+        feed2->setLane(i, 1.0);
+    }
+    flowsheet.solveBatch();
+
+    for (size_t i = 0; i < scenarios; ++i) {
+        EXPECT_NEAR(mixed->getLane(i), 10.0 * i + 1.0, POSSIBLE_ERROR);
+        EXPECT_NEAR(product1->getLane(i), (10.0 * i + 1.0) / 2.0, POSSIBLE_ERROR);
+        EXPECT_NEAR(product2->getLane(i), (10.0 * i + 1.0) / 2.0, POSSIBLE_ERROR);
+    }
+}
+
+TEST(BatchTest, RequiresBatchMode) {
+    Flowsheet flowsheet;
+    EXPECT_THROW(flowsheet.solveBatch(), string);
+}
+
+TEST(TraceTest, RingBufferDrainsInOrder) {
+    RingBufferTraceSink sink(4);
+    sink.write(TraceLevel::Info, "first");
+    sink.write(TraceLevel::Info, "second");
+
+    ostringstream out;
+    EXPECT_TRUE(sink.drain(out) == 2);
+    EXPECT_TRUE(out.str() == "first\nsecond\n");
+    EXPECT_TRUE(sink.drain(out) == 0);
+}
+
+TEST(TraceTest, FullRingBufferDropsMessages) {
+    RingBufferTraceSink sink(2);
+    sink.write(TraceLevel::Info, "a");
+    sink.write(TraceLevel::Info, "b");
+    sink.write(TraceLevel::Info, "c");
+
+    ostringstream out;
+    EXPECT_TRUE(sink.drain(out) == 2);
+    EXPECT_TRUE(sink.droppedCount() == 1);
+}
+
+TEST_SERIAL(TraceTest, MessagesAreFilteredByLevel) {
+    RingBufferTraceSink sink;
+    setTraceSink(&sink, TraceLevel::Info);
+    traceMessage(TraceLevel::Info, "kept %d", 1);
+    traceMessage(TraceLevel::Debug, "filtered %d", 2);
+    setTraceSink(nullptr);
+    traceMessage(TraceLevel::Error, "no sink");
+
+    ostringstream out;
+    sink.drain(out);
+    EXPECT_TRUE(out.str() == "kept 1\n");
+}
+
+TEST_SERIAL(TraceTest, ReactorTracesThroughSink) {
+    RingBufferTraceSink sink;
+    setTraceSink(&sink, TraceLevel::Debug);
+
+    Reactor reactor(true);
+    shared_ptr<Stream> input(new Stream(++streamcounter));
+    shared_ptr<Stream> output1(new Stream(++streamcounter));
+    shared_ptr<Stream> output2(new Stream(++streamcounter));
+    input->setMassFlow(40.0);
+    reactor.addInput(input);
+    reactor.addOutput(output1);
+    reactor.addOutput(output2);
+    reactor.updateOutputs();
+    setTraceSink(nullptr);
+
+    ostringstream out;
+    sink.drain(out);
+#if DEVICE_TRACE_LEVEL >= 3
+    EXPECT_TRUE(out.str() == "Reactor: split mass 40 into two outputs of 20\n");
+#else
+    EXPECT_TRUE(out.str().empty());
+#endif
+}
+
+TEST_SERIAL(DeviceStatusTest, TryAddReportsLimitsWithoutThrowing) {
+    Mixer mixer(1);
+    Reactor reactor(false);
+
+    shared_ptr<Stream> s1(new Stream(++streamcounter));
+    shared_ptr<Stream> s2(new Stream(++streamcounter));
+    shared_ptr<Stream> s3(new Stream(++streamcounter));
+
+    EXPECT_TRUE(mixer.tryAddInput(*s1).ok());
+    EXPECT_TRUE(mixer.tryAddInput(*s2).error == DeviceError::InputLimit);
+    EXPECT_TRUE(mixer.tryAddOutput(*s3).ok());
+    EXPECT_TRUE(mixer.tryAddOutput(*s1).error == DeviceError::OutputLimit);
+
+    EXPECT_TRUE(reactor.tryAddInput(*s1).ok());
+    EXPECT_TRUE(reactor.tryAddInput(*s2).error == DeviceError::InputLimit);
+    EXPECT_TRUE(mixer.getInputs().size() == 1);
+}
+
+TEST_SERIAL(DeviceStatusTest, TryUpdateReportsMissingWiring) {
+    Mixer mixer(2);
+    Reactor reactor(true);
+
+    shared_ptr<Stream> s1(new Stream(++streamcounter));
+    shared_ptr<Stream> s2(new Stream(++streamcounter));
+
+    EXPECT_TRUE(mixer.tryUpdateOutputs().error == DeviceError::OutputsNotSet);
+    EXPECT_TRUE(reactor.tryUpdateOutputs().error == DeviceError::InputNotConnected);
+
+    reactor.addInput(s1);
+    reactor.addOutput(s2);
+    DeviceStatus status = reactor.tryUpdateOutputs();
+    EXPECT_FALSE(status);
+    EXPECT_TRUE(status.error == DeviceError::OutputsNotSet);
+    EXPECT_TRUE(string(status.message()) == "Output streams not properly set");
+}
+
+TEST(DeviceStatusTest, FlowsheetValidatesAllDevicesInBulk) {
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+
+    Mixer& mixer = flowsheet.addDevice<Mixer>(1);
+    mixer.addInput(feed);
+    flowsheet.addDevice<Reactor>(false);
+    Reactor& wired = flowsheet.addDevice<Reactor>(false);
+    wired.addInput(feed);
+    wired.addOutput(product);
+
+    vector<WiringIssue> issues = flowsheet.validate();
+    EXPECT_TRUE(issues.size() == 2);
+    EXPECT_TRUE(issues[0].device == 0 && issues[0].error == DeviceError::OutputsNotSet);
+    EXPECT_TRUE(issues[1].device == 1 && issues[1].error == DeviceError::InputNotConnected);
+
+    feed->setMassFlow(5.0);
+    EXPECT_TRUE(flowsheet.trySolve().error == DeviceError::OutputsNotSet);
+    EXPECT_NEAR(product->getMassFlow(), 0.0, POSSIBLE_ERROR);
+}
+
+TEST(IncrementalTest, OnlyDownstreamDevicesRerun) {
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feedA = flowsheet.addStream();
+    shared_ptr<Stream> middleA = flowsheet.addStream();
+    shared_ptr<Stream> productA = flowsheet.addStream();
+    shared_ptr<Stream> feedB = flowsheet.addStream();
+    shared_ptr<Stream> productB = flowsheet.addStream();
+
+    Reactor& first = flowsheet.addDevice<Reactor>(false);
+    first.addInput(feedA);
+    first.addOutput(middleA);
+    Reactor& second = flowsheet.addDevice<Reactor>(false);
+    second.addInput(middleA);
+    second.addOutput(productA);
+    Reactor& other = flowsheet.addDevice<Reactor>(false);
+    other.addInput(feedB);
+    other.addOutput(productB);
+
+    feedA->setMassFlow(1.0);
+    feedB->setMassFlow(2.0);
+    EXPECT_TRUE(flowsheet.solveIncremental() == 3);
+
+    feedA->setMassFlow(4.0);
+    EXPECT_TRUE(flowsheet.solveIncremental() == 2);
+    EXPECT_NEAR(productA->getMassFlow(), 4.0, POSSIBLE_ERROR);
+    EXPECT_NEAR(productB->getMassFlow(), 2.0, POSSIBLE_ERROR);
+
+    EXPECT_TRUE(flowsheet.solveIncremental() == 0);
+}
+
+TEST(IncrementalTest, UnchangedOutputsStopPropagation) {
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed1 = flowsheet.addStream();
+    shared_ptr<Stream> feed2 = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(mixed);
+    reactor.addOutput(product);
+
+    feed1->setMassFlow(1.0);
+    feed2->setMassFlow(3.0);
+    flowsheet.solve();
+
+    // Same total: the mixer reruns but the reactor does not
+    feed1->setMassFlow(2.0);
+    feed2->setMassFlow(2.0);
+    EXPECT_TRUE(flowsheet.solveIncremental() == 1);
+    EXPECT_NEAR(product->getMassFlow(), 4.0, POSSIBLE_ERROR);
+}
+
+// Builds `chains` independent feed -> Mixer -> Reactor(double) -> Reactor chains
+static vector<shared_ptr<Stream>> buildParallelChains(Flowsheet& flowsheet, size_t chains) {
+    vector<shared_ptr<Stream>> products;
+    for (size_t i = 0; i < chains; ++i) {
+        shared_ptr<Stream> feed1 = flowsheet.addStream();
+        shared_ptr<Stream> feed2 = flowsheet.addStream();
+        shared_ptr<Stream> mixed = flowsheet.addStream();
+        shared_ptr<Stream> split1 = flowsheet.addStream();
+        shared_ptr<Stream> split2 = flowsheet.addStream();
+        shared_ptr<Stream> product = flowsheet.addStream();
+
+        Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+        mixer.addInput(feed1);
+        mixer.addInput(feed2);
+        mixer.addOutput(mixed);
+        Reactor& splitter = flowsheet.addDevice<Reactor>(true);
+        splitter.addInput(mixed);
+        splitter.addOutput(split1);
+        splitter.addOutput(split2);
+        Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+        reactor.addInput(split1);
+        reactor.addOutput(product);
+
+        feed1->setMassFlow(0.1 * i);
+        feed2->setMassFlow(1.0 / (i + 1));
+        products.push_back(product);
+        products.push_back(split2);
+    }
+    return products;
+}
+
+TEST(ParallelExecutorTest, MatchesSerialSolveExactly) {
+    Flowsheet serial;
+    Flowsheet parallel;
+    vector<shared_ptr<Stream>> expected = buildParallelChains(serial, 500);
+    vector<shared_ptr<Stream>> actual = buildParallelChains(parallel, 500);
+
+    serial.solve();
+    ParallelExecutor executor(4, 16);
+    EXPECT_TRUE(executor.threadCount() == 4);
+    executor.solve(parallel);
+
+    EXPECT_TRUE(parallel.getLevelStarts().size() == 4);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        EXPECT_TRUE(expected[i]->getMassFlow() == actual[i]->getMassFlow());
+    }
+
+    // Executor is reusable across solves and the flowsheet counts as solved
+    executor.solve(parallel);
+    EXPECT_TRUE(parallel.solveIncremental() == 0);
+}
+
+TEST(ParallelExecutorTest, ManySmallLevelsDoNotStall) {
+    // Four chains of 200 Reactors: 200 levels of four single-device tasks, so
+    // workers are often still draining one level when the next is queued
+    Flowsheet flowsheet;
+    vector<Stream*> products;
+    for (int chain = 0; chain < 4; ++chain) {
+        Stream* last = &flowsheet.createStream();
+        last->setMassFlow(1.0 + chain);
+        for (int i = 0; i < 200; ++i) {
+            Stream& next = flowsheet.createStream();
+            Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+            reactor.addInput(*last);
+            reactor.addOutput(next);
+            last = &next;
+        }
+        products.push_back(last);
+    }
+
+    ParallelExecutor executor(4, 1);
+    for (int round = 0; round < 500; ++round) executor.solve(flowsheet);
+    for (int chain = 0; chain < 4; ++chain) EXPECT_NEAR(products[chain]->getMassFlow(), 1.0 + chain, 1e-12);
+}
+
+TEST(ParallelExecutorTest, RethrowsDeviceErrors) {
+    Flowsheet flowsheet;
+    buildParallelChains(flowsheet, 50);
+    flowsheet.addDevice<Mixer>(1);  // never wired
+
+    ParallelExecutor executor(3, 4);
+    EXPECT_THROW(executor.solve(flowsheet), string);
+}
+
+TEST_SERIAL(StreamArenaTest, NamesAreDerivedFromNumericIds) {
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> s1 = flowsheet.addStream();
+    shared_ptr<Stream> s2 = flowsheet.addStream();
+    EXPECT_TRUE(s1->getNumber() == 1 && s2->getNumber() == 2);
+    EXPECT_TRUE(s2->getName() == "s2");
+
+    s1->setName("feed");
+    EXPECT_TRUE(s1->getName() == "feed");
+    EXPECT_TRUE(s2->getName() == "s2");
+
+    Stream standalone(42);
+    EXPECT_TRUE(standalone.getName() == "s42");
+}
+
+TEST(StreamArenaTest, HandlesKeepStreamDataAlive) {
+    shared_ptr<Stream> survivor;
+    {
+        Flowsheet flowsheet;
+        for (int i = 0; i < 3000; ++i) flowsheet.addStream();  // spans several chunks
+        survivor = flowsheet.addStream();
+        survivor->setMassFlow(12.5);
+    }
+    EXPECT_NEAR(survivor->getMassFlow(), 12.5, POSSIBLE_ERROR);
+    EXPECT_TRUE(survivor->getNumber() == 3001);
+}
+
+// feed -> Mixer(feed, recycle) -> Reactor(double) -> product + recycle
+static shared_ptr<Stream> buildRecycleLoop(Flowsheet& flowsheet, shared_ptr<Stream>& recycle) {
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    recycle = flowsheet.addStream();
+
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product);
+    reactor.addOutput(recycle);
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed);
+    mixer.addInput(recycle);
+    mixer.addOutput(mixed);
+
+    feed->setMassFlow(10.0);
+    return product;
+}
+
+TEST(RecycleTest, FindsTearStream) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> recycle;
+    buildRecycleLoop(flowsheet, recycle);
+
+    EXPECT_TRUE(flowsheet.getTearStreams().size() == 1);
+    EXPECT_TRUE(flowsheet.getSchedule().size() == 2);
+}
+
+TEST(RecycleTest, DevicesDownstreamOfALoopAreNotTorn) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> waste = flowsheet.addStream();
+    Reactor& polisher = flowsheet.addDevice<Reactor>(false);
+    shared_ptr<Stream> recycle;
+    shared_ptr<Stream> product = buildRecycleLoop(flowsheet, recycle);
+    polisher.addInput(product);
+    polisher.addOutput(waste);
+
+    EXPECT_TRUE(flowsheet.getTearStreams().size() == 1);
+    EXPECT_TRUE(flowsheet.getTearStreams()[0] != product->getId());
+    EXPECT_TRUE(flowsheet.getSchedule().back() == &polisher);
+
+    RecycleResult result = flowsheet.converge();
+    EXPECT_TRUE(result.converged);
+    EXPECT_NEAR(waste->getMassFlow(), 10.0, POSSIBLE_ERROR);
+}
+
+TEST(RecycleTest, WegsteinConvergesInAFewPasses) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> recycle;
+    shared_ptr<Stream> product = buildRecycleLoop(flowsheet, recycle);
+
+    RecycleResult result = flowsheet.converge();
+    EXPECT_TRUE(result.converged);
+    EXPECT_TRUE(result.iterations <= 4);
+    EXPECT_NEAR(product->getMassFlow(), 10.0, POSSIBLE_ERROR);
+    EXPECT_NEAR(recycle->getMassFlow(), 10.0, POSSIBLE_ERROR);
+}
+
+TEST(RecycleTest, SubstitutionNeedsMorePasses) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> recycle;
+    shared_ptr<Stream> product = buildRecycleLoop(flowsheet, recycle);
+
+    RecycleOptions options;
+    options.method = RecycleMethod::Substitution;
+    options.tolerance = 1e-6;
+    RecycleResult result = flowsheet.converge(options);
+    EXPECT_TRUE(result.converged);
+    EXPECT_TRUE(result.iterations > 10);
+    EXPECT_NEAR(product->getMassFlow(), 10.0, 1e-5);
+
+    options.maxIterations = 3;
+    flowsheet.getStore().setMassFlow(flowsheet.getTearStreams()[0], 0.0);
+    EXPECT_FALSE(flowsheet.converge(options).converged);
+}
+
+TEST(ComponentTest, MixerAndReactorWorkPerSpecies) {
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed1 = flowsheet.addStream();
+    shared_ptr<Stream> feed2 = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+
+    const size_t species = 50;
+    flowsheet.setComponentCount(species);
+    for (size_t c = 0; c < species; ++c) {
+        feed1->setComponentFlow(c, 1.0 * c);
+        feed2->setComponentFlow(c, 2.0);
+    }
+    flowsheet.solveComponents();
+
+    for (size_t c = 0; c < species; ++c) {
+        EXPECT_NEAR(mixed->getComponentFlow(c), c + 2.0, POSSIBLE_ERROR);
+        EXPECT_NEAR(product2->getComponentFlow(c), (c + 2.0) / 2.0, POSSIBLE_ERROR);
+    }
+    // Totals are derived: sum(c) + 2 * species = 1225 + 100
+    EXPECT_NEAR(mixed->getMassFlow(), 1325.0, POSSIBLE_ERROR);
+    EXPECT_NEAR(product1->getMassFlow() + product2->getMassFlow(), 1325.0, POSSIBLE_ERROR);
+    EXPECT_THROW(feed1->setMassFlow(1.0), string);
+}
+
+TEST(ComponentTest, RowsAreAlignedAndPadded) {
+    StreamStore store;
+    store.add(1);
+    store.add(2);
+    store.setComponents(5);
+
+    EXPECT_TRUE((uintptr_t)store.componentFlows(0) % SIMD_ALIGNMENT == 0);
+    EXPECT_TRUE((uintptr_t)store.componentFlows(1) % SIMD_ALIGNMENT == 0);
+    EXPECT_TRUE(store.componentRows().width == 8);
+}
+
+TEST(ComponentTest, IndicesPastTheSpeciesCountThrow) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    flowsheet.getStore().setComponents(3);
+    feed->setComponentFlow(0, 1.0);
+    feed->setComponentFlow(2, 2.0);
+
+    EXPECT_THROW(feed->setComponentFlow(3, 5.0), string);
+    EXPECT_THROW(feed->getComponentFlow(3), string);
+    flowsheet.getStore().componentFlows(feed->getId())[3] = 5.0;
+    EXPECT_NEAR(feed->getMassFlow(), 3.0, POSSIBLE_ERROR);
+}
+
+TEST(StaticDeviceTest, MatchesRuntimeDevices) {
+    Flowsheet flowsheet;
+
+    shared_ptr<Stream> feed1 = flowsheet.addStream();
+    shared_ptr<Stream> feed2 = flowsheet.addStream();
+    shared_ptr<Stream> feed3 = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+    feed1->setMassFlow(1.0);
+    feed2->setMassFlow(2.0);
+    feed3->setMassFlow(3.0);
+
+    StaticMixer<3>& mixer = flowsheet.addDevice<StaticMixer<3>>();
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addInput(feed3);
+    mixer.addOutput(mixed);
+    StaticReactor<2>& reactor = flowsheet.addDevice<StaticReactor<2>>();
+    reactor.addInput(mixed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+    flowsheet.solve();
+
+    EXPECT_NEAR(mixed->getMassFlow(), 6.0, POSSIBLE_ERROR);
+    EXPECT_NEAR(product1->getMassFlow(), 3.0, POSSIBLE_ERROR);
+    EXPECT_NEAR(product2->getMassFlow(), 3.0, POSSIBLE_ERROR);
+
+    flowsheet.setScenarioCount(5);
+    for (size_t lane = 0; lane < 5; ++lane) {
+        feed1->setLane(lane, 1.0 * lane);
+        feed2->setLane(lane, 1.0);
+        feed3->setLane(lane, 1.0);
+    }
+    flowsheet.solveBatch();
+    for (size_t lane = 0; lane < 5; ++lane) {
+        EXPECT_NEAR(product2->getLane(lane), (lane + 2.0) / 2.0, POSSIBLE_ERROR);
+    }
+}
+
+TEST(StaticDeviceTest, EnforcesFixedArity) {
+    StreamStore store;
+    StaticMixer<2> mixer;
+    StaticReactor<1> reactor;
+    StreamId ids[4];
+    for (int i = 0; i < 4; ++i) ids[i] = store.add(i + 1);
+
+    EXPECT_TRUE(mixer.tryAddInput(Stream(store, ids[0])).ok());
+    EXPECT_TRUE(mixer.tryAddOutput(Stream(store, ids[2])).ok());
+    EXPECT_TRUE(mixer.validate().error == DeviceError::InputNotConnected);
+    EXPECT_TRUE(mixer.tryAddInput(Stream(store, ids[1])).ok());
+    EXPECT_TRUE(mixer.tryAddInput(Stream(store, ids[3])).error == DeviceError::InputLimit);
+    EXPECT_TRUE(mixer.tryAddOutput(Stream(store, ids[3])).error == DeviceError::OutputLimit);
+    EXPECT_TRUE(mixer.validate().ok());
+
+    EXPECT_TRUE(reactor.tryAddInput(Stream(store, ids[2])).ok());
+    EXPECT_TRUE(reactor.validate().error == DeviceError::OutputsNotSet);
+    EXPECT_TRUE(reactor.tryAddOutput(Stream(store, ids[3])).ok());
+    EXPECT_TRUE(reactor.tryAddOutput(Stream(store, ids[0])).error == DeviceError::OutputLimit);
+}
+
+class Doubler : public Device
+{
+public:
+    Doubler() : Device() {
+        inputAmount = 1;
+        outputAmount = 1;
+    }
+    void updateOutputs() override {
+        store->setMassFlow(outputs[0], 2.0 * store->getMassFlow(inputs[0]));
+    }
+};
+
+TEST(TapeTest, MatchesSolve) {
+    Flowsheet flowsheet;
+    Flowsheet reference;
+    Flowsheet* sheets[] = {&flowsheet, &reference};
+    for (Flowsheet* sheet : sheets) {
+        shared_ptr<Stream> feed1 = sheet->addStream();
+        shared_ptr<Stream> feed2 = sheet->addStream();
+        shared_ptr<Stream> mixed = sheet->addStream();
+        shared_ptr<Stream> doubled = sheet->addStream();
+        shared_ptr<Stream> product1 = sheet->addStream();
+        shared_ptr<Stream> product2 = sheet->addStream();
+        shared_ptr<Stream> product3 = sheet->addStream();
+        feed1->setMassFlow(3.0);
+        feed2->setMassFlow(5.0);
+
+        Mixer& mixer = sheet->addDevice<Mixer>(2);
+        mixer.addInput(feed1);
+        mixer.addInput(feed2);
+        mixer.addOutput(mixed);
+        Doubler& doubler = sheet->addDevice<Doubler>();
+        doubler.addInput(mixed);
+        doubler.addOutput(doubled);
+        Reactor& reactor = sheet->addDevice<Reactor>(true);
+        reactor.addInput(doubled);
+        reactor.addOutput(product1);
+        reactor.addOutput(product2);
+        StaticReactor<1>& copy = sheet->addDevice<StaticReactor<1>>();
+        copy.addInput(product2);
+        copy.addOutput(product3);
+    }
+    flowsheet.solveTape();
+    reference.solve();
+
+    for (StreamId id = 0; id < flowsheet.streamCount(); ++id) {
+        EXPECT_NEAR(flowsheet.getStore().getMassFlow(id), reference.getStore().getMassFlow(id), POSSIBLE_ERROR);
+    }
+    EXPECT_NEAR(flowsheet.getStore().getMassFlow(6), 8.0, POSSIBLE_ERROR);
+
+    const vector<TapeInstruction>& code = flowsheet.getTape().instructions();
+    EXPECT_TRUE(code.size() == 4);
+    EXPECT_TRUE(code[0].op == TapeOp::Sum);
+    EXPECT_TRUE(code[1].op == TapeOp::Call);
+    EXPECT_TRUE(code[2].op == TapeOp::Split);
+    EXPECT_TRUE(code[3].op == TapeOp::Copy);
+}
+
+TEST(TapeTest, RecompilesOnlyAfterWiringChanges) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> middle = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    Reactor& first = flowsheet.addDevice<Reactor>(false);
+    first.addInput(feed);
+    first.addOutput(middle);
+
+    feed->setMassFlow(4.0);
+    flowsheet.solveTape();
+    const TapeInstruction* compiled = flowsheet.getTape().instructions().data();
+    feed->setMassFlow(6.0);
+    flowsheet.solveTape();
+    EXPECT_TRUE(flowsheet.getTape().instructions().data() == compiled);
+    EXPECT_NEAR(middle->getMassFlow(), 6.0, POSSIBLE_ERROR);
+
+    Reactor& second = flowsheet.addDevice<Reactor>(false);
+    second.addInput(middle);
+    EXPECT_THROW(flowsheet.solveTape(), string);
+    second.addOutput(product);
+    flowsheet.solveTape();
+    EXPECT_TRUE(flowsheet.getTape().size() == 2);
+    EXPECT_NEAR(product->getMassFlow(), 6.0, POSSIBLE_ERROR);
+}
+
+class FailingDevice : public Device
+{
+public:
+    FailingDevice() : Device() {
+        inputAmount = 1;
+        outputAmount = 1;
+    }
+    void updateOutputs() override { throw string("device failed"); }
+};
+
+TEST_SERIAL(ProfileTest, CountsCallsPerDeviceAndPhase) {
+    resetDeviceProfiles();
+    Flowsheet flowsheet;
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+
+    flowsheet.solve();
+    flowsheet.solve();
+    flowsheet.setScenarioCount(4);
+    flowsheet.solveBatch();
+
+    DeviceProfile update = deviceProfile(&reactor);
+    DeviceProfile batch = deviceProfile(&reactor, ProfilePhase::Batch);
+#if DEVICE_PROFILING
+    EXPECT_TRUE(update.calls == 2);
+    EXPECT_TRUE(update.maxNs <= update.totalNs);
+    EXPECT_TRUE(batch.calls == 1);
+    ostringstream dump;
+    flowsheet.dumpProfile(dump);
+    EXPECT_TRUE(dump.str().find("#0 Reactor update calls=2") == 0);
+#else
+    EXPECT_TRUE(update.calls == 0 && batch.calls == 0);
+    EXPECT_TRUE(deviceProfiles().empty());
+#endif
+}
+
+TEST_SERIAL(ProfileTest, CountsExceptionsAcrossThreads) {
+    resetDeviceProfiles();
+    StreamStore store;
+    FailingDevice device;
+    device.tryAddInput(Stream(store, store.add(1)));
+    device.tryAddOutput(Stream(store, store.add(2)));
+
+    vector<thread> workers;
+    for (int t = 0; t < 4; ++t) {
+        workers.emplace_back([&device]() {
+            for (int i = 0; i < 10; ++i) {
+                try {
+                    device.evaluate();
+                } catch (const string&) {
+                }
+            }
+        });
+    }
+    for (thread& worker : workers) worker.join();
+
+    DeviceProfile profile = deviceProfile(&device);
+#if DEVICE_PROFILING
+    EXPECT_TRUE(profile.calls == 40);
+    EXPECT_TRUE(profile.exceptions == 40);
+#else
+    EXPECT_TRUE(profile.calls == 0);
+#endif
+    resetDeviceProfiles();
+    EXPECT_TRUE(deviceProfile(&device).calls == 0);
+}
+
+TEST_SERIAL(ProfileTest, ResetAndDestructionRaceWithRecording) {
+    resetDeviceProfiles();
+    StreamStore store;
+    Reactor device(false);
+    device.tryAddInput(Stream(store, store.add(1)));
+    device.tryAddOutput(Stream(store, store.add(2)));
+
+    atomic<bool> running(true);
+    thread worker([&]() {
+        while (running.load()) device.evaluate();
+    });
+    for (int i = 0; i < 200; ++i) {
+        resetDeviceProfiles();
+        Reactor* shortLived = new Reactor(false);
+        shortLived->tryAddInput(Stream(store, 0));
+        shortLived->tryAddOutput(Stream(store, 1));
+        shortLived->evaluate();
+        delete shortLived;
+        ostringstream dump;
+        dumpDeviceProfiles(dump);
+        EXPECT_TRUE(dump.str().find("Reactor@") == 0 || dump.str().empty());
+    }
+    running = false;
+    worker.join();
+
+    // A destroyed device leaves nothing behind for a successor at its address
+    Reactor* gone = new Reactor(false);
+    gone->tryAddInput(Stream(store, 0));
+    gone->tryAddOutput(Stream(store, 1));
+    gone->evaluate();
+    const Device* address = gone;
+    delete gone;
+    for (const DeviceProfile& profile : deviceProfiles()) EXPECT_FALSE(profile.device == address);
+    resetDeviceProfiles();
+}
+
+TEST(RunnerTest, FilterUsesGtestGlobs) {
+    EXPECT_TRUE(FilterMatches("*", "TapeTest.MatchesSolve"));
+    EXPECT_TRUE(FilterMatches("Tape*", "TapeTest.MatchesSolve"));
+    EXPECT_TRUE(FilterMatches("Mixer*:Tape?est.*", "TapeTest.MatchesSolve"));
+    EXPECT_FALSE(FilterMatches("Mixer*", "TapeTest.MatchesSolve"));
+    EXPECT_FALSE(FilterMatches("*-*Solve", "TapeTest.MatchesSolve"));
+    EXPECT_TRUE(FilterMatches("-Mixer*", "TapeTest.MatchesSolve"));
+}
+
+TEST(RunnerTest, FailuresAreCapturedPerTest) {
+    std::ostringstream log;
+    bool passed = RunCaptured([]() { EXPECT_TRUE(1 + 1 == 3); }, log);
+    EXPECT_FALSE(passed);
+    EXPECT_TRUE(log.str().find("Failure: 1 + 1 == 3") == 0);
+    EXPECT_TRUE(RunCaptured([]() {}, log));
+}
+
+BENCHMARK(FlowsheetBenchmark, SolveTapeOf500Chains) {
+    static Flowsheet flowsheet;
+    static vector<shared_ptr<Stream>> products = buildParallelChains(flowsheet, 500);
+    flowsheet.solveTape();
+    EXPECT_TRUE(products.size() == 1000);
+}
+
+TEST(StreamIdTest, AllocatorHandsOutDisjointBlocks) {
+    StreamIdAllocator allocator;
+    vector<vector<uint32_t>> taken(4);
+    vector<thread> builders;
+    for (size_t t = 0; t < taken.size(); ++t) {
+        builders.emplace_back([&allocator, &taken, t]() {
+            StreamIdBlock block;
+            for (int i = 0; i < 1000; ++i) taken[t].push_back(block.take(allocator));
+        });
+    }
+    for (thread& builder : builders) builder.join();
+
+    vector<uint32_t> all;
+    for (const vector<uint32_t>& numbers : taken) all.insert(all.end(), numbers.begin(), numbers.end());
+    sort(all.begin(), all.end());
+    EXPECT_TRUE(all.size() == 4000);
+    EXPECT_TRUE(adjacent_find(all.begin(), all.end()) == all.end());
+    EXPECT_TRUE(all.front() >= 1);
+}
+
+TEST(StreamIdTest, SubFlowsheetsBuiltInParallelMerge) {
+    shared_ptr<StreamIdAllocator> ids = make_shared<StreamIdAllocator>();
+    Flowsheet plant(ids);
+    vector<unique_ptr<Flowsheet>> parts;
+    vector<vector<shared_ptr<Stream>>> products(4);
+    for (size_t t = 0; t < products.size(); ++t) parts.emplace_back(new Flowsheet(ids));
+
+    vector<thread> builders;
+    for (size_t t = 0; t < parts.size(); ++t) {
+        builders.emplace_back([&parts, &products, t]() { products[t] = buildParallelChains(*parts[t], 300); });
+    }
+    for (thread& builder : builders) builder.join();
+
+    Flowsheet reference;
+    vector<shared_ptr<Stream>> expected = buildParallelChains(reference, 300);
+    reference.solve();
+
+    for (size_t t = 0; t < parts.size(); ++t) {
+        plant.merge(*parts[t]);
+        EXPECT_TRUE(parts[t]->deviceCount() == 0 && parts[t]->streamCount() == 0);
+    }
+    parts.clear();
+    EXPECT_TRUE(plant.deviceCount() == 4 * 900);
+    plant.solve();
+
+    vector<string> names;
+    for (StreamId id = 0; id < plant.streamCount(); ++id) names.push_back(plant.getStore().getName(id));
+    sort(names.begin(), names.end());
+    EXPECT_TRUE(adjacent_find(names.begin(), names.end()) == names.end());
+    for (size_t t = 0; t < products.size(); ++t) {
+        for (size_t i = 0; i < expected.size(); ++i) {
+            EXPECT_TRUE(&products[t][i]->getStore() == &plant.getStore());
+            EXPECT_NEAR(products[t][i]->getMassFlow(), expected[i]->getMassFlow(), 1e-12);
+        }
+    }
+}
+
+TEST(StreamIdTest, MergeKeepsStaticPortsAndRejectsSelfMerge) {
+    Flowsheet plant;
+    Flowsheet part;
+    plant.addStream();
+    shared_ptr<Stream> feed = part.addStream();
+    shared_ptr<Stream> product = part.addStream();
+    StaticReactor<1>& reactor = part.addDevice<StaticReactor<1>>();
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+    feed->setMassFlow(2.5);
+
+    EXPECT_TRUE(plant.merge(part) == 1);
+    EXPECT_TRUE(feed->getId() == 1 && product->getId() == 2);
+    plant.solveTape();
+    EXPECT_NEAR(product->getMassFlow(), 2.5, POSSIBLE_ERROR);
+    EXPECT_THROW(plant.merge(plant), string);
+}
+
+TEST(StreamIdTest, MergeBackIsRejected) {
+    Flowsheet first;
+    Flowsheet second;
+    Flowsheet third;
+    shared_ptr<Stream> feed = first.addStream();
+    feed->setMassFlow(4.0);
+    second.merge(first);
+    third.merge(second);
+    first.addStream();
+
+    EXPECT_THROW(second.merge(third), string);
+    EXPECT_THROW(first.merge(third), string);
+    EXPECT_TRUE(third.getStore().size() == 1);
+    EXPECT_NEAR(feed->getMassFlow(), 4.0, POSSIBLE_ERROR);
+    EXPECT_TRUE(third.merge(first) == 1);
+}
+
+TEST(SnapshotTest, ReadersSeeWholePasses) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+    Mixer& mixer = flowsheet.addDevice<Mixer>(1);
+    mixer.addInput(feed);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+    flowsheet.setPublishing(true);
+
+    atomic<bool> done(false);
+    atomic<int> inconsistent(0);
+    atomic<uint64_t> lastEpoch(0);
+    thread reader([&]() {
+        vector<double> values;
+        uint64_t previous = 0;
+        while (!done.load()) {
+            uint64_t epoch = flowsheet.getSnapshot().read(values);
+            if (epoch < previous || values.size() != 4) ++inconsistent;
+            else if (values[1] != values[0] || values[2] != values[0] / 2 || values[3] != values[2]) ++inconsistent;
+            previous = epoch;
+        }
+        lastEpoch = previous;
+    });
+    for (int pass = 1; pass <= 20000; ++pass) {
+        feed->setMassFlow(pass);
+        flowsheet.solve();
+    }
+    done = true;
+    reader.join();
+
+    EXPECT_TRUE(inconsistent == 0);
+    EXPECT_TRUE(flowsheet.getSnapshot().epoch() == 20001);
+    EXPECT_TRUE(lastEpoch <= 20001);
+    EXPECT_NEAR(flowsheet.getSnapshot().get(product2->getId()), 10000.0, POSSIBLE_ERROR);
+}
+
+TEST(SnapshotTest, GrowsWithTheFlowsheet) {
+    Flowsheet flowsheet;
+    EXPECT_TRUE(flowsheet.getSnapshot().epoch() == 0);
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    feed->setMassFlow(1.5);
+    flowsheet.setPublishing(true);
+    EXPECT_NEAR(flowsheet.getSnapshot().get(feed->getId()), 1.5, POSSIBLE_ERROR);
+
+    shared_ptr<Stream> product = flowsheet.addStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+    EXPECT_NEAR(flowsheet.getSnapshot().get(product->getId()), 0.0, POSSIBLE_ERROR);
+    flowsheet.solveTape();
+
+    vector<double> values;
+    EXPECT_TRUE(flowsheet.getSnapshot().read(values) == 2);
+    EXPECT_TRUE(values.size() == 2);
+    EXPECT_NEAR(values[1], 1.5, POSSIBLE_ERROR);
+}
+
+TEST(MassBalanceTest, SolvedFlowsheetCloses) {
+    Flowsheet flowsheet;
+    buildParallelChains(flowsheet, 100);
+    flowsheet.solveTape();
+
+    BalanceReport report = flowsheet.checkMassBalance();
+    EXPECT_TRUE(report.ok());
+    EXPECT_TRUE(report.checked == 300);
+    EXPECT_TRUE(report.worst.size() == 5);
+    EXPECT_TRUE(report.maxResidual < 1e-12);
+}
+
+TEST(MassBalanceTest, ReportsWorstOffendersFirst) {
+    Flowsheet flowsheet;
+    vector<shared_ptr<Stream>> feeds;
+    for (int i = 1; i <= 3; ++i) {
+        shared_ptr<Stream> feed = flowsheet.addStream();
+        shared_ptr<Stream> product = flowsheet.addStream();
+        Doubler& doubler = flowsheet.addDevice<Doubler>();
+        doubler.addInput(feed);
+        doubler.addOutput(product);
+        feed->setMassFlow(i);
+    }
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(flowsheet.addStream());
+    reactor.addOutput(flowsheet.addStream());
+    flowsheet.solve();
+    flowsheet.addDevice<Mixer>(2);  // never wired, not checked
+
+    BalanceOptions options;
+    options.worstCount = 2;
+    BalanceReport report = flowsheet.checkMassBalance(options);
+    EXPECT_TRUE(report.checked == 4);
+    EXPECT_TRUE(report.violations == 3);
+    EXPECT_TRUE(report.worst.size() == 2);
+    EXPECT_TRUE(report.worst[0].device == 2);
+    EXPECT_NEAR(report.worst[0].residual, -3.0, 1e-12);
+    EXPECT_TRUE(report.worst[1].device == 1);
+    EXPECT_NEAR(report.maxResidual, 3.0, 1e-12);
+}
+
+TEST(MassBalanceTest, UsesTotalsInComponentMode) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> product1 = flowsheet.addStream();
+    shared_ptr<Stream> product2 = flowsheet.addStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(feed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+    flowsheet.setComponentCount(3);
+    feed->setComponentFlow(0, 1.0);
+    feed->setComponentFlow(2, 5.0);
+    flowsheet.solveComponents();
+    EXPECT_TRUE(flowsheet.checkMassBalance().ok());
+
+    product2->setComponentFlow(1, 0.5);
+    EXPECT_NEAR(flowsheet.checkMassBalance().worst[0].residual, -0.5, 1e-12);
+}
+
+TEST(IngestTest, BurstIsSolvedOnce) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> feed1 = flowsheet.addStream();
+    shared_ptr<Stream> feed2 = flowsheet.addStream();
+    shared_ptr<Stream> mixed = flowsheet.addStream();
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    flowsheet.solve();
+
+    IngestOptions options;
+    options.maxDelay = chrono::seconds(10);
+    SensorIngestor ingestor(flowsheet, options);
+    vector<thread> sensors;
+    for (int t = 0; t < 2; ++t) {
+        sensors.emplace_back([&ingestor, &feed1, &feed2, t]() {
+            for (int i = 1; i <= 500; ++i) ingestor.post(t == 0 ? *feed1 : *feed2, t == 0 ? i : 2.0 * i);
+        });
+    }
+    for (thread& sensor : sensors) sensor.join();
+    ingestor.flush();
+
+    IngestStats stats = ingestor.getStats();
+    EXPECT_TRUE(stats.readings == 1000);
+    EXPECT_TRUE(stats.batches == 1);
+    EXPECT_TRUE(stats.devices == 1);
+    EXPECT_NEAR(mixed->getMassFlow(), 1500.0, POSSIBLE_ERROR);
+}
+
+TEST(IngestTest, LargeBurstsAreSplitAtMaxBatch) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+    flowsheet.setPublishing(true);
+
+    IngestOptions options;
+    options.maxDelay = chrono::seconds(10);
+    options.maxBatch = 100;
+    {
+        SensorIngestor ingestor(flowsheet, options);
+        for (int i = 1; i <= 250; ++i) ingestor.post(*feed, i);
+        ingestor.flush();
+        IngestStats stats = ingestor.getStats();
+        EXPECT_TRUE(stats.batches >= 1 && stats.batches <= 3);
+        ingestor.post(*feed, 7.0);
+    }
+    EXPECT_NEAR(flowsheet.getSnapshot().get(product->getId()), 7.0, POSSIBLE_ERROR);
+}
+
+TEST(IngestTest, SolveErrorsSurfaceOnFlush) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> recycle;
+    buildRecycleLoop(flowsheet, recycle);
+    SensorIngestor ingestor(flowsheet);
+    ingestor.post(*recycle, 1.0);
+    EXPECT_THROW(ingestor.flush(), string);
+    ingestor.flush();
+}
+
+TEST(LinearSolveTest, RecycleLoopIsSolvedDirectly) {
+    Flowsheet direct;
+    Flowsheet iterative;
+    shared_ptr<Stream> recycle1, recycle2;
+    shared_ptr<Stream> product = buildRecycleLoop(direct, recycle1);
+    shared_ptr<Stream> expected = buildRecycleLoop(iterative, recycle2);
+
+    EXPECT_TRUE(direct.canSolveDirectly());
+    RecycleResult result = direct.solveLinear();
+    EXPECT_TRUE(result.converged && result.iterations == 0);
+    RecycleOptions tight;
+    tight.tolerance = 1e-12;
+    iterative.converge(tight);
+    EXPECT_NEAR(product->getMassFlow(), 10.0, 1e-9);
+    EXPECT_NEAR(recycle1->getMassFlow(), recycle2->getMassFlow(), 1e-9);
+    EXPECT_NEAR(product->getMassFlow(), expected->getMassFlow(), 1e-9);
+
+    direct.getStore().setMassFlow(0, 3.0);
+    direct.solveLinear();
+    EXPECT_NEAR(product->getMassFlow(), 3.0, 1e-12);
+    EXPECT_NEAR(recycle1->getMassFlow(), 3.0, 1e-12);
+}
+
+TEST(LinearSolveTest, MatchesSerialSolveWithoutRecycles) {
+    Flowsheet direct;
+    Flowsheet serial;
+    vector<shared_ptr<Stream>> actual = buildParallelChains(direct, 50);
+    vector<shared_ptr<Stream>> expected = buildParallelChains(serial, 50);
+    direct.solveLinear();
+    serial.solve();
+    for (size_t i = 0; i < actual.size(); ++i) {
+        EXPECT_NEAR(actual[i]->getMassFlow(), expected[i]->getMassFlow(), 1e-12);
+    }
+}
+
+TEST(LinearSolveTest, FallsBackToIteration) {
+    Flowsheet nonlinear;
+    shared_ptr<Stream> feed = nonlinear.addStream();
+    shared_ptr<Stream> product = nonlinear.addStream();
+    Doubler& doubler = nonlinear.addDevice<Doubler>();
+    doubler.addInput(feed);
+    doubler.addOutput(product);
+    feed->setMassFlow(2.0);
+    EXPECT_FALSE(nonlinear.canSolveDirectly());
+    EXPECT_TRUE(nonlinear.solveLinear().iterations == 1);
+    EXPECT_NEAR(product->getMassFlow(), 4.0, POSSIBLE_ERROR);
+
+    // A loop that returns all of its mass never settles: I - M is singular
+    Flowsheet closed;
+    shared_ptr<Stream> inlet = closed.addStream();
+    shared_ptr<Stream> mixed = closed.addStream();
+    shared_ptr<Stream> back = closed.addStream();
+    Mixer& mixer = closed.addDevice<Mixer>(2);
+    mixer.addInput(inlet);
+    mixer.addInput(back);
+    mixer.addOutput(mixed);
+    Reactor& reactor = closed.addDevice<Reactor>(false);
+    reactor.addInput(mixed);
+    reactor.addOutput(back);
+    EXPECT_FALSE(closed.canSolveDirectly());
+}
+
+TEST(SplitterTest, SharesFeedAcrossAllSolvePaths) {
+    for (int path = 0; path < 4; ++path) {
+        Flowsheet flowsheet;
+        shared_ptr<Stream> feed = flowsheet.addStream();
+        Splitter& splitter = flowsheet.addDevice<Splitter>(initializer_list<double>{0.2, 0.3, 0.5});
+        splitter.addInput(feed);
+        vector<shared_ptr<Stream>> products;
+        for (int i = 0; i < 3; ++i) {
+            products.push_back(flowsheet.addStream());
+            splitter.addOutput(products.back());
+        }
+        feed->setMassFlow(10.0);
+        if (path == 0) flowsheet.solve();
+        if (path == 1) flowsheet.solveTape();
+        if (path == 3) EXPECT_TRUE(flowsheet.solveLinear().iterations == 0);
+        if (path == 2) {
+            flowsheet.setScenarioCount(5);
+            for (size_t lane = 0; lane < 5; ++lane) feed->setLane(lane, 10.0 * (lane + 1));
+            flowsheet.solveBatch();
+            for (size_t lane = 0; lane < 5; ++lane) {
+                EXPECT_NEAR(products[0]->getLane(lane), 2.0 * (lane + 1), 1e-12);
+                EXPECT_NEAR(products[2]->getLane(lane), 5.0 * (lane + 1), 1e-12);
+            }
+            continue;
+        }
+        EXPECT_NEAR(products[0]->getMassFlow(), 2.0, 1e-12);
+        EXPECT_NEAR(products[1]->getMassFlow(), 3.0, 1e-12);
+        EXPECT_NEAR(products[2]->getMassFlow(), 5.0, 1e-12);
+    }
+}
+
+TEST(SplitterTest, RejectsBadFractions) {
+    EXPECT_THROW(Splitter(vector<double>{0.5, 0.6}), string);
+    EXPECT_THROW(Splitter(vector<double>{1.5, -0.5}), string);
+    EXPECT_THROW(Splitter(vector<double>()), string);
+
+    Flowsheet flowsheet;
+    Splitter& splitter = flowsheet.addDevice<Splitter>(vector<double>{0.5, 0.5});
+    splitter.addOutput(flowsheet.addStream());
+    splitter.addOutput(flowsheet.addStream());
+    EXPECT_THROW(splitter.addOutput(flowsheet.addStream()), const char*);
+}
+
+TEST(SmallVectorTest, SpillsToHeapPastInlineCapacity) {
+    SmallVector<StreamId, 4> values;
+    for (StreamId i = 0; i < 4; ++i) values.push_back(i);
+    EXPECT_TRUE(values.isInline());
+    SmallVector<StreamId, 4> inlineCopy(values);
+    values.push_back(4);
+    EXPECT_FALSE(values.isInline());
+    EXPECT_TRUE(values.size() == 5u);
+    EXPECT_TRUE(values[4] == 4u);
+
+    SmallVector<StreamId, 4> heapCopy(values);
+    SmallVector<StreamId, 4> moved(std::move(values));
+    EXPECT_TRUE(heapCopy.size() == 5u);
+    EXPECT_TRUE(moved.size() == 5u);
+    EXPECT_TRUE(moved[3] == 3u);
+    EXPECT_TRUE(inlineCopy.isInline() && inlineCopy.size() == 4u);
+    inlineCopy = moved;
+    EXPECT_TRUE(inlineCopy[4] == 4u);
+}
+
+TEST(SmallVectorTest, DevicePortsStayInline) {
+    Flowsheet flowsheet;
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2, 2);
+    shared_ptr<Stream> left = flowsheet.addStream();
+    shared_ptr<Stream> right = flowsheet.addStream();
+    shared_ptr<Stream> first = flowsheet.addStream();
+    shared_ptr<Stream> second = flowsheet.addStream();
+    mixer.addInput(left);
+    mixer.addInput(right);
+    mixer.addOutput(first);
+    mixer.addOutput(second);
+    EXPECT_TRUE(mixer.getInputs().isInline() && mixer.getOutputs().isInline());
+    left->setMassFlow(3.0);
+    right->setMassFlow(5.0);
+    flowsheet.solve();
+    EXPECT_NEAR(first->getMassFlow(), 4.0, POSSIBLE_ERROR);
+    EXPECT_NEAR(second->getMassFlow(), 4.0, POSSIBLE_ERROR);
+}
+
+TEST(StreamHandleTest, DevicesWireByReference) {
+    Flowsheet flowsheet;
+    Stream& feed = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+    feed.setMassFlow(4.0);
+    flowsheet.solve();
+    EXPECT_NEAR(product.getMassFlow(), 4.0, POSSIBLE_ERROR);
+    EXPECT_TRUE(flowsheet.streamCount() == 2u);
+}
+
+TEST(StreamHandleTest, SharedHandlesAreNotRetained) {
+    Flowsheet flowsheet;
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    shared_ptr<Stream> legacy = flowsheet.addStream();
+    // All handles of a flowsheet share the arena's count
+    long before = feed.use_count();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+    reactor.addOutput(std::move(legacy));
+    EXPECT_TRUE(feed.use_count() == before);
+    EXPECT_TRUE(reactor.getOutputs().size() == 2u);
+    EXPECT_THROW(reactor.addOutput(flowsheet.createStream()), const char*);
+}
+
+TEST(StreamHandleTest, ReferencesSurviveMerge) {
+    Flowsheet target;
+    Stream& kept = target.createStream();
+    Stream* moved = nullptr;
+    {
+        Flowsheet part;
+        Stream& feed = part.createStream();
+        Stream& product = part.createStream();
+        moved = &product;
+        Reactor& reactor = part.addDevice<Reactor>(false);
+        reactor.addInput(feed);
+        reactor.addOutput(product);
+        feed.setMassFlow(7.0);
+        target.merge(part);
+    }
+    kept.setMassFlow(1.0);
+    target.solve();
+    EXPECT_NEAR(moved->getMassFlow(), 7.0, POSSIBLE_ERROR);
+    EXPECT_TRUE(&moved->getStore() == &target.getStore());
+}
+
+TEST(TapeOptimizerTest, FusesTreesAndSkipsPassThroughs) {
+    Flowsheet optimized;
+    Flowsheet reference;
+    Flowsheet* sheets[] = {&optimized, &reference};
+    vector<Stream*> products;
+    for (Flowsheet* sheet : sheets) {
+        Stream& feed1 = sheet->createStream();
+        Stream& feed2 = sheet->createStream();
+        Stream& feed3 = sheet->createStream();
+        Stream& inner = sheet->createStream();
+        Stream& outer = sheet->createStream();
+        Stream& passed = sheet->createStream();
+        Stream& spare = sheet->createStream();
+        Stream& product = sheet->createStream();
+        Mixer& first = sheet->addDevice<Mixer>(2);
+        first.addInput(feed1);
+        first.addInput(feed2);
+        first.addOutput(inner);
+        Mixer& second = sheet->addDevice<Mixer>(2);
+        second.addInput(inner);
+        second.addInput(feed3);
+        second.addOutput(outer);
+        Reactor& copy = sheet->addDevice<Reactor>(false);
+        copy.addInput(outer);
+        copy.addOutput(passed);
+        Splitter& splitter = sheet->addDevice<Splitter>(initializer_list<double>{0.25, 0.75});
+        splitter.addInput(passed);
+        splitter.addOutput(spare);
+        splitter.addOutput(product);
+        feed1.setMassFlow(1.0);
+        feed2.setMassFlow(2.0);
+        feed3.setMassFlow(5.0);
+        products.push_back(&spare);
+        products.push_back(&product);
+    }
+    optimized.setOptimizing(true);
+    optimized.solveTape();
+    reference.solveTape();
+    EXPECT_TRUE(optimized.getTape().size() < reference.getTape().size());
+    EXPECT_TRUE(optimized.getTape().size() == 3u);
+    EXPECT_NEAR(products[0]->getMassFlow(), products[2]->getMassFlow(), 1e-12);
+    EXPECT_NEAR(products[1]->getMassFlow(), products[3]->getMassFlow(), 1e-12);
+    EXPECT_NEAR(products[1]->getMassFlow(), 6.0, 1e-12);
+}
+
+TEST(TapeOptimizerTest, PinsAndFoldsConstants) {
+    Flowsheet flowsheet;
+    Stream& feed = flowsheet.createStream();
+    Stream& fixed = flowsheet.createStream();
+    Stream& mixed = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed);
+    mixer.addInput(fixed);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(mixed);
+    reactor.addOutput(product);
+    feed.setMassFlow(1.0);
+    fixed.setMassFlow(10.0);
+    flowsheet.setOptimizing(true);
+    flowsheet.markConstant(fixed);
+    flowsheet.solveTape();
+    EXPECT_NEAR(product.getMassFlow(), 11.0, 1e-12);
+
+    const FlowsheetTape& tape = flowsheet.getTape();
+    EXPECT_TRUE(tape.size() == 1u && tape.instructions()[0].count == 1u);
+    EXPECT_NEAR(tape.instructions()[0].bias, 10.0, 1e-12);
+
+    // The folded value is kept even if the feed changes
+    fixed.setMassFlow(20.0);
+    feed.setMassFlow(3.0);
+    flowsheet.solveTape();
+    EXPECT_NEAR(product.getMassFlow(), 13.0, 1e-12);
+
+    // Pinning rebuilds the tape, which folds the feed's new value
+    flowsheet.pinStream(mixed);
+    flowsheet.solveTape();
+    EXPECT_TRUE(flowsheet.getTape().size() == 2u);
+    EXPECT_NEAR(mixed.getMassFlow(), 23.0, 1e-12);
+    EXPECT_NEAR(product.getMassFlow(), 23.0, 1e-12);
+}
+
+TEST(TapeOptimizerTest, PartialPassesAreNotPublished) {
+    Flowsheet flowsheet;
+    Stream& feed = flowsheet.createStream();
+    Stream& mixed = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Reactor& first = flowsheet.addDevice<Reactor>(false);
+    first.addInput(feed);
+    first.addOutput(mixed);
+    Reactor& second = flowsheet.addDevice<Reactor>(false);
+    second.addInput(mixed);
+    second.addOutput(product);
+    feed.setMassFlow(2.0);
+    flowsheet.solve();
+    flowsheet.setPublishing(true);
+
+    flowsheet.setOptimizing(true);
+    feed.setMassFlow(5.0);
+    flowsheet.solveTape();
+    EXPECT_NEAR(product.getMassFlow(), 5.0, 1e-12);
+    EXPECT_NEAR(mixed.getMassFlow(), 2.0, 1e-12);
+    EXPECT_NEAR(flowsheet.getSnapshot().get(product.getId()), 2.0, 1e-12);
+    EXPECT_FALSE(flowsheet.checkMassBalance().ok());
+
+    flowsheet.pinStream(mixed);
+    flowsheet.solveTape();
+    EXPECT_NEAR(flowsheet.getSnapshot().get(product.getId()), 2.0, 1e-12);
+    EXPECT_TRUE(flowsheet.checkMassBalance().ok());
+
+    flowsheet.solve();
+    EXPECT_NEAR(flowsheet.getSnapshot().get(product.getId()), 5.0, 1e-12);
+}
+
+TEST(TapeOptimizerTest, KeepsInputsOfCalls) {
+    Flowsheet flowsheet;
+    Stream& feed = flowsheet.createStream();
+    Stream& passed = flowsheet.createStream();
+    Stream& doubled = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Reactor& copy = flowsheet.addDevice<Reactor>(false);
+    copy.addInput(feed);
+    copy.addOutput(passed);
+    Doubler& doubler = flowsheet.addDevice<Doubler>();
+    doubler.addInput(passed);
+    doubler.addOutput(doubled);
+    Reactor& last = flowsheet.addDevice<Reactor>(false);
+    last.addInput(doubled);
+    last.addOutput(product);
+    feed.setMassFlow(4.0);
+    flowsheet.setOptimizing(true);
+    flowsheet.solveTape();
+    EXPECT_NEAR(passed.getMassFlow(), 4.0, 1e-12);
+    EXPECT_NEAR(product.getMassFlow(), 8.0, 1e-12);
+
+    // Optimized passes leave intermediates stale, so the next incremental solve is a full one
+    EXPECT_TRUE(flowsheet.solveIncremental() == 3u);
+}
+
+TEST(SnapshotTest, RoundTripRestoresGraphAndValues) {
+    const string path = "test_snapshot_roundtrip.bin";
+    Flowsheet original;
+    Stream& feed1 = original.createStream();
+    Stream& feed2 = original.createStream();
+    Stream& mixed = original.createStream();
+    Stream& reacted = original.createStream();
+    Stream& product1 = original.createStream();
+    Stream& product2 = original.createStream();
+    Mixer& mixer = original.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    Reactor& reactor = original.addDevice<Reactor>(false);
+    reactor.addInput(mixed);
+    reactor.addOutput(reacted);
+    Splitter& splitter = original.addDevice<Splitter>(initializer_list<double>{0.4, 0.6});
+    splitter.addInput(reacted);
+    splitter.addOutput(product1);
+    splitter.addOutput(product2);
+    feed1.setMassFlow(3.0);
+    feed2.setMassFlow(7.0);
+    original.solve();
+    original.saveSnapshot(path);
+
+    Flowsheet loaded;
+    loaded.loadSnapshot(path);
+    remove(path.c_str());
+    EXPECT_TRUE(loaded.deviceCount() == 3u && loaded.streamCount() == 6u);
+    for (StreamId id = 0; id < 6; ++id) {
+        EXPECT_NEAR(loaded.getStore().getMassFlow(id), original.getStore().getMassFlow(id), 0.0);
+        EXPECT_TRUE(loaded.getStore().getName(id) == original.getStore().getName(id));
+    }
+
+    Stream& loadedFeed = loaded.createHandle(feed1.getId());
+    loadedFeed.setMassFlow(13.0);
+    loaded.solve();
+    EXPECT_NEAR(loaded.getStore().getMassFlow(product1.getId()), 8.0, 1e-12);
+    EXPECT_NEAR(loaded.getStore().getMassFlow(product2.getId()), 12.0, 1e-12);
+    EXPECT_TRUE(loaded.addStream()->getName() != loaded.getStore().getName(5));
+    EXPECT_THROW(loaded.createHandle(100), string);
+}
+
+TEST(SnapshotTest, RejectsBadInput) {
+    const string path = "test_snapshot_rejects.bin";
+    Flowsheet custom;
+    Doubler& doubler = custom.addDevice<Doubler>();
+    doubler.addInput(custom.createStream());
+    doubler.addOutput(custom.createStream());
+    EXPECT_THROW(custom.saveSnapshot(path), string);
+
+    Flowsheet missing;
+    EXPECT_THROW(missing.loadSnapshot("no_such_snapshot.bin"), string);
+
+    Flowsheet plain;
+    Reactor& reactor = plain.addDevice<Reactor>(true);
+    reactor.addInput(plain.createStream());
+    reactor.addOutput(plain.createStream());
+    reactor.addOutput(plain.createStream());
+    plain.saveSnapshot(path);
+    EXPECT_THROW(plain.loadSnapshot(path), string);
+
+    // Drop the last byte: the section sizes no longer add up
+    FILE* file = fopen(path.c_str(), "rb");
+    vector<char> bytes(4096);
+    bytes.resize(fread(bytes.data(), 1, bytes.size(), file));
+    fclose(file);
+    file = fopen(path.c_str(), "wb");
+    fwrite(bytes.data(), 1, bytes.size() - 1, file);
+    fclose(file);
+    Flowsheet truncated;
+    EXPECT_THROW(truncated.loadSnapshot(path), string);
+    EXPECT_TRUE(truncated.streamCount() == 0u && truncated.deviceCount() == 0u);
+
+    bytes[0] = 'X';
+    file = fopen(path.c_str(), "wb");
+    fwrite(bytes.data(), 1, bytes.size(), file);
+    fclose(file);
+    Flowsheet foreign;
+    EXPECT_THROW(foreign.loadSnapshot(path), string);
+    remove(path.c_str());
+}
+
+string readExport(const string& path) {
+    string contents;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return contents;
+    char chunk[4096];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0) contents.append(chunk, got);
+    fclose(file);
+    remove(path.c_str());
+    return contents;
+}
+
+TEST(ExportTest, WritesCsvRows) {
+    const string path = "test_export_rows.csv";
+    StreamStore store;
+    store.add(1);
+    store.add(42);
+    store.add(7);
+    store.setMassFlow(0, 1.5);
+    store.setMassFlow(1, 0.1);
+    store.setMassFlow(2, -2.0);
+    store.setName(2, "feed, \"east\"");
+    ResultExporter::write(store, path);
+    EXPECT_TRUE(readExport(path) == "name,mass_flow\ns1,1.5\ns42,0.10000000000000001\n\"feed, \"\"east\"\"\",-2\n");
+}
+
+TEST(ExportTest, WritesColumnarFile) {
+    const string path = "test_export_columns.bin";
+    Flowsheet flowsheet;
+    vector<shared_ptr<Stream>> streams = buildParallelChains(flowsheet, 3);
+    flowsheet.solve();
+    flowsheet.getStore().setName(1, "product");
+    ResultExporter::write(flowsheet.getStore(), path, ExportFormat::Columnar);
+    string bytes = readExport(path);
+
+    ColumnarHeader header;
+    memcpy(&header, bytes.data(), sizeof(header));
+    size_t rows = flowsheet.streamCount();
+    EXPECT_TRUE(memcmp(header.magic, "FLOWCOLS", 8) == 0 && header.rows == rows);
+    size_t offsetsAt = sizeof(header) + rows * sizeof(double);
+    size_t namesAt = offsetsAt + (rows + 1) * sizeof(uint64_t);
+    EXPECT_TRUE(bytes.size() == namesAt + snapshotAlign((size_t)header.nameBytes));
+    for (size_t i = 0; i < rows; ++i) {
+        double flow;
+        uint64_t range[2];
+        memcpy(&flow, bytes.data() + sizeof(header) + i * sizeof(double), sizeof(flow));
+        memcpy(range, bytes.data() + offsetsAt + i * sizeof(uint64_t), sizeof(range));
+        string name = bytes.substr(namesAt + (size_t)range[0], (size_t)(range[1] - range[0]));
+        EXPECT_NEAR(flow, flowsheet.getStore().getMassFlow((StreamId)i), 0.0);
+        EXPECT_TRUE(name == flowsheet.getStore().getName((StreamId)i));
+    }
+}
+
+TEST(ExportTest, AsyncWriteKeepsValuesOfTheCall) {
+    const string path = "test_export_async.csv";
+    Flowsheet flowsheet;
+    shared_ptr<Stream> feed = flowsheet.addStream();
+    shared_ptr<Stream> product = flowsheet.addStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(feed);
+    reactor.addOutput(product);
+    feed->setMassFlow(2.0);
+    flowsheet.solve();
+
+    ResultExporter exporter;
+    exporter.writeAsync(flowsheet.getStore(), path);
+    feed->setMassFlow(5.0);
+    flowsheet.solve();
+    exporter.wait();
+    EXPECT_TRUE(readExport(path) == "name,mass_flow\n" + feed->getName() + ",2\n" + product->getName() + ",2\n");
+
+    exporter.writeAsync(flowsheet.getStore(), "no_such_directory/results.csv");
+    EXPECT_THROW(exporter.wait(), string);
+    exporter.wait();
+}
+
+TEST(SweepTest, StatisticsMatchSerialSolves) {
+    Flowsheet flowsheet;
+    Stream& feed = flowsheet.createStream();
+    Stream& product1 = flowsheet.createStream();
+    Stream& product2 = flowsheet.createStream();
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(feed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+
+    const size_t scenarios = 1001;
+    SweepOptions options;
+    options.threads = 4;
+    options.batch = 7;
+    SweepRunner runner(flowsheet, vector<StreamId>(), options);
+    EXPECT_TRUE(runner.getOutlets().size() == 2u && runner.getOutlets()[0] == product1.getId());
+    SweepResult result = runner.run(scenarios, [&](size_t k, SweepScenario& scenario) {
+        scenario.setMassFlow(feed, 2.0 * k);
+    });
+
+    // product1 takes the values 0, 1, ..., 1000
+    EXPECT_TRUE(result.scenarios == scenarios && result.outlets.size() == 2u);
+    const OutletStats& stats = result.outlets[0];
+    EXPECT_TRUE(stats.count == scenarios);
+    EXPECT_NEAR(stats.mean, 500.0, 1e-9);
+    EXPECT_NEAR(stats.variance, 1001.0 * 1002.0 / 12.0, 1e-6);
+    EXPECT_NEAR(stats.min, 0.0, 0.0);
+    EXPECT_NEAR(stats.max, 1000.0, 0.0);
+    EXPECT_TRUE(stats.quantiles.size() == 3u);
+    EXPECT_NEAR(stats.quantiles[0], 50.0, 15.0);
+    EXPECT_NEAR(stats.quantiles[1], 500.0, 15.0);
+    EXPECT_NEAR(stats.quantiles[2], 950.0, 15.0);
+    // The flowsheet itself is untouched
+    EXPECT_NEAR(feed.getMassFlow(), 0.0, 0.0);
+}
+
+TEST(SweepTest, SplitFractionsApplyToOneScenario) {
+    Flowsheet flowsheet;
+    Stream& feed = flowsheet.createStream();
+    Stream& product1 = flowsheet.createStream();
+    Stream& product2 = flowsheet.createStream();
+    Splitter& splitter = flowsheet.addDevice<Splitter>(initializer_list<double>{0.5, 0.5});
+    splitter.addInput(feed);
+    splitter.addOutput(product1);
+    splitter.addOutput(product2);
+    feed.setMassFlow(10.0);
+
+    SweepOptions options;
+    options.threads = 1;
+    SweepRunner runner(flowsheet, vector<StreamId>{product1.getId()}, options);
+    SweepResult result = runner.run(100, [&](size_t k, SweepScenario& scenario) {
+        if (k % 2 == 0) scenario.setFractions(splitter, {0.9, 0.1});
+    });
+    EXPECT_NEAR(result.outlets[0].mean, 7.0, 1e-9);
+    EXPECT_NEAR(result.outlets[0].min, 5.0, 1e-12);
+    EXPECT_NEAR(result.outlets[0].max, 9.0, 1e-12);
+
+    EXPECT_THROW(runner.run(1, [&](size_t, SweepScenario& scenario) { scenario.setFractions(splitter, {1.0}); }), string);
+    Reactor& copy = flowsheet.addDevice<Reactor>(false);
+    copy.addInput(product2);
+    copy.addOutput(flowsheet.createStream());
+    SweepRunner rebuilt(flowsheet);
+    EXPECT_THROW(rebuilt.run(1, [&](size_t, SweepScenario& scenario) { scenario.setFractions(copy, {1.0}); }), string);
+}
+
+TEST(SweepTest, RejectsCallsAndSurfacesGeneratorErrors) {
+    Flowsheet custom;
+    Doubler& doubler = custom.addDevice<Doubler>();
+    doubler.addInput(custom.createStream());
+    doubler.addOutput(custom.createStream());
+    EXPECT_THROW(SweepRunner runner(custom), string);
+
+    Flowsheet flowsheet;
+    buildParallelChains(flowsheet, 4);
+    SweepOptions options;
+    options.threads = 3;
+    options.batch = 2;
+    SweepRunner runner(flowsheet, vector<StreamId>(), options);
+    EXPECT_THROW(runner.run(50, [](size_t k, SweepScenario&) {
+        if (k == 17) throw string("bad scenario");
+    }), string);
+    EXPECT_TRUE(runner.run(0, [](size_t, SweepScenario&) {}).outlets[0].count == 0u);
+}
+
+TEST(SweepTest, QuantileEstimatorTracksShuffledData) {
+    QuantileEstimator median(0.5);
+    QuantileEstimator upper(0.9);
+    EXPECT_NEAR(median.value(), 0.0, 0.0);
+    for (uint32_t i = 0; i < 10000; ++i) {
+        double x = (double)((i * 7919u) % 10000u);
+        median.add(x);
+        upper.add(x);
+    }
+    EXPECT_NEAR(median.value(), 5000.0, 100.0);
+    EXPECT_NEAR(upper.value(), 9000.0, 100.0);
+
+    QuantileEstimator small(0.5);
+    small.add(3.0);
+    small.add(1.0);
+    small.add(2.0);
+    EXPECT_NEAR(small.value(), 2.0, 0.0);
+}
+
+TEST(MemoTest, HitsRestoreProducedStreams) {
+    Flowsheet flowsheet;
+    Stream& feed1 = flowsheet.createStream();
+    Stream& feed2 = flowsheet.createStream();
+    Stream& mixed = flowsheet.createStream();
+    Stream& product1 = flowsheet.createStream();
+    Stream& product2 = flowsheet.createStream();
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+    flowsheet.setMemoCapacity(4);
+
+    feed1.setMassFlow(2.0);
+    feed2.setMassFlow(4.0);
+    EXPECT_FALSE(flowsheet.solveCached());
+    feed1.setMassFlow(10.0);
+    EXPECT_FALSE(flowsheet.solveCached());
+    EXPECT_NEAR(product1.getMassFlow(), 7.0, 1e-12);
+
+    feed1.setMassFlow(2.0);
+    EXPECT_TRUE(flowsheet.solveCached());
+    EXPECT_NEAR(mixed.getMassFlow(), 6.0, 1e-12);
+    EXPECT_NEAR(product2.getMassFlow(), 3.0, 1e-12);
+    EXPECT_FALSE(flowsheet.getStore().isDirty(product2.getId()));
+
+    // Closer than POSSIBLE_ERROR shares the entry
+    feed1.setMassFlow(2.004);
+    EXPECT_TRUE(flowsheet.solveCached());
+    EXPECT_NEAR(product2.getMassFlow(), 3.0, 1e-12);
+    feed1.setMassFlow(2.02);
+    EXPECT_FALSE(flowsheet.solveCached());
+
+    MemoStats stats = flowsheet.getMemoStats();
+    EXPECT_TRUE(stats.hits == 2u && stats.misses == 3u && stats.entries == 3u && stats.evictions == 0u);
+}
+
+TEST(MemoTest, EvictsLeastRecentlyUsed) {
+    Flowsheet flowsheet;
+    vector<shared_ptr<Stream>> products = buildParallelChains(flowsheet, 2);
+    StreamStore& store = flowsheet.getStore();
+    flowsheet.setMemoCapacity(2);
+    // 1.0 is used again before 3.0 arrives, so 2.0 is the one evicted
+    const double feeds[] = {1.0, 2.0, 1.0, 3.0, 2.0, 3.0};
+    const bool hits[] = {false, false, true, false, false, true};
+    for (size_t i = 0; i < 6; ++i) {
+        store.setMassFlow(0, feeds[i]);
+        EXPECT_TRUE(flowsheet.solveCached() == hits[i]);
+    }
+    MemoStats stats = flowsheet.getMemoStats();
+    EXPECT_TRUE(stats.entries == 2u && stats.evictions == 2u);
+
+    // Rewiring empties the cache
+    Reactor& extra = flowsheet.addDevice<Reactor>(false);
+    extra.addInput(flowsheet.createStream());
+    extra.addOutput(flowsheet.createStream());
+    EXPECT_FALSE(flowsheet.solveCached());
+    EXPECT_TRUE(flowsheet.getMemoStats().entries == 1u);
+
+    flowsheet.setMemoCapacity(0);
+    EXPECT_FALSE(flowsheet.solveCached());
+    EXPECT_TRUE(flowsheet.getMemoStats().entries == 0u && flowsheet.getMemoStats().misses == 5u);
+}
+
+TEST(TangentTest, JacobianMatchesFiniteDifferences) {
+    Flowsheet flowsheet;
+    vector<Stream*> feeds;
+    for (int i = 0; i < 3; ++i) feeds.push_back(&flowsheet.createStream());
+    Stream& mixed = flowsheet.createStream();
+    Stream& product1 = flowsheet.createStream();
+    Stream& product2 = flowsheet.createStream();
+    vector<Stream*> split;
+    for (int i = 0; i < 3; ++i) split.push_back(&flowsheet.createStream());
+    Mixer& mixer = flowsheet.addDevice<Mixer>(3);
+    for (Stream* feed : feeds) mixer.addInput(*feed);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(true);
+    reactor.addInput(mixed);
+    reactor.addOutput(product1);
+    reactor.addOutput(product2);
+    Splitter& splitter = flowsheet.addDevice<Splitter>(initializer_list<double>{0.1, 0.3, 0.6});
+    splitter.addInput(product1);
+    for (Stream* stream : split) splitter.addOutput(*stream);
+
+    for (int i = 0; i < 3; ++i) feeds[i]->setMassFlow(1.0 + i);
+    vector<StreamId> outlets = {product2.getId(), split[0]->getId(), split[1]->getId(), split[2]->getId()};
+    vector<StreamId> inlets = {feeds[0]->getId(), feeds[1]->getId(), feeds[2]->getId()};
+    vector<double> jacobian = flowsheet.jacobian(outlets, inlets);
+    EXPECT_TRUE(jacobian.size() == 12u);
+
+    StreamStore& store = flowsheet.getStore();
+    const double step = 1e-4;
+    flowsheet.solve();
+    vector<double> base;
+    for (StreamId outlet : outlets) base.push_back(store.getMassFlow(outlet));
+    for (size_t j = 0; j < inlets.size(); ++j) {
+        double flow = store.getMassFlow(inlets[j]);
+        store.setMassFlow(inlets[j], flow + step);
+        flowsheet.solve();
+        for (size_t i = 0; i < outlets.size(); ++i) {
+            EXPECT_NEAR(jacobian[i * inlets.size() + j], (store.getMassFlow(outlets[i]) - base[i]) / step, 1e-6);
+        }
+        store.setMassFlow(inlets[j], flow);
+    }
+    EXPECT_NEAR(jacobian[2 * inlets.size()], 0.15, 1e-12);
+    EXPECT_TRUE(store.tangents() == 0u);
+}
+
+TEST(TangentTest, ValuesAndTangentsShareOnePass) {
+    Flowsheet flowsheet;
+    Stream& feed1 = flowsheet.createStream();
+    Stream& feed2 = flowsheet.createStream();
+    Stream& mixed = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Mixer& mixer = flowsheet.addDevice<Mixer>(2);
+    mixer.addInput(feed1);
+    mixer.addInput(feed2);
+    mixer.addOutput(mixed);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(mixed);
+    reactor.addOutput(product);
+
+    EXPECT_THROW(flowsheet.solveTangents(), string);
+    // Five directions pad to two registers; the padding stays zero
+    flowsheet.setTangentDirections(5);
+    StreamStore& store = flowsheet.getStore();
+    feed1.setMassFlow(3.0);
+    feed2.setMassFlow(4.0);
+    for (size_t k = 0; k < 5; ++k) {
+        store.tangentValues(feed1.getId())[k] = (double)k;
+        store.tangentValues(feed2.getId())[k] = 10.0;
+    }
+    flowsheet.solveTangents();
+    EXPECT_NEAR(product.getMassFlow(), 7.0, 1e-12);
+    EXPECT_FALSE(store.isDirty(product.getId()));
+    for (size_t k = 0; k < 5; ++k) EXPECT_NEAR(store.tangentValues(product.getId())[k], 10.0 + k, 1e-12);
+    for (size_t k = 5; k < 8; ++k) EXPECT_NEAR(store.tangentValues(product.getId())[k], 0.0, 0.0);
+
+    // jacobian() reseeds its own directions and restores this layout afterwards
+    vector<double> jacobian = flowsheet.jacobian({product.getId()}, {feed2.getId()});
+    EXPECT_NEAR(jacobian[0], 1.0, 1e-12);
+    EXPECT_TRUE(store.tangents() == 5u);
+}
+
+TEST(TangentTest, RejectsDevicesWithoutRowKernels) {
+    Flowsheet flowsheet;
+    Stream& feed = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Doubler& doubler = flowsheet.addDevice<Doubler>();
+    doubler.addInput(feed);
+    doubler.addOutput(product);
+    EXPECT_THROW(flowsheet.jacobian({product.getId()}, {feed.getId()}), string);
+    EXPECT_TRUE(flowsheet.getStore().tangents() == 0u);
+
+    Flowsheet loop;
+    shared_ptr<Stream> recycle;
+    buildRecycleLoop(loop, recycle);
+    loop.setTangentDirections(1);
+    EXPECT_THROW(loop.solveTangents(), string);
+}
+
+TEST(PartitionTest, PlanKeepsIndependentTrainsWhole) {
+    Flowsheet flowsheet;
+    buildParallelChains(flowsheet, 4);
+    PartitionPlan plan = flowsheet.partition(4);
+    EXPECT_TRUE(plan.partitions.size() == 4u);
+    EXPECT_TRUE(plan.cutStreams.empty());
+    for (const vector<size_t>& part : plan.partitions) {
+        EXPECT_TRUE(part.size() == 3u);
+        // Each chain was added as three consecutive devices
+        EXPECT_TRUE(part[0] / 3 == part[1] / 3 && part[1] / 3 == part[2] / 3);
+    }
+
+    EXPECT_TRUE(flowsheet.partition(2).cutStreams.empty());
+    EXPECT_TRUE(flowsheet.partition(100).partitions.size() == 12u);
+    EXPECT_THROW(flowsheet.partition(0), string);
+}
+
+TEST_SERIAL(PartitionTest, MatchesSolveAcrossCutStreams) {
+    Flowsheet flowsheet;
+    Flowsheet reference;
+    Flowsheet* sheets[] = {&flowsheet, &reference};
+    for (Flowsheet* sheet : sheets) {
+        buildParallelChains(*sheet, 3);
+        // A mixer joining every train makes the partitions depend on each other
+        Mixer& join = sheet->addDevice<Mixer>(3);
+        for (StreamId product = 5; product < 18; product += 6) join.addInput(sheet->createHandle(product));
+        join.addOutput(sheet->createStream());
+    }
+    PartitionedSolver solver(flowsheet, 3);
+    EXPECT_TRUE(solver.getPlan().cutStreams.size() == 2u);
+
+    StreamStore& store = flowsheet.getStore();
+    for (int round = 0; round < 2; ++round) {
+        store.setMassFlow(0, 1.0 + round);
+        reference.getStore().setMassFlow(0, 1.0 + round);
+        RecycleResult result = solver.solve();
+        reference.solve();
+        EXPECT_TRUE(result.converged && result.iterations == 1u);
+        for (StreamId id = 0; id < store.size(); ++id) {
+            EXPECT_NEAR(store.getMassFlow(id), reference.getStore().getMassFlow(id), 1e-12);
+        }
+    }
+    EXPECT_FALSE(store.isDirty(18));
+}
+
+TEST_SERIAL(PartitionTest, ConvergesRecycleAcrossPartitions) {
+    Flowsheet flowsheet;
+    Flowsheet reference;
+    shared_ptr<Stream> recycle, referenceRecycle;
+    shared_ptr<Stream> product = buildRecycleLoop(flowsheet, recycle);
+    shared_ptr<Stream> expected = buildRecycleLoop(reference, referenceRecycle);
+    RecycleOptions options;
+    options.tolerance = 1e-9;
+    reference.converge(options);
+
+    PartitionedSolver solver(flowsheet, 2);
+    EXPECT_TRUE(solver.getPlan().cutStreams.size() == 2u);
+    RecycleResult result = solver.solve(options);
+    EXPECT_TRUE(result.converged);
+    EXPECT_NEAR(product->getMassFlow(), expected->getMassFlow(), 1e-8);
+    EXPECT_NEAR(recycle->getMassFlow(), referenceRecycle->getMassFlow(), 1e-8);
+}
+
+TEST_SERIAL(PartitionTest, SurfacesWorkerErrors) {
+    Flowsheet flowsheet;
+    Stream& feed = flowsheet.createStream();
+    Stream& middle = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    FailingDevice& failing = flowsheet.addDevice<FailingDevice>();
+    failing.addInput(feed);
+    failing.addOutput(middle);
+    Reactor& reactor = flowsheet.addDevice<Reactor>(false);
+    reactor.addInput(middle);
+    reactor.addOutput(product);
+
+    PartitionedSolver solver(flowsheet, 2);
+    EXPECT_THROW(solver.solve(), string);
+    // The workers stay in step after a failure
+    EXPECT_THROW(solver.solve(), string);
+
+    Reactor& extra = flowsheet.addDevice<Reactor>(false);
+    extra.addInput(flowsheet.createStream());
+    extra.addOutput(flowsheet.createStream());
+    EXPECT_THROW(solver.solve(), string);
+}
+
+TEST(FootprintTest, CategoriesTrackWhatTheyHold) {
+    Flowsheet flowsheet;
+    FootprintReport empty = flowsheet.footprint();
+    EXPECT_TRUE(empty.names == 0u && empty.ports == 0u && empty.schedules == 0u);
+
+    buildParallelChains(flowsheet, 50);
+    FootprintReport wired = flowsheet.footprint();
+    EXPECT_TRUE(wired.streams >= empty.streams + 300 * sizeof(double));
+    EXPECT_TRUE(wired.ports >= 50 * (sizeof(Mixer) + 2 * sizeof(Reactor)));
+    EXPECT_TRUE(wired.names == 0u && wired.caches == empty.caches);
+
+    // Ports beyond the inline four move to the heap
+    Mixer& wide = flowsheet.addDevice<Mixer>(6);
+    for (int i = 0; i < 6; ++i) wide.addInput(flowsheet.createStream());
+    wide.addOutput(flowsheet.createStream());
+    EXPECT_TRUE(flowsheet.footprint().ports >= wired.ports + sizeof(Mixer) + 6 * sizeof(StreamId));
+
+    flowsheet.getStore().setName(0, string("a feed name too long for the inline buffer"));
+    flowsheet.solveTape();
+    FootprintReport solved = flowsheet.footprint();
+    EXPECT_TRUE(solved.names > 40u);
+    EXPECT_TRUE(solved.schedules >= 151 * sizeof(Device*));
+    EXPECT_TRUE(solved.caches > wired.caches);
+    EXPECT_TRUE(solved.total() == solved.streams + solved.names + solved.ports + solved.schedules + solved.caches);
+
+    ostringstream line;
+    writeFootprint(line, solved);
+    EXPECT_TRUE(line.str().find("footprint streams=") == 0);
+    EXPECT_TRUE(line.str().find(" total=" + to_string(solved.total()) + "\n") != string::npos);
+}
+
+TEST(FootprintTest, MergeMovesDeviceBytes) {
+    shared_ptr<StreamIdAllocator> ids = make_shared<StreamIdAllocator>();
+    Flowsheet target(ids);
+    Flowsheet source(ids);
+    buildParallelChains(source, 4);
+    size_t ports = source.footprint().ports;
+    target.merge(source);
+    // Only the emptied device list's capacity stays behind
+    EXPECT_TRUE(source.footprint().ports <= 16 * sizeof(unique_ptr<Device>));
+    EXPECT_TRUE(target.footprint().ports >= ports - 16 * sizeof(unique_ptr<Device>));
+}
+
+TEST(SweepTest, CompactMatchesDoublePrecision) {
+    Flowsheet flowsheet;
+    buildParallelChains(flowsheet, 20);
+    auto perturb = [](size_t k, SweepScenario& scenario) {
+        scenario.setMassFlow(0, 100.0 + 0.37 * (double)k);
+        EXPECT_NEAR(scenario.getMassFlow(0), 100.0 + 0.37 * (double)k, 1e-4);
+    };
+    SweepOptions options;
+    options.threads = 2;
+    SweepResult exact = SweepRunner(flowsheet, vector<StreamId>(), options).run(500, perturb);
+    options.compact = true;
+    SweepResult compact = SweepRunner(flowsheet, vector<StreamId>(), options).run(500, perturb);
+    EXPECT_TRUE(exact.outlets.size() == compact.outlets.size());
+    for (size_t o = 0; o < exact.outlets.size(); ++o) {
+        EXPECT_NEAR(compact.outlets[o].mean, exact.outlets[o].mean, POSSIBLE_ERROR);
+        EXPECT_NEAR(compact.outlets[o].max, exact.outlets[o].max, POSSIBLE_ERROR);
+    }
+}
+
+TEST(TapeTest, CompactRunRejectsCalls) {
+    Flowsheet flowsheet;
+    Stream& feed = flowsheet.createStream();
+    Stream& product = flowsheet.createStream();
+    Doubler& doubler = flowsheet.addDevice<Doubler>();
+    doubler.addInput(feed);
+    doubler.addOutput(product);
+    vector<float> values(flowsheet.getStore().size(), 1.0f);
+    EXPECT_THROW(flowsheet.getTape().run(values.data()), string);
+}
+
+// ==================== MAIN ====================
+
+int main(int argc, char **argv) {
+    cout << "Chemical Process Simulation - Google Tests" << endl;
+    cout << "==========================================" << endl;
+
+    // Usage: test_runner [--jobs=N] [--filter=PATTERN] [--benchmarks]
+    if (RunAllTests(ParseRunnerOptions(argc, argv)) != 0) return 1;
+
+    cout << endl << "All tests passed successfully!" << endl;
+    return 0;
+}